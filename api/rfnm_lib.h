@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef __RFNM_LIB_H__
+#define __RFNM_LIB_H__
+
+#include <stdint.h>
+
+#include "rfnm_stream_layout.h"
+
+/** \addtogroup  HOST_LIBRFNM_API
+ *  @{
+ */
+
+/*
+ * Host side of the RFNM IQ stream. Channel N is IN endpoint N of the vendor
+ * interface, it carries the buffers of adc N. The channel lists that start
+ * the adcs are set with the RFNM_B_REQUEST vendor requests as before, the
+ * library only moves the data.
+ *
+ * Every channel keeps a number of bulk transfers in flight. Completed
+ * transfers are split into buffers, put back in usb_cc order and handed to
+ * the application without a copy, the transfer is resubmitted once all of
+ * its buffers are released. A slow consumer holds transfers back, the device
+ * then drops buffers and the gap shows up in usb_cc_gap.
+ */
+
+#define RFNM_LIB_MAX_CH		4
+
+struct rfnm_dev;
+
+/** One struct rfnm_rx_usb_buf of a channel */
+struct rfnm_rx_buf {
+	/** packed 12 bit IQ, points into the transfer buffer */
+	const uint8_t *iq;
+	uint32_t bytes;
+	uint32_t adc;
+	uint64_t usb_cc;
+	uint64_t adc_cc;
+	uint64_t phytimer;
+	/** buffers the device dropped right before this one */
+	uint64_t usb_cc_gap;
+	/** adc_cc values lost on the LA9310 side right before this one */
+	uint64_t adc_cc_gap;
+};
+
+/**
+ * @brief Called on the worker thread of the channel for every buffer, in
+ * usb_cc order. buf and its IQ are only valid until the callback returns.
+ */
+typedef void (*rfnm_rx_cb_t)(void *ctx, const struct rfnm_rx_buf *buf);
+
+struct rfnm_rx_params {
+	/** channels to stream */
+	uint32_t ch_mask;
+	/** transfers in flight per channel, 0 for 16 */
+	uint32_t transfers;
+	/** buffers per transfer, 0 for one device IN request */
+	uint32_t xfer_bufs;
+	/** out of order buffers waited for before a gap is declared, 0 for two transfers,
+	 *  at most transfers - 1 transfers worth */
+	uint32_t reorder_bufs;
+	/** NULL for the ring read API */
+	rfnm_rx_cb_t cb;
+	void *cb_ctx;
+};
+
+struct rfnm_rx_stats {
+	uint64_t bufs;
+	uint64_t bytes;
+	uint64_t usb_cc_lost;
+	uint64_t adc_cc_lost;
+	/** buffers that completed ahead of an earlier one */
+	uint64_t reordered;
+	/** buffers that came in after their gap was declared, or twice */
+	uint64_t late;
+	/** usb_cc went backwards, the device stream was restarted */
+	uint64_t resync;
+	uint64_t bad_magic;
+	/** transfers that didn't end on a buffer boundary */
+	uint64_t short_xfers;
+	uint64_t failed_xfers;
+};
+
+/**
+ * @brief Open the first device with vid:pid, claim the vendor interface and
+ * read the stream layout
+ * @param[in] vid usb vendor id
+ * @param[in] pid usb product id
+ * @return On success the device. On failure NULL
+ */
+struct rfnm_dev *rfnm_open(uint16_t vid, uint16_t pid);
+
+/**
+ * @brief Stop streaming and close the device
+ * @param[in] dev device from rfnm_open
+ */
+void rfnm_close(struct rfnm_dev *dev);
+
+/**
+ * @brief Layout of the rx usb buffers as reported by the device
+ * @param[in] dev device from rfnm_open
+ * @return host endian copy of the layout
+ */
+const struct rfnm_stream_layout *rfnm_get_layout(struct rfnm_dev *dev);
+
+/**
+ * @brief Start the transfers of the channels in params->ch_mask
+ * @param[in] dev device from rfnm_open
+ * @param[in] params transfer counts and the callback, copied
+ * @return On success 0. On failure negative error number
+ */
+int rfnm_rx_start(struct rfnm_dev *dev, const struct rfnm_rx_params *params);
+
+/**
+ * @brief Cancel all transfers and wait for them. Must not race with
+ * rfnm_rx_acquire or rfnm_rx_release, buffers still held are dropped.
+ * @param[in] dev device from rfnm_open
+ * @return On success 0. On failure negative error number
+ */
+int rfnm_rx_stop(struct rfnm_dev *dev);
+
+/**
+ * @brief Ring read API, return the oldest buffer of a channel without
+ * removing it. One thread per channel, any number of channels in parallel.
+ * @param[in] dev device from rfnm_open
+ * @param[in] ch channel
+ * @param[out] buf the buffer, valid until rfnm_rx_release
+ * @param[in] timeout_ms -1 to wait forever
+ * @return On success 0. -ETIMEDOUT, or -EINVAL with a callback set
+ */
+int rfnm_rx_acquire(struct rfnm_dev *dev, uint32_t ch,
+		    const struct rfnm_rx_buf **buf, int timeout_ms);
+
+/**
+ * @brief Give the buffer from rfnm_rx_acquire back, its transfer is
+ * resubmitted when all of its buffers are released
+ * @param[in] dev device from rfnm_open
+ * @param[in] ch channel
+ */
+void rfnm_rx_release(struct rfnm_dev *dev, uint32_t ch);
+
+/**
+ * @brief Counters of a channel since rfnm_rx_start, updated while streaming
+ * @param[in] dev device from rfnm_open
+ * @param[in] ch channel
+ * @param[out] st counters
+ * @return On success 0. On failure negative error number
+ */
+int rfnm_rx_get_stats(struct rfnm_dev *dev, uint32_t ch, struct rfnm_rx_stats *st);
+
+/*
+ * Sample conversion. cnt is in complex samples, 3 bytes packed, two int16
+ * (12 bit data left aligned) or two floats in [-1, 1) unpacked, I first.
+ * The kernels are picked for the CPU on first use.
+ */
+
+/**
+ * @brief Name of the conversion kernels in use, scalar, sse4, avx2, avx512
+ * or neon. RFNM_CONV_ISA in the environment selects one.
+ * @return kernel set name
+ */
+const char *rfnm_conv_isa(void);
+
+/**
+ * @brief 12 bit packed to int16
+ * @param[out] dst 2 * cnt int16
+ * @param[in] src 3 * cnt bytes
+ * @param[in] cnt complex samples
+ */
+void rfnm_unpack12to16(int16_t *dst, const uint8_t *src, uint32_t cnt);
+
+/**
+ * @brief int16 to 12 bit packed, the 4 low bits are dropped
+ * @param[out] dst 3 * cnt bytes
+ * @param[in] src 2 * cnt int16
+ * @param[in] cnt complex samples
+ */
+void rfnm_pack16to12(uint8_t *dst, const int16_t *src, uint32_t cnt);
+
+/**
+ * @brief 12 bit packed to complex float
+ * @param[out] dst 2 * cnt floats
+ * @param[in] src 3 * cnt bytes
+ * @param[in] cnt complex samples
+ */
+void rfnm_unpack12tocf32(float *dst, const uint8_t *src, uint32_t cnt);
+
+/**
+ * @brief Complex float to 12 bit packed, rounded and saturated
+ * @param[out] dst 3 * cnt bytes
+ * @param[in] src 2 * cnt floats
+ * @param[in] cnt complex samples
+ */
+void rfnm_packcf32to12(uint8_t *dst, const float *src, uint32_t cnt);
+
+/** @} */
+
+#endif
@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+/*
+ * User space counterpart of rfnm/microbench in debugfs: runs the sample
+ * conversion kernels over a sweep of sizes and buffer offsets and reports
+ * ns/byte and cycles/sample, checking every kernel against a scalar C
+ * reference first.
+ *
+ * On aarch64 the device kernels rfnm_pack16to12_aarch64 and
+ * rfnm_unpack12to16_aarch64 are linked in from kernel_driver/la9310rfnm and
+ * the cache maintenance is timed with dc cvac (clean) and dc civac (clean
+ * and invalidate, dc ivac is not allowed at EL0). Everywhere else, QEMU user
+ * mode included, the librfnm kernels are run, RFNM_CONV_ISA selects them.
+ *
+ * Sizes are bytes on the int16 side, one complex sample is 4 of them.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <rfnm_lib.h>
+
+#ifdef __aarch64__
+void rfnm_pack16to12_aarch64(uint8_t *dest, uint8_t *src, uint32_t bytes);
+void rfnm_unpack12to16_aarch64(uint8_t *dest, uint8_t *src, uint32_t bytes);
+#endif
+
+static const uint32_t mb_sizes[] = { 1024, 4096, 16384, 65536, 262144, 1048576 };
+static const uint32_t mb_offs[] = { 0, 16, 40 };
+
+#define MB_BUF_SIZE	(1048576 * 2 + 4096)
+
+enum {
+	MB_REF_UNPACK,
+	MB_LIB_UNPACK,
+	MB_LIB_PACK,
+	MB_LIB_UNPACK_CF32,
+	MB_LIB_PACK_CF32,
+#ifdef __aarch64__
+	MB_ASM_UNPACK,
+	MB_ASM_PACK,
+	MB_CLEAN,
+	MB_CLEAN_INVAL,
+#endif
+	MB_CNT,
+};
+
+static const char *mb_names[MB_CNT] = {
+	"ref unpack", "lib unpack", "lib pack", "lib unpack cf32", "lib pack cf32",
+#ifdef __aarch64__
+	"unpack12to16", "pack16to12", "dc cvac", "dc civac",
+#endif
+};
+
+static uint32_t iters = 64;
+
+static void print_usage_message(const char *name)
+{
+	fprintf(stderr, "usage: %s [-i iterations] [-f cpu MHz]\n", name);
+	fprintf(stderr, "\t-i\tper size and offset, default 64\n");
+	fprintf(stderr, "\t-f\tfor cycles/sample, default cpu0 scaling_cur_freq\n");
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double cpu_mhz(void)
+{
+	FILE *f = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "r");
+	unsigned long khz = 0;
+
+	if (f) {
+		if (fscanf(f, "%lu", &khz) != 1)
+			khz = 0;
+		fclose(f);
+	}
+	return khz / 1000.0;
+}
+
+static void ref_unpack(int16_t *dst, const uint8_t *src, uint32_t bytes)
+{
+	uint32_t n;
+
+	for (n = 0; n < bytes / 4; n++, src += 3) {
+		dst[n * 2] = (uint16_t) ((src[0] | src[1] << 8) << 4);
+		dst[n * 2 + 1] = (src[1] | src[2] << 8) & 0xfff0;
+	}
+}
+
+/* two's complement for the host kernels, sign/magnitude for the device one */
+static void ref_pack(uint8_t *dst, const int16_t *src, uint32_t bytes, int sign_mag)
+{
+	uint32_t n;
+
+	for (n = 0; n < bytes / 4; n++, dst += 3) {
+		int16_t ri = src[n * 2], rq = src[n * 2 + 1];
+		uint16_t i = ri, q = rq;
+
+		if (sign_mag) {
+			i = ri < 0 ? -(ri & 0x7fff) : ri;
+			q = rq < 0 ? -(rq & 0x7fff) : rq;
+		}
+
+		dst[0] = i >> 4;
+		dst[1] = (i >> 12) | (q & 0xf0);
+		dst[2] = q >> 8;
+	}
+}
+
+#ifdef __aarch64__
+static void dc_op(uint8_t *p, uint32_t size, int inval)
+{
+	uint64_t ctr, line;
+	uintptr_t a, end = (uintptr_t) p + size;
+
+	__asm__ volatile("mrs %0, ctr_el0" : "=r" (ctr));
+	line = 4 << ((ctr >> 16) & 0xf);
+
+	for (a = (uintptr_t) p & ~(line - 1); a < end; a += line) {
+		if (inval)
+			__asm__ volatile("dc civac, %0" : : "r" (a) : "memory");
+		else
+			__asm__ volatile("dc cvac, %0" : : "r" (a) : "memory");
+	}
+	__asm__ volatile("dsb sy" : : : "memory");
+}
+#endif
+
+static void mb_op(int op, uint8_t *dst, uint8_t *src, uint32_t size)
+{
+	switch (op) {
+	case MB_REF_UNPACK:
+		ref_unpack((int16_t *) dst, src, size);
+		break;
+	case MB_LIB_UNPACK:
+		rfnm_unpack12to16((int16_t *) dst, src, size / 4);
+		break;
+	case MB_LIB_PACK:
+		rfnm_pack16to12(dst, (int16_t *) src, size / 4);
+		break;
+	case MB_LIB_UNPACK_CF32:
+		rfnm_unpack12tocf32((float *) dst, src, size / 4);
+		break;
+	case MB_LIB_PACK_CF32:
+		rfnm_packcf32to12(dst, (float *) src, size / 4);
+		break;
+#ifdef __aarch64__
+	case MB_ASM_UNPACK:
+		rfnm_unpack12to16_aarch64(dst, src, size);
+		break;
+	case MB_ASM_PACK:
+		rfnm_pack16to12_aarch64(dst, src, size);
+		break;
+	case MB_CLEAN:
+		dc_op(src, size, 0);
+		break;
+	case MB_CLEAN_INVAL:
+		dc_op(src, size, 1);
+		break;
+#endif
+	}
+}
+
+static const char *mb_check(int op, uint8_t *dst, uint8_t *src, uint8_t *ref, uint32_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < size * 2; i++)
+		src[i] = rand();
+
+	switch (op) {
+	case MB_LIB_UNPACK:
+#ifdef __aarch64__
+	case MB_ASM_UNPACK:
+#endif
+		mb_op(op, dst, src, size);
+		ref_unpack((int16_t *) ref, src, size);
+		return memcmp(dst, ref, size) ? "MISMATCH" : "ok";
+	case MB_LIB_PACK:
+#ifdef __aarch64__
+	case MB_ASM_PACK:
+#endif
+		mb_op(op, dst, src, size);
+		ref_pack(ref, (int16_t *) src, size, op != MB_LIB_PACK);
+		return memcmp(dst, ref, size / 4 * 3) ? "MISMATCH" : "ok";
+	case MB_LIB_UNPACK_CF32: {
+		const float *f = (const float *) dst;
+
+		mb_op(op, dst, src, size);
+		ref_unpack((int16_t *) ref, src, size);
+		for (i = 0; i < size / 2; i++)
+			if (f[i] != ((int16_t *) ref)[i] / 32768.0f)
+				return "MISMATCH";
+		return "ok";
+	}
+	case MB_LIB_PACK_CF32: {
+		float *f = (float *) src;
+
+		/* exactly representable, packing back must be lossless */
+		ref_unpack((int16_t *) ref, src, size);
+		for (i = 0; i < size / 2; i++)
+			f[i] = ((int16_t *) ref)[i] / 32768.0f;
+		mb_op(op, dst, src, size);
+		ref_pack(ref + size, (int16_t *) ref, size, 0);
+		return memcmp(dst, ref + size, size / 4 * 3) ? "MISMATCH" : "ok";
+	}
+	}
+	return "-";
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t *src, *dst, *ref;
+	double mhz = 0;
+	int opt, op;
+	unsigned z, o, i;
+
+	while ((opt = getopt(argc, argv, "i:f:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			iters = atoi(optarg);
+			break;
+		case 'f':
+			mhz = atof(optarg);
+			break;
+		default:
+			print_usage_message(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!iters) {
+		print_usage_message(argv[0]);
+		return 1;
+	}
+	if (!mhz)
+		mhz = cpu_mhz();
+
+	/* float buffers are twice the int16 size */
+	src = aligned_alloc(4096, MB_BUF_SIZE);
+	dst = aligned_alloc(4096, MB_BUF_SIZE);
+	ref = aligned_alloc(4096, MB_BUF_SIZE);
+	if (!src || !dst || !ref) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("%.0f MHz, %u iterations, librfnm %s\n", mhz, iters, rfnm_conv_isa());
+	printf("%-16s %8s %4s %10s %12s %s\n", "op", "size", "off", "ns/byte", "cyc/sample", "check");
+
+	for (op = 0; op < MB_CNT; op++) {
+		for (z = 0; z < sizeof(mb_sizes) / sizeof(mb_sizes[0]); z++) {
+			for (o = 0; o < sizeof(mb_offs) / sizeof(mb_offs[0]); o++) {
+				uint32_t size = mb_sizes[z], off = mb_offs[o];
+				const char *check = mb_check(op, dst + off, src + off, ref, size);
+				uint64_t t0, ns;
+
+				/* warm up, then time */
+				mb_op(op, dst + off, src + off, size);
+				t0 = now_ns();
+				for (i = 0; i < iters; i++)
+					mb_op(op, dst + off, src + off, size);
+				ns = now_ns() - t0;
+
+				printf("%-16s %8u %4u %10.3f %12.3f %s\n", mb_names[op], size, off,
+					(double) ns / size / iters,
+					(double) ns * mhz / 1000 / (size / 4) / iters, check);
+			}
+		}
+	}
+
+	free(src);
+	free(dst);
+	free(ref);
+	return 0;
+}
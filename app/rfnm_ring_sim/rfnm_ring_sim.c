@@ -0,0 +1,525 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+/*
+ * Runs the LA9310 ring flow control of la9310_rfnm.c (librfnm_ring, built
+ * from kernel_driver/la9310rfnm/rfnm_ring.c) against a simulated M7 on any
+ * Linux machine.
+ *
+ * RX: an M7 thread fills descriptors and advances rx_head at the sample
+ * rate, a reader thread consumes them the way rfnm_handler_in does.
+ * TX: a writer thread turns simulated usb chunks into descriptors the way
+ * rfnm_handler_out does, an M7 thread plays them out and advances
+ * tx_buf_id. The M7 threads take jitter, stalls and cc errors, the kernel
+ * threads stalls and a cost per buffer. Every second the throughput and
+ * the overrun, underrun and cc error counts are printed.
+ *
+ * -C runs the rfnm_ring_check.c self check and times the poll functions
+ * instead, like rfnm/ring_check in debugfs, and fails on a mismatch.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <rfnm_ring.h>
+
+// usb chunks the gadget keeps queued before the oldest are dropped
+#define SIM_USB_QUEUE		64
+// M7 publication period, before jitter
+#define SIM_TICK_NS		100000
+
+struct sim_cfg {
+	uint32_t size;
+	uint32_t adcs;
+	double rx_rate;
+	double tx_rate;
+	uint32_t chunk;
+	uint32_t jitter_us;
+	uint64_t m7_stall_period_ns, m7_stall_ns;
+	uint64_t k_stall_period_ns, k_stall_ns;
+	uint32_t cc_err;
+	uint32_t cost_ns;
+	uint32_t seconds;
+	int rx, tx;
+};
+
+struct sim_stats {
+	_Atomic uint64_t rx_bufs;
+	_Atomic uint64_t rx_wait;
+	_Atomic uint64_t rx_overrun;
+	_Atomic uint64_t rx_overrun_bufs;
+	_Atomic uint64_t rx_cc_err;
+	_Atomic uint64_t rx_cc_injected;
+	_Atomic uint64_t tx_bufs;
+	_Atomic uint64_t tx_wait;
+	_Atomic uint64_t tx_underrun;
+	_Atomic uint64_t tx_latency;
+	_Atomic uint64_t tx_cc_gap;
+	_Atomic uint64_t tx_cc_injected;
+	_Atomic uint64_t tx_usb_dropped;
+	_Atomic uint64_t tx_stale;
+};
+
+#define STAT_ADD(f, v)	atomic_fetch_add_explicit(&st.f, (v), memory_order_relaxed)
+#define STAT(f)		atomic_load_explicit(&st.f, memory_order_relaxed)
+
+static struct sim_cfg cfg = {
+	.size = 16384,
+	.adcs = 1,
+	.rx_rate = 400000,
+	.tx_rate = 400000,
+	.chunk = 4,
+	.seconds = 10,
+	.rx = 1,
+	.tx = 1,
+};
+
+static struct sim_stats st;
+
+// the shared memory, descriptors are adc_id << 32 | cc
+static _Atomic uint64_t *rx_desc;
+static _Atomic uint32_t rx_head;
+static _Atomic uint64_t *tx_desc;
+static _Atomic uint32_t tx_buf_id;
+
+static atomic_int stop;
+static uint64_t t_start;
+
+static void print_usage_message(const char *name)
+{
+	fprintf(stderr, "usage: %s [options]\n", name);
+	fprintf(stderr, "\t-n\tring size in buffers, default 16384\n");
+	fprintf(stderr, "\t-a\tadcs interleaved in the rx ring, default 1\n");
+	fprintf(stderr, "\t-r\trx buffers/s, default 400000\n");
+	fprintf(stderr, "\t-t\ttx buffers/s, default 400000\n");
+	fprintf(stderr, "\t-b\ttx buffers per usb chunk, default 4\n");
+	fprintf(stderr, "\t-j\tM7 jitter in us, uniform, default 0\n");
+	fprintf(stderr, "\t-s\tM7 stall, period_ms:len_us\n");
+	fprintf(stderr, "\t-S\tkernel thread stall, period_ms:len_us\n");
+	fprintf(stderr, "\t-e\tone cc error every N buffers on average\n");
+	fprintf(stderr, "\t-c\tkernel thread cost per buffer in ns, default 0\n");
+	fprintf(stderr, "\t-d\tseconds, default 10\n");
+	fprintf(stderr, "\t-R\trx only\n");
+	fprintf(stderr, "\t-T\ttx only\n");
+	fprintf(stderr, "\t-C\tcheck and time the ring helpers, with -n one size only\n");
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+	struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static void spin_ns(uint64_t ns)
+{
+	uint64_t end;
+
+	if (!ns)
+		return;
+	end = now_ns() + ns;
+	while (now_ns() < end)
+		;
+}
+
+/* stalls are windows of len at the start of every period, returns what is left */
+static uint64_t stalled(uint64_t t, uint64_t period, uint64_t len)
+{
+	uint64_t in;
+
+	if (!period || !len)
+		return 0;
+	in = (t - t_start) % period;
+	return in < len ? len - in : 0;
+}
+
+static int parse_stall(const char *arg, uint64_t *period, uint64_t *len)
+{
+	unsigned long ms, us;
+
+	if (sscanf(arg, "%lu:%lu", &ms, &us) != 2 || !ms || us >= ms * 1000)
+		return -1;
+	*period = ms * 1000000ULL;
+	*len = us * 1000ULL;
+	return 0;
+}
+
+static int cc_error(unsigned int *seed)
+{
+	return cfg.cc_err && rand_r(seed) % cfg.cc_err == 0;
+}
+
+/* buffers due at t for rate since start */
+static uint64_t due(uint64_t t, double rate)
+{
+	return (uint64_t) ((t - t_start) * rate / 1e9);
+}
+
+static void m7_tick(unsigned int *seed)
+{
+	uint64_t ns = SIM_TICK_NS;
+
+	if (cfg.jitter_us)
+		ns += (uint64_t) (rand_r(seed) % cfg.jitter_us) * 1000;
+	sleep_ns(ns);
+}
+
+static void *rx_m7_thread(void *arg)
+{
+	unsigned int seed = 1;
+	uint32_t cc[4] = { 0 };
+	uint32_t head = 0, adc = 0;
+	uint64_t done = 0;
+
+	while (!atomic_load(&stop)) {
+		uint64_t t = now_ns(), d;
+
+		if (stalled(t, cfg.m7_stall_period_ns, cfg.m7_stall_ns)) {
+			// the dma keeps going, the buffers show up in a burst later
+			m7_tick(&seed);
+			continue;
+		}
+
+		for (d = due(t, cfg.rx_rate); done < d; done++) {
+			if (cc_error(&seed)) {
+				cc[adc]++;
+				STAT_ADD(rx_cc_injected, 1);
+			}
+			atomic_store_explicit(&rx_desc[head], (uint64_t) adc << 32 | cc[adc]++,
+					      memory_order_relaxed);
+			head = rfnm_ring_next(cfg.size, head);
+			adc = (adc + 1) % cfg.adcs;
+		}
+		atomic_store_explicit(&rx_head, head, memory_order_release);
+
+		m7_tick(&seed);
+	}
+	return NULL;
+}
+
+/* rfnm_handler_in */
+static void *rx_kernel_thread(void *arg)
+{
+	unsigned int seed = 2;
+	uint32_t expect[4] = { 0 };
+	uint32_t tail = 0;
+
+	while (!atomic_load(&stop)) {
+		uint64_t left = stalled(now_ns(), cfg.k_stall_period_ns, cfg.k_stall_ns);
+		uint32_t head, cnt, q;
+		enum rfnm_ring_rx_act act;
+
+		if (left) {
+			sleep_ns(left);
+			continue;
+		}
+
+		head = atomic_load_explicit(&rx_head, memory_order_acquire);
+		act = rfnm_ring_rx_poll(cfg.size, head, tail, &cnt);
+
+		if (act == RFNM_RING_RX_WAIT) {
+			STAT_ADD(rx_wait, 1);
+			sleep_ns(500000 + rand_r(&seed) % 500000);
+			continue;
+		}
+
+		if (act == RFNM_RING_RX_OVERRUN) {
+			tail = atomic_load_explicit(&rx_head, memory_order_acquire);
+			STAT_ADD(rx_overrun, 1);
+			STAT_ADD(rx_overrun_bufs, cnt);
+			sleep_ns(500000 + rand_r(&seed) % 500000);
+			continue;
+		}
+
+		for (q = 0; q < cnt; q++) {
+			uint64_t d = atomic_load_explicit(&rx_desc[tail], memory_order_relaxed);
+
+			if (rfnm_ring_rx_cc(&expect[(d >> 32) & 3], (uint32_t) d))
+				STAT_ADD(rx_cc_err, 1);
+			spin_ns(cfg.cost_ns);
+			tail = rfnm_ring_next(cfg.size, tail);
+		}
+		STAT_ADD(rx_bufs, cnt);
+	}
+	return NULL;
+}
+
+/* the M7 plays out one buffer per period no matter what, stale ones included */
+static void *tx_m7_thread(void *arg)
+{
+	unsigned int seed = 3;
+	uint64_t expect = 0, done = 0;
+	uint32_t tail = 0;
+
+	while (!atomic_load(&stop)) {
+		uint64_t t = now_ns(), d;
+
+		if (stalled(t, cfg.m7_stall_period_ns, cfg.m7_stall_ns)) {
+			m7_tick(&seed);
+			continue;
+		}
+
+		for (d = due(t, cfg.tx_rate); done < d; done++) {
+			uint64_t cc = atomic_load_explicit(&tx_desc[tail], memory_order_relaxed);
+
+			if (cc != expect)
+				STAT_ADD(tx_stale, 1);
+			expect = cc + 1;
+			tail = rfnm_ring_next(cfg.size, tail);
+		}
+		atomic_store_explicit(&tx_buf_id, tail, memory_order_release);
+
+		m7_tick(&seed);
+	}
+	return NULL;
+}
+
+/* rfnm_handler_out, fed by a usb host sending chunks at the tx rate */
+static void *tx_kernel_thread(void *arg)
+{
+	unsigned int seed = 4;
+	uint64_t usb_done = 0, usb_skip = 0, usb_expect = 0, dac_cc = 0;
+	uint32_t head = 0;
+
+	while (!atomic_load(&stop)) {
+		uint64_t t = now_ns();
+		uint64_t left = stalled(t, cfg.k_stall_period_ns, cfg.k_stall_ns);
+		uint64_t usb_due = due(t, cfg.tx_rate / cfg.chunk);
+		uint32_t tail, cnt, q;
+		enum rfnm_ring_tx_act act;
+		int64_t gap;
+
+		if (left) {
+			sleep_ns(left);
+			continue;
+		}
+
+		if (usb_due - usb_done > SIM_USB_QUEUE) {
+			STAT_ADD(tx_usb_dropped, usb_due - usb_done - SIM_USB_QUEUE);
+			usb_done = usb_due - SIM_USB_QUEUE;
+		}
+
+		if (usb_done == usb_due) {
+			sleep_ns(20000);
+			continue;
+		}
+
+		tail = atomic_load_explicit(&tx_buf_id, memory_order_acquire);
+		act = rfnm_ring_tx_poll(cfg.size, tail, &head, cfg.chunk, &cnt);
+
+		if (act == RFNM_RING_TX_UNDERRUN) {
+			STAT_ADD(tx_underrun, 1);
+			continue;
+		}
+		if (act == RFNM_RING_TX_LATENCY) {
+			STAT_ADD(tx_latency, 1);
+			continue;
+		}
+		if (act == RFNM_RING_TX_WAIT) {
+			STAT_ADD(tx_wait, 1);
+			sleep_ns(20000);
+			continue;
+		}
+
+		if (cc_error(&seed)) {
+			usb_skip++;
+			STAT_ADD(tx_cc_injected, 1);
+		}
+		gap = rfnm_ring_tx_cc(&usb_expect, usb_done + usb_skip);
+		if (gap)
+			STAT_ADD(tx_cc_gap, 1);
+		usb_done++;
+
+		for (q = 0; q < cnt; q++) {
+			spin_ns(cfg.cost_ns);
+			atomic_store_explicit(&tx_desc[head], dac_cc++, memory_order_relaxed);
+			head = rfnm_ring_next(cfg.size, head);
+		}
+		STAT_ADD(tx_bufs, cnt);
+	}
+	return NULL;
+}
+
+/* small sizes are checked exhaustively, 16384 is the RX and TX ring of the device */
+static const uint32_t check_sizes[] = { 128, 200, 256, 4096, 16384 };
+
+static int ring_check(const uint32_t *sizes, unsigned int cnt)
+{
+	struct rfnm_ring_check c;
+	unsigned int z, failed = 0;
+	volatile uint32_t sink;
+
+	printf("%8s %10s %6s %12s %12s\n", "size", "cases", "failed", "rx_poll ns", "tx_poll ns");
+
+	for (z = 0; z < cnt; z++) {
+		uint32_t size = sizes[z], n = 64 * size, tx;
+		uint64_t t0, ns[2];
+
+		rfnm_ring_check_run(&c, size);
+		for (tx = 0; tx < 2; tx++) {
+			t0 = now_ns();
+			sink = rfnm_ring_check_bench(size, tx, n);
+			ns[tx] = now_ns() - t0;
+		}
+		(void) sink;
+
+		printf("%8u %10u %6u %12.3f %12.3f\n", size, c.cases, c.failed,
+			(double) ns[0] / n, (double) ns[1] / n);
+		if (c.failed) {
+			printf("\tfirst: %s, head %u tail %u\n", c.what, c.head, c.tail);
+			failed++;
+		}
+	}
+
+	printf("%s\n", failed ? "FAIL" : "ok");
+	return failed ? 1 : 0;
+}
+
+static void report(const char *what, double secs, const struct sim_stats *prev)
+{
+	if (cfg.rx)
+		printf("%-6s rx %10.0f buf/s  wait %8lu  overrun %5lu (%8lu bufs)  cc err %6lu (%lu injected)\n",
+			what, (STAT(rx_bufs) - prev->rx_bufs) / secs,
+			STAT(rx_wait), STAT(rx_overrun), STAT(rx_overrun_bufs),
+			STAT(rx_cc_err), STAT(rx_cc_injected));
+	if (cfg.tx)
+		printf("%-6s tx %10.0f buf/s  wait %8lu  underrun %4lu  latency %4lu  cc gap %6lu (%lu injected)  usb drop %lu  stale %lu\n",
+			what, (STAT(tx_bufs) - prev->tx_bufs) / secs,
+			STAT(tx_wait), STAT(tx_underrun), STAT(tx_latency),
+			STAT(tx_cc_gap), STAT(tx_cc_injected),
+			STAT(tx_usb_dropped), STAT(tx_stale));
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t th[4];
+	struct sim_stats prev = { 0 }, zero = { 0 };
+	int opt, nth = 0, i, check = 0, size_set = 0;
+	uint32_t s;
+	char what[16];
+
+	while ((opt = getopt(argc, argv, "n:a:r:t:b:j:s:S:e:c:d:RTCh")) != -1) {
+		switch (opt) {
+		case 'n':
+			cfg.size = atoi(optarg);
+			size_set = 1;
+			break;
+		case 'a':
+			cfg.adcs = atoi(optarg);
+			break;
+		case 'r':
+			cfg.rx_rate = atof(optarg);
+			break;
+		case 't':
+			cfg.tx_rate = atof(optarg);
+			break;
+		case 'b':
+			cfg.chunk = atoi(optarg);
+			break;
+		case 'j':
+			cfg.jitter_us = atoi(optarg);
+			break;
+		case 's':
+			if (parse_stall(optarg, &cfg.m7_stall_period_ns, &cfg.m7_stall_ns))
+				goto usage;
+			break;
+		case 'S':
+			if (parse_stall(optarg, &cfg.k_stall_period_ns, &cfg.k_stall_ns))
+				goto usage;
+			break;
+		case 'e':
+			cfg.cc_err = atoi(optarg);
+			break;
+		case 'c':
+			cfg.cost_ns = atoi(optarg);
+			break;
+		case 'd':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'R':
+			cfg.tx = 0;
+			break;
+		case 'T':
+			cfg.rx = 0;
+			break;
+		case 'C':
+			check = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (check) {
+		if (size_set && !cfg.size)
+			goto usage;
+		if (size_set)
+			return ring_check(&cfg.size, 1);
+		return ring_check(check_sizes, sizeof(check_sizes) / sizeof(check_sizes[0]));
+	}
+
+	// the RX ring needs room for RFNM_RING_RX_MIN behind a quarter of it
+	if (cfg.size < 4 * RFNM_RING_RX_MIN || !cfg.adcs || cfg.adcs > 4 ||
+	    !cfg.chunk || cfg.chunk > cfg.size / 4 || !cfg.seconds ||
+	    cfg.rx_rate <= 0 || cfg.tx_rate <= 0 || (!cfg.rx && !cfg.tx))
+		goto usage;
+
+	rx_desc = calloc(cfg.size, sizeof(*rx_desc));
+	tx_desc = calloc(cfg.size, sizeof(*tx_desc));
+	if (!rx_desc || !tx_desc) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("ring %u, rx %.0f buf/s on %u adcs, tx %.0f buf/s in chunks of %u\n",
+		cfg.size, cfg.rx_rate, cfg.adcs, cfg.tx_rate, cfg.chunk);
+
+	t_start = now_ns();
+
+	if (cfg.rx) {
+		pthread_create(&th[nth++], NULL, rx_m7_thread, NULL);
+		pthread_create(&th[nth++], NULL, rx_kernel_thread, NULL);
+	}
+	if (cfg.tx) {
+		pthread_create(&th[nth++], NULL, tx_m7_thread, NULL);
+		pthread_create(&th[nth++], NULL, tx_kernel_thread, NULL);
+	}
+
+	for (s = 1; s <= cfg.seconds; s++) {
+		uint64_t t = now_ns();
+
+		if (t < t_start + s * 1000000000ULL)
+			sleep_ns(t_start + s * 1000000000ULL - t);
+		snprintf(what, sizeof(what), "%us", s);
+		report(what, 1, &prev);
+		prev.rx_bufs = STAT(rx_bufs);
+		prev.tx_bufs = STAT(tx_bufs);
+	}
+
+	atomic_store(&stop, 1);
+	for (i = 0; i < nth; i++)
+		pthread_join(th[i], NULL);
+
+	report("total", (now_ns() - t_start) / 1e9, &zero);
+
+	free(rx_desc);
+	free(tx_desc);
+	return 0;
+
+usage:
+	print_usage_message(argv[0]);
+	return 1;
+}
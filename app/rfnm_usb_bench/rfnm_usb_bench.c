@@ -0,0 +1,409 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+/*
+ * Host side of the rfnm_usb_bench gadget function: streams a running
+ * counter to the OUT endpoints, checks the one coming from the IN endpoints
+ * and reports MB/s and error counts from both ends of the link.
+ *
+ * With -q min:max the run is repeated for each transfer depth from min to
+ * max, doubling, and a table of the rates closes the output. The depth of
+ * the device side is the bulk_qlen configfs attribute, it is swept by
+ * running this again after each change.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include <libusb-1.0/libusb.h>
+
+#include <rfnm_usb_bench.h>
+
+#define BENCH_QLEN_MAX	64
+
+struct bench_ep {
+	unsigned char addr;
+	int in;
+	int id;
+	/* next word to send, or the one expected */
+	uint32_t next;
+	int sync;
+	uint64_t bytes;
+	uint64_t bytes_last;
+	uint64_t errors;
+	uint64_t failed;
+};
+
+static struct bench_ep eps[2 * RFNM_BENCH_EP_CNT];
+static int ep_cnt;
+static int in_flight;
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t interrupted;
+
+struct bench_result {
+	int qlen;
+	double in_rate;
+	double out_rate;
+	uint64_t errors;
+	uint64_t failed;
+};
+
+static void print_usage_message(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d vid:pid] [-i in mask] [-o out mask] [-t seconds] [-s bytes] [-q transfers[:max]]\n", name);
+	fprintf(stderr, "\t-d\tdevice, default 15a2:008c\n");
+	fprintf(stderr, "\t-i\tIN endpoints to read, default 0x1\n");
+	fprintf(stderr, "\t-o\tOUT endpoints to write, default 0x0\n");
+	fprintf(stderr, "\t-t\tduration, default 10\n");
+	fprintf(stderr, "\t-s\ttransfer size, default 65536\n");
+	fprintf(stderr, "\t-q\ttransfers in flight per endpoint, default 8, a range is swept doubling\n");
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_fill(struct bench_ep *e, unsigned char *buf, int len)
+{
+	uint32_t *w = (uint32_t *) buf;
+	int i;
+
+	for (i = 0; i < len / 4; i++)
+		w[i] = htole32(e->next++);
+}
+
+static void bench_check(struct bench_ep *e, const unsigned char *buf, int len)
+{
+	const uint32_t *w = (const uint32_t *) buf;
+	int i;
+
+	for (i = 0; i < len / 4; i++) {
+		uint32_t v = le32toh(w[i]);
+
+		if (!e->sync) {
+			e->sync = 1;
+			e->next = v;
+		}
+		if (v != e->next)
+			e->errors++;
+		e->next = v + 1;
+	}
+}
+
+static void LIBUSB_CALL bench_cb(struct libusb_transfer *t)
+{
+	struct bench_ep *e = t->user_data;
+
+	if (t->status == LIBUSB_TRANSFER_COMPLETED) {
+		if (e->in)
+			bench_check(e, t->buffer, t->actual_length);
+		else
+			bench_fill(e, t->buffer, t->length);
+		e->bytes += t->actual_length;
+	} else if (t->status != LIBUSB_TRANSFER_CANCELLED) {
+		e->failed++;
+	}
+
+	if (stop || t->status == LIBUSB_TRANSFER_CANCELLED ||
+		t->status == LIBUSB_TRANSFER_NO_DEVICE || libusb_submit_transfer(t)) {
+		in_flight--;
+	}
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+	interrupted = 1;
+}
+
+/* the first vendor class interface with bulk endpoints, IN and OUT in order */
+static int find_interface(libusb_device *dev, int *intf)
+{
+	struct libusb_config_descriptor *cfg;
+	int i, j, n_in = 0, n_out = 0;
+
+	if (libusb_get_active_config_descriptor(dev, &cfg))
+		return -1;
+
+	*intf = -1;
+
+	for (i = 0; i < cfg->bNumInterfaces && *intf < 0; i++) {
+		const struct libusb_interface_descriptor *id = &cfg->interface[i].altsetting[0];
+
+		if (id->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC)
+			continue;
+
+		for (j = 0; j < id->bNumEndpoints; j++) {
+			const struct libusb_endpoint_descriptor *ed = &id->endpoint[j];
+			struct bench_ep *e;
+
+			if ((ed->bmAttributes & 3) != LIBUSB_TRANSFER_TYPE_BULK)
+				continue;
+			if (ep_cnt == 2 * RFNM_BENCH_EP_CNT)
+				break;
+
+			e = &eps[ep_cnt++];
+			e->addr = ed->bEndpointAddress;
+			e->in = !!(ed->bEndpointAddress & LIBUSB_ENDPOINT_IN);
+			e->id = e->in ? n_in++ : n_out++;
+		}
+
+		if (ep_cnt)
+			*intf = id->bInterfaceNumber;
+	}
+
+	libusb_free_config_descriptor(cfg);
+	return *intf < 0 ? -1 : 0;
+}
+
+static void print_device_stats(libusb_device_handle *h)
+{
+	struct rfnm_usb_bench_stats st;
+	double t;
+	int i, r;
+
+	r = libusb_control_transfer(h, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR,
+		RFNM_BENCH_B_REQUEST, RFNM_BENCH_GET_STATS, 0,
+		(unsigned char *) &st, sizeof(st), 1000);
+	if (r != sizeof(st)) {
+		printf("device stats: %s\n", r < 0 ? libusb_error_name(r) : "short read");
+		return;
+	}
+
+	t = le64toh(st.time_ns) / 1e9;
+
+	printf("device, %.1f s:\n", t);
+	printf("ep\tin MB/s\tout MB/s\tout errors\tin failed\tout failed\n");
+	for (i = 0; i < RFNM_BENCH_EP_CNT; i++) {
+		printf("%d\t%.1f\t%.1f\t\t%llu\t\t%llu\t\t%llu\n", i,
+			le64toh(st.in_bytes[i]) / t / 1e6, le64toh(st.out_bytes[i]) / t / 1e6,
+			(unsigned long long) le64toh(st.out_errors[i]),
+			(unsigned long long) le64toh(st.in_failed[i]),
+			(unsigned long long) le64toh(st.out_failed[i]));
+	}
+}
+
+/* one run at a depth of qlen, the totals of the host side into res */
+static int bench_run(libusb_device_handle *h, unsigned in_mask, unsigned out_mask,
+	int seconds, int size, int qlen, struct bench_result *res)
+{
+	double t0, t_last, t;
+	int i, q, r;
+
+	for (i = 0; i < ep_cnt; i++) {
+		eps[i].sync = 0;
+		eps[i].bytes = 0;
+		eps[i].bytes_last = 0;
+		eps[i].errors = 0;
+		eps[i].failed = 0;
+	}
+	stop = 0;
+
+	libusb_control_transfer(h, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR,
+		RFNM_BENCH_B_REQUEST, RFNM_BENCH_RESET, 0, NULL, 0, 1000);
+
+	printf("%d transfers of %d bytes per endpoint\n", qlen, size);
+
+	for (i = 0; i < ep_cnt; i++) {
+		struct bench_ep *e = &eps[i];
+
+		if (!((e->in ? in_mask : out_mask) & (1 << e->id)))
+			continue;
+
+		for (q = 0; q < qlen; q++) {
+			struct libusb_transfer *t = libusb_alloc_transfer(0);
+			unsigned char *buf = malloc(size);
+
+			if (!t || !buf) {
+				fprintf(stderr, "out of memory\n");
+				return -1;
+			}
+
+			if (!e->in)
+				bench_fill(e, buf, size);
+
+			libusb_fill_bulk_transfer(t, h, e->addr, buf, size, bench_cb, e, 0);
+			t->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+			r = libusb_submit_transfer(t);
+			if (r) {
+				fprintf(stderr, "submit ep %02x: %s\n", e->addr, libusb_error_name(r));
+				return -1;
+			}
+			in_flight++;
+		}
+	}
+
+	t0 = t_last = now_s();
+
+	while (!stop && in_flight) {
+		struct timeval tv = { 0, 100000 };
+		double in_rate = 0, out_rate = 0;
+		uint64_t errors = 0, failed = 0;
+
+		libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+
+		t = now_s();
+		if (t - t_last < 1.0)
+			continue;
+
+		for (i = 0; i < ep_cnt; i++) {
+			double rate = (eps[i].bytes - eps[i].bytes_last) / (t - t_last) / 1e6;
+
+			eps[i].bytes_last = eps[i].bytes;
+			if (eps[i].in)
+				in_rate += rate;
+			else
+				out_rate += rate;
+			errors += eps[i].errors;
+			failed += eps[i].failed;
+		}
+
+		printf("%5.1f s\tin %7.1f MB/s\tout %7.1f MB/s\tin errors %llu\tfailed %llu\n",
+			t - t0, in_rate, out_rate, (unsigned long long) errors, (unsigned long long) failed);
+		fflush(stdout);
+
+		t_last = t;
+		if (seconds && t - t0 >= seconds)
+			stop = 1;
+	}
+
+	while (in_flight)
+		libusb_handle_events(NULL);
+
+	t = now_s() - t0;
+
+	memset(res, 0, sizeof(*res));
+	res->qlen = qlen;
+
+	printf("host, %.1f s:\n", t);
+	printf("ep\tMB/s\terrors\tfailed\n");
+	for (i = 0; i < ep_cnt; i++) {
+		if (eps[i].in)
+			res->in_rate += eps[i].bytes / t / 1e6;
+		else
+			res->out_rate += eps[i].bytes / t / 1e6;
+		res->errors += eps[i].errors;
+		res->failed += eps[i].failed;
+
+		if (!eps[i].bytes && !eps[i].failed)
+			continue;
+		printf("%s %d\t%.1f\t%llu\t%llu\n", eps[i].in ? "in" : "out", eps[i].id,
+			eps[i].bytes / t / 1e6, (unsigned long long) eps[i].errors,
+			(unsigned long long) eps[i].failed);
+	}
+
+	print_device_stats(h);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned vid = 0x15a2, pid = 0x008c;
+	unsigned in_mask = 0x1, out_mask = 0x0;
+	int seconds = 10, size = 65536, qlen = 8, qlen_max = 0;
+	struct bench_result res[BENCH_QLEN_MAX];
+	libusb_device_handle *h;
+	int opt, intf, i, n = 0, r;
+
+	while ((opt = getopt(argc, argv, "d:i:o:t:s:q:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (sscanf(optarg, "%x:%x", &vid, &pid) != 2) {
+				print_usage_message(argv[0]);
+				return 1;
+			}
+			break;
+		case 'i':
+			in_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'q':
+			if (sscanf(optarg, "%d:%d", &qlen, &qlen_max) < 1) {
+				print_usage_message(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			print_usage_message(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!qlen_max)
+		qlen_max = qlen;
+
+	if (size <= 0 || size % 1024 || qlen <= 0 || qlen_max < qlen || qlen_max > BENCH_QLEN_MAX) {
+		fprintf(stderr, "size must be a multiple of 1024, 1 to %d transfers\n", BENCH_QLEN_MAX);
+		return 1;
+	}
+
+	if (qlen_max > qlen && !seconds) {
+		fprintf(stderr, "a sweep needs a duration\n");
+		return 1;
+	}
+
+	r = libusb_init(NULL);
+	if (r) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	h = libusb_open_device_with_vid_pid(NULL, vid, pid);
+	if (!h) {
+		fprintf(stderr, "no %04x:%04x\n", vid, pid);
+		return 1;
+	}
+
+	if (find_interface(libusb_get_device(h), &intf)) {
+		fprintf(stderr, "no vendor interface with bulk endpoints\n");
+		return 1;
+	}
+
+	libusb_set_auto_detach_kernel_driver(h, 1);
+	r = libusb_claim_interface(h, intf);
+	if (r) {
+		fprintf(stderr, "claim interface %d: %s\n", intf, libusb_error_name(r));
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+
+	for (; qlen <= qlen_max && !interrupted; qlen *= 2) {
+		if (bench_run(h, in_mask, out_mask, seconds, size, qlen, &res[n]))
+			return 1;
+		n++;
+	}
+
+	if (n > 1) {
+		printf("transfers\tin MB/s\tout MB/s\terrors\tfailed\n");
+		for (i = 0; i < n; i++) {
+			printf("%d\t\t%.1f\t%.1f\t\t%llu\t%llu\n", res[i].qlen, res[i].in_rate,
+				res[i].out_rate, (unsigned long long) res[i].errors,
+				(unsigned long long) res[i].failed);
+		}
+	}
+
+	libusb_release_interface(h, intf);
+	libusb_close(h);
+	libusb_exit(NULL);
+
+	return 0;
+}
@@ -40,6 +40,8 @@
 #include <linux/delay.h>
 
 #include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/scatterlist.h>
 
 #include <linux/rfnm-shared.h>
 #include <linux/rfnm-vspa.h>
@@ -48,17 +50,25 @@
 
 #include <linux/kthread.h>
 #include <linux/list_sort.h>
+#include <linux/of.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/mm.h>
 
 #include <uapi/linux/sched.h>
 #include <uapi/linux/sched/types.h>
 
 #include <linux/sched.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
+#include <linux/seq_file.h>
 
-#define GPIO_DEBUG 0
+#include "rfnm_dsp.h"
+#include "rfnm_stream.h"
+#include "rfnm_ring.h"
+#include "rfnm_dma.h"
+#include "rfnm_flight.h"
 
-DECLARE_WAIT_QUEUE_HEAD(wq_out);
-DECLARE_WAIT_QUEUE_HEAD(wq_in);
-DECLARE_WAIT_QUEUE_HEAD(wq_usb);
+#define GPIO_DEBUG 0
 
 #define RFNM_ADC_BUFCNT (0x4000) // 4096 ~= 10ms
 
@@ -95,9 +105,42 @@ int gpio4_initial;
 
 
 
-struct rfnm_bufdesc_rx *rfnm_bufdesc_rx;
-struct rfnm_bufdesc_tx *rfnm_bufdesc_tx;
-volatile struct rfnm_m7_status *rfnm_m7_status;
+/*
+ * The stream buffers live in a reserved-memory node, see
+ * doc/stream_buffers.txt. The descriptor rings are laid out as the M7
+ * firmware expects them, the rx usb buffers follow and are sized here.
+ * Without the node the fixed carve-out at RFNM_MEM_LEGACY_BASE is used.
+ * With several LA9310s the n-th node belongs to nlm<n>, and names the
+ * status block of its M7 in rfnm,m7-status.
+ */
+#define RFNM_MEM_COMPATIBLE	"rfnm,stream-buffers"
+// the M7 of nlm0 publishes its ring positions here, in the imx OCRAM
+#define RFNM_M7_STATUS_BASE	(0x00900000 + 0x1000)
+#define RFNM_MEM_LEGACY_BASE	0x96400000
+// the tx descriptors had a 64M window before the rx usb buffers
+#define RFNM_MEM_LEGACY_TX_SIZE	SZ_64M
+
+static uint rx_usb_bufs = RFNM_RX_USB_BUF_SIZE;
+module_param(rx_usb_bufs, uint, 0444);
+MODULE_PARM_DESC(rx_usb_bufs, "rx usb buffers shared by the adcs, more ride out longer usb stalls at the cost of latency");
+
+static bool release_unused = true;
+module_param(release_unused, bool, 0444);
+MODULE_PARM_DESC(release_unused, "give the reserved memory past the stream buffers back to Linux, until reboot");
+
+// the dac ring is only ever written by rfnm_handler_out, see rfnm/microbench for the cost of either
+static bool tx_wc;
+module_param(tx_wc, bool, 0444);
+MODULE_PARM_DESC(tx_wc, "map the dac ring write-combining, the unpack streams into it with no cache clean pass");
+
+uint32_t rfnm_rx_usb_bufcnt;
+
+struct rfnm_mem_layout {
+	phys_addr_t rx_desc;
+	phys_addr_t tx_desc;
+	phys_addr_t rx_usb;
+	phys_addr_t m7_status;
+};
 
 struct rfnm_rx_usb_cb {
 	// in the buffer of rx_usb_cb outgoing usb buffers, this is the next one we are going to equeue
@@ -105,6 +148,14 @@ struct rfnm_rx_usb_cb {
 	uint32_t head;
 	uint32_t adc_buf[4];
 	uint32_t adc_buf_cnt[4];
+	// each usb request covers a run of req_slots consecutive buffers, run_start/run_len
+	// describe the run an adc is currently filling and run_pos is adc_buf's place in it
+	uint32_t req_slots;
+	// the udc takes sg lists, runs may wrap around the end of rx_usb_buf
+	uint32_t req_sg;
+	uint32_t run_start[4];
+	uint32_t run_len[4];
+	uint32_t run_pos[4];
 	uint32_t cc;
 	uint64_t usb_cc[4];
 	uint32_t usb_host_dropped;
@@ -129,10 +180,6 @@ struct rfnm_rx_la_cb {
 	//int read_cc;
 };
 
-struct rfnm_rx_usb_buf *rfnm_rx_usb_buf;
-
-
-
 struct rfnm_tx_la_cb {
 	//int head;
 	uint32_t head;
@@ -154,14 +201,9 @@ struct rfnm_usb_req_buffer {
 
 
 
-struct rfnm_stream_stats rfnm_stream_stats;
-
-
-
-struct rfnm_usb_req_buffer *rfnm_usb_req_buffer_in;
-struct rfnm_usb_req_buffer *rfnm_usb_req_buffer_in_usb;
-struct rfnm_usb_req_buffer *rfnm_usb_req_buffer_out;
-struct rfnm_usb_req_buffer *rfnm_usb_req_buffer_out_usb;
+// every out endpoint feeds the single dac ring through this endpoint's req_out,
+// sorted by usb_cc, req_out of the others stays empty
+#define RFNM_TX_EP 0
 
 enum {
 	RFNM_USB_EP_OK,
@@ -169,10 +211,101 @@ enum {
 	RFNM_USB_EP_OVERFLOW,
 	RFNM_USB_EP_DEFAULT,
 	RFNM_USB_EP_REMOTEIO,	
+	RFNM_USB_EP_RECOVERED,
+	RFNM_USB_EP_ISO_MISSED,
 	RFNM_USB_EP_MAX,	
 };
 
-int rfnm_ep_stats[RFNM_USB_EP_MAX];	
+struct rfnm_ep_state {
+	struct usb_ep *ep;
+	// every request the usb function allocated for this endpoint, so they can be
+	// dequeued no matter where they are
+	struct usb_request *req[RFNM_USB_QLEN_MAX];
+	int req_cnt;
+	// usb_ep_queue failed, the USB thread will recover the endpoint
+	int failed;
+	uint64_t recoveries;
+	uint64_t recover_errors;
+};
+
+// runs the RX thread finished but the USB thread hasn't sliced up yet
+#define RFNM_ISO_RUNS 8
+
+// isochronous IN, see rfnm_stream_set_iso()
+struct rfnm_iso_ep {
+	// bytes per service interval, 0 while the endpoint is bulk
+	uint32_t chunk;
+	uint32_t run_start[RFNM_ISO_RUNS];
+	uint32_t run_len[RFNM_ISO_RUNS];
+	// head is written by the RX thread, tail and off by the USB thread
+	uint32_t head;
+	uint32_t tail;
+	// bytes of the run at tail already queued
+	uint32_t off;
+};
+
+/*
+ * NAPI style polling: a thread handles up to budget adc buffers (RX), usb
+ * chunks (TX) or requests per direction (USB) per pass, and polls again
+ * right away while passes use the budget up. A pass that finds less puts
+ * it to sleep until kicked, or for poll_idle_us: the M7 rings raise no
+ * interrupt, the timeout is what paces an idle RX.
+ */
+enum {
+	RFNM_POLL_RX,
+	RFNM_POLL_TX,
+	RFNM_POLL_USB,
+	RFNM_POLL_CNT,
+};
+
+struct rfnm_poll {
+	// a small budget gets buffers to usb sooner, a big one syncs and wakes less
+	uint32_t budget;
+	// set by the side that has work for the thread, taken when it wakes
+	int kick;
+	// passes that found work, what they handled and the ones that used the budget up
+	uint64_t passes;
+	uint64_t work;
+	uint64_t full;
+	// sleeps, and the ones ended by a kick rather than the timeout
+	uint64_t idle;
+	uint64_t kicked;
+};
+
+/*
+ * Health check, one entry per stage in RFNM_HEALTH_* order. A stage is
+ * armed once it has made progress and stalled when, armed and with work
+ * pending, it makes none for health_stall_ms. Every further health_stall_ms
+ * the recovery goes a step up, see rfnm_health_act.
+ */
+struct rfnm_health {
+	uint64_t progress;
+	uint64_t last_progress_ns;
+	int armed;
+	// 0 while healthy, else the last recovery step taken
+	int level;
+	uint64_t stall_ns;
+	uint64_t incidents;
+};
+
+enum rfnm_health_act {
+	RFNM_HEALTH_REQUEUE = 1,
+	RFNM_HEALTH_RESTART,
+	RFNM_HEALTH_NOTIFY,
+	RFNM_HEALTH_RECOVERED,
+};
+
+// incidents kept for debugfs, oldest overwritten
+#define RFNM_HEALTH_LOG		64
+
+struct rfnm_health_rec {
+	uint64_t ts_ns;
+	uint8_t stage;
+	uint8_t act;
+	// stalled for, or from the stall to progress for RECOVERED
+	uint32_t ms;
+	uint64_t progress;
+};
 
 struct usb_ep_queue_ele {
 	struct usb_ep *ep;
@@ -181,22 +314,203 @@ struct usb_ep_queue_ele {
 	uint64_t usb_cc;
 };
 
+/*
+ * One streaming pipeline per LA9310, nlm<id> of la9310shiva: the shared
+ * rings, the RX/TX/USB threads and the rfnm/nlm<id> debugfs directory.
+ */
 struct rfnm_dev {
+	struct la9310_dev *la9310_dev;
+	int id;
+	// the usb function streams through this pipeline, see usb_dev
+	int usb;
+
+	// shared with the M7, see rfnm_mem_layout()
+	struct rfnm_bufdesc_rx *bufdesc_rx;
+	struct rfnm_bufdesc_tx *bufdesc_tx;
+	struct rfnm_rx_usb_buf *rx_usb_buf;
+	volatile struct rfnm_m7_status *m7_status;
+	// bufdesc_tx is mapped write-combining
+	int tx_wc;
+	struct rfnm_dma_region dma[RFNM_DMA_REGIONS];
+	// two entries per ring slot, used by a wrapping run that starts at that slot
+	struct scatterlist *rx_sg;
+
+	struct task_struct *thread_in;
+	struct task_struct *thread_out;
+	struct task_struct *thread_usb;
+	wait_queue_head_t wq_in;
+	wait_queue_head_t wq_out;
+	wait_queue_head_t wq_usb;
+	struct rfnm_poll poll[RFNM_POLL_CNT];
+	// how long an idle RX or TX thread sleeps when nothing kicks it
+	uint32_t poll_idle_us;
+
+	struct rfnm_stream_stats stream_stats;
+	int ep_stats[RFNM_USB_EP_MAX];
+	// completed requests per direction, never reset, the health check watches them
+	uint64_t usb_done[RFNM_EP_DIR_CNT];
+
+	// one set of queues per endpoint, indexed like f_sourcesink in_ep[]/out_ep[]
+	struct rfnm_usb_req_buffer *req_in[RFNM_EP_CNT];
+	struct rfnm_usb_req_buffer *req_in_usb[RFNM_EP_CNT];
+	struct rfnm_usb_req_buffer *req_out[RFNM_EP_CNT];
+	struct rfnm_usb_req_buffer *req_out_usb[RFNM_EP_CNT];
+
+	// second consumer of the rx ring, see rfnm_stream_set_rx_tap()
+	rfnm_rx_tap_fn rx_tap;
+	spinlock_t rx_tap_lock;
+
+	struct dentry *dfs_dir;
+	// stream_status prints rates since the previous read
+	uint64_t dfs_last_read;
+	struct rfnm_stream_stats dfs_last_stats;
+
 	struct rfnm_rx_usb_cb rx_usb_cb;
 	struct rfnm_rx_la_cb rx_la_cb;
 	struct rfnm_tx_la_cb tx_la_cb;
 	uint8_t * usb_config_buffer;
 	
-	int usb_flushmode;
+	/*
+	 * Soft restart, see rfnm_epoch_request(). Once epoch_req moves on RX
+	 * and TX park at their next pass boundary, the USB thread flushes and
+	 * resets the stages and publishes epoch, which lets them go.
+	 */
+	uint32_t epoch_req;
+	uint32_t epoch;
+	// indexed by RFNM_POLL_RX and RFNM_POLL_TX
+	uint32_t epoch_parked[2];
+	wait_queue_head_t wq_epoch;
+	uint64_t epoch_t0;
+	// from the request to the stages running again
+	uint64_t resets;
+	uint64_t reset_last_ns;
+	uint64_t reset_max_ns;
+	uint64_t reset_total_ns;
+	// the host restart waiting for its ep0 reply, see rfnm_stream_soft_restart()
+	spinlock_t restart_lock;
+	rfnm_restart_done_fn restart_done;
+	void *restart_ctx;
+	uint32_t restart_epoch;
+	struct delayed_work restart_timeout;
+
+	// stall detection and recovery, see rfnm_health_work()
+	struct delayed_work health_work;
+	struct rfnm_health health[RFNM_HEALTH_CNT];
+	struct rfnm_health_rec health_log[RFNM_HEALTH_LOG];
+	uint32_t health_log_head;
+
+	// last events of each stage, rfnm/nlm<N>/flight
+	struct rfnm_flight flight;
 
 	int wq_stop_in;
 	int wq_stop_out;
 	int wq_stop_usb;
+
+	// optional TX interpolation/NCO stage, owned by the TX thread
+	struct rfnm_tx_interp *tx_interp;
+	// staged by debugfs, picked up by the TX thread between USB buffers
+	struct rfnm_tx_interp *tx_interp_next;
+	int tx_interp_update;
+	spinlock_t tx_interp_lock;
+
+	// digital gain/IQ/DC correction per dac, applied while unpacking
+	struct rfnm_iq_corr tx_corr[4];
+	// same per adc, applied while packing, dc is subtracted before the matrix
+	struct rfnm_iq_corr rx_corr[4];
+	spinlock_t corr_lock;
+
+	// per endpoint counters: adc buffers handed to usb, adc buffers dropped
+	// because the endpoint had no free request, out requests fed to the dac ring
+	uint64_t ep_rx_ok[RFNM_EP_CNT];
+	uint64_t ep_rx_starved[RFNM_EP_CNT];
+	uint64_t ep_tx_ok[RFNM_EP_CNT];
+	// only the first starved buffer of a run is reported to the host
+	int ep_rx_starving[RFNM_EP_CNT];
+
+	// endpoint recovery, see rfnm_usb_ep_recover()
+	struct rfnm_ep_state ep_state[RFNM_EP_DIR_CNT][RFNM_EP_CNT];
+	spinlock_t ep_state_lock;
+	// set after an out endpoint recovery, the TX thread takes the next usb_cc as is
+	int tx_cc_resync;
+	// set after an in endpoint recovery, the RX thread restarts usb_cc of that adc
+	int rx_cc_resync[RFNM_EP_CNT];
+
+	struct rfnm_iso_ep iso[RFNM_EP_CNT];
+
+	// running dc estimate per adc, owned by the RX thread
+	struct rfnm_rx_dc rx_dc[4];
+	// 0 disables tracking, otherwise the time constant is 2^shift adc buffers,
+	// written from debugfs, the RX thread clamps it to RFNM_RX_DC_SHIFT_MAX
+	uint32_t rx_dc_shift;
 };
 
 #define CONFIG_DESCRIPTOR_MAX_SIZE 1000
 
-struct rfnm_dev *rfnm_dev;
+static struct rfnm_dev *rfnm_devs[MAX_MODEM_INSTANCES];
+// the pipeline behind the usb function and the exported rfnm_stream_* calls
+static struct rfnm_dev *rfnm_usb_dev;
+
+static uint usb_dev;
+module_param(usb_dev, uint, 0444);
+MODULE_PARM_DESC(usb_dev, "LA9310 (nlm<N>) whose pipeline the usb function streams, the others feed only their rx tap");
+
+static uint rx_budget = 256;
+module_param(rx_budget, uint, 0444);
+MODULE_PARM_DESC(rx_budget, "adc buffers the RX thread packs per pass, rfnm/nlm<N>/rx_budget at run time");
+
+static uint tx_budget = 16;
+module_param(tx_budget, uint, 0444);
+MODULE_PARM_DESC(tx_budget, "usb chunks the TX thread unpacks per pass, rfnm/nlm<N>/tx_budget at run time");
+
+static uint usb_budget = 16;
+module_param(usb_budget, uint, 0444);
+MODULE_PARM_DESC(usb_budget, "requests per direction the USB thread queues per pass, rfnm/nlm<N>/usb_budget at run time");
+
+static uint poll_idle_us = 500;
+module_param(poll_idle_us, uint, 0444);
+MODULE_PARM_DESC(poll_idle_us, "longest sleep of an idle RX or TX thread, rfnm/nlm<N>/poll_idle_us at run time");
+
+static uint32_t rfnm_poll_budget(struct rfnm_poll *p)
+{
+	return max_t(uint32_t, READ_ONCE(p->budget), 1);
+}
+
+// account a pass that handled cnt, returns full
+static int rfnm_poll_done(struct rfnm_poll *p, uint32_t cnt, int full)
+{
+	if(cnt) {
+		p->passes++;
+		p->work += cnt;
+	}
+	if(full) {
+		p->full++;
+	}
+	return full;
+}
+
+// there is work for the thread polling p
+static void rfnm_poll_kick(struct rfnm_poll *p, wait_queue_head_t *wq)
+{
+	WRITE_ONCE(p->kick, 1);
+	wake_up(wq);
+}
+
+// sleep until kicked, cond or poll_idle_us. A kick during the pass ends the next sleep at once.
+#define rfnm_poll_idle(rfnm_dev, p, wq, cond) do {						\
+	(p)->idle++;										\
+	if(!wait_event_hrtimeout(wq, xchg(&(p)->kick, 0) || (cond),				\
+			ns_to_ktime((u64) READ_ONCE((rfnm_dev)->poll_idle_us) * NSEC_PER_USEC))) {	\
+		(p)->kicked++;									\
+	}											\
+} while(0)
+
+// events go to the host, only the pipeline it streams through has any for it
+static void rfnm_dev_event(struct rfnm_dev *rfnm_dev, uint8_t type, uint8_t ch, uint32_t arg)
+{
+	if(rfnm_dev->usb) {
+		rfnm_stream_event(type, ch, arg);
+	}
+}
 
 
 #define DRIVER_VENDOR_ID	0x0525 /* NetChip */
@@ -232,40 +546,219 @@ struct __attribute__((__packed__)) rfnm_packet_head {
 #define RFNM_PACKET_HEAD_SIZE sizeof (struct rfnm_packet_head)
 
 
-static void rfnm_usb_buffer_done_in(struct usb_ep_queue_ele *usb_ep_queue_ele)
+static struct usb_ep_queue_ele *rfnm_usb_req_pop(struct rfnm_usb_req_buffer *rb)
+{
+	struct usb_ep_queue_ele *usb_ep_queue_ele;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rb->list_lock, flags);
+	usb_ep_queue_ele = list_first_entry_or_null(&rb->active, struct usb_ep_queue_ele, head);
+	if(usb_ep_queue_ele) {
+		list_del(&usb_ep_queue_ele->head);
+	}
+	spin_unlock_irqrestore(&rb->list_lock, flags);
+
+	return usb_ep_queue_ele;
+}
+
+static int rfnm_usb_req_empty(struct rfnm_usb_req_buffer *rb)
+{
+	unsigned long flags;
+	int empty;
+
+	spin_lock_irqsave(&rb->list_lock, flags);
+	empty = list_empty(&rb->active);
+	spin_unlock_irqrestore(&rb->list_lock, flags);
+
+	return empty;
+}
+
+// endpoint index of a request, from usb_request->context
+static int rfnm_usb_req_ep(struct usb_ep_queue_ele *usb_ep_queue_ele)
+{
+	int e = RFNM_EP_CTX_TO_ID(usb_ep_queue_ele->req->context);
+
+	return e < 0 || e >= RFNM_EP_CNT ? 0 : e;
+}
+
+// move an element from one queue to the tail of another
+static void rfnm_usb_req_move(struct usb_ep_queue_ele *usb_ep_queue_ele, struct rfnm_usb_req_buffer *from, struct rfnm_usb_req_buffer *to)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&to->list_lock, flags);
+	spin_lock(&from->list_lock);
+	list_move_tail(&usb_ep_queue_ele->head, &to->active);
+	spin_unlock(&from->list_lock);
+	spin_unlock_irqrestore(&to->list_lock, flags);
+}
+
+// usb_ep_queue refused a request: park it and leave the endpoint to the USB thread.
+// IN requests go back to the free queue, OUT requests wait to be queued again.
+static void rfnm_usb_ep_failed(struct rfnm_dev *rfnm_dev, struct usb_ep_queue_ele *usb_ep_queue_ele, int status)
+{
+	struct usb_ep *ep = usb_ep_queue_ele->ep;
+	int e = RFNM_EP_CTX_TO_ID(usb_ep_queue_ele->req->context);
+	int dir = usb_endpoint_dir_in(ep->desc) ? RFNM_EP_DIR_IN : RFNM_EP_DIR_OUT;
+	struct rfnm_usb_req_buffer *rb;
+	unsigned long flags;
+
+	if(e < 0 || e >= RFNM_EP_CNT) {
+		e = 0;
+	}
+
+	printk("kill %s:  resubmit %d bytes --> %d, recovering\n", ep->name, usb_ep_queue_ele->req->length, status);
+	rfnm_flight_error(&rfnm_dev->flight, "usb_ep_queue failed");
+
+	rb = dir == RFNM_EP_DIR_IN ? rfnm_dev->req_in[e] : rfnm_dev->req_out_usb[e];
+
+	spin_lock_irqsave(&rb->list_lock, flags);
+	list_add_tail(&usb_ep_queue_ele->head, &rb->active);
+	spin_unlock_irqrestore(&rb->list_lock, flags);
+
+	WRITE_ONCE(rfnm_dev->ep_state[dir][e].failed, 1);
+	wake_up(&rfnm_dev->wq_usb);
+}
+
+/*
+ * Runs in the USB thread. Every request the endpoint owns is dequeued, their
+ * completions (-ECONNRESET) put them back on the free/out_usb queues, which
+ * re-primes the endpoint on the next pass. The halt is cleared and the cc
+ * counters of the endpoint restart: TX from whatever the host sends next, RX
+ * from 1. Without an endpoint (disconnect, set_alt) the requests stay parked
+ * until the usb function adds it again.
+ */
+static void rfnm_usb_ep_recover(struct rfnm_dev *rfnm_dev, int dir, int e)
+{
+	struct rfnm_ep_state *es = &rfnm_dev->ep_state[dir][e];
+	struct usb_request *req[RFNM_USB_QLEN_MAX];
+	struct usb_ep *ep;
+	unsigned long flags;
+	int req_cnt, ret;
+
+	// usb_ep_dequeue takes the udc lock and waits for the completion, not under ours
+	spin_lock_irqsave(&rfnm_dev->ep_state_lock, flags);
+	ep = es->ep;
+	req_cnt = es->req_cnt;
+	memcpy(req, es->req, req_cnt * sizeof(req[0]));
+	spin_unlock_irqrestore(&rfnm_dev->ep_state_lock, flags);
+
+	if(!ep) {
+		return;
+	}
+
+	for(int i = 0; i < req_cnt; i++) {
+		usb_ep_dequeue(ep, req[i]);
+	}
+
+	ret = usb_ep_clear_halt(ep);
+
+	spin_lock_irqsave(&rfnm_dev->ep_state_lock, flags);
+	if(ret) {
+		es->recover_errors++;
+	} else {
+		es->recoveries++;
+		WRITE_ONCE(es->failed, 0);
+	}
+	spin_unlock_irqrestore(&rfnm_dev->ep_state_lock, flags);
+
+	if(dir == RFNM_EP_DIR_OUT) {
+		WRITE_ONCE(rfnm_dev->tx_cc_resync, 1);
+	} else {
+		WRITE_ONCE(rfnm_dev->rx_cc_resync[e], 1);
+	}
+
+	printk("%s ep %d recovery %s (%d)\n", dir == RFNM_EP_DIR_IN ? "in" : "out", e, ret ? "failed" : "done", ret);
+	rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_CTRL, RFNM_FL_EP_RECOVERY, dir, e, ret, 0);
+
+	rfnm_dev_event(rfnm_dev, RFNM_EVT_EP_RECOVERY, e | (dir == RFNM_EP_DIR_IN ? RFNM_EVT_CH_IN : 0), ret);
+}
+
+// called by the usb function for every request it allocates
+void rfnm_stream_ep_add_req(int dir, int id, struct usb_ep *ep, struct usb_request *req) {
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
+	struct rfnm_ep_state *es = &rfnm_dev->ep_state[dir][id];
+	unsigned long flags;
+
+	spin_lock_irqsave(&rfnm_dev->ep_state_lock, flags);
+	es->ep = ep;
+	if(es->req_cnt < RFNM_USB_QLEN_MAX) {
+		es->req[es->req_cnt++] = req;
+	}
+	spin_unlock_irqrestore(&rfnm_dev->ep_state_lock, flags);
+}
+EXPORT_SYMBOL(rfnm_stream_ep_add_req);
+
+// called by the usb function before it disables the endpoint
+void rfnm_stream_ep_reset(int dir, int id) {
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
+	struct rfnm_ep_state *es = &rfnm_dev->ep_state[dir][id];
+	unsigned long flags;
+
+	spin_lock_irqsave(&rfnm_dev->ep_state_lock, flags);
+	es->ep = NULL;
+	es->req_cnt = 0;
+	es->failed = 0;
+	spin_unlock_irqrestore(&rfnm_dev->ep_state_lock, flags);
+}
+EXPORT_SYMBOL(rfnm_stream_ep_reset);
+
+// point an IN request at run_len consecutive rfnm_rx_usb_buf starting at run_start,
+// a run that wraps around the end of the ring goes out as a two entry sg list
+static void rfnm_rx_usb_req_fill(struct rfnm_dev *rfnm_dev, struct usb_request *req, uint32_t run_start, uint32_t run_len)
+{
+	uint32_t first = min_t(uint32_t, run_len, rfnm_rx_usb_bufcnt - run_start);
+
+	req->buf = (uint8_t *) &rfnm_dev->rx_usb_buf[run_start];
+	req->length = sizeof(struct rfnm_rx_usb_buf) * run_len;
+
+	if(first == run_len) {
+		req->sg = NULL;
+		req->num_sgs = 0;
+	} else {
+		struct scatterlist *sg = &rfnm_dev->rx_sg[run_start * 2];
+
+		sg_init_table(sg, 2);
+		sg_set_buf(&sg[0], &rfnm_dev->rx_usb_buf[run_start], sizeof(struct rfnm_rx_usb_buf) * first);
+		sg_set_buf(&sg[1], &rfnm_dev->rx_usb_buf[0], sizeof(struct rfnm_rx_usb_buf) * (run_len - first));
+
+		req->sg = sg;
+		req->num_sgs = 2;
+	}
+}
+
+static void rfnm_usb_buffer_done_in(struct rfnm_dev *rfnm_dev, struct usb_ep_queue_ele *usb_ep_queue_ele, struct rfnm_usb_req_buffer *rb)
 {
 	unsigned long flags;
 	int status;
 
-	spin_lock_irqsave(&rfnm_usb_req_buffer_in->list_lock, flags);
+	spin_lock_irqsave(&rb->list_lock, flags);
 	list_del(&usb_ep_queue_ele->head);
-	spin_unlock_irqrestore(&rfnm_usb_req_buffer_in->list_lock, flags);
+	spin_unlock_irqrestore(&rb->list_lock, flags);
 
 	status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
 	if (status) {
-		printk("kill %s:  resubmit %d bytes --> %d\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, status);
-		usb_ep_set_halt(usb_ep_queue_ele->ep);
-		// FIXME recover later ... somehow 
+		rfnm_usb_ep_failed(rfnm_dev, usb_ep_queue_ele, status);
+		return;
 	}
 
 	kfree(usb_ep_queue_ele);
 }
 
 
-static void rfnm_usb_buffer_done_out(struct usb_ep_queue_ele *usb_ep_queue_ele)
+static void rfnm_usb_buffer_done_out(struct rfnm_dev *rfnm_dev, struct usb_ep_queue_ele *usb_ep_queue_ele, struct rfnm_usb_req_buffer *rb)
 {
 	unsigned long flags;
 	int status;
 
-	spin_lock_irqsave(&rfnm_usb_req_buffer_out->list_lock, flags);
+	spin_lock_irqsave(&rb->list_lock, flags);
 	list_del(&usb_ep_queue_ele->head);
-	spin_unlock_irqrestore(&rfnm_usb_req_buffer_out->list_lock, flags);
+	spin_unlock_irqrestore(&rb->list_lock, flags);
 
 	status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
 	if (status) {
-		printk("kill %s:  resubmit %d bytes --> %d\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, status);
-		usb_ep_set_halt(usb_ep_queue_ele->ep);
-		// FIXME recover later ... somehow 
+		rfnm_usb_ep_failed(rfnm_dev, usb_ep_queue_ele, status);
+		return;
 	}
 
 	kfree(usb_ep_queue_ele);
@@ -294,231 +787,378 @@ DECLARE_WORK(rfnm_tasklet_out, rfnm_handler_out);
 void kernel_neon_begin(void);
 void kernel_neon_end(void);
 
-int can_run_handler_in(void) {
-	struct usb_ep_queue_ele *usb_ep_queue_ele;
+// RX thread: offer every buffer of a finished run to the tap, if there is one
+static void rfnm_rx_tap_run(struct rfnm_dev *rfnm_dev, uint32_t run_start, uint32_t run_len)
+{
+	unsigned long flags;
 
-	spin_lock(&rfnm_usb_req_buffer_in->list_lock);
-	usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_in->active, struct usb_ep_queue_ele, head);
-	spin_unlock(&rfnm_usb_req_buffer_in->list_lock);
+	if(!READ_ONCE(rfnm_dev->rx_tap)) {
+		return;
+	}
 
-	return usb_ep_queue_ele != NULL;
+	spin_lock_irqsave(&rfnm_dev->rx_tap_lock, flags);
+	if(rfnm_dev->rx_tap) {
+		for(uint32_t i = 0; i < run_len; i++) {
+			rfnm_dev->rx_tap(&rfnm_dev->rx_usb_buf[(run_start + i) % rfnm_rx_usb_bufcnt]);
+		}
+	}
+	spin_unlock_irqrestore(&rfnm_dev->rx_tap_lock, flags);
 }
 
-int can_run_handler_usb(void) {
-	struct usb_ep_queue_ele *usb_ep_queue_ele_in;
+int rfnm_stream_set_rx_tap(int dev, rfnm_rx_tap_fn fn) {
+	struct rfnm_dev *rfnm_dev;
+	unsigned long flags;
 
-	spin_lock(&rfnm_usb_req_buffer_in_usb->list_lock);
-	usb_ep_queue_ele_in = list_first_entry_or_null(&rfnm_usb_req_buffer_in_usb->active, struct usb_ep_queue_ele, head);
-	spin_unlock(&rfnm_usb_req_buffer_in_usb->list_lock);
+	if(dev < 0 || dev >= MAX_MODEM_INSTANCES || !rfnm_devs[dev]) {
+		return -ENODEV;
+	}
+	rfnm_dev = rfnm_devs[dev];
 
-	struct usb_ep_queue_ele *usb_ep_queue_ele_out;
+	spin_lock_irqsave(&rfnm_dev->rx_tap_lock, flags);
+	WRITE_ONCE(rfnm_dev->rx_tap, fn);
+	spin_unlock_irqrestore(&rfnm_dev->rx_tap_lock, flags);
 
-	spin_lock(&rfnm_usb_req_buffer_out_usb->list_lock);
-	usb_ep_queue_ele_out = list_first_entry_or_null(&rfnm_usb_req_buffer_out_usb->active, struct usb_ep_queue_ele, head);
-	spin_unlock(&rfnm_usb_req_buffer_out_usb->list_lock);
-	
-	return (usb_ep_queue_ele_in != NULL) || (usb_ep_queue_ele_out != NULL) || rfnm_dev->usb_flushmode || rfnm_dev->wq_stop_usb;
+	return 0;
 }
+EXPORT_SYMBOL(rfnm_stream_set_rx_tap);
 
-//static void rfnm_handler_usb(unsigned long tasklet_data) {
-//void rfnm_handler_usb(struct work_struct * tasklet_data) {
-int rfnm_handler_usb(void * tasklet_data) {
-
-	struct sched_param sparam = { .sched_priority = 1 };
-sched_setscheduler(current, SCHED_FIFO, &sparam);
+// RX thread: hand a finished run to the USB thread instead of a bulk request
+static void rfnm_iso_push_run(struct rfnm_dev *rfnm_dev, int e, uint32_t run_start, uint32_t run_len)
+{
+	struct rfnm_iso_ep *iso = &rfnm_dev->iso[e];
+	uint32_t head = iso->head;
+
+	if(head - READ_ONCE(iso->tail) >= RFNM_ISO_RUNS) {
+		// the host stopped polling, the run is lost
+		rfnm_dev->stream_stats.usb_rx_error[0]++;
+		rfnm_dev->ep_rx_starved[e]++;
+		if(!rfnm_dev->ep_rx_starving[e]) {
+			rfnm_dev->ep_rx_starving[e] = 1;
+			rfnm_dev_event(rfnm_dev, RFNM_EVT_RX_OVERRUN, e, 1);
+		}
+		return;
+	}
 
-	while(1) {
-wait:
-		//usleep_range(500, 1000);
-		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_5);
-		wait_event(wq_usb, can_run_handler_usb());
-		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_5);
+	iso->run_start[head % RFNM_ISO_RUNS] = run_start;
+	iso->run_len[head % RFNM_ISO_RUNS] = run_len;
+	smp_store_release(&iso->head, head + 1);
 
-		//if(rfnm_dev->wq_stop_usb) {
-		//	rfnm_dev->usb_flushmode = 1;
-		//	printk("Stopping USB thread by entering flushmode");
-		//}
+	rfnm_dev->ep_rx_starving[e] = 0;
+	rfnm_dev->stream_stats.usb_rx_ok[0]++;
+	rfnm_dev->ep_rx_ok[e]++;
 
-		struct usb_ep_queue_ele *usb_ep_queue_ele;
-		int status;
-		
-		if(rfnm_dev->usb_flushmode) {
-			
-			struct rfnm_usb_req_buffer *flushing_queues[4];
+	wake_up(&rfnm_dev->wq_usb);
+}
 
-			flushing_queues[0] = rfnm_usb_req_buffer_in;
-			flushing_queues[1] = rfnm_usb_req_buffer_in_usb;
-			flushing_queues[2] = rfnm_usb_req_buffer_out;
-			flushing_queues[3] = rfnm_usb_req_buffer_out_usb;
+static int rfnm_iso_pending(struct rfnm_dev *rfnm_dev, int e)
+{
+	struct rfnm_iso_ep *iso = &rfnm_dev->iso[e];
 
-			for (int q = 0; q < 4; q++) {
+	return READ_ONCE(iso->chunk) && READ_ONCE(iso->tail) != smp_load_acquire(&iso->head) &&
+		!rfnm_usb_req_empty(rfnm_dev->req_in[e]);
+}
 
-				while(1) {
-					spin_lock(&flushing_queues[q]->list_lock);
-					usb_ep_queue_ele = list_first_entry_or_null(&flushing_queues[q]->active, struct usb_ep_queue_ele, head);
-					spin_unlock(&flushing_queues[q]->list_lock);
+// USB thread: queue the next service interval worth of the oldest run. A request
+// never crosses the end of a struct rfnm_rx_usb_buf, so runs that wrap around the
+// ring need no sg and the host reassembles buffers by concatenating packets.
+static int rfnm_iso_service(struct rfnm_dev *rfnm_dev, int e)
+{
+	struct rfnm_iso_ep *iso = &rfnm_dev->iso[e];
+	struct usb_ep_queue_ele *usb_ep_queue_ele;
+	struct usb_request *req;
+	uint32_t chunk = READ_ONCE(iso->chunk);
+	uint32_t t, slot, in_slot;
+	int status;
 
-					if(usb_ep_queue_ele == NULL) {
-						break;
-					}
+	if(!chunk || iso->tail == smp_load_acquire(&iso->head)) {
+		return 0;
+	}
 
-					spin_lock(&flushing_queues[q]->list_lock);
-					list_del(&usb_ep_queue_ele->head);
-					spin_unlock(&flushing_queues[q]->list_lock);
-#if 1
-					usb_ep_queue_ele->req->length = 0;
-					//usb_ep_queue_ele->req->buf = rfnm_rx_usb_buf;
-					//usb_ep_queue_ele->req->buf = kzalloc(0x100, GFP_KERNEL);
-					status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
-					if (status) {
-						printk("usb_flushmode: kill %s:  resubmit %d bytes --> %d\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, status);
-						usb_ep_set_halt(usb_ep_queue_ele->ep);
-						// FIXME recover later ... somehow 
-					} else {
-						printk("usb_flushmode: %s:  resubmit %d bytes --> %d (%lx)\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, usb_ep_queue_ele->req->buf, status);
-					}
-#endif
+	usb_ep_queue_ele = rfnm_usb_req_pop(rfnm_dev->req_in[e]);
+	if(usb_ep_queue_ele == NULL) {
+		return 0;
+	}
 
-					kfree(usb_ep_queue_ele);
-				}
-			}
+	t = iso->tail % RFNM_ISO_RUNS;
+	slot = (iso->run_start[t] + iso->off / sizeof(struct rfnm_rx_usb_buf)) % rfnm_rx_usb_bufcnt;
+	in_slot = iso->off % sizeof(struct rfnm_rx_usb_buf);
 
-			rfnm_dev->usb_flushmode = 0;
+	req = usb_ep_queue_ele->req;
+	req->buf = (uint8_t *) &rfnm_dev->rx_usb_buf[slot] + in_slot;
+	req->length = min_t(uint32_t, chunk, sizeof(struct rfnm_rx_usb_buf) - in_slot);
+	req->sg = NULL;
+	req->num_sgs = 0;
 
-			printk("Flushmode done");
-		}
+	iso->off += req->length;
+	if(iso->off == iso->run_len[t] * sizeof(struct rfnm_rx_usb_buf)) {
+		iso->off = 0;
+		smp_store_release(&iso->tail, iso->tail + 1);
+	}
 
-		if(rfnm_dev->wq_stop_usb) {
-			rfnm_dev->wq_stop_usb = 0;
-			printk("Stopping USB process");
-			do_exit(0);
-		}
+	status = usb_ep_queue(usb_ep_queue_ele->ep, req, GFP_ATOMIC);
+	if (status) {
+		rfnm_usb_ep_failed(rfnm_dev, usb_ep_queue_ele, status);
+		return 0;
+	}
 
-		//printk("kill\n");
-		
-try_input:
-		spin_lock(&rfnm_usb_req_buffer_in_usb->list_lock);
-		usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_in_usb->active, struct usb_ep_queue_ele, head);
-		spin_unlock(&rfnm_usb_req_buffer_in_usb->list_lock);
-		
+	kfree(usb_ep_queue_ele);
+	return 1;
+}
 
-		if(usb_ep_queue_ele == NULL) {
-			goto try_other_direction;
+int can_run_handler_in(struct rfnm_dev *rfnm_dev) {
+	for(int e = 0; e < RFNM_EP_CNT; e++) {
+		if(!rfnm_usb_req_empty(rfnm_dev->req_in[e])) {
+			return 1;
 		}
+	}
 
-		spin_lock(&rfnm_usb_req_buffer_in_usb->list_lock);
-		list_del(&usb_ep_queue_ele->head);
-		spin_unlock(&rfnm_usb_req_buffer_in_usb->list_lock);
-
-		dcache_clean_poc(usb_ep_queue_ele->req->buf, usb_ep_queue_ele->req->buf + usb_ep_queue_ele->req->length);
-
-		//printk("DQ %lx\n", usb_ep_queue_ele->req->buf);
-
-
-#if 0
-
-		static int delay_wavedetct = 0;
-		static int wavedetect = 0;
-
-		if(1 || ++delay_wavedetct == 10000) {
-			delay_wavedetct = 0;
-
-			for (int s = 0; s < 50000; s += 768) {
+	return 0;
+}
 
-				uint32_t *packed;
-				uint32_t lp;
-				int16_t li, lq;
+// RX or TX at a pass boundary: stay put while a soft restart resets the stages under it
+static void rfnm_epoch_park(struct rfnm_dev *rfnm_dev, int stage, int *stop)
+{
+	uint32_t req;
 
-				packed = (uint32_t *) (((uint8_t*) usb_ep_queue_ele->req->buf) + 32 + s);
-				lp = *packed;
+	while((req = smp_load_acquire(&rfnm_dev->epoch_req)) != READ_ONCE(rfnm_dev->epoch) && !READ_ONCE(*stop)) {
+		smp_store_release(&rfnm_dev->epoch_parked[stage], req);
+		wake_up(&rfnm_dev->wq_usb);
+		wait_event(rfnm_dev->wq_epoch, READ_ONCE(rfnm_dev->epoch) == req ||
+			READ_ONCE(rfnm_dev->epoch_req) != req || READ_ONCE(*stop));
+	}
+}
 
-				li = ((lp & 0xfff000ll) >> 12) << 4;
-				lq = (lp & 0xfff) << 4;
+// a soft restart was asked for and RX and TX are parked for it
+static int rfnm_epoch_ready(struct rfnm_dev *rfnm_dev)
+{
+	uint32_t req = smp_load_acquire(&rfnm_dev->epoch_req);
 
-				li = abs(li);
-				lq = abs(lq);
-				
+	return req != READ_ONCE(rfnm_dev->epoch) &&
+		smp_load_acquire(&rfnm_dev->epoch_parked[RFNM_POLL_RX]) == req &&
+		smp_load_acquire(&rfnm_dev->epoch_parked[RFNM_POLL_TX]) == req;
+}
 
-#if 1
-				if((li + lq) > (150 * 4)) {
-					if(!wavedetect) {
-						wavedetect = 1;
-						printk("Y %d %d \t%d\n", lq, li, s);
-					}
-					
-				} else if((li + lq) < (20 * 4)){
-					if(wavedetect) {
-						wavedetect = 0;
-						printk("N %d %d \t\t%d\n", lq, li, s);
-					}
+// hand every request we hold back to the udc empty, the host sees them complete
+static void rfnm_usb_flush(struct rfnm_dev *rfnm_dev)
+{
+	struct rfnm_usb_req_buffer **flushing_queues[4] = {
+		rfnm_dev->req_in, rfnm_dev->req_in_usb, rfnm_dev->req_out, rfnm_dev->req_out_usb,
+	};
+	struct usb_ep_queue_ele *usb_ep_queue_ele, *tmp;
+	LIST_HEAD(flush_failed);
+	int status, flushed = 0;
+
+	for (int q = 0; q < 4; q++) {
+		for (int e = 0; e < RFNM_EP_CNT; e++) {
+
+			while((usb_ep_queue_ele = rfnm_usb_req_pop(flushing_queues[q][e])) != NULL) {
+				usb_ep_queue_ele->req->length = 0;
+				usb_ep_queue_ele->req->num_sgs = 0;
+				status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
+				if (status) {
+					printk("usb flush: kill %s:  resubmit %d bytes --> %d\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, status);
+					// parked after the flush, putting it back now would loop forever
+					list_add_tail(&usb_ep_queue_ele->head, &flush_failed);
+					continue;
 				}
-#else
-				printk("%d %d\n", li, lq);
-#endif
+
+				kfree(usb_ep_queue_ele);
+				flushed++;
 			}
 		}
-#endif
-
-#if 0
-	struct rfnm_rx_usb_buf *rfnm_rx_usb_buf_t;
+	}
 
-	rfnm_rx_usb_buf_t = usb_ep_queue_ele->req->buf;
+	list_for_each_entry_safe(usb_ep_queue_ele, tmp, &flush_failed, head) {
+		list_del(&usb_ep_queue_ele->head);
+		rfnm_usb_ep_failed(rfnm_dev, usb_ep_queue_ele, -EIO);
+	}
 
-	static int d_dbg = 0;
-				if(++d_dbg == 4) {
-					d_dbg = 0;
-					printk("Q %ld\n", rfnm_rx_usb_buf_t->usb_cc);
-				}
-#endif
-		//memset(((uint8_t*) usb_ep_queue_ele->req->buf) + 32, 0xee, 16);
+	printk("usb flush: %d requests resubmitted empty\n", flushed);
+}
 
-		status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
-		if (status) {
-			printk("kill %s:  resubmit %d bytes --> %d\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, status);
-			usb_ep_set_halt(usb_ep_queue_ele->ep);
-			// FIXME recover later ... somehow 
-		}
+static void rfnm_reset_sm(struct rfnm_dev *rfnm_dev);
 
-		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_6);
-		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_6);
-		kfree(usb_ep_queue_ele);
+// epoch runs, reply to the host restart that asked for it or an earlier one
+static void rfnm_restart_complete(struct rfnm_dev *rfnm_dev, uint32_t epoch)
+{
+	rfnm_restart_done_fn done = NULL;
+	void *ctx = NULL;
+	unsigned long flags;
 
-try_other_direction:
+	spin_lock_irqsave(&rfnm_dev->restart_lock, flags);
+	if(rfnm_dev->restart_done && (int32_t) (epoch - rfnm_dev->restart_epoch) >= 0) {
+		done = rfnm_dev->restart_done;
+		ctx = rfnm_dev->restart_ctx;
+		rfnm_dev->restart_done = NULL;
+	}
+	spin_unlock_irqrestore(&rfnm_dev->restart_lock, flags);
 
-		spin_lock(&rfnm_usb_req_buffer_out_usb->list_lock);
-		usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_out_usb->active, struct usb_ep_queue_ele, head);
-		spin_unlock(&rfnm_usb_req_buffer_out_usb->list_lock);
-		
-		if(usb_ep_queue_ele == NULL) {
-			goto wait;
-		}
+	if(done) {
+		done(ctx, 0);
+	}
+}
 
-		//printk("%x\n", usb_ep_queue_ele);
-		//printk("%x %x\n", usb_ep_queue_ele->ep, usb_ep_queue_ele->req);
+// USB thread, RX and TX parked: start the new epoch
+static void rfnm_epoch_reset(struct rfnm_dev *rfnm_dev)
+{
+	uint32_t req = smp_load_acquire(&rfnm_dev->epoch_req);
+	uint64_t ns;
+
+	rfnm_usb_flush(rfnm_dev);
+	rfnm_reset_sm(rfnm_dev);
+
+	// carry on from where the M7 is, starting from 0 would read as an rx overrun and a tx underrun
+	rfnm_dev->rx_la_cb.tail = rfnm_ring_wrap(RFNM_ADC_BUFCNT, rfnm_dev->m7_status->rx_head);
+	rfnm_dev->tx_la_cb.head = (rfnm_ring_wrap(RFNM_DAC_BUFCNT, rfnm_dev->m7_status->tx_buf_id) +
+		RFNM_RING_TX_RESTART) % RFNM_DAC_BUFCNT;
+
+	ns = ktime_get_ns() - READ_ONCE(rfnm_dev->epoch_t0);
+	rfnm_dev->resets++;
+	rfnm_dev->reset_last_ns = ns;
+	rfnm_dev->reset_total_ns += ns;
+	if(ns > rfnm_dev->reset_max_ns) {
+		rfnm_dev->reset_max_ns = ns;
+	}
 
+	rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_CTRL, RFNM_FL_EPOCH, req,
+		rfnm_dev->rx_la_cb.tail, rfnm_dev->tx_la_cb.head, 0);
 
-		spin_lock(&rfnm_usb_req_buffer_out_usb->list_lock);
-		list_del(&usb_ep_queue_ele->head);
-		spin_unlock(&rfnm_usb_req_buffer_out_usb->list_lock);
+	smp_store_release(&rfnm_dev->epoch, req);
+	wake_up(&rfnm_dev->wq_epoch);
 
+	rfnm_restart_complete(rfnm_dev, req);
+}
 
-		status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
-		if (status) {
-			printk("kill %s:  resubmit %d bytes --> %d\n",usb_ep_queue_ele->ep->name, usb_ep_queue_ele->req->length, status);
-			usb_ep_set_halt(usb_ep_queue_ele->ep);
-			// FIXME recover later ... somehow 
-		}
+// a failed endpoint is only worked on while it exists, its requests stay parked until then
+static int rfnm_usb_ep_parked(struct rfnm_dev *rfnm_dev, int dir, int e)
+{
+	return READ_ONCE(rfnm_dev->ep_state[dir][e].failed);
+}
 
-		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_7);
-		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_7);
-		kfree(usb_ep_queue_ele);
+static int rfnm_usb_ep_recoverable(struct rfnm_dev *rfnm_dev, int dir, int e)
+{
+	return rfnm_usb_ep_parked(rfnm_dev, dir, e) && READ_ONCE(rfnm_dev->ep_state[dir][e].ep);
+}
 
-		goto try_input;
+int can_run_handler_usb(struct rfnm_dev *rfnm_dev) {
+	for(int e = 0; e < RFNM_EP_CNT; e++) {
+		if((!rfnm_usb_ep_parked(rfnm_dev, RFNM_EP_DIR_IN, e) && !rfnm_usb_req_empty(rfnm_dev->req_in_usb[e])) ||
+				(!rfnm_usb_ep_parked(rfnm_dev, RFNM_EP_DIR_OUT, e) && !rfnm_usb_req_empty(rfnm_dev->req_out_usb[e]))) {
+			return 1;
+		}
+		if(rfnm_usb_ep_recoverable(rfnm_dev, RFNM_EP_DIR_IN, e) || rfnm_usb_ep_recoverable(rfnm_dev, RFNM_EP_DIR_OUT, e)) {
+			return 1;
+		}
+		if(rfnm_iso_pending(rfnm_dev, e)) {
+			return 1;
+		}
 	}
+
+	return rfnm_epoch_ready(rfnm_dev) || rfnm_dev->wq_stop_usb;
 }
 
-static struct hrtimer test_hrtimer;
-struct completion setup_done;
+//static void rfnm_handler_usb(unsigned long tasklet_data) {
+//void rfnm_handler_usb(struct work_struct * tasklet_data) {
+int rfnm_handler_usb(void * tasklet_data) {
+	struct rfnm_dev *rfnm_dev = tasklet_data;
+
+	struct sched_param sparam = { .sched_priority = 1 };
+sched_setscheduler(current, SCHED_FIFO, &sparam);
+
+	while(1) {
+		//usleep_range(500, 1000);
+		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_5);
+		if(!can_run_handler_usb(rfnm_dev)) {
+			// no timeout here, every wakeup is a completion or a control kick
+			rfnm_dev->poll[RFNM_POLL_USB].idle++;
+			rfnm_dev->poll[RFNM_POLL_USB].kicked++;
+		}
+		wait_event(rfnm_dev->wq_usb, can_run_handler_usb(rfnm_dev));
+		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_5);
+
+		struct usb_ep_queue_ele *usb_ep_queue_ele;
+		int status;
+
+		for(int dir = 0; dir < RFNM_EP_DIR_CNT; dir++) {
+			for(int e = 0; e < RFNM_EP_CNT; e++) {
+				if(rfnm_usb_ep_recoverable(rfnm_dev, dir, e)) {
+					rfnm_usb_ep_recover(rfnm_dev, dir, e);
+					if(rfnm_usb_ep_recoverable(rfnm_dev, dir, e)) {
+						// udc not ready yet, don't spin on it
+						usleep_range(1000, 2000);
+					}
+				}
+			}
+		}
+		
+		if(rfnm_epoch_ready(rfnm_dev)) {
+			rfnm_epoch_reset(rfnm_dev);
+		}
+
+		if(rfnm_dev->wq_stop_usb) {
+			rfnm_dev->wq_stop_usb = 0;
+			printk("Stopping USB process");
+			do_exit(0);
+		}
+
+		// round robin over the endpoints, one request per endpoint and direction
+		// per round, so a busy channel can't hold back the others. Each direction
+		// stops at the budget, recovery, flush and stop get a look in between.
+		uint32_t budget = rfnm_poll_budget(&rfnm_dev->poll[RFNM_POLL_USB]);
+		uint32_t in_done = 0, out_done = 0;
+		int did_work;
+
+		do {
+			did_work = 0;
+
+			for(int e = 0; e < RFNM_EP_CNT; e++) {
+
+				usb_ep_queue_ele = in_done < budget && !rfnm_usb_ep_parked(rfnm_dev, RFNM_EP_DIR_IN, e) ?
+					rfnm_usb_req_pop(rfnm_dev->req_in_usb[e]) : NULL;
+				if(usb_ep_queue_ele != NULL) {
+					// usb_gadget_map_request in the udc cleans the buffers for the controller
+					status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
+					if (status) {
+						rfnm_usb_ep_failed(rfnm_dev, usb_ep_queue_ele, status);
+					} else {
+						kfree(usb_ep_queue_ele);
+						did_work = 1;
+						in_done++;
+					}
+
+					if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_6);
+					if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_6);
+				}
+
+				if(in_done < budget && rfnm_iso_service(rfnm_dev, e)) {
+					did_work = 1;
+					in_done++;
+				}
+
+				usb_ep_queue_ele = out_done < budget && !rfnm_usb_ep_parked(rfnm_dev, RFNM_EP_DIR_OUT, e) ?
+					rfnm_usb_req_pop(rfnm_dev->req_out_usb[e]) : NULL;
+				if(usb_ep_queue_ele != NULL) {
+					status = usb_ep_queue(usb_ep_queue_ele->ep, usb_ep_queue_ele->req, GFP_ATOMIC);
+					if (status) {
+						rfnm_usb_ep_failed(rfnm_dev, usb_ep_queue_ele, status);
+					} else {
+						kfree(usb_ep_queue_ele);
+						did_work = 1;
+						out_done++;
+					}
+
+					if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_7);
+					if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_7);
+				}
+			}
+		} while(did_work);
+
+		rfnm_poll_done(&rfnm_dev->poll[RFNM_POLL_USB], in_done + out_done, in_done >= budget || out_done >= budget);
+	}
+}
+
+static struct hrtimer test_hrtimer;
+struct completion setup_done;
 
 
 static enum hrtimer_restart test_hrtimer_handler(struct hrtimer *timer)
@@ -546,7 +1186,13 @@ DECLARE_WORK(rfnm_tasklet_usb, rfnm_handler_usb);
 //static DECLARE_TASKLET_OLD(rfnm_tasklet_usb, &rfnm_handler_usb);
 #endif
 //static void rfnm_tasklet_handler_in(unsigned long tasklet_data) {
+// enough adc buffers behind the M7 for a pass
+static int rfnm_rx_ready(struct rfnm_dev *rfnm_dev) {
+	return rfnm_ring_readable(RFNM_ADC_BUFCNT, rfnm_dev->m7_status->rx_head, rfnm_dev->rx_la_cb.tail) >= RFNM_RING_RX_MIN;
+}
+
 int rfnm_handler_in(void * tasklet_data) {
+	struct rfnm_dev *rfnm_dev = tasklet_data;
 //void rfnm_handler_in(struct work_struct * tasklet_data) {
 
 
@@ -558,6 +1204,8 @@ sched_setscheduler(current, SCHED_FIFO, &sparam);
 
 while(1) {
 
+	rfnm_epoch_park(rfnm_dev, RFNM_POLL_RX, &rfnm_dev->wq_stop_in);
+
 	//wait_event(wq_in, can_run_handler_in());
 
 
@@ -580,21 +1228,19 @@ while(1) {
 
 	barrier();
 	
-	//uint32_t la_head = smp_load_acquire(&rfnm_m7_status->rx_head);
-	uint32_t la_head = rfnm_m7_status->rx_head;
+	//uint32_t la_head = smp_load_acquire(&rfnm_dev->m7_status->rx_head);
+	uint32_t la_head = rfnm_dev->m7_status->rx_head;
 	uint32_t la_tail = rfnm_dev->rx_la_cb.tail;
+	uint32_t la_readable;
+	uint32_t la_budget = rfnm_poll_budget(&rfnm_dev->poll[RFNM_POLL_RX]);
+	enum rfnm_ring_rx_act la_act;
 
-	uint32_t la_readable = la_head - la_tail;
-
-	if(la_head < la_tail) {
-		la_readable += RFNM_ADC_BUFCNT;
-	}
-
-	if(la_readable < 32) {
-		// need to stay behind writer, as the ping pong dma has a 2 buffers write latency
+	la_act = rfnm_ring_rx_poll(RFNM_ADC_BUFCNT, la_head, la_tail, &la_readable);
 
+	if(la_act == RFNM_RING_RX_WAIT) {
 		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_1);
-		usleep_range(500, 1000);
+		rfnm_poll_idle(rfnm_dev, &rfnm_dev->poll[RFNM_POLL_RX], rfnm_dev->wq_in,
+			rfnm_rx_ready(rfnm_dev) || rfnm_dev->wq_stop_in);
 		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_1);
 		
 		//schedule();
@@ -605,24 +1251,14 @@ while(1) {
 		goto exit_tasklet;
 	}
 
-	la_readable -= 16;
-
-	if(la_readable < 0) {
-		la_readable = 0;
-		
-		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_1);
-		usleep_range(500, 1000);
-		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_1);
-		
-		//schedule();
-		//reinit_completion(&setup_done); wait_for_completion(&setup_done);	
-		goto exit_tasklet;
-	}
-
-	if(la_readable > (RFNM_ADC_BUFCNT / 4)) {
+	if(la_act == RFNM_RING_RX_OVERRUN) {
 		// too many buffers behind, log error and jump forward
-		rfnm_dev->rx_la_cb.tail = rfnm_m7_status->rx_head;
-		printk("rx too many buffers behind, error not logged to buffer...\n");
+		rfnm_dev->rx_la_cb.tail = rfnm_ring_wrap(RFNM_ADC_BUFCNT, rfnm_dev->m7_status->rx_head);
+		// the detail is in the flight recorder, storms of these would only flood the log
+		printk_ratelimited("rx too many buffers behind, see flight_error\n");
+		rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_RX, RFNM_FL_RX_OVERRUN, la_head, la_tail, la_readable, 0);
+		rfnm_flight_error(&rfnm_dev->flight, "rx overrun");
+		rfnm_dev_event(rfnm_dev, RFNM_EVT_RX_OVERRUN, 0xff, la_readable);
 		
 		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_1);
 		usleep_range(500, 1000);
@@ -637,21 +1273,21 @@ while(1) {
 	//	printk("readable %d head %d tail %d\n", la_readable, la_head, la_tail);
 	}
 
+	// the rest is left for the next pass, which follows right away
+	rfnm_poll_done(&rfnm_dev->poll[RFNM_POLL_RX], min(la_readable, la_budget), la_readable >= la_budget);
+	rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_RX, RFNM_FL_RX_READ, la_head, la_tail,
+		min(la_readable, la_budget), rfnm_dev->rx_usb_cb.head);
+	la_readable = min(la_readable, la_budget);
+
 	*gpio4 = *gpio4 | (0x1 << 7);
 
 
 	if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_2);
-	if(la_tail + la_readable >= RFNM_ADC_BUFCNT) {
-		dcache_inval_poc((unsigned char *) &rfnm_bufdesc_rx[la_tail], (unsigned char *) &rfnm_bufdesc_rx[RFNM_ADC_BUFCNT/* - 1*/]);
-		dcache_inval_poc((unsigned char *) &rfnm_bufdesc_rx[0], (unsigned char *) &rfnm_bufdesc_rx[la_tail + la_readable + 1 - RFNM_ADC_BUFCNT]);
-		//printk("invalid %d to %d and %d to %d\n", la_tail, RFNM_ADC_BUFCNT, 0, la_tail + la_readable + 1 - RFNM_ADC_BUFCNT);
-	} else {
-		dcache_inval_poc((unsigned char *) &rfnm_bufdesc_rx[la_tail], (unsigned char *) &rfnm_bufdesc_rx[la_tail + la_readable + 1]);
-		//printk("invalid %d to %d \n", la_tail, la_tail + la_readable + 1);
-	}
+	// exactly the buffers read below, the cpu never writes them so they go back to the M7 without a sync
+	rfnm_dma_ring_for_cpu(&rfnm_dev->dma[RFNM_DMA_BUFDESC_RX], sizeof(struct rfnm_bufdesc_rx), RFNM_ADC_BUFCNT, la_tail, la_readable);
 	if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_2);
 	
-	//dcache = (unsigned char *) &rfnm_bufdesc_rx[la_tail];
+	//dcache = (unsigned char *) &rfnm_dev->bufdesc_rx[la_tail];
 	//dcache_inval_poc(dcache, dcache + SZ_64K /*sizeof(struct rfnm_bufdesc_rx)*/);
 	*gpio4 = *gpio4 & ~(0x1 << 7);
 
@@ -662,23 +1298,40 @@ while(1) {
 
 	//kernel_neon_begin();
 
+	struct rfnm_iq_corr rx_corr[4];
+	uint32_t rx_dc_shift = min_t(uint32_t, READ_ONCE(rfnm_dev->rx_dc_shift), RFNM_RX_DC_SHIFT_MAX);
+
+	spin_lock(&rfnm_dev->corr_lock);
+	memcpy(rx_corr, rfnm_dev->rx_corr, sizeof(rx_corr));
+	spin_unlock(&rfnm_dev->corr_lock);
+
 	for(int q = 0; q < la_readable; q++) {
 
 		//*gpio4 = *gpio4 | (0x1 << 5);
 		//*gpio4 = *gpio4 & ~(0x1 << 5);
 
-		uint32_t la_adc_id = smp_load_acquire(&rfnm_bufdesc_rx[la_tail].adc_id);
-		uint32_t la_adc_cc = rfnm_bufdesc_rx[la_tail].cc;
+		uint32_t la_adc_id = smp_load_acquire(&rfnm_dev->bufdesc_rx[la_tail].adc_id);
+		uint32_t la_adc_cc = rfnm_dev->bufdesc_rx[la_tail].cc;
 
 		//printk("la_adc_cc %d adc_buf_cnt %d adc_buf %d head %d\n", 
 		//	la_adc_cc, rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id], rfnm_dev->rx_usb_cb.adc_buf[la_adc_id], rfnm_dev->rx_usb_cb.head);
 
-		if(la_adc_id > 4) {
-			printk("Why is this ADC %d? tail is %d axiq is %d\n", la_adc_id, la_tail, rfnm_bufdesc_rx[la_tail].axiq_done);
+		if(la_adc_id >= 4) {
+			printk("Why is this ADC %d? tail is %d axiq is %d\n", la_adc_id, la_tail, rfnm_dev->bufdesc_rx[la_tail].axiq_done);
 			continue;
 		}
 
 		
+		if(rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id] == RFNM_RX_USB_BUF_MULTI &&
+			rfnm_dev->rx_usb_cb.run_pos[la_adc_id] + 1 < rfnm_dev->rx_usb_cb.run_len[la_adc_id]) {
+			// next buffer of the same run
+			rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id] = 0;
+			rfnm_dev->rx_usb_cb.run_pos[la_adc_id]++;
+			if(++rfnm_dev->rx_usb_cb.adc_buf[la_adc_id] == rfnm_rx_usb_bufcnt) {
+				rfnm_dev->rx_usb_cb.adc_buf[la_adc_id] = 0;
+			}
+		}
+
 		if(rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id] == RFNM_RX_USB_BUF_MULTI) {
 			
 
@@ -686,133 +1339,141 @@ while(1) {
 			
 			
 			#if 0
-			spin_lock(&rfnm_usb_req_buffer_in->list_lock);
-			usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_in->active, struct usb_ep_queue_ele, head);
-			spin_unlock(&rfnm_usb_req_buffer_in->list_lock);
+			spin_lock(&rfnm_dev->req_in[la_adc_id]->list_lock);
+			usb_ep_queue_ele = list_first_entry_or_null(&rfnm_dev->req_in[la_adc_id]->active, struct usb_ep_queue_ele, head);
+			spin_unlock(&rfnm_dev->req_in[la_adc_id]->list_lock);
 
 			if(usb_ep_queue_ele == NULL) {
 				*gpio4 = *gpio4 | (0x1 << 8); *gpio4 = *gpio4 & ~(0x1 << 8);
-				rfnm_stream_stats.usb_rx_error[0]++;
+				rfnm_dev->stream_stats.usb_rx_error[0]++;
 			} else {
-				usb_ep_queue_ele->req->buf = (uint8_t *) &rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]];
+				usb_ep_queue_ele->req->buf = (uint8_t *) &rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]];
 				usb_ep_queue_ele->req->length = sizeof(struct rfnm_rx_usb_buf);
 				kernel_neon_end();
-				rfnm_usb_buffer_done_in(usb_ep_queue_ele);
+				rfnm_usb_buffer_done_in(rfnm_dev, usb_ep_queue_ele, rfnm_dev->req_in[la_adc_id]);
 				kernel_neon_begin();
-				rfnm_stream_stats.usb_rx_ok[0]++;
+				rfnm_dev->stream_stats.usb_rx_ok[0]++;
 			}
 			#else
-			spin_lock(&rfnm_usb_req_buffer_in->list_lock);
-			usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_in->active, struct usb_ep_queue_ele, head);
-			spin_unlock(&rfnm_usb_req_buffer_in->list_lock);
+			rfnm_rx_tap_run(rfnm_dev, rfnm_dev->rx_usb_cb.run_start[la_adc_id], rfnm_dev->rx_usb_cb.run_len[la_adc_id]);
 
-			if(usb_ep_queue_ele == NULL) {
-				*gpio4 = *gpio4 | (0x1 << 8); *gpio4 = *gpio4 & ~(0x1 << 8);
-				rfnm_stream_stats.usb_rx_error[0]++;
+			if(!rfnm_dev->usb) {
+				// no usb function behind this pipeline, the tap is the only consumer
+			} else if(READ_ONCE(rfnm_dev->iso[la_adc_id].chunk)) {
+				// isochronous alt setting, the USB thread slices the run into service intervals
+				rfnm_iso_push_run(rfnm_dev, la_adc_id, rfnm_dev->rx_usb_cb.run_start[la_adc_id], rfnm_dev->rx_usb_cb.run_len[la_adc_id]);
 			} else {
-				usb_ep_queue_ele->req->buf = (uint8_t *) &rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]];
-				usb_ep_queue_ele->req->length = sizeof(struct rfnm_rx_usb_buf);
+				// adc N always streams on in endpoint N
+				spin_lock(&rfnm_dev->req_in[la_adc_id]->list_lock);
+				usb_ep_queue_ele = list_first_entry_or_null(&rfnm_dev->req_in[la_adc_id]->active, struct usb_ep_queue_ele, head);
+				spin_unlock(&rfnm_dev->req_in[la_adc_id]->list_lock);
+
+				if(usb_ep_queue_ele == NULL) {
+					*gpio4 = *gpio4 | (0x1 << 8); *gpio4 = *gpio4 & ~(0x1 << 8);
+					rfnm_dev->stream_stats.usb_rx_error[0]++;
+					rfnm_dev->ep_rx_starved[la_adc_id]++;
+					if(!rfnm_dev->ep_rx_starving[la_adc_id]) {
+						rfnm_dev->ep_rx_starving[la_adc_id] = 1;
+						rfnm_dev_event(rfnm_dev, RFNM_EVT_RX_OVERRUN, la_adc_id, 1);
+					}
+				} else {
+					rfnm_dev->ep_rx_starving[la_adc_id] = 0;
+					rfnm_rx_usb_req_fill(rfnm_dev, usb_ep_queue_ele->req, rfnm_dev->rx_usb_cb.run_start[la_adc_id], rfnm_dev->rx_usb_cb.run_len[la_adc_id]);
 
-				//printk("scheduling\n");
+					//printk("scheduling\n");
 
 
-				//printk("Q %lx\n", usb_ep_queue_ele->req->buf);
+					//printk("Q %lx\n", usb_ep_queue_ele->req->buf);
 				
 					
 
 
 #if 0
 
-		static int delay_wavedetct = 0;
-		static int wavedetect = 0;
+			static int delay_wavedetct = 0;
+			static int wavedetect = 0;
 
-		if(1 || ++delay_wavedetct == 10000) {
-			delay_wavedetct = 0;
+			if(1 || ++delay_wavedetct == 10000) {
+				delay_wavedetct = 0;
 
-			for (int s = 0; s < 50000; s += 768) {
+				for (int s = 0; s < 50000; s += 768) {
 
-				uint32_t *packed;
-				uint32_t lp;
-				int16_t li, lq;
+					uint32_t *packed;
+					uint32_t lp;
+					int16_t li, lq;
 
-				packed = (uint32_t *) (((uint8_t*) usb_ep_queue_ele->req->buf) + 32 + s);
-				lp = *packed;
+					packed = (uint32_t *) (((uint8_t*) usb_ep_queue_ele->req->buf) + 32 + s);
+					lp = *packed;
 
-				li = ((lp & 0xfff000ll) >> 12) << 4;
-				lq = (lp & 0xfff) << 4;
+					li = ((lp & 0xfff000ll) >> 12) << 4;
+					lq = (lp & 0xfff) << 4;
 
-				li = abs(li);
-				lq = abs(lq);
+					li = abs(li);
+					lq = abs(lq);
 				
 
 #if 1
-				if((li + lq) > (150 * 4)) {
-					if(!wavedetect) {
-						wavedetect = 1;
-						printk("Q Y %d %d \t%d\n", lq, li, s);
-					}
+					if((li + lq) > (150 * 4)) {
+						if(!wavedetect) {
+							wavedetect = 1;
+							printk("Q Y %d %d \t%d\n", lq, li, s);
+						}
 					
-				} else if((li + lq) < (20 * 4)){
-					if(wavedetect) {
-						wavedetect = 0;
-						printk("Q N %d %d \t\t%d\n", lq, li, s);
+					} else if((li + lq) < (20 * 4)){
+						if(wavedetect) {
+							wavedetect = 0;
+							printk("Q N %d %d \t\t%d\n", lq, li, s);
+						}
 					}
-				}
 #else
-				printk("%d %d\n", li, lq);
+					printk("%d %d\n", li, lq);
 #endif
+				}
 			}
-		}
 #endif
 
 				
 
 
-				struct usb_ep_queue_ele usb_ep_queue_ele_tmp;
-
-				//usb_ep_queue_ele_tmp = kzalloc(sizeof(struct usb_ep_queue_ele), GFP_KERNEL);
-
-				memcpy(&usb_ep_queue_ele_tmp, usb_ep_queue_ele, sizeof(struct usb_ep_queue_ele ));
-
-				spin_lock(&rfnm_usb_req_buffer_in_usb->list_lock);
-				spin_lock(&rfnm_usb_req_buffer_in->list_lock);
+					rfnm_usb_req_move(usb_ep_queue_ele, rfnm_dev->req_in[la_adc_id], rfnm_dev->req_in_usb[la_adc_id]);
 
-				list_add_tail(&usb_ep_queue_ele->head, &rfnm_usb_req_buffer_in_usb->active);
-
-				list_del(&usb_ep_queue_ele_tmp.head);
-
-				spin_unlock(&rfnm_usb_req_buffer_in->list_lock);
-				spin_unlock(&rfnm_usb_req_buffer_in_usb->list_lock);
-
-				//kfree(usb_ep_queue_ele_tmp);
-
-				//kfree(usb_ep_queue_ele);
+					//kfree(usb_ep_queue_ele);
 
 				
-//kernel_neon_end();
-				wake_up(&wq_usb);
-				//tasklet_schedule(&rfnm_tasklet_usb);
-				//schedule_work(&rfnm_tasklet_usb);
-//kernel_neon_begin();
+	//kernel_neon_end();
+					wake_up(&rfnm_dev->wq_usb);
+					//tasklet_schedule(&rfnm_tasklet_usb);
+					//schedule_work(&rfnm_tasklet_usb);
+	//kernel_neon_begin();
 
-				rfnm_stream_stats.usb_rx_ok[0]++;
+					rfnm_dev->stream_stats.usb_rx_ok[0]++;
+					rfnm_dev->ep_rx_ok[la_adc_id]++;
+				}
 			}
 			#endif
 			
 
 			//spin_lock(&rfnm_dev->rx_usb_cb.reader_lock);
 			
-			rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id] = 0;
-			rfnm_dev->rx_usb_cb.adc_buf[la_adc_id] = rfnm_dev->rx_usb_cb.head;
+			// claim the next run, without sg support it can't wrap around the end of rx_usb_buf
+			uint32_t req_slots = READ_ONCE(rfnm_dev->rx_usb_cb.req_slots);
 
-			if(++rfnm_dev->rx_usb_cb.head == RFNM_RX_USB_BUF_SIZE) {
+			if(!READ_ONCE(rfnm_dev->rx_usb_cb.req_sg) && rfnm_dev->rx_usb_cb.head + req_slots > rfnm_rx_usb_bufcnt) {
 				rfnm_dev->rx_usb_cb.head = 0;
 			}
+
+			rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id] = 0;
+			rfnm_dev->rx_usb_cb.adc_buf[la_adc_id] = rfnm_dev->rx_usb_cb.head;
+			rfnm_dev->rx_usb_cb.run_start[la_adc_id] = rfnm_dev->rx_usb_cb.head;
+			rfnm_dev->rx_usb_cb.run_len[la_adc_id] = req_slots;
+			rfnm_dev->rx_usb_cb.run_pos[la_adc_id] = 0;
+
+			rfnm_dev->rx_usb_cb.head = (rfnm_dev->rx_usb_cb.head + req_slots) % rfnm_rx_usb_bufcnt;
 		}
 #if 1
 		//if(q == 0 && rfnm_dev->rx_usb_cb.adc_buf[la_adc_id] == 0)
 		//printk("adc_buf %d offset %d destbuf %lx srcbuf %lx\n", rfnm_dev->rx_usb_cb.adc_buf[la_adc_id], LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id], 
-		//	&rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]], rfnm_bufdesc_rx[la_tail].buf);
+		//	&rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]], rfnm_dev->bufdesc_rx[la_tail].buf);
 #endif
 #if 0
 
@@ -826,8 +1487,8 @@ while(1) {
 			int16_t *q, *i;
 			uint32_t *t;
 
-			q = (int16_t *) &rfnm_bufdesc_rx[la_tail].buf[0];
-			t = (uint32_t *) &rfnm_bufdesc_rx[la_tail].buf[0];
+			q = (int16_t *) &rfnm_dev->bufdesc_rx[la_tail].buf[0];
+			t = (uint32_t *) &rfnm_dev->bufdesc_rx[la_tail].buf[0];
 
 			int16_t li, lq;
 
@@ -859,9 +1520,30 @@ while(1) {
 #if 1
 		//if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_4);
 		//kernel_neon_begin();
-		rfnm_pack16to12_aarch64_wrapper( (uint8_t *) &rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]], 
-					(uint8_t *) rfnm_bufdesc_rx[la_tail].buf, 
+		if(rx_dc_shift || rx_corr[la_adc_id].enabled) {
+			int16_t dc[2];
+			int64_t sum[2];
+
+			if(rx_dc_shift) {
+				dc[0] = rfnm_rx_dc_get(&rfnm_dev->rx_dc[la_adc_id], 0);
+				dc[1] = rfnm_rx_dc_get(&rfnm_dev->rx_dc[la_adc_id], 1);
+			} else {
+				dc[0] = rx_corr[la_adc_id].dc[0];
+				dc[1] = rx_corr[la_adc_id].dc[1];
+			}
+
+			rfnm_rx_pack_corr( (uint8_t *) &rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]], 
+					(int16_t *) rfnm_dev->bufdesc_rx[la_tail].buf, 
+					LA_RX_BASE_BUFSIZE, &rx_corr[la_adc_id], dc, sum);
+
+			if(rx_dc_shift) {
+				rfnm_rx_dc_update(&rfnm_dev->rx_dc[la_adc_id], sum, LA_RX_BASE_BUFSIZE / 4, rx_dc_shift);
+			}
+		} else {
+		rfnm_pack16to12_aarch64_wrapper( (uint8_t *) &rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]], 
+					(uint8_t *) rfnm_dev->bufdesc_rx[la_tail].buf, 
 					LA_RX_BASE_BUFSIZE / 1);
+		}
 		//kernel_neon_end();
 		//if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_4);	
 
@@ -869,7 +1551,7 @@ while(1) {
 
 #if 0
 	if(rfnm_dev->rx_usb_cb.adc_buf[la_adc_id] == 100)
-	printk("%d %d %d\n", rfnm_dev->rx_usb_cb.adc_buf[la_adc_id], rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id], rfnm_bufdesc_rx[la_tail].cc);
+	printk("%d %d %d\n", rfnm_dev->rx_usb_cb.adc_buf[la_adc_id], rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id], rfnm_dev->bufdesc_rx[la_tail].cc);
 #endif
 
 
@@ -885,7 +1567,7 @@ while(1) {
 			uint32_t lp;
 			int16_t li, lq;
 
-			packed = (uint32_t *) &rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]];
+			packed = (uint32_t *) &rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].buf[LA_RX_BASE_BUFSIZE_12 * rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]];
 			lp = *packed;
 
 			li = ((lp & 0xfff000ll) >> 12) << 4;
@@ -917,35 +1599,38 @@ while(1) {
 
 
 		if(!rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]) {
-			rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].magic = 0x7ab8bd6f;
-			rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].phytimer = rfnm_bufdesc_rx[la_tail].phytimer;
-			rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].usb_cc = ++rfnm_dev->rx_usb_cb.usb_cc[la_adc_id];
-			rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].adc_id = la_adc_id;
-			rfnm_rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].adc_cc = la_adc_cc;
+			if(la_adc_id < RFNM_EP_CNT && READ_ONCE(rfnm_dev->rx_cc_resync[la_adc_id])) {
+				// what was in flight on the recovered endpoint is gone, the host starts over
+				WRITE_ONCE(rfnm_dev->rx_cc_resync[la_adc_id], 0);
+				rfnm_dev->rx_usb_cb.usb_cc[la_adc_id] = 0;
+			}
+			rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].magic = 0x7ab8bd6f;
+			rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].phytimer = rfnm_dev->bufdesc_rx[la_tail].phytimer;
+			rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].usb_cc = ++rfnm_dev->rx_usb_cb.usb_cc[la_adc_id];
+			rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].adc_id = la_adc_id;
+			rfnm_dev->rx_usb_buf[rfnm_dev->rx_usb_cb.adc_buf[la_adc_id]].adc_cc = la_adc_cc;
 		}
 
 
 			
 		
-		if(rfnm_dev->rx_la_cb.adc_cc[la_adc_id] != la_adc_cc) {
+		uint32_t la_adc_cc_expect = rfnm_dev->rx_la_cb.adc_cc[la_adc_id];
+
+		if(rfnm_ring_rx_cc(&rfnm_dev->rx_la_cb.adc_cc[la_adc_id], la_adc_cc)) {
+			rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_RX, RFNM_FL_RX_CC, la_adc_id, la_adc_cc_expect, la_adc_cc, la_tail);
+			rfnm_flight_error(&rfnm_dev->flight, "rx cc mismatch");
 #if 0
 			printk("cc mismatch on adc %d -> %d vs %d tail is %d axiq is %d | adc_buf_cnt %d adc_buf %d head %d\n", la_adc_id, 
 				la_adc_cc, rfnm_dev->rx_la_cb.adc_cc[la_adc_id], 
-				la_tail, rfnm_bufdesc_rx[la_tail].axiq_done,
+				la_tail, rfnm_dev->bufdesc_rx[la_tail].axiq_done,
 				rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id], rfnm_dev->rx_usb_cb.adc_buf[la_adc_id], rfnm_dev->rx_usb_cb.head);
 #endif
-			rfnm_dev->rx_la_cb.adc_cc[la_adc_id] = la_adc_cc;
-
-			rfnm_stream_stats.la_adc_error[la_adc_id]++;
+			rfnm_dev->stream_stats.la_adc_error[la_adc_id]++;
 		} else {
-			rfnm_stream_stats.la_adc_ok[la_adc_id]++;
+			rfnm_dev->stream_stats.la_adc_ok[la_adc_id]++;
 		}
-		//la_adc_cc++;
-		rfnm_dev->rx_la_cb.adc_cc[la_adc_id]++;
 
-		if(++la_tail == RFNM_ADC_BUFCNT) {
-			la_tail = 0;
-		}
+		la_tail = rfnm_ring_next(RFNM_ADC_BUFCNT, la_tail);
 
 		rfnm_dev->rx_usb_cb.adc_buf_cnt[la_adc_id]++;
 	}
@@ -957,12 +1642,12 @@ while(1) {
 
 	rfnm_dev->rx_la_cb.tail = la_tail;
 
-	rfnm_m7_status->kernel_cache_flush_tail = la_tail;
+	rfnm_dev->m7_status->kernel_cache_flush_tail = la_tail;
 
 	
 	
 
-	//printk("head is at %d\n", rfnm_m7_status->rx_head);
+	//printk("head is at %d\n", rfnm_dev->m7_status->rx_head);
 
 exit_tasklet: 
 	//spin_unlock(&rfnm_dev->rx_usb_cb.reader_lock);
@@ -986,14 +1671,8 @@ exit_tasklet_no_unlock:
 }
 
 
-int can_run_handler_out(void) {
-	struct usb_ep_queue_ele *usb_ep_queue_ele;
-
-	spin_lock(&rfnm_usb_req_buffer_out->list_lock);
-	usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_out->active, struct usb_ep_queue_ele, head);
-	spin_unlock(&rfnm_usb_req_buffer_out->list_lock);
-
-	return usb_ep_queue_ele != NULL;
+int can_run_handler_out(struct rfnm_dev *rfnm_dev) {
+	return !rfnm_usb_req_empty(rfnm_dev->req_out[RFNM_TX_EP]);
 }
 
 static int rfnm_order_tx_usb_buf(void *priv, const struct list_head *a, const struct list_head *b) {
@@ -1041,25 +1720,60 @@ static int rfnm_order_tx_usb_buf(void *priv, const struct list_head *a, const st
 
 //static void rfnm_tasklet_handler_out(unsigned long tasklet_data) {
  int rfnm_handler_out(void * tasklet_data) {
+	struct rfnm_dev *rfnm_dev = tasklet_data;
 //void rfnm_handler_out(struct work_struct * tasklet_data) {
 
 
+	uint32_t tx_done = 0;
+
 	while(1) {
 
 	//	wait_event(wq_out, can_run_handler_out());
 
 
+		rfnm_epoch_park(rfnm_dev, RFNM_POLL_TX, &rfnm_dev->wq_stop_out);
+
 		struct usb_ep_queue_ele *usb_ep_queue_ele;
+		uint32_t tx_budget;
 again:
 		uint32_t list_size = 0;
 		int cc_is_continuous = 0;
+		uint32_t tx_factor = 1;
+		struct rfnm_tx_interp *interp;
+
+		if(rfnm_dev->tx_interp_update) {
+			struct rfnm_tx_interp *old;
 
-		spin_lock(&rfnm_usb_req_buffer_out->list_lock);
-		list_sort(NULL, &rfnm_usb_req_buffer_out->active, rfnm_order_tx_usb_buf);
-		usb_ep_queue_ele = list_first_entry_or_null(&rfnm_usb_req_buffer_out->active, struct usb_ep_queue_ele, head);
+			spin_lock(&rfnm_dev->tx_interp_lock);
+			old = rfnm_dev->tx_interp;
+			rfnm_dev->tx_interp = rfnm_dev->tx_interp_next;
+			rfnm_dev->tx_interp_next = NULL;
+			rfnm_dev->tx_interp_update = 0;
+			spin_unlock(&rfnm_dev->tx_interp_lock);
+
+			rfnm_tx_interp_free(old);
+		}
+
+		interp = rfnm_dev->tx_interp;
+		if(interp) {
+			tx_factor = interp->factor;
+		}
+
+		tx_budget = rfnm_poll_budget(&rfnm_dev->poll[RFNM_POLL_TX]);
+
+		// the stream carries a single dac for now
+		struct rfnm_iq_corr tx_corr;
+
+		spin_lock(&rfnm_dev->corr_lock);
+		tx_corr = rfnm_dev->tx_corr[0];
+		spin_unlock(&rfnm_dev->corr_lock);
+
+		spin_lock(&rfnm_dev->req_out[RFNM_TX_EP]->list_lock);
+		list_sort(NULL, &rfnm_dev->req_out[RFNM_TX_EP]->active, rfnm_order_tx_usb_buf);
+		usb_ep_queue_ele = list_first_entry_or_null(&rfnm_dev->req_out[RFNM_TX_EP]->active, struct usb_ep_queue_ele, head);
 		
-		list_size = list_count_nodes(&rfnm_usb_req_buffer_out->active);
-		spin_unlock(&rfnm_usb_req_buffer_out->list_lock);
+		list_size = list_count_nodes(&rfnm_dev->req_out[RFNM_TX_EP]->active);
+		spin_unlock(&rfnm_dev->req_out[RFNM_TX_EP]->list_lock);
 
 		
 
@@ -1075,20 +1789,18 @@ again:
 
 		if( (list_size > 8 && usb_ep_queue_ele != NULL) || (cc_is_continuous) ) {
 
-			uint32_t la_tail = rfnm_m7_status->tx_buf_id;
+			uint32_t la_tail = rfnm_dev->m7_status->tx_buf_id;
 			uint32_t la_head = rfnm_dev->tx_la_cb.head;
 
 			barrier();
 
 			uint32_t la_writable, la_margin;
-			
-			if(la_tail < la_head) {
-				la_writable = RFNM_DAC_BUFCNT - la_head + la_tail;
-			} else {
-				la_writable = la_tail - la_head;
-			}
+			enum rfnm_ring_tx_act la_act;
 
-			la_margin = RFNM_DAC_BUFCNT - la_writable;
+			la_act = rfnm_ring_tx_poll(RFNM_DAC_BUFCNT, la_tail, &rfnm_dev->tx_la_cb.head,
+						RFNM_TX_USB_BUF_MULTI * tx_factor, &la_writable);
+			// on UNDERRUN and LATENCY the count is the margin
+			la_margin = la_writable;
 /*
 [ 1881.458194] tx too many buffers behind ... tail 1001 head 8507 writable (8878)
 [ 1882.073539] tx too many buffers behind ... tail 9306 head 12265 writable (13425)
@@ -1103,26 +1815,16 @@ rfnm_tx_la_cb
 
 */
 
-			int max_latency = 4500;
-
-
-			if(la_margin < 20) {
-			//if(la_writable < 20 || la_writable > (RFNM_DAC_BUFCNT - 20)) {
-				// too many buffers behind, log error and jump forward
-				rfnm_dev->tx_la_cb.head = rfnm_m7_status->tx_buf_id + (max_latency/3);
-				if(rfnm_dev->tx_la_cb.head >= RFNM_DAC_BUFCNT) {
-					rfnm_dev->tx_la_cb.head -= RFNM_DAC_BUFCNT;
-				}
-
-				if(rfnm_dev->tx_la_cb.head < 0) {
-					printk("why is head < 0 lol was %d\n",  rfnm_m7_status->tx_buf_id); 
-					while(1) {mdelay(1);}
-				}
-
-				printk("tx too many buffers behind ... tail %d head %d writable (%d) new head %d txid %d\n", 
-					la_tail, la_head, la_writable, rfnm_dev->tx_la_cb.head, rfnm_m7_status->tx_buf_id);
-				rfnm_stream_stats.usb_tx_error[0]++;
-				//rfnm_stream_stats.la_dac_error[0]++;
+			if(la_act == RFNM_RING_TX_UNDERRUN) {
+				// too many buffers behind, logged here, head already jumped forward
+				printk_ratelimited("tx too many buffers behind ... tail %d head %d margin (%d) new head %d txid %d\n", 
+					la_tail, la_head, la_margin, rfnm_dev->tx_la_cb.head, rfnm_dev->m7_status->tx_buf_id);
+				rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_TX, RFNM_FL_TX_UNDERRUN, la_tail, la_head,
+					la_margin, rfnm_dev->tx_la_cb.head);
+				rfnm_flight_error(&rfnm_dev->flight, "tx underrun");
+				rfnm_dev->stream_stats.usb_tx_error[0]++;
+				rfnm_dev_event(rfnm_dev, RFNM_EVT_TX_UNDERRUN, 0, la_margin);
+				//rfnm_dev->stream_stats.la_dac_error[0]++;
 				continue;
 				//usleep_range(500, 1000);
 				//goto exit_tasklet;
@@ -1130,25 +1832,20 @@ rfnm_tx_la_cb
 
 			
 
-			if(la_margin > (max_latency)) {
-				// too many buffers behind, log error and jump forward
-				rfnm_dev->tx_la_cb.head = rfnm_m7_status->tx_buf_id + (max_latency/3);
-				if(rfnm_dev->tx_la_cb.head >= RFNM_DAC_BUFCNT) {
-					rfnm_dev->tx_la_cb.head -= RFNM_DAC_BUFCNT;
-				}
-
-				printk("reducing tx latency ... tail %d head %d writable (%d) new head %d txid %d\n", 
-					la_tail, la_head, la_writable, rfnm_dev->tx_la_cb.head, rfnm_m7_status->tx_buf_id);
-				rfnm_stream_stats.usb_tx_error[0]++;
-				continue;
-			}
-
-			if(la_writable < RFNM_TX_USB_BUF_MULTI) {
+			if(la_act == RFNM_RING_TX_LATENCY) {
+				printk_ratelimited("reducing tx latency ... tail %d head %d margin (%d) new head %d txid %d\n", 
+					la_tail, la_head, la_margin, rfnm_dev->tx_la_cb.head, rfnm_dev->m7_status->tx_buf_id);
+				rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_TX, RFNM_FL_TX_LATENCY, la_tail, la_head,
+					la_margin, rfnm_dev->tx_la_cb.head);
+				rfnm_dev->stream_stats.usb_tx_error[0]++;
+				rfnm_dev_event(rfnm_dev, RFNM_EVT_LATENCY, 0, la_margin);
 				continue;
 			}
 
-			if(la_writable > RFNM_TX_USB_BUF_MULTI) {
-				la_writable = RFNM_TX_USB_BUF_MULTI;
+			// each usb chunk expands to tx_factor dac buffers, la_writable is capped to one
+			if(la_act == RFNM_RING_TX_WAIT) {
+				// no room until the M7 plays some out, which raises nothing
+				goto tx_pass_end;
 			}
 
 			dcache_inval_poc(usb_ep_queue_ele->req->buf, usb_ep_queue_ele->req->buf + usb_ep_queue_ele->req->length);
@@ -1156,19 +1853,29 @@ rfnm_tx_la_cb
 			struct rfnm_tx_usb_buf *lb = usb_ep_queue_ele->req->buf;
 
 
-			if(lb->usb_cc != rfnm_dev->tx_la_cb.usb_cc) {
-				printk("usb cc error %d vs %d .. tail %d head %d writable (%d) list %d\n", lb->usb_cc, rfnm_dev->tx_la_cb.usb_cc, la_tail, la_head, la_writable, list_size);
-				rfnm_stream_stats.usb_tx_error[0]++;
+			if(READ_ONCE(rfnm_dev->tx_cc_resync)) {
+				// buffers in flight during an endpoint recovery are gone, start over from here
+				WRITE_ONCE(rfnm_dev->tx_cc_resync, 0);
 				rfnm_dev->tx_la_cb.usb_cc = lb->usb_cc;
 			}
 
-			rfnm_dev->tx_la_cb.usb_cc++;
+			int64_t cc_gap = rfnm_ring_tx_cc(&rfnm_dev->tx_la_cb.usb_cc, lb->usb_cc);
+
+			rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_TX, RFNM_FL_TX_WRITE, la_tail, la_head, lb->usb_cc, list_size);
+
+			if(cc_gap) {
+				printk_ratelimited("usb cc error %d gap %lld .. tail %d head %d writable (%d) list %d\n", lb->usb_cc, cc_gap, la_tail, la_head, la_writable, list_size);
+				rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_TX, RFNM_FL_TX_CC, lb->usb_cc, cc_gap, la_head, list_size);
+				rfnm_flight_error(&rfnm_dev->flight, "tx cc gap");
+				rfnm_dev->stream_stats.usb_tx_error[0]++;
+				rfnm_dev_event(rfnm_dev, RFNM_EVT_TX_CC_GAP, 0, cc_gap);
+			}
 
 
 
 			
 
-			//rfnm_stream_stats.la_dac_ok[0]++;
+			//rfnm_dev->stream_stats.la_dac_ok[0]++;
 
 				//printk("tail %d head %d writable (%d)\n", la_tail, la_head, la_writable);
 
@@ -1177,27 +1884,54 @@ rfnm_tx_la_cb
 
 			//printk("magic is %x\n", lb->magic); 0x758f4d4a
 
-			for(int w = 0; w < la_writable; w++) {
+			for(int w = 0; w < RFNM_TX_USB_BUF_MULTI; w++) {
+
+				if(interp) {
+					rfnm_unpack12to16_aarch64_wrapper( 
+								(uint8_t *) rfnm_tx_interp_input(interp),
+								(uint8_t *) &lb->buf[ w * LA_TX_BASE_BUFSIZE_12 ],
+								LA_TX_BASE_BUFSIZE);
+
+					for(int p = 0; p < tx_factor; p++) {
+						rfnm_tx_interp_run(interp, (int16_t *) rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].buf, p, &tx_corr);
+
+						rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].cc = rfnm_dev->tx_la_cb.dac_cc++;
+
+						if(++rfnm_dev->tx_la_cb.head == RFNM_DAC_BUFCNT) {
+							rfnm_dev->tx_la_cb.head = 0;
+						}
+					}
+
+					rfnm_tx_interp_advance(interp);
+					continue;
+				}
 				//
 				// LA_TX_BASE_BUFSIZE_12 * RFNM_TX_USB_BUF_MULTI
 #if 1
+				if(tx_corr.enabled) {
+					rfnm_tx_unpack_corr( 
+							(int16_t *) rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
+							(uint8_t *) &lb->buf[ w * LA_TX_BASE_BUFSIZE_12 ],
+							LA_TX_BASE_BUFSIZE, &tx_corr);
+				} else {
 				//kernel_neon_begin();
 				rfnm_unpack12to16_aarch64_wrapper( 
-							(uint8_t *) rfnm_bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
+							(uint8_t *) rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
 							(uint8_t *) &lb->buf[ w * LA_TX_BASE_BUFSIZE_12 ],
 							LA_TX_BASE_BUFSIZE);
 				//kernel_neon_end();
+				}
 #endif
 
 #if 0
 				memcpy( 
-							(uint8_t *) rfnm_bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
+							(uint8_t *) rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
 							(uint8_t *) &lb->buf[ w * LA_TX_BASE_BUFSIZE_12 ],
 							LA_TX_BASE_BUFSIZE);
 #endif
-				rfnm_bufdesc_tx[rfnm_dev->tx_la_cb.head].cc = rfnm_dev->tx_la_cb.dac_cc++;
+				rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].cc = rfnm_dev->tx_la_cb.dac_cc++;
 
-				//printk("%lx %lx -> %lx\n", (uint8_t *) rfnm_bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
+				//printk("%lx %lx -> %lx\n", (uint8_t *) rfnm_dev->bufdesc_tx[rfnm_dev->tx_la_cb.head].buf,
 				//			(uint8_t *) &lb->buf[ w * LA_TX_BASE_BUFSIZE_12 ], lb->buf[ w * LA_TX_BASE_BUFSIZE_12 ]);
 
 				if(++rfnm_dev->tx_la_cb.head == RFNM_DAC_BUFCNT) {
@@ -1208,12 +1942,8 @@ rfnm_tx_la_cb
 
 
 			if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_4);
-			if(la_head + la_writable >= RFNM_DAC_BUFCNT) {
-				dcache_clean_poc((unsigned char *) &rfnm_bufdesc_tx[la_head], (unsigned char *) &rfnm_bufdesc_tx[RFNM_DAC_BUFCNT/* - 1*/]);
-				dcache_clean_poc((unsigned char *) &rfnm_bufdesc_tx[0], (unsigned char *) &rfnm_bufdesc_tx[la_head + la_writable - RFNM_DAC_BUFCNT + 1]);
-			} else {
-				dcache_clean_poc((unsigned char *) &rfnm_bufdesc_tx[la_head], (unsigned char *) &rfnm_bufdesc_tx[la_head + la_writable + 1]);
-			}
+			// with tx_wc only drains the write-combining buffers
+			rfnm_dma_ring_for_device(&rfnm_dev->dma[RFNM_DMA_BUFDESC_TX], sizeof(struct rfnm_bufdesc_tx), RFNM_DAC_BUFCNT, la_head, la_writable);
 			if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_4);
 			
 
@@ -1226,40 +1956,36 @@ rfnm_tx_la_cb
 
 
 #if 1
-			struct usb_ep_queue_ele usb_ep_queue_ele_tmp;
-
-			memcpy(&usb_ep_queue_ele_tmp, usb_ep_queue_ele, sizeof(struct usb_ep_queue_ele));
-
-			spin_lock(&rfnm_usb_req_buffer_out_usb->list_lock);
-			spin_lock(&rfnm_usb_req_buffer_out->list_lock);
-
-			list_add_tail(&usb_ep_queue_ele->head, &rfnm_usb_req_buffer_out_usb->active);
-			
-			list_del(&usb_ep_queue_ele_tmp.head);
+			// back to the queue of the endpoint it came from
+			rfnm_usb_req_move(usb_ep_queue_ele, rfnm_dev->req_out[RFNM_TX_EP],
+				rfnm_dev->req_out_usb[rfnm_usb_req_ep(usb_ep_queue_ele)]);
 
-			spin_unlock(&rfnm_usb_req_buffer_out_usb->list_lock);
-			spin_unlock(&rfnm_usb_req_buffer_out->list_lock);
-
-			wake_up(&wq_usb);
+			wake_up(&rfnm_dev->wq_usb);
 #else		
-			rfnm_usb_buffer_done_out(usb_ep_queue_ele);
+			rfnm_usb_buffer_done_out(rfnm_dev, usb_ep_queue_ele, rfnm_dev->req_out[RFNM_TX_EP]);
 #endif
 
-			rfnm_stream_stats.usb_tx_ok[0]++;
-			goto again;
+			rfnm_dev->stream_stats.usb_tx_ok[0]++;
+			if(++tx_done < tx_budget) {
+				goto again;
+			}
 		}
 
+tx_pass_end:
 		if(rfnm_dev->wq_stop_out) {
 			printk("stopping OUT process\n");
 			rfnm_dev->wq_stop_out = 0;
 			do_exit(0);
 		}
 
-		
-		
+		if(rfnm_poll_done(&rfnm_dev->poll[RFNM_POLL_TX], tx_done, tx_done >= tx_budget)) {
+			tx_done = 0;
+			continue;
+		}
+		tx_done = 0;
 		
 		if(GPIO_DEBUG) rfnm_gpio_clear(0, RFNM_DGB_GPIO4_3);
-		usleep_range(500, 1000);
+		rfnm_poll_idle(rfnm_dev, &rfnm_dev->poll[RFNM_POLL_TX], rfnm_dev->wq_out, rfnm_dev->wq_stop_out);
 		if(GPIO_DEBUG) rfnm_gpio_set(0, RFNM_DGB_GPIO4_3);
 	}
 		
@@ -1307,6 +2033,7 @@ int rfnm_callback_deinit(void)
 
 static void rfnm_submit_usb_req_in(struct usb_ep *ep, struct usb_request *req)
 {
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
 	struct usb_composite_dev	*cdev;
 	struct f_sourcesink		*ss = ep->driver_data;
 	int				status = req->status;
@@ -1317,12 +2044,15 @@ static void rfnm_submit_usb_req_in(struct usb_ep *ep, struct usb_request *req)
 
 	//*gpio4 = *gpio4 | (0x1 << 1); *gpio4 = *gpio4 & ~(0x1 << 1);
 
+	rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_USB, RFNM_FL_USB_IN, RFNM_EP_CTX_TO_ID(req->context),
+		status, req->actual, rfnm_dev->usb_done[RFNM_EP_DIR_IN]);
 
 	switch (status) {
 
 	case 0:				/* normal completion? */
 
-		rfnm_ep_stats[RFNM_USB_EP_OK]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_OK]++;
+		rfnm_dev->usb_done[RFNM_EP_DIR_IN]++;
 		//printk("req->length %d\n", req->length);
 
 		//if (ep == ss->out_ep[0]) {
@@ -1332,12 +2062,20 @@ static void rfnm_submit_usb_req_in(struct usb_ep *ep, struct usb_request *req)
 		//}
 		break;
 
+	case -EXDEV:			/* isochronous interval missed */
+		rfnm_dev->ep_stats[RFNM_USB_EP_ISO_MISSED]++;
+		break;
+
 	/* this endpoint is normally active while we're configured */
-	case -ECONNABORTED:		/* hardware forced ep reset */
 	case -ECONNRESET:		/* request dequeued */
+		// only endpoint recovery dequeues, the request goes back to the free queue
+		rfnm_dev->ep_stats[RFNM_USB_EP_RECOVERED]++;
+		break;
+
+	case -ECONNABORTED:		/* hardware forced ep reset */
 	case -ESHUTDOWN:		/* disconnect from host */
 		printk("%s dead (%d), %d/%d\n", ep->name, status, req->actual, req->length);
-		rfnm_ep_stats[RFNM_USB_EP_DEAD]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_DEAD]++;
 
 		//if (ep == ss->out_ep[0])
 			//check_read_data(ss, req);
@@ -1348,33 +2086,45 @@ static void rfnm_submit_usb_req_in(struct usb_ep *ep, struct usb_request *req)
 					 * we didn't provide a big enough
 					 * buffer.
 					 */
-		rfnm_ep_stats[RFNM_USB_EP_OVERFLOW]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_OVERFLOW]++;
 		printk( "%s EOVERFLOW (%d), %d/%d\n", ep->name, status, req->actual, req->length);
 
 	default:
 #if 1
-		rfnm_ep_stats[RFNM_USB_EP_DEFAULT]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_DEFAULT]++;
 		printk("%s complete --> %d, %d/%d\n", ep->name, status, req->actual, req->length);
+		rfnm_flight_error(&rfnm_dev->flight, "usb completion error");
 		break;
 #endif
 	case -EREMOTEIO:		/* short read */
-		rfnm_ep_stats[RFNM_USB_EP_REMOTEIO]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_REMOTEIO]++;
 		printk( "%s short read (%d), %d/%d\n", ep->name, status, req->actual, req->length);
+		rfnm_flight_error(&rfnm_dev->flight, "usb completion error");
 		break;
 	}
 #if 1
 	struct usb_ep_queue_ele *new_ele;
 
-	new_ele = kzalloc(sizeof(struct usb_ep_queue_ele), GFP_KERNEL);
+	new_ele = kzalloc(sizeof(struct usb_ep_queue_ele), GFP_ATOMIC);
 	new_ele->ep = ep;
 	new_ele->req = req;
 	//new_ele->dwc_queue_sent = 0;
 
 	unsigned long flags;
+	int ep_id = RFNM_EP_CTX_TO_ID(req->context);
+
+	if(ep_id < 0 || ep_id >= RFNM_EP_CNT) {
+		ep_id = 0;
+	}
+
+	spin_lock_irqsave(&rfnm_dev->req_in[ep_id]->list_lock, flags);
+	list_add_tail(&new_ele->head, &rfnm_dev->req_in[ep_id]->active);
+	spin_unlock_irqrestore(&rfnm_dev->req_in[ep_id]->list_lock, flags);
 
-	spin_lock_irqsave(&rfnm_usb_req_buffer_in->list_lock, flags);
-	list_add_tail(&new_ele->head, &rfnm_usb_req_buffer_in->active);
-	spin_unlock_irqrestore(&rfnm_usb_req_buffer_in->list_lock, flags);
+	if(READ_ONCE(rfnm_dev->iso[ep_id].chunk)) {
+		// isochronous requests are handed out by the USB thread, not the RX thread
+		wake_up(&rfnm_dev->wq_usb);
+	}
 
 	//static int wg_delay = 0;
 
@@ -1394,7 +2144,7 @@ status = usb_ep_queue(ep, req, GFP_ATOMIC);
 #endif
 
 	// actual was working before... what changed?
-	rfnm_stream_stats.usb_rx_bytes[0] += req->actual;
+	rfnm_dev->stream_stats.usb_rx_bytes[0] += req->actual;
 
 
 
@@ -1419,9 +2169,11 @@ EXPORT_SYMBOL_GPL(rfnm_submit_usb_req_in);
 
 static void rfnm_submit_usb_req_out(struct usb_ep *ep, struct usb_request *req)
 {
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
 	struct usb_composite_dev	*cdev;
 	struct f_sourcesink		*ss = ep->driver_data;
 	int				status = req->status;
+	int				requeue = 0;
 
 	/* driver_data will be null if ep has been disabled */
 	if (!ss)
@@ -1429,12 +2181,15 @@ static void rfnm_submit_usb_req_out(struct usb_ep *ep, struct usb_request *req)
 
 	//*gpio4 = *gpio4 | (0x1 << 1); *gpio4 = *gpio4 & ~(0x1 << 1);
 
+	rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_USB, RFNM_FL_USB_OUT, RFNM_EP_CTX_TO_ID(req->context),
+		status, req->actual, rfnm_dev->usb_done[RFNM_EP_DIR_OUT]);
 
 	switch (status) {
 
 	case 0:				/* normal completion? */
 
-		rfnm_ep_stats[RFNM_USB_EP_OK]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_OK]++;
+		rfnm_dev->usb_done[RFNM_EP_DIR_OUT]++;
 		//printk("req->length %d\n", req->length);
 
 		//if (ep == ss->out_ep[0]) {
@@ -1445,11 +2200,16 @@ static void rfnm_submit_usb_req_out(struct usb_ep *ep, struct usb_request *req)
 		break;
 
 	/* this endpoint is normally active while we're configured */
-	case -ECONNABORTED:		/* hardware forced ep reset */
 	case -ECONNRESET:		/* request dequeued */
+		// only endpoint recovery dequeues, the request has no data and is queued again
+		rfnm_dev->ep_stats[RFNM_USB_EP_RECOVERED]++;
+		requeue = 1;
+		break;
+
+	case -ECONNABORTED:		/* hardware forced ep reset */
 	case -ESHUTDOWN:		/* disconnect from host */
 		printk("%s dead (%d), %d/%d\n", ep->name, status, req->actual, req->length);
-		rfnm_ep_stats[RFNM_USB_EP_DEAD]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_DEAD]++;
 
 		//if (ep == ss->out_ep[0])
 			//check_read_data(ss, req);
@@ -1460,47 +2220,64 @@ static void rfnm_submit_usb_req_out(struct usb_ep *ep, struct usb_request *req)
 					 * we didn't provide a big enough
 					 * buffer.
 					 */
-		rfnm_ep_stats[RFNM_USB_EP_OVERFLOW]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_OVERFLOW]++;
 		printk( "%s EOVERFLOW (%d), %d/%d\n", ep->name, status, req->actual, req->length);
 
 	default:
 #if 1
-		rfnm_ep_stats[RFNM_USB_EP_DEFAULT]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_DEFAULT]++;
 		printk("%s complete --> %d, %d/%d\n", ep->name, status, req->actual, req->length);
+		rfnm_flight_error(&rfnm_dev->flight, "usb completion error");
 		break;
 #endif
 	case -EREMOTEIO:		/* short read */
-		rfnm_ep_stats[RFNM_USB_EP_REMOTEIO]++;
+		rfnm_dev->ep_stats[RFNM_USB_EP_REMOTEIO]++;
 		printk( "%s short read (%d), %d/%d\n", ep->name, status, req->actual, req->length);
+		rfnm_flight_error(&rfnm_dev->flight, "usb completion error");
 		break;
 	}
 #if 1
 	struct usb_ep_queue_ele *new_ele;
 	struct rfnm_tx_usb_buf *lb = req->buf;
 
-	new_ele = kzalloc(sizeof(struct usb_ep_queue_ele), GFP_KERNEL);
+	new_ele = kzalloc(sizeof(struct usb_ep_queue_ele), GFP_ATOMIC);
 	new_ele->ep = ep;
 	new_ele->req = req;
 	new_ele->usb_cc = lb->usb_cc;
 	//new_ele->dwc_queue_sent = 0;
 
 	unsigned long flags;
+	int ep_id = RFNM_EP_CTX_TO_ID(req->context);
+
+	if(ep_id < 0 || ep_id >= RFNM_EP_CNT) {
+		ep_id = RFNM_TX_EP;
+	}
 
-	spin_lock_irqsave(&rfnm_usb_req_buffer_out->list_lock, flags);
-	list_add_tail(&new_ele->head, &rfnm_usb_req_buffer_out->active);
-	spin_unlock_irqrestore(&rfnm_usb_req_buffer_out->list_lock, flags);
+	if(requeue) {
+		// no data after recovery, hand the request straight back
+		spin_lock_irqsave(&rfnm_dev->req_out_usb[ep_id]->list_lock, flags);
+		list_add_tail(&new_ele->head, &rfnm_dev->req_out_usb[ep_id]->active);
+		spin_unlock_irqrestore(&rfnm_dev->req_out_usb[ep_id]->list_lock, flags);
+		wake_up(&rfnm_dev->wq_usb);
+		return;
+	}
 
+	// all out endpoints share the dac ring, the TX thread puts the chunks in usb_cc order
+	rfnm_dev->ep_tx_ok[ep_id]++;
+	spin_lock_irqsave(&rfnm_dev->req_out[RFNM_TX_EP]->list_lock, flags);
+	list_add_tail(&new_ele->head, &rfnm_dev->req_out[RFNM_TX_EP]->active);
+	spin_unlock_irqrestore(&rfnm_dev->req_out[RFNM_TX_EP]->list_lock, flags);
 
-	//wake_up(&wq_out);
+	rfnm_poll_kick(&rfnm_dev->poll[RFNM_POLL_TX], &rfnm_dev->wq_out);
 	//tasklet_schedule(&rfnm_tasklet_out);
 	//schedule_work(&rfnm_tasklet_out);
 
 	// actual was working before... what changed?
-	rfnm_stream_stats.usb_tx_bytes[0] += req->actual;
+	rfnm_dev->stream_stats.usb_tx_bytes[0] += req->actual;
 #else
 
 	// actual was working before... what changed?
-	rfnm_stream_stats.usb_tx_bytes[0] += req->actual;
+	rfnm_dev->stream_stats.usb_tx_bytes[0] += req->actual;
 
 	status = usb_ep_queue(ep, req, GFP_ATOMIC);
 	if (status) {
@@ -1545,14 +2322,16 @@ EXPORT_SYMBOL_GPL(rfnm_submit_usb_req_out);
 
 
 void rfnm_populate_dev_status(struct rfnm_dev_status * r_stat) {
-	memcpy(&r_stat->stream_stats, &rfnm_stream_stats, sizeof(struct rfnm_stream_stats));
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
+
+	memcpy(&r_stat->stream_stats, &rfnm_dev->stream_stats, sizeof(struct rfnm_stream_stats));
 
-	//memcpy(&r_stat->m7_status, (uint8_t *) rfnm_m7_status, sizeof(struct rfnm_m7_status));	
+	//memcpy(&r_stat->m7_status, (uint8_t *) rfnm_dev->m7_status, sizeof(struct rfnm_m7_status));	
 	// kazan freezes during this memcpy -- just copy it over manually
 
-	r_stat->m7_status.tx_buf_id = rfnm_m7_status->tx_buf_id;
-	r_stat->m7_status.rx_head = rfnm_m7_status->rx_head;
-	r_stat->m7_status.kernel_cache_flush_tail = rfnm_m7_status->kernel_cache_flush_tail;
+	r_stat->m7_status.tx_buf_id = rfnm_dev->m7_status->tx_buf_id;
+	r_stat->m7_status.rx_head = rfnm_dev->m7_status->rx_head;
+	r_stat->m7_status.kernel_cache_flush_tail = rfnm_dev->m7_status->kernel_cache_flush_tail;
 	
 	// cc is advanced by an extra element from the main loop
 	if(rfnm_dev->tx_la_cb.usb_cc > 0) {
@@ -1564,132 +2343,239 @@ void rfnm_populate_dev_status(struct rfnm_dev_status * r_stat) {
 }
 EXPORT_SYMBOL(rfnm_populate_dev_status);
 
+// called by the usb function on set_alt, picked up by the RX thread at the next run
+void rfnm_stream_set_rx_req_size(uint32_t bytes, int sg_supported) {
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
+	uint32_t slots = bytes / sizeof(struct rfnm_rx_usb_buf);
+
+	if(bytes % sizeof(struct rfnm_rx_usb_buf)) {
+		printk("rx usb request size %u is not a multiple of %d\n", bytes, (int) sizeof(struct rfnm_rx_usb_buf));
+	}
+
+	if(slots < 1) {
+		slots = 1;
+	}
+	if(slots > RFNM_RX_REQ_SLOTS_MAX) {
+		slots = RFNM_RX_REQ_SLOTS_MAX;
+	}
+
+	printk("rx usb request %d buffers (%d bytes)%s\n", slots, slots * (int) sizeof(struct rfnm_rx_usb_buf), sg_supported ? " sg" : "");
+
+	WRITE_ONCE(rfnm_dev->rx_usb_cb.req_sg, sg_supported && slots > 1);
+	WRITE_ONCE(rfnm_dev->rx_usb_cb.req_slots, slots);
+}
+EXPORT_SYMBOL(rfnm_stream_set_rx_req_size);
+
+// called by the usb function on set_alt, chunk is the byte count per service
+// interval of isochronous IN endpoint id, 0 puts it back on bulk
+void rfnm_stream_set_iso(int id, uint32_t chunk) {
+	struct rfnm_iso_ep *iso;
+
+	if(id < 0 || id >= RFNM_EP_CNT) {
+		return;
+	}
+
+	iso = &rfnm_usb_dev->iso[id];
+
+	WRITE_ONCE(iso->chunk, 0);
+	// drop whatever the old setting left behind, the RX thread only moves head
+	iso->off = 0;
+	smp_store_release(&iso->tail, READ_ONCE(iso->head));
+	WRITE_ONCE(iso->chunk, chunk);
+
+	if(chunk) {
+		printk("rx usb ep %d isochronous, %d bytes per interval\n", id, chunk);
+	}
+}
+EXPORT_SYMBOL(rfnm_stream_set_iso);
+
+static DEFINE_SPINLOCK(rfnm_notify_lock);
+static rfnm_stream_notify_fn rfnm_notify_fn;
+static atomic_t rfnm_notify_seq;
+
+void rfnm_stream_set_notifier(rfnm_stream_notify_fn fn) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&rfnm_notify_lock, flags);
+	rfnm_notify_fn = fn;
+	spin_unlock_irqrestore(&rfnm_notify_lock, flags);
+}
+EXPORT_SYMBOL(rfnm_stream_set_notifier);
+
+// safe from any context, the notifier only queues the record
+void rfnm_stream_event(uint8_t type, uint8_t ch, uint32_t arg) {
+	struct rfnm_stream_event ev;
+	unsigned long flags;
+
+	ev.type = type;
+	ev.ch = ch;
+	ev.seq = atomic_inc_return(&rfnm_notify_seq);
+	ev.arg = arg;
+	ev.ts_ns = ktime_get_ns();
+
+	spin_lock_irqsave(&rfnm_notify_lock, flags);
+	if(rfnm_notify_fn) {
+		rfnm_notify_fn(&ev);
+	}
+	spin_unlock_irqrestore(&rfnm_notify_lock, flags);
+}
+EXPORT_SYMBOL(rfnm_stream_event);
 
 
 
-static ssize_t dfs_rfnm_stream_status_read(struct file *f, char *buffer, size_t len, loff_t *offset)
+
+static int dfs_rfnm_stream_status_show(struct seq_file *s, void *unused)
 {
-	char data[1000];
-	int data_len = 0;
+	struct rfnm_dev *rfnm_dev = s->private;
 
 	uint64_t time_diff, time_processing_start;
-	static uint64_t last_print_time = 0;
-	static struct rfnm_stream_stats last_stats;
 
 	
 	time_processing_start = ktime_get();
-	time_diff = time_processing_start - last_print_time;
-	last_print_time = time_processing_start;
+	time_diff = time_processing_start - rfnm_dev->dfs_last_read;
+	rfnm_dev->dfs_last_read = time_processing_start;
 
 	
 
 
-	data_len += sprintf(&data[data_len], "usb rx ok:\t\t%ld\t%ld\n", rfnm_stream_stats.usb_rx_ok[0], rfnm_stream_stats.usb_rx_ok[1]);
-	data_len += sprintf(&data[data_len], "usb rx error:\t%ld\t%ld\n", rfnm_stream_stats.usb_rx_error[0], rfnm_stream_stats.usb_rx_error[1]);
+	seq_printf(s, "usb rx ok:\t\t%ld\t%ld\n", rfnm_dev->stream_stats.usb_rx_ok[0], rfnm_dev->stream_stats.usb_rx_ok[1]);
+	seq_printf(s, "usb rx error:\t%ld\t%ld\n", rfnm_dev->stream_stats.usb_rx_error[0], rfnm_dev->stream_stats.usb_rx_error[1]);
 
-	data_len += sprintf(&data[data_len], "\n");
+	seq_putc(s, '\n');
 
-	data_len += sprintf(&data[data_len], "usb tx ok:\t\t%ld\t%ld\n", rfnm_stream_stats.usb_tx_ok[0], rfnm_stream_stats.usb_tx_ok[1]);
-	data_len += sprintf(&data[data_len], "usb tx error:\t%ld\t%ld\n", rfnm_stream_stats.usb_tx_error[0], rfnm_stream_stats.usb_tx_error[1]);
+	seq_printf(s, "usb tx ok:\t\t%ld\t%ld\n", rfnm_dev->stream_stats.usb_tx_ok[0], rfnm_dev->stream_stats.usb_tx_ok[1]);
+	seq_printf(s, "usb tx error:\t%ld\t%ld\n", rfnm_dev->stream_stats.usb_tx_error[0], rfnm_dev->stream_stats.usb_tx_error[1]);
 
-	data_len += sprintf(&data[data_len], "\n");
+	seq_putc(s, '\n');
 
 	
 
 
-	uint64_t usb_rx_data_diff = rfnm_stream_stats.usb_rx_bytes[0] - last_stats.usb_rx_bytes[0];
-	uint64_t usb_rx_data_rate = ((usb_rx_data_diff / 1000) / (time_diff / (1000 * 1000))) / (1);
+	uint64_t usb_rx_data_diff = rfnm_dev->stream_stats.usb_rx_bytes[0] - rfnm_dev->dfs_last_stats.usb_rx_bytes[0];
+	// two reads within a ms have no rate
+	uint64_t time_diff_ms = time_diff / (1000 * 1000);
+	uint64_t usb_rx_data_rate = time_diff_ms ? (usb_rx_data_diff / 1000) / time_diff_ms : 0;
 
 
-	uint64_t usb_tx_data_diff = rfnm_stream_stats.usb_tx_bytes[0] - last_stats.usb_tx_bytes[0];
-	uint64_t usb_tx_data_rate = ((usb_tx_data_diff / 1000) / (time_diff / (1000 * 1000))) / (1);
+	uint64_t usb_tx_data_diff = rfnm_dev->stream_stats.usb_tx_bytes[0] - rfnm_dev->dfs_last_stats.usb_tx_bytes[0];
+	uint64_t usb_tx_data_rate = time_diff_ms ? (usb_tx_data_diff / 1000) / time_diff_ms : 0;
 
 
-	data_len += sprintf(&data[data_len], "usb tx bw:\t%lld (MB/s)\n", usb_tx_data_rate);
-	data_len += sprintf(&data[data_len], "usb rx bw:\t%lld (MB/s)\n", usb_rx_data_rate);
+	seq_printf(s, "usb tx bw:\t%lld (MB/s)\n", usb_tx_data_rate);
+	seq_printf(s, "usb rx bw:\t%lld (MB/s)\n", usb_rx_data_rate);
 
-	data_len += sprintf(&data[data_len], "\n");
+	seq_putc(s, '\n');
 
 
-	data_len += sprintf(&data[data_len], "adc ok:\t\t%ld\t%ld\t%ld\t%ld\n", rfnm_stream_stats.la_adc_ok[0], rfnm_stream_stats.la_adc_ok[1], 
-		rfnm_stream_stats.la_adc_ok[2], rfnm_stream_stats.la_adc_ok[3]);
-	data_len += sprintf(&data[data_len], "adc error:\t%ld\t%ld\t%ld\t%ld\n", rfnm_stream_stats.la_adc_error[0], rfnm_stream_stats.la_adc_error[1], 
-		rfnm_stream_stats.la_adc_error[2], rfnm_stream_stats.la_adc_error[3]);
+	seq_printf(s, "adc ok:\t\t%ld\t%ld\t%ld\t%ld\n", rfnm_dev->stream_stats.la_adc_ok[0], rfnm_dev->stream_stats.la_adc_ok[1], 
+		rfnm_dev->stream_stats.la_adc_ok[2], rfnm_dev->stream_stats.la_adc_ok[3]);
+	seq_printf(s, "adc error:\t%ld\t%ld\t%ld\t%ld\n", rfnm_dev->stream_stats.la_adc_error[0], rfnm_dev->stream_stats.la_adc_error[1], 
+		rfnm_dev->stream_stats.la_adc_error[2], rfnm_dev->stream_stats.la_adc_error[3]);
 
-	data_len += sprintf(&data[data_len], "\n");
+	seq_putc(s, '\n');
 
-	data_len += sprintf(&data[data_len], "dac ok:\t\t%ld\n", rfnm_stream_stats.la_dac_ok[0]);
-	data_len += sprintf(&data[data_len], "dac error:\t%ld\n", rfnm_stream_stats.la_dac_error[0]);
+	seq_printf(s, "adc dc i:\t%d\t%d\t%d\t%d\n", rfnm_rx_dc_get(&rfnm_dev->rx_dc[0], 0), 
+		rfnm_rx_dc_get(&rfnm_dev->rx_dc[1], 0), rfnm_rx_dc_get(&rfnm_dev->rx_dc[2], 0), rfnm_rx_dc_get(&rfnm_dev->rx_dc[3], 0));
+	seq_printf(s, "adc dc q:\t%d\t%d\t%d\t%d\n", rfnm_rx_dc_get(&rfnm_dev->rx_dc[0], 1), 
+		rfnm_rx_dc_get(&rfnm_dev->rx_dc[1], 1), rfnm_rx_dc_get(&rfnm_dev->rx_dc[2], 1), rfnm_rx_dc_get(&rfnm_dev->rx_dc[3], 1));
 
+	seq_putc(s, '\n');
 
+	seq_printf(s, "dac ok:\t\t%ld\n", rfnm_dev->stream_stats.la_dac_ok[0]);
+	seq_printf(s, "dac error:\t%ld\n", rfnm_dev->stream_stats.la_dac_error[0]);
 
 
 
 
-	data_len += sprintf(&data[data_len], "\n");
 
-	data_len += sprintf(&data[data_len], "\t\thead\ttail\treadable\t\n");
 
+	seq_putc(s, '\n');
 
+	seq_printf(s, "\t\thead\ttail\treadable\t\n");
 
-	uint32_t la_tail = rfnm_m7_status->tx_buf_id;
-	uint32_t la_head = rfnm_dev->tx_la_cb.head;
-	uint32_t la_writable, la_margin;  
-	
-	if(la_tail < la_head) {
-		la_writable = RFNM_DAC_BUFCNT - la_head + la_tail;
-	} else {
-		la_writable = la_tail - la_head;
-	}
 
-	la_margin = RFNM_DAC_BUFCNT - la_writable;
 
-	data_len += sprintf(&data[data_len], "writer:\t\t%d\t%d\t%d\n", la_head, la_tail, la_margin);
+	uint32_t la_tail = rfnm_dev->m7_status->tx_buf_id;
+	uint32_t la_head = rfnm_dev->tx_la_cb.head;
+	uint32_t la_margin = rfnm_ring_margin(RFNM_DAC_BUFCNT, la_head, la_tail);
+
+	seq_printf(s, "writer:\t\t%d\t%d\t%d\n", la_head, la_tail, la_margin);
 
 
-	la_head = rfnm_m7_status->rx_head;
+	la_head = rfnm_dev->m7_status->rx_head;
 	la_tail = rfnm_dev->rx_la_cb.tail;
 
-	uint32_t la_readable = la_head - la_tail;
+	uint32_t la_readable = rfnm_ring_readable(RFNM_ADC_BUFCNT, la_head, la_tail);
 
-	if(la_head < la_tail) {
-		la_readable += RFNM_ADC_BUFCNT;
-	}
+	seq_printf(s, "reader:\t\t%d\t%d\t%d\n", la_head, la_tail, la_readable);
+	seq_printf(s, "rx req slots:\t%d%s\n", READ_ONCE(rfnm_dev->rx_usb_cb.req_slots), READ_ONCE(rfnm_dev->rx_usb_cb.req_sg) ? " sg" : "");
+	seq_printf(s, "iso chunk:\t%d\t%d\t%d\t%d\tmissed %d\n",
+		READ_ONCE(rfnm_dev->iso[0].chunk), READ_ONCE(rfnm_dev->iso[1].chunk),
+		READ_ONCE(rfnm_dev->iso[2].chunk), READ_ONCE(rfnm_dev->iso[3].chunk),
+		rfnm_dev->ep_stats[RFNM_USB_EP_ISO_MISSED]);
 
-	data_len += sprintf(&data[data_len], "reader:\t\t%d\t%d\t%d\n", la_head, la_tail, la_readable);
+	seq_putc(s, '\n');
 
-	data_len += sprintf(&data[data_len], "\n");
 
+	seq_printf(s, "ep\tin\tin usb\tout\tout usb\trx ok\t\trx starved\ttx ok\tin rec\tout rec\n");
 
-	uint32_t ls_in, ls_in_usb, ls_out, ls_out_usb;
-	spin_lock(&rfnm_usb_req_buffer_in->list_lock);
-	ls_in = list_count_nodes(&rfnm_usb_req_buffer_in->active);
-	spin_unlock(&rfnm_usb_req_buffer_in->list_lock);
+	for(int e = 0; e < RFNM_EP_CNT; e++) {
+		uint32_t ls_in, ls_in_usb, ls_out, ls_out_usb;
 
-	spin_lock(&rfnm_usb_req_buffer_in_usb->list_lock);
-	ls_in_usb = list_count_nodes(&rfnm_usb_req_buffer_in_usb->active);
-	spin_unlock(&rfnm_usb_req_buffer_in_usb->list_lock);
+		spin_lock_irq(&rfnm_dev->req_in[e]->list_lock);
+		ls_in = list_count_nodes(&rfnm_dev->req_in[e]->active);
+		spin_unlock_irq(&rfnm_dev->req_in[e]->list_lock);
 
-	spin_lock(&rfnm_usb_req_buffer_out->list_lock);
-	ls_out = list_count_nodes(&rfnm_usb_req_buffer_out->active);
-	spin_unlock(&rfnm_usb_req_buffer_out->list_lock);
+		spin_lock_irq(&rfnm_dev->req_in_usb[e]->list_lock);
+		ls_in_usb = list_count_nodes(&rfnm_dev->req_in_usb[e]->active);
+		spin_unlock_irq(&rfnm_dev->req_in_usb[e]->list_lock);
 
-	spin_lock(&rfnm_usb_req_buffer_out_usb->list_lock);
-	ls_out_usb = list_count_nodes(&rfnm_usb_req_buffer_out_usb->active);
-	spin_unlock(&rfnm_usb_req_buffer_out_usb->list_lock);
-	
+		spin_lock_irq(&rfnm_dev->req_out[e]->list_lock);
+		ls_out = list_count_nodes(&rfnm_dev->req_out[e]->active);
+		spin_unlock_irq(&rfnm_dev->req_out[e]->list_lock);
 
-	data_len += sprintf(&data[data_len], "ls in:\t\t%d\n", ls_in);
-	data_len += sprintf(&data[data_len], "ls in usb:\t%d\n", ls_in_usb);
-	data_len += sprintf(&data[data_len], "ls out:\t\t%d\n", ls_out);
-	data_len += sprintf(&data[data_len], "ls out usb:\t%d\n", ls_out_usb);
+		spin_lock_irq(&rfnm_dev->req_out_usb[e]->list_lock);
+		ls_out_usb = list_count_nodes(&rfnm_dev->req_out_usb[e]->active);
+		spin_unlock_irq(&rfnm_dev->req_out_usb[e]->list_lock);
+
+		seq_printf(s, "%d\t%d\t%d\t%d\t%d\t%llu\t\t%llu\t\t%llu\t\t%llu/%llu\t%llu/%llu\n", e,
+			ls_in, ls_in_usb, ls_out, ls_out_usb,
+			rfnm_dev->ep_rx_ok[e], rfnm_dev->ep_rx_starved[e], rfnm_dev->ep_tx_ok[e],
+			rfnm_dev->ep_state[RFNM_EP_DIR_IN][e].recoveries, rfnm_dev->ep_state[RFNM_EP_DIR_IN][e].recover_errors,
+			rfnm_dev->ep_state[RFNM_EP_DIR_OUT][e].recoveries, rfnm_dev->ep_state[RFNM_EP_DIR_OUT][e].recover_errors);
+	}
 
 	
 
 
-	memcpy(&last_stats, &rfnm_stream_stats, sizeof(struct rfnm_stream_stats));
+	seq_putc(s, '\n');
 
-	return simple_read_from_buffer(buffer, len, offset, data, data_len);
+	seq_printf(s, "soft restarts:\t%llu\tlast %llu us\tmax %llu us\tavg %llu us\n", rfnm_dev->resets,
+		rfnm_dev->reset_last_ns / 1000, rfnm_dev->reset_max_ns / 1000,
+		rfnm_dev->resets ? div64_u64(rfnm_dev->reset_total_ns, rfnm_dev->resets) / 1000 : 0);
+
+	seq_printf(s, "poll\tbudget\tpasses\t\tper pass\tfull\t\tidle\t\tkicked\n");
+
+	for(int t = 0; t < RFNM_POLL_CNT; t++) {
+		static const char * const names[RFNM_POLL_CNT] = { "rx", "tx", "usb" };
+		struct rfnm_poll *p = &rfnm_dev->poll[t];
+
+		seq_printf(s, "%s\t%u\t%llu\t\t%llu\t\t%llu\t\t%llu\t\t%llu\n", names[t],
+			READ_ONCE(p->budget), p->passes, p->passes ? div64_u64(p->work, p->passes) : 0,
+			p->full, p->idle, p->kicked);
+	}
+
+	memcpy(&rfnm_dev->dfs_last_stats, &rfnm_dev->stream_stats, sizeof(struct rfnm_stream_stats));
+
+	return 0;
+}
+
+// sized for the whole table, a retry of show would read as a zero length interval
+#define RFNM_STREAM_STATUS_SIZE	8192
+
+static int dfs_rfnm_stream_status_open(struct inode *inode, struct file *file)
+{
+	return single_open_size(file, dfs_rfnm_stream_status_show, inode->i_private, RFNM_STREAM_STATUS_SIZE);
 }
 
 static inline struct task_struct *
@@ -1708,31 +2594,247 @@ kthread_run_on_cpu(int (*threadfn)(void *data), void *data,
 
 const struct file_operations dfs_rfnm_stream_fops = {
 	.owner = THIS_MODULE,
-	.read = dfs_rfnm_stream_status_read,
+	.open = dfs_rfnm_stream_status_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
+static ssize_t dfs_rfnm_tx_interp_read(struct file *f, char *buffer, size_t len, loff_t *offset)
+{
+	struct rfnm_dev *rfnm_dev = f->private_data;
+	char data[100];
+	int data_len = 0;
+	uint32_t factor = 1;
+	int32_t nco_step = 0;
+
+	spin_lock(&rfnm_dev->tx_interp_lock);
+	if(rfnm_dev->tx_interp_update) {
+		if(rfnm_dev->tx_interp_next) {
+			factor = rfnm_dev->tx_interp_next->factor;
+			nco_step = rfnm_dev->tx_interp_next->nco_step;
+		}
+	} else if(rfnm_dev->tx_interp) {
+		factor = rfnm_dev->tx_interp->factor;
+		nco_step = rfnm_dev->tx_interp->nco_step;
+	}
+	spin_unlock(&rfnm_dev->tx_interp_lock);
 
-static struct dentry *dfs_rfnm_dir;
-static struct dentry *dfs_rfnm_stream_stat;
+	data_len += sprintf(&data[data_len], "%u %d\n", factor, nco_step);
 
-void stop_sm(void) {
-	
-	rfnm_dev->wq_stop_in = 1;
-	rfnm_dev->wq_stop_out = 1;
-	while(rfnm_dev->wq_stop_in || rfnm_dev->wq_stop_out) { mdelay(1); }
-	rfnm_dev->wq_stop_usb = 1;
-	wake_up(&wq_usb);
+	return simple_read_from_buffer(buffer, len, offset, data, data_len);
+}
+
+// "<factor> <nco_step>": factor is a power of two up to 64, nco_step is
+// the frequency shift as a fraction of the dac rate times 2^32. "1 0" bypasses.
+static ssize_t dfs_rfnm_tx_interp_write(struct file *f, const char __user *buffer, size_t len, loff_t *offset)
+{
+	struct rfnm_dev *rfnm_dev = f->private_data;
+	char data[64];
+	unsigned int factor;
+	int nco_step;
+	struct rfnm_tx_interp *ip = NULL, *old;
+
+	if(len >= sizeof(data)) {
+		return -EINVAL;
+	}
+
+	if(copy_from_user(data, buffer, len)) {
+		return -EFAULT;
+	}
+	data[len] = 0;
+
+	if(sscanf(data, "%u %d", &factor, &nco_step) != 2) {
+		return -EINVAL;
+	}
+
+	if(factor > 1 || nco_step) {
+		ip = rfnm_tx_interp_alloc(factor, nco_step, LA_TX_BASE_BUFSIZE / 4);
+		if(IS_ERR(ip)) {
+			return PTR_ERR(ip);
+		}
+	}
+
+	spin_lock(&rfnm_dev->tx_interp_lock);
+	old = rfnm_dev->tx_interp_next;
+	rfnm_dev->tx_interp_next = ip;
+	rfnm_dev->tx_interp_update = 1;
+	spin_unlock(&rfnm_dev->tx_interp_lock);
+
+	rfnm_tx_interp_free(old);
+
+	return len;
+}
+
+const struct file_operations dfs_rfnm_tx_interp_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = dfs_rfnm_tx_interp_read,
+	.write = dfs_rfnm_tx_interp_write,
+};
+
+static ssize_t dfs_rfnm_corr_read(struct rfnm_dev *rfnm_dev, struct rfnm_iq_corr *corr, char *buffer, size_t len, loff_t *offset)
+{
+	char data[400];
+	int data_len = 0;
+	struct rfnm_iq_corr c[4];
+
+	spin_lock(&rfnm_dev->corr_lock);
+	memcpy(c, corr, sizeof(c));
+	spin_unlock(&rfnm_dev->corr_lock);
+
+	data_len += sprintf(&data[data_len], "ch\tm00\tm01\tm10\tm11\tdc_i\tdc_q\ton\n");
+
+	for(int i = 0; i < 4; i++) {
+		data_len += sprintf(&data[data_len], "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i, 
+			c[i].m[0], c[i].m[1], c[i].m[2], c[i].m[3], c[i].dc[0], c[i].dc[1], c[i].enabled);
+	}
+
+	return simple_read_from_buffer(buffer, len, offset, data, data_len);
+}
+
+// "<ch> <m00> <m01> <m10> <m11> <dc_i> <dc_q>", matrix in Q14 (16384 = 1.0), dc in
+// int16 sample units. The identity with no offset disables the stage.
+static ssize_t dfs_rfnm_corr_write(struct rfnm_dev *rfnm_dev, struct rfnm_iq_corr *corr, const char __user *buffer, size_t len)
+{
+	char data[128];
+	int ch, m[4], dc[2];
+	struct rfnm_iq_corr c;
+
+	if(len >= sizeof(data)) {
+		return -EINVAL;
+	}
+
+	if(copy_from_user(data, buffer, len)) {
+		return -EFAULT;
+	}
+	data[len] = 0;
+
+	if(sscanf(data, "%d %d %d %d %d %d %d", &ch, &m[0], &m[1], &m[2], &m[3], &dc[0], &dc[1]) != 7) {
+		return -EINVAL;
+	}
+
+	if(ch < 0 || ch >= 4) {
+		return -EINVAL;
+	}
+
+	for(int i = 0; i < 4; i++) {
+		if(m[i] < S16_MIN || m[i] > S16_MAX) {
+			return -ERANGE;
+		}
+		c.m[i] = m[i];
+	}
+
+	for(int i = 0; i < 2; i++) {
+		if(dc[i] < S16_MIN || dc[i] > S16_MAX) {
+			return -ERANGE;
+		}
+		c.dc[i] = dc[i];
+	}
+
+	c.enabled = !(c.m[0] == RFNM_IQ_CORR_ONE && c.m[1] == 0 && c.m[2] == 0 && 
+		c.m[3] == RFNM_IQ_CORR_ONE && c.dc[0] == 0 && c.dc[1] == 0);
+
+	spin_lock(&rfnm_dev->corr_lock);
+	corr[ch] = c;
+	spin_unlock(&rfnm_dev->corr_lock);
+
+	return len;
+}
+
+static ssize_t dfs_rfnm_tx_corr_read(struct file *f, char *buffer, size_t len, loff_t *offset)
+{
+	struct rfnm_dev *rfnm_dev = f->private_data;
+	return dfs_rfnm_corr_read(rfnm_dev, rfnm_dev->tx_corr, buffer, len, offset);
+}
+
+static ssize_t dfs_rfnm_tx_corr_write(struct file *f, const char __user *buffer, size_t len, loff_t *offset)
+{
+	struct rfnm_dev *rfnm_dev = f->private_data;
+	return dfs_rfnm_corr_write(rfnm_dev, rfnm_dev->tx_corr, buffer, len);
+}
+
+const struct file_operations dfs_rfnm_tx_corr_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = dfs_rfnm_tx_corr_read,
+	.write = dfs_rfnm_tx_corr_write,
+};
+
+static ssize_t dfs_rfnm_rx_corr_read(struct file *f, char *buffer, size_t len, loff_t *offset)
+{
+	struct rfnm_dev *rfnm_dev = f->private_data;
+	return dfs_rfnm_corr_read(rfnm_dev, rfnm_dev->rx_corr, buffer, len, offset);
+}
+
+static ssize_t dfs_rfnm_rx_corr_write(struct file *f, const char __user *buffer, size_t len, loff_t *offset)
+{
+	struct rfnm_dev *rfnm_dev = f->private_data;
+	return dfs_rfnm_corr_write(rfnm_dev, rfnm_dev->rx_corr, buffer, len);
+}
+
+const struct file_operations dfs_rfnm_rx_corr_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = dfs_rfnm_rx_corr_read,
+	.write = dfs_rfnm_rx_corr_write,
+};
+
+static void rfnm_corr_reset(struct rfnm_iq_corr *corr)
+{
+	for(int i = 0; i < 4; i++) {
+		corr[i].m[0] = RFNM_IQ_CORR_ONE;
+		corr[i].m[1] = 0;
+		corr[i].m[2] = 0;
+		corr[i].m[3] = RFNM_IQ_CORR_ONE;
+		corr[i].dc[0] = 0;
+		corr[i].dc[1] = 0;
+		corr[i].enabled = 0;
+	}
+}
+
+
+static struct dentry *dfs_rfnm_dir;
+
+static void stop_sm(struct rfnm_dev *rfnm_dev) {
+	
+	rfnm_dev->wq_stop_in = 1;
+	rfnm_dev->wq_stop_out = 1;
+	wake_up(&rfnm_dev->wq_in);
+	wake_up(&rfnm_dev->wq_out);
+	wake_up(&rfnm_dev->wq_epoch);
+	while(rfnm_dev->wq_stop_in || rfnm_dev->wq_stop_out) { mdelay(1); }
+	rfnm_dev->wq_stop_usb = 1;
+	wake_up(&rfnm_dev->wq_usb);
 	while(rfnm_dev->wq_stop_usb) { mdelay(1); }
 }
 
-void start_sm(void) {
+static struct task_struct *rfnm_thread_run(struct rfnm_dev *rfnm_dev, int (*fn)(void *), int k, const char *name) {
+
+	// nlm0 keeps RX, TX and USB on cpu 1, 2 and 3, each further pipeline takes the next three
+	unsigned int cpu = (1 + 3 * rfnm_dev->id + k) % num_possible_cpus();
+	char buf[TASK_COMM_LEN];
+
+	if(rfnm_dev->id) {
+		snprintf(buf, sizeof(buf), "%s%d", name, rfnm_dev->id);
+		name = buf;
+	}
+
+	return kthread_run_on_cpu(fn, rfnm_dev, cpu, name);
+}
+
+static void start_sm(struct rfnm_dev *rfnm_dev) {
 	
-	kthread_run_on_cpu(rfnm_handler_in, NULL, 1, "RX");
-	kthread_run_on_cpu(rfnm_handler_out, NULL, 2, "TX");
-	kthread_run_on_cpu(rfnm_handler_usb, NULL, 3, "USB");
+	rfnm_dev->wq_stop_in = 0;
+	rfnm_dev->wq_stop_out = 0;
+	rfnm_dev->wq_stop_usb = 0;
+
+	rfnm_dev->thread_in = rfnm_thread_run(rfnm_dev, rfnm_handler_in, 0, "RX");
+	rfnm_dev->thread_out = rfnm_thread_run(rfnm_dev, rfnm_handler_out, 1, "TX");
+	rfnm_dev->thread_usb = rfnm_thread_run(rfnm_dev, rfnm_handler_usb, 2, "USB");
 }
 
-void rfnm_reset_sm(void) {
+static void rfnm_reset_sm(struct rfnm_dev *rfnm_dev) {
 
 	int i;
 
@@ -1745,6 +2847,12 @@ void rfnm_reset_sm(void) {
 	for(i = 0; i < 4; i++) {
 		rfnm_dev->rx_usb_cb.adc_buf[i] = 0;
 		rfnm_dev->rx_usb_cb.adc_buf_cnt[i] = RFNM_RX_USB_BUF_MULTI;
+		rfnm_dev->rx_usb_cb.run_start[i] = 0;
+		rfnm_dev->rx_usb_cb.run_len[i] = 1;
+		rfnm_dev->rx_usb_cb.run_pos[i] = 0;
+		rfnm_dev->iso[i].head = 0;
+		rfnm_dev->iso[i].tail = 0;
+		rfnm_dev->iso[i].off = 0;
 		rfnm_dev->rx_la_cb.adc_cc[i] = 0;
 		rfnm_dev->rx_usb_cb.usb_cc[i] = 0;
 	}
@@ -1753,163 +2861,694 @@ void rfnm_reset_sm(void) {
 	rfnm_dev->tx_la_cb.dac_cc = 0;
 	rfnm_dev->tx_la_cb.usb_cc = 0;
 
-	rfnm_dev->wq_stop_in = 0;
-	rfnm_dev->wq_stop_out = 0;
-	rfnm_dev->wq_stop_usb = 0;
+	memset(&rfnm_dev->stream_stats, 0, sizeof(struct rfnm_stream_stats));
+}
 
-	memset(&rfnm_stream_stats, 0, sizeof(struct rfnm_stream_stats));
+// a pass of each stage is all a restart waits for, the host gets its reply after this at the latest
+#define RFNM_EPOCH_TIMEOUT_US	50000
+
+/*
+ * Reset the stream state in place: the threads keep running, the requests
+ * we hold go back to the udc and the cc counters start over. The request
+ * returns at once, the USB thread starts the new epoch once RX and TX are
+ * parked.
+ */
+static uint32_t rfnm_epoch_request(struct rfnm_dev *rfnm_dev) {
+
+	uint32_t req;
+
+	WRITE_ONCE(rfnm_dev->epoch_t0, ktime_get_ns());
+	req = READ_ONCE(rfnm_dev->epoch_req) + 1;
+	smp_store_release(&rfnm_dev->epoch_req, req);
+
+	rfnm_poll_kick(&rfnm_dev->poll[RFNM_POLL_RX], &rfnm_dev->wq_in);
+	rfnm_poll_kick(&rfnm_dev->poll[RFNM_POLL_TX], &rfnm_dev->wq_out);
+	wake_up(&rfnm_dev->wq_usb);
+
+	return req;
 }
 
+static void rfnm_restart_timeout(struct work_struct *work)
+{
+	struct rfnm_dev *rfnm_dev = container_of(to_delayed_work(work), struct rfnm_dev, restart_timeout);
+	rfnm_restart_done_fn done;
+	void *ctx;
+	unsigned long flags;
 
+	spin_lock_irqsave(&rfnm_dev->restart_lock, flags);
+	done = rfnm_dev->restart_done;
+	ctx = rfnm_dev->restart_ctx;
+	rfnm_dev->restart_done = NULL;
+	spin_unlock_irqrestore(&rfnm_dev->restart_lock, flags);
+
+	if(done) {
+		printk("soft restart: stages not back after %d us, carrying on\n", RFNM_EPOCH_TIMEOUT_US);
+		done(ctx, -ETIMEDOUT);
+	}
+}
+
+static void rfnm_dev_restart_sm(struct rfnm_dev *rfnm_dev, int hard) {
+
+	if(!hard) {
+		rfnm_epoch_request(rfnm_dev);
+		return;
+	}
+
+	// threads torn down and started again, only for debugging now
+	stop_sm(rfnm_dev);
+	rfnm_reset_sm(rfnm_dev);
+	start_sm(rfnm_dev);
+}
+
+// the usb function only ever restarts the pipeline it streams
 void rfnm_restart_sm(int hard) {
 
-	int i;
+	rfnm_dev_restart_sm(rfnm_usb_dev, hard);
+}
+EXPORT_SYMBOL(rfnm_restart_sm);
 
-	if(hard) {
-		stop_sm();
-	} else {
-		rfnm_dev->usb_flushmode = 1;
+int rfnm_stream_soft_restart(rfnm_restart_done_fn done, void *ctx) {
+	struct rfnm_dev *rfnm_dev = rfnm_usb_dev;
+	unsigned long flags;
+
+	if(!rfnm_dev) {
+		return -ENODEV;
+	}
+
+	spin_lock_irqsave(&rfnm_dev->restart_lock, flags);
+	if(rfnm_dev->restart_done) {
+		spin_unlock_irqrestore(&rfnm_dev->restart_lock, flags);
+		return -EBUSY;
+	}
+	rfnm_dev->restart_done = done;
+	rfnm_dev->restart_ctx = ctx;
+	// under the lock, so the USB thread can't complete an older epoch for us
+	rfnm_dev->restart_epoch = rfnm_epoch_request(rfnm_dev);
+	spin_unlock_irqrestore(&rfnm_dev->restart_lock, flags);
+
+	mod_delayed_work(system_wq, &rfnm_dev->restart_timeout, usecs_to_jiffies(RFNM_EPOCH_TIMEOUT_US));
+
+	return 0;
+}
+EXPORT_SYMBOL(rfnm_stream_soft_restart);
+
+
+
+static int flight = 1;
+module_param(flight, int, 0444);
+MODULE_PARM_DESC(flight, "record the last events of every stage for rfnm/nlm<N>/flight, 0 turns it off");
+
+static uint health_ms = 50;
+module_param(health_ms, uint, 0444);
+MODULE_PARM_DESC(health_ms, "how often the stream health is checked, 0 turns the check off");
+
+static uint health_stall_ms = 200;
+module_param(health_stall_ms, uint, 0444);
+MODULE_PARM_DESC(health_stall_ms, "a stage without progress this long is stalled, each further period takes the next recovery step");
+
+static const char * const rfnm_health_names[RFNM_HEALTH_CNT] = {
+	[RFNM_HEALTH_RX_M7] = "rx_head",
+	[RFNM_HEALTH_RX] = "rx",
+	[RFNM_HEALTH_USB_IN] = "usb in",
+	[RFNM_HEALTH_TX] = "tx",
+	[RFNM_HEALTH_TX_M7] = "tx_buf_id",
+};
+
+static const char * const rfnm_health_acts[] = {
+	[RFNM_HEALTH_REQUEUE] = "requeue",
+	[RFNM_HEALTH_RESTART] = "restart",
+	[RFNM_HEALTH_NOTIFY] = "notify",
+	[RFNM_HEALTH_RECOVERED] = "recovered",
+};
 
-		wake_up(&wq_usb);
+static void rfnm_health_log(struct rfnm_dev *rfnm_dev, int stage, int act, uint64_t ns)
+{
+	struct rfnm_health_rec *rec = &rfnm_dev->health_log[rfnm_dev->health_log_head % RFNM_HEALTH_LOG];
+
+	rec->ts_ns = ktime_get_ns();
+	rec->stage = stage;
+	rec->act = act;
+	rec->ms = div_u64(ns, NSEC_PER_MSEC);
+	rec->progress = rfnm_dev->health[stage].progress;
+	// the debugfs reader goes by head, the record is complete before it moves
+	smp_store_release(&rfnm_dev->health_log_head, rfnm_dev->health_log_head + 1);
+
+	rfnm_flight_rec(&rfnm_dev->flight, RFNM_FLIGHT_CTRL, RFNM_FL_HEALTH, stage, act, rec->ms, rec->progress);
+	if(act == RFNM_HEALTH_REQUEUE) {
+		rfnm_flight_error(&rfnm_dev->flight, "stream stall");
+	}
+
+	printk("%s: %s %s after %u ms\n", rfnm_dev->la9310_dev->name, rfnm_health_names[stage],
+		rfnm_health_acts[act], rec->ms);
+}
+
+// someone takes the rx stream: the host has IN requests with us, or a tap is attached
+static int rfnm_health_rx_on(struct rfnm_dev *rfnm_dev)
+{
+	if(READ_ONCE(rfnm_dev->rx_tap)) {
+		return 1;
+	}
+
+	for(int e = 0; e < RFNM_EP_CNT; e++) {
+		if(!rfnm_usb_req_empty(rfnm_dev->req_in[e])) {
+			return 1;
+		}
+	}
 
-		//if(wait) {
-			while(rfnm_dev->usb_flushmode) {
-				mdelay(1);
+	return 0;
+}
+
+/*
+ * Progress counter of each stage, and whether it has anything to make progress
+ * on. rx_moved is whether RX progressed since the previous check, taken
+ * before any stage is updated.
+ */
+static uint64_t rfnm_health_sample(struct rfnm_dev *rfnm_dev, int stage, uint64_t rx_work, int rx_moved, int *pending)
+{
+	uint32_t tx_buf_id;
+
+	switch(stage) {
+	case RFNM_HEALTH_RX_M7:
+		*pending = rfnm_health_rx_on(rfnm_dev);
+		return rfnm_dev->m7_status->rx_head;
+	case RFNM_HEALTH_RX:
+		*pending = rfnm_rx_ready(rfnm_dev);
+		return rx_work;
+	case RFNM_HEALTH_USB_IN:
+		// only while RX has buffers for the host
+		*pending = rfnm_dev->usb && rx_moved;
+		return READ_ONCE(rfnm_dev->usb_done[RFNM_EP_DIR_IN]);
+	case RFNM_HEALTH_TX:
+		*pending = !rfnm_usb_req_empty(rfnm_dev->req_out[RFNM_TX_EP]);
+		return READ_ONCE(rfnm_dev->poll[RFNM_POLL_TX].work);
+	case RFNM_HEALTH_TX_M7:
+		// only while the dac ring holds buffers the M7 has not played
+		tx_buf_id = rfnm_dev->m7_status->tx_buf_id;
+		*pending = rfnm_ring_readable(RFNM_DAC_BUFCNT, READ_ONCE(rfnm_dev->tx_la_cb.head), tx_buf_id) > 0;
+		return tx_buf_id;
+	}
+
+	*pending = 0;
+	return 0;
+}
+
+static void rfnm_health_step(struct rfnm_dev *rfnm_dev, int stage, int level)
+{
+	int dir = stage == RFNM_HEALTH_TX || stage == RFNM_HEALTH_TX_M7 ? RFNM_EP_DIR_OUT : RFNM_EP_DIR_IN;
+
+	switch(level) {
+	case RFNM_HEALTH_REQUEUE:
+		// the USB thread dequeues and requeues everything the endpoints own
+		if(rfnm_dev->usb) {
+			for(int e = 0; e < RFNM_EP_CNT; e++) {
+				if(READ_ONCE(rfnm_dev->ep_state[dir][e].ep)) {
+					WRITE_ONCE(rfnm_dev->ep_state[dir][e].failed, 1);
+				}
 			}
-		//}
+			wake_up(&rfnm_dev->wq_usb);
+		}
+		break;
+	case RFNM_HEALTH_RESTART:
+		rfnm_epoch_request(rfnm_dev);
+		break;
+	case RFNM_HEALTH_NOTIFY:
+		rfnm_dev_event(rfnm_dev, RFNM_EVT_STALL, stage,
+			div_u64(rfnm_dev->health[stage].stall_ns, NSEC_PER_MSEC));
+		break;
 	}
+}
 
-	rfnm_reset_sm();
+/*
+ * Every health_ms: a stage that made no progress for health_stall_ms while it
+ * had work gets its endpoints requeued, one period later a soft restart, one
+ * more and the host is told. After that the stage is left alone until it
+ * moves again. Every step and the recovery go to the health log.
+ */
+static void rfnm_health_work(struct work_struct *work)
+{
+	struct rfnm_dev *rfnm_dev = container_of(to_delayed_work(work), struct rfnm_dev, health_work);
+	uint64_t stall_ns = (uint64_t) max_t(uint, health_stall_ms, 1) * NSEC_PER_MSEC;
+	uint64_t now = ktime_get_ns();
+	uint64_t rx_work = READ_ONCE(rfnm_dev->poll[RFNM_POLL_RX].work);
+	int rx_moved = rx_work != rfnm_dev->health[RFNM_HEALTH_RX].progress;
+
+	for(int stage = 0; stage < RFNM_HEALTH_CNT; stage++) {
+		struct rfnm_health *h = &rfnm_dev->health[stage];
+		int pending, level;
+		uint64_t progress = rfnm_health_sample(rfnm_dev, stage, rx_work, rx_moved, &pending);
+
+		if(progress != h->progress) {
+			if(h->level) {
+				rfnm_health_log(rfnm_dev, stage, RFNM_HEALTH_RECOVERED, now - h->last_progress_ns);
+				h->level = 0;
+			}
+			h->progress = progress;
+			h->last_progress_ns = now;
+			h->armed = 1;
+			continue;
+		}
+
+		if(!h->armed || !pending) {
+			h->last_progress_ns = now;
+			continue;
+		}
 
-	if(hard) {
-		start_sm();
+		h->stall_ns = now - h->last_progress_ns;
+		level = min_t(uint64_t, div64_u64(h->stall_ns, stall_ns), RFNM_HEALTH_NOTIFY);
+
+		while(h->level < level) {
+			if(!h->level) {
+				h->incidents++;
+			}
+			h->level++;
+			rfnm_health_log(rfnm_dev, stage, h->level, h->stall_ns);
+			rfnm_health_step(rfnm_dev, stage, h->level);
+		}
+
+		if(h->level == RFNM_HEALTH_NOTIFY) {
+			// nothing left to try, wait for the stage to move by itself
+			h->armed = 0;
+		}
 	}
 
+	if(health_ms) {
+		schedule_delayed_work(&rfnm_dev->health_work, msecs_to_jiffies(health_ms));
+	}
+}
+
+static void rfnm_health_start(struct rfnm_dev *rfnm_dev)
+{
+	if(health_ms) {
+		schedule_delayed_work(&rfnm_dev->health_work, msecs_to_jiffies(health_ms));
+	}
 }
-EXPORT_SYMBOL(rfnm_restart_sm);
 
+static int dfs_rfnm_health_show(struct seq_file *s, void *unused)
+{
+	struct rfnm_dev *rfnm_dev = s->private;
+	uint32_t head = smp_load_acquire(&rfnm_dev->health_log_head);
+	uint32_t i = head > RFNM_HEALTH_LOG ? head - RFNM_HEALTH_LOG : 0;
 
+	seq_printf(s, "%-10s %-6s %-6s %10s %10s %20s\n", "stage", "armed", "level", "stalled ms", "incidents", "progress");
+	for(int stage = 0; stage < RFNM_HEALTH_CNT; stage++) {
+		struct rfnm_health *h = &rfnm_dev->health[stage];
 
-static int __init la9310_rfnm_init(void)
+		seq_printf(s, "%-10s %-6d %-6d %10llu %10llu %20llu\n", rfnm_health_names[stage], h->armed, h->level,
+			h->level ? div_u64(h->stall_ns, NSEC_PER_MSEC) : 0, h->incidents, h->progress);
+	}
+
+	seq_printf(s, "\n%-16s %-10s %-10s %8s %20s\n", "time ns", "stage", "step", "ms", "progress");
+	for(; i != head; i++) {
+		struct rfnm_health_rec *rec = &rfnm_dev->health_log[i % RFNM_HEALTH_LOG];
+
+		seq_printf(s, "%-16llu %-10s %-10s %8u %20llu\n", rec->ts_ns, rfnm_health_names[rec->stage],
+			rfnm_health_acts[rec->act], rec->ms, rec->progress);
+	}
+
+	return 0;
+}
+
+static int dfs_rfnm_health_open(struct inode *inode, struct file *file)
 {
-	int err = 0, i;
-	struct la9310_dev *la9310_dev;
+	return single_open(file, dfs_rfnm_health_show, inode->i_private);
+}
 
-	init_completion(&setup_done);
-		
-	//hrtimer_init(&test_hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	//test_hrtimer.function = &test_hrtimer_handler;
-	//hrtimer_start(&test_hrtimer, ms_to_ktime(1), HRTIMER_MODE_REL);
+static const struct file_operations dfs_rfnm_health_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_health_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	rfnm_dev = kzalloc(sizeof(struct rfnm_dev), GFP_KERNEL);
 
-	dfs_rfnm_dir = debugfs_create_dir("rfnm", NULL);
-	dfs_rfnm_stream_stat = debugfs_create_file("stream_status", 0644, dfs_rfnm_dir, NULL, &dfs_rfnm_stream_fops);
+static void rfnm_mem_release(struct device *dev, struct reserved_mem *rmem, phys_addr_t used)
+{
+	unsigned long pfn, start = PFN_UP(used), end = PFN_DOWN(rmem->base + rmem->size);
+
+	if (start >= end)
+		return;
 
+	for (pfn = start; pfn < end; pfn++)
+		free_reserved_page(pfn_to_page(pfn));
 
+	dev_info(dev, "released %lu KB of %s to Linux\n", (end - start) << (PAGE_SHIFT - 10), rmem->name);
 
-	rfnm_dev->usb_config_buffer = kzalloc(CONFIG_DESCRIPTOR_MAX_SIZE, GFP_KERNEL);
-	
+	// a reload sees what is left, and can't lay out more than that
+	rmem->size = PFN_PHYS(start) - rmem->base;
+}
 
-	la9310_dev = get_la9310_dev_byname("nlm0");
-	if (la9310_dev == NULL) {
-		pr_err("No LA9310 device named nlm0\n");
+static int rfnm_mem_layout(struct device *dev, int id, struct rfnm_mem_layout *m)
+{
+	size_t rx_desc = sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT;
+	size_t tx_desc = sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT;
+	size_t rx_usb = sizeof(struct rfnm_rx_usb_buf) * rfnm_rx_usb_bufcnt;
+	struct device_node *np;
+	struct reserved_mem *rmem;
+	phys_addr_t end;
+	bool no_map, reusable;
+	u32 status;
+	int i;
+
+	// the id-th node, of_find_compatible_node drops the previous one
+	np = NULL;
+	for (i = 0; i <= id; i++) {
+		np = of_find_compatible_node(np, NULL, RFNM_MEM_COMPATIBLE);
+		if (!np)
+			break;
+	}
+
+	if (!np && id) {
+		dev_err(dev, "no %s reserved-memory for nlm%d\n", RFNM_MEM_COMPATIBLE, id);
 		return -ENODEV;
 	}
+	if (!np) {
+		m->m7_status = RFNM_M7_STATUS_BASE;
+		m->rx_desc = RFNM_MEM_LEGACY_BASE;
+		m->tx_desc = m->rx_desc + rx_desc;
+		m->rx_usb = m->tx_desc + RFNM_MEM_LEGACY_TX_SIZE;
+		dev_info(dev, "no %s reserved-memory, fixed layout at %pa\n", RFNM_MEM_COMPATIBLE, &m->rx_desc);
+		return 0;
+	}
 
-	memset(&rfnm_stream_stats, 0x00, sizeof(struct rfnm_stream_stats));
+	rmem = of_reserved_mem_lookup(np);
+	no_map = of_property_read_bool(np, "no-map");
+	reusable = of_property_read_bool(np, "reusable");
+	if (of_property_read_u32(np, "rfnm,m7-status", &status))
+		status = id ? 0 : RFNM_M7_STATUS_BASE;
+	of_node_put(np);
 
-	tmp_usb_buffer_copy_to_be_deprecated =  kzalloc(500*1000, GFP_KERNEL);
+	if (!rmem) {
+		dev_err(dev, "%s is not a reserved-memory node\n", RFNM_MEM_COMPATIBLE);
+		return -ENODEV;
+	}
+	if (reusable) {
+		// the pages may be lent to Linux at any time, the M7 can't share them
+		dev_err(dev, "%s must not be reusable\n", rmem->name);
+		return -EINVAL;
+	}
+	if (no_map) {
+		// the udc dma-maps the rx usb buffers and sg lists need their struct pages
+		dev_err(dev, "%s must not be no-map\n", rmem->name);
+		return -EINVAL;
+	}
+	if (!status) {
+		// only the M7 of nlm0 has a known place
+		dev_err(dev, "%s has no rfnm,m7-status\n", rmem->name);
+		return -ENODEV;
+	}
 
-/*
-	for(i = 0; i < RFNM_IQFLOOD_BUFCNT; i++) {
-		rfnm_iqflood_buf[i] = kmalloc(RFNM_IQFLOOD_BUFSIZE, GFP_KERNEL);
-		if(!rfnm_iqflood_buf[i]) {
-			dev_err(la9310_dev->dev, "Failed to allocate memory for I/Q buffer\n");
-			err = ENOMEM;
-		}
+	m->m7_status = status;
+	m->rx_desc = rmem->base;
+	m->tx_desc = m->rx_desc + rx_desc;
+	m->rx_usb = PAGE_ALIGN(m->tx_desc + tx_desc);
+	end = PAGE_ALIGN(m->rx_usb + rx_usb);
+
+	if (end > rmem->base + rmem->size) {
+		dev_err(dev, "%u rx usb buffers need %llu KB, %s has %llu KB\n", rfnm_rx_usb_bufcnt,
+			(u64) (end - rmem->base) >> 10, rmem->name, (u64) rmem->size >> 10);
+		return -ENOMEM;
 	}
-*/	
-	//rfnm_iqflood_vmem_nocache = ioremap(RFNM_IQFLOOD_MEMADDR, RFNM_IQFLOOD_MEMSIZE);
-	//rfnm_iqflood_vmem = memremap(RFNM_IQFLOOD_MEMADDR, RFNM_IQFLOOD_MEMSIZE, MEMREMAP_WB ); 
 
-	//if(!rfnm_iqflood_vmem) {
-	//	dev_err(la9310_dev->dev, "Failed to map I/Q buffer\n");
-	//	err = ENOMEM;
-	//}
+	dev_info(dev, "%s at %pa, %llu of %llu KB used, %u rx usb buffers\n", rmem->name, &rmem->base,
+		(u64) (end - rmem->base) >> 10, (u64) rmem->size >> 10, rfnm_rx_usb_bufcnt);
 
-	//dev_info(la9310_dev->dev, "Mapped IQflood from %x to %p\n", RFNM_IQFLOOD_MEMADDR, rfnm_iqflood_vmem);
+	if (release_unused) {
+		rfnm_mem_release(dev, rmem, end);
+	}
 
+	return 0;
+}
 
-	gpio4_iomem = ioremap(0x30230000, SZ_4K);
-	gpio4 = (volatile unsigned int *) gpio4_iomem;
-	gpio4_initial = *gpio4;
+static void rfnm_dev_destroy(struct rfnm_dev *rfnm_dev)
+{
+	int i;
 
-	// disable gpio4
-	gpio4 = kzalloc(SZ_4K, GFP_KERNEL);
+	debugfs_remove_recursive(rfnm_dev->dfs_dir);
+	rfnm_flight_free(&rfnm_dev->flight);
+
+	for (i = 0; i < RFNM_DMA_REGIONS; i++)
+		rfnm_dma_region_unmap(&rfnm_dev->dma[i]);
+	if (rfnm_dev->bufdesc_rx)
+		memunmap(rfnm_dev->bufdesc_rx);
+	if (rfnm_dev->tx_wc)
+		rfnm_dma_vunmap_wc(rfnm_dev->bufdesc_tx);
+	else if (rfnm_dev->bufdesc_tx)
+		memunmap(rfnm_dev->bufdesc_tx);
+	if (rfnm_dev->rx_usb_buf)
+		memunmap(rfnm_dev->rx_usb_buf);
+	if (rfnm_dev->m7_status)
+		iounmap((void __iomem *) rfnm_dev->m7_status);
+
+	for (i = 0; i < RFNM_EP_CNT; i++) {
+		kfree(rfnm_dev->req_in[i]);
+		kfree(rfnm_dev->req_in_usb[i]);
+		kfree(rfnm_dev->req_out[i]);
+		kfree(rfnm_dev->req_out_usb[i]);
+	}
 
-	rfnm_bufdesc_rx = (struct rfnm_bufdesc_rx *) memremap(0x96400000, SZ_64M, MEMREMAP_WB);
-	dev_info(la9310_dev->dev, "Mapped rfnm_bufdesc_rx from %x to %lx size %d\n", 0x96400000, rfnm_bufdesc_rx, (sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT));
+	kfree(rfnm_dev->rx_sg);
+	rfnm_tx_interp_free(rfnm_dev->tx_interp);
+	rfnm_tx_interp_free(rfnm_dev->tx_interp_next);
+	kfree(rfnm_dev->usb_config_buffer);
+	kfree(rfnm_dev);
+}
 
-	rfnm_bufdesc_tx = (struct rfnm_bufdesc_tx *) memremap(0x96400000 + (sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT), SZ_64M, MEMREMAP_WB);
-	dev_info(la9310_dev->dev, "Mapped rfnm_bufdesc_tx from %x to %lx size %d\n", 0x96400000 + (sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT), rfnm_bufdesc_tx, (sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT));
+// the streaming pipeline of one LA9310, its threads are started separately
+static struct rfnm_dev *rfnm_dev_create(struct la9310_dev *la9310_dev, int id)
+{
+	struct rfnm_dev *rfnm_dev;
+	struct rfnm_mem_layout mem;
+	int err;
 
-	rfnm_rx_usb_buf = (struct rfnm_rx_usb_buf *) memremap(
-						0x96400000 +  (sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT) + SZ_64M, 
-						sizeof(struct rfnm_rx_usb_buf) * RFNM_RX_USB_BUF_SIZE, MEMREMAP_WB);
+	err = rfnm_mem_layout(la9310_dev->dev, id, &mem);
+	if (err)
+		return ERR_PTR(err);
 
-	dev_info(la9310_dev->dev, "Mapped rfnm_rx_usb_buf from %x to %lx size %d\n", 
-			0x96400000 +  (sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT) + SZ_64M, 
-			rfnm_rx_usb_buf, sizeof(struct rfnm_rx_usb_buf) * RFNM_RX_USB_BUF_SIZE);
+	rfnm_dev = kzalloc(sizeof(struct rfnm_dev), GFP_KERNEL);
+	if (!rfnm_dev)
+		return ERR_PTR(-ENOMEM);
 
+	rfnm_dev->la9310_dev = la9310_dev;
+	rfnm_dev->id = id;
+	rfnm_dev->tx_wc = tx_wc;
+
+	init_waitqueue_head(&rfnm_dev->wq_in);
+	init_waitqueue_head(&rfnm_dev->wq_out);
+	init_waitqueue_head(&rfnm_dev->wq_usb);
+	init_waitqueue_head(&rfnm_dev->wq_epoch);
+	INIT_DELAYED_WORK(&rfnm_dev->health_work, rfnm_health_work);
+	INIT_DELAYED_WORK(&rfnm_dev->restart_timeout, rfnm_restart_timeout);
+	spin_lock_init(&rfnm_dev->restart_lock);
+	err = rfnm_flight_init(&rfnm_dev->flight, la9310_dev->name, flight);
+	if (err)
+		goto fail;
+	rfnm_dev->poll[RFNM_POLL_RX].budget = rx_budget;
+	rfnm_dev->poll[RFNM_POLL_TX].budget = tx_budget;
+	rfnm_dev->poll[RFNM_POLL_USB].budget = usb_budget;
+	rfnm_dev->poll_idle_us = poll_idle_us;
+	spin_lock_init(&rfnm_dev->tx_interp_lock);
+	spin_lock_init(&rfnm_dev->corr_lock);
+	spin_lock_init(&rfnm_dev->rx_tap_lock);
+	rfnm_corr_reset(rfnm_dev->tx_corr);
+	rfnm_corr_reset(rfnm_dev->rx_corr);
 
-	//rfnm_rx_usb_buf = kzalloc((sizeof(struct rfnm_rx_usb_buf) * RFNM_RX_USB_BUF_SIZE), GFP_KERNEL);
-	rfnm_m7_status = (struct rfnm_m7_status *) ioremap((0x00900000 + 0x1000), SZ_4K);
+	rfnm_dev->usb_config_buffer = kzalloc(CONFIG_DESCRIPTOR_MAX_SIZE, GFP_KERNEL);
 
+	rfnm_dev->bufdesc_rx = (struct rfnm_bufdesc_rx *) memremap(mem.rx_desc, sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT, MEMREMAP_WB);
+	dev_info(la9310_dev->dev, "Mapped rfnm_bufdesc_rx from %pa to %px size %zu\n", &mem.rx_desc, rfnm_dev->bufdesc_rx, (sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT));
 
+	if (rfnm_dev->tx_wc) {
+		rfnm_dev->bufdesc_tx = (struct rfnm_bufdesc_tx *) rfnm_dma_vmap_wc(mem.tx_desc, sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT);
+		if (!rfnm_dev->bufdesc_tx) {
+			dev_warn(la9310_dev->dev, "Can't map rfnm_bufdesc_tx write-combining, using the cache\n");
+			rfnm_dev->tx_wc = false;
+		}
+	}
+	if (!rfnm_dev->tx_wc)
+		rfnm_dev->bufdesc_tx = (struct rfnm_bufdesc_tx *) memremap(mem.tx_desc, sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT, MEMREMAP_WB);
+	dev_info(la9310_dev->dev, "Mapped rfnm_bufdesc_tx from %pa to %px size %zu\n", &mem.tx_desc, rfnm_dev->bufdesc_tx, (sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT));
 
-	
+	rfnm_dev->rx_usb_buf = (struct rfnm_rx_usb_buf *) memremap(mem.rx_usb, sizeof(struct rfnm_rx_usb_buf) * rfnm_rx_usb_bufcnt, MEMREMAP_WB);
+	dev_info(la9310_dev->dev, "Mapped rfnm_rx_usb_buf from %pa to %px size %zu\n", &mem.rx_usb, rfnm_dev->rx_usb_buf, sizeof(struct rfnm_rx_usb_buf) * rfnm_rx_usb_bufcnt);
 
+	rfnm_dev->rx_sg = kcalloc(rfnm_rx_usb_bufcnt * 2, sizeof(struct scatterlist), GFP_KERNEL);
+	if (!rfnm_dev->rx_sg) {
+		err = -ENOMEM;
+		goto fail;
+	}
 
+	/*
+	 * The LA9310 reads and writes the descriptors, so they are synced against
+	 * its device. The rx usb buffers are the USB controller's, the udc maps
+	 * every request against its own device when it is queued.
+	 */
+	err = rfnm_dma_region_map(&rfnm_dev->dma[RFNM_DMA_BUFDESC_RX], la9310_dev->dev, "bufdesc_rx", rfnm_dev->bufdesc_rx,
+				sizeof(struct rfnm_bufdesc_rx) * RFNM_ADC_BUFCNT, DMA_FROM_DEVICE);
+	if (!err && rfnm_dev->tx_wc)
+		err = rfnm_dma_region_map_wc(&rfnm_dev->dma[RFNM_DMA_BUFDESC_TX], la9310_dev->dev, "bufdesc_tx", rfnm_dev->bufdesc_tx,
+				sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT, DMA_TO_DEVICE);
+	else if (!err)
+		err = rfnm_dma_region_map(&rfnm_dev->dma[RFNM_DMA_BUFDESC_TX], la9310_dev->dev, "bufdesc_tx", rfnm_dev->bufdesc_tx,
+				sizeof(struct rfnm_bufdesc_tx) * RFNM_DAC_BUFCNT, DMA_TO_DEVICE);
+	if (err) {
+		dev_err(la9310_dev->dev, "Failed to map the streaming buffers\n");
+		goto fail;
+	}
 
+	rfnm_dev->m7_status = (struct rfnm_m7_status *) ioremap(mem.m7_status, SZ_4K);
+	if (!rfnm_dev->m7_status) {
+		err = -ENOMEM;
+		goto fail;
+	}
 
 	spin_lock_init(&rfnm_dev->rx_usb_cb.reader_lock);
 	spin_lock_init(&rfnm_dev->rx_usb_cb.writer_lock);
+	rfnm_dev->rx_usb_cb.req_slots = 1;
+	spin_lock_init(&rfnm_dev->ep_state_lock);
+
+	rfnm_reset_sm(rfnm_dev);
+
+	for(int e = 0; e < RFNM_EP_CNT; e++) {
+		struct rfnm_usb_req_buffer **queues[4] = {
+			&rfnm_dev->req_in[e], &rfnm_dev->req_in_usb[e],
+			&rfnm_dev->req_out[e], &rfnm_dev->req_out_usb[e],
+		};
+
+		for(int q = 0; q < 4; q++) {
+			*queues[q] = kzalloc(sizeof(struct rfnm_usb_req_buffer), GFP_KERNEL);
+			if (!*queues[q]) {
+				err = -ENOMEM;
+				goto fail;
+			}
 
+			INIT_LIST_HEAD(&(*queues[q])->active);
+			spin_lock_init(&(*queues[q])->list_lock);
+		}
+	}
 
+	rfnm_dev->dfs_dir = debugfs_create_dir(la9310_dev->name, dfs_rfnm_dir);
+	debugfs_create_file("stream_status", 0644, rfnm_dev->dfs_dir, rfnm_dev, &dfs_rfnm_stream_fops);
+	debugfs_create_file("tx_interp", 0644, rfnm_dev->dfs_dir, rfnm_dev, &dfs_rfnm_tx_interp_fops);
+	debugfs_create_file("tx_corr", 0644, rfnm_dev->dfs_dir, rfnm_dev, &dfs_rfnm_tx_corr_fops);
+	debugfs_create_file("rx_corr", 0644, rfnm_dev->dfs_dir, rfnm_dev, &dfs_rfnm_rx_corr_fops);
+	debugfs_create_u32("rx_dc_track", 0644, rfnm_dev->dfs_dir, &rfnm_dev->rx_dc_shift);
+	debugfs_create_u32("rx_budget", 0644, rfnm_dev->dfs_dir, &rfnm_dev->poll[RFNM_POLL_RX].budget);
+	debugfs_create_u32("tx_budget", 0644, rfnm_dev->dfs_dir, &rfnm_dev->poll[RFNM_POLL_TX].budget);
+	debugfs_create_u32("usb_budget", 0644, rfnm_dev->dfs_dir, &rfnm_dev->poll[RFNM_POLL_USB].budget);
+	debugfs_create_u32("poll_idle_us", 0644, rfnm_dev->dfs_dir, &rfnm_dev->poll_idle_us);
+	rfnm_dma_debugfs_init(rfnm_dev->dfs_dir, rfnm_dev->dma);
+	debugfs_create_file("health", 0444, rfnm_dev->dfs_dir, rfnm_dev, &dfs_rfnm_health_fops);
+	rfnm_flight_debugfs_init(rfnm_dev->dfs_dir, &rfnm_dev->flight);
+
+	return rfnm_dev;
+
+fail:
+	rfnm_dev_destroy(rfnm_dev);
+	return ERR_PTR(err);
+}
 
-	
+static void rfnm_devs_destroy(void)
+{
+	int i;
 
-	rfnm_reset_sm();
-	
+	for (i = 0; i < MAX_MODEM_INSTANCES; i++) {
+		if (rfnm_devs[i]) {
+			cancel_delayed_work_sync(&rfnm_devs[i]->health_work);
+			stop_sm(rfnm_devs[i]);
+			cancel_delayed_work_sync(&rfnm_devs[i]->restart_timeout);
+		}
+	}
 
-	rfnm_usb_req_buffer_in = kzalloc(sizeof(struct rfnm_usb_req_buffer), GFP_KERNEL);
-	if (!rfnm_usb_req_buffer_in)
-		return ERR_PTR(-ENOMEM);
+	for (i = 0; i < MAX_MODEM_INSTANCES; i++) {
+		if (rfnm_devs[i])
+			rfnm_dev_destroy(rfnm_devs[i]);
+		rfnm_devs[i] = NULL;
+	}
+	rfnm_usb_dev = NULL;
+}
 
-	INIT_LIST_HEAD(&rfnm_usb_req_buffer_in->active);
+static int __init la9310_rfnm_init(void)
+{
+	static const char * const usb_files[] = {
+		"stream_status", "tx_interp", "tx_corr", "rx_corr", "rx_dc_track", "dma_stats",
+	};
+	int err = 0, i;
+	struct la9310_dev *la9310_dev;
+	struct rfnm_dev *rfnm_dev;
+	char name[32];
 
-	rfnm_usb_req_buffer_in_usb = kzalloc(sizeof(struct rfnm_usb_req_buffer), GFP_KERNEL);
-	if (!rfnm_usb_req_buffer_in_usb)
-		return ERR_PTR(-ENOMEM);
+	init_completion(&setup_done);
+		
+	//hrtimer_init(&test_hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	//test_hrtimer.function = &test_hrtimer_handler;
+	//hrtimer_start(&test_hrtimer, ms_to_ktime(1), HRTIMER_MODE_REL);
 
-	INIT_LIST_HEAD(&rfnm_usb_req_buffer_in_usb->active);
+	dfs_rfnm_dir = debugfs_create_dir("rfnm", NULL);
+	rfnm_microbench_init(dfs_rfnm_dir);
 
-	rfnm_usb_req_buffer_out_usb = kzalloc(sizeof(struct rfnm_usb_req_buffer), GFP_KERNEL);
-	if (!rfnm_usb_req_buffer_out_usb)
-		return ERR_PTR(-ENOMEM);
+	tmp_usb_buffer_copy_to_be_deprecated =  kzalloc(500*1000, GFP_KERNEL);
 
-	INIT_LIST_HEAD(&rfnm_usb_req_buffer_out_usb->active);
+/*
+	for(i = 0; i < RFNM_IQFLOOD_BUFCNT; i++) {
+		rfnm_iqflood_buf[i] = kmalloc(RFNM_IQFLOOD_BUFSIZE, GFP_KERNEL);
+		if(!rfnm_iqflood_buf[i]) {
+			dev_err(la9310_dev->dev, "Failed to allocate memory for I/Q buffer\n");
+			err = ENOMEM;
+		}
+	}
+*/	
+	//rfnm_iqflood_vmem_nocache = ioremap(RFNM_IQFLOOD_MEMADDR, RFNM_IQFLOOD_MEMSIZE);
+	//rfnm_iqflood_vmem = memremap(RFNM_IQFLOOD_MEMADDR, RFNM_IQFLOOD_MEMSIZE, MEMREMAP_WB ); 
 
-	rfnm_usb_req_buffer_out = kzalloc(sizeof(struct rfnm_usb_req_buffer), GFP_KERNEL);
-	if (!rfnm_usb_req_buffer_out)
-		return ERR_PTR(-ENOMEM);
+	//if(!rfnm_iqflood_vmem) {
+	//	dev_err(la9310_dev->dev, "Failed to map I/Q buffer\n");
+	//	err = ENOMEM;
+	//}
 
-	INIT_LIST_HEAD(&rfnm_usb_req_buffer_out->active);
+	//dev_info(la9310_dev->dev, "Mapped IQflood from %x to %p\n", RFNM_IQFLOOD_MEMADDR, rfnm_iqflood_vmem);
 
-	
-	spin_lock_init(&rfnm_usb_req_buffer_in->list_lock);
-	spin_lock_init(&rfnm_usb_req_buffer_out->list_lock);
+
+	gpio4_iomem = ioremap(0x30230000, SZ_4K);
+	gpio4 = (volatile unsigned int *) gpio4_iomem;
+	gpio4_initial = *gpio4;
+
+	// disable gpio4
+	gpio4 = kzalloc(SZ_4K, GFP_KERNEL);
+
+	// every adc needs room for a run in flight and one being filled
+	rfnm_rx_usb_bufcnt = max_t(uint, rx_usb_bufs, 4 * 2 * RFNM_RX_REQ_SLOTS_MAX);
+
+	// one pipeline per LA9310, a card without its buffers is left out
+	for (i = 0; i < MAX_MODEM_INSTANCES; i++) {
+		snprintf(name, sizeof(name), "nlm%d", i);
+		la9310_dev = get_la9310_dev_byname(name);
+		if (la9310_dev == NULL)
+			continue;
+
+		rfnm_dev = rfnm_dev_create(la9310_dev, i);
+		if (IS_ERR(rfnm_dev)) {
+			dev_err(la9310_dev->dev, "No streaming pipeline for %s: %ld\n", name, PTR_ERR(rfnm_dev));
+			continue;
+		}
+		rfnm_devs[i] = rfnm_dev;
+	}
+
+	if (usb_dev >= MAX_MODEM_INSTANCES || !rfnm_devs[usb_dev]) {
+		pr_err("No streaming pipeline on nlm%u for the usb function\n", usb_dev);
+		rfnm_devs_destroy();
+		debugfs_remove_recursive(dfs_rfnm_dir);
+		kfree(tmp_usb_buffer_copy_to_be_deprecated);
+		return -ENODEV;
+	}
+	rfnm_usb_dev = rfnm_devs[usb_dev];
+	rfnm_usb_dev->usb = 1;
+
+	// rfnm/<file> as before the pipelines had their own directory
+	for (i = 0; i < ARRAY_SIZE(usb_files); i++) {
+		snprintf(name, sizeof(name), "%s/%s", rfnm_usb_dev->la9310_dev->name, usb_files[i]);
+		debugfs_create_symlink(usb_files[i], dfs_rfnm_dir, name);
+	}
 
 	
 	/*err = usb_gadget_probe_driver(&rfnm_usb_driver);
@@ -1918,9 +3557,9 @@ static int __init la9310_rfnm_init(void)
 
 
 	// callback should be called when certain everything is inited
-	err = rfnm_callback_init(la9310_dev);
+	err = rfnm_callback_init(rfnm_usb_dev->la9310_dev);
 	if (err < 0)
-		dev_err(la9310_dev->dev, "Failed to register RFNM Callback\n");
+		dev_err(rfnm_usb_dev->la9310_dev->dev, "Failed to register RFNM Callback\n");
 
 
 	//schedule_work(&rfnm_tasklet_in);
@@ -1932,7 +3571,12 @@ static int __init la9310_rfnm_init(void)
 	kthread_run(rfnm_handler_out, NULL, "TX");
 	kthread_run(rfnm_handler_usb, NULL, "USB");
 #else
-	start_sm();
+	for (i = 0; i < MAX_MODEM_INSTANCES; i++) {
+		if (rfnm_devs[i]) {
+			start_sm(rfnm_devs[i]);
+			rfnm_health_start(rfnm_devs[i]);
+		}
+	}
 #endif
 
 #if 1
@@ -1961,25 +3605,23 @@ static int __init la9310_rfnm_init(void)
 
 static void  __exit la9310_rfnm_exit(void)
 {
-	int err = 0, i;
-	struct la9310_dev *la9310_dev = get_la9310_dev_byname("nlm0");
+	int err = 0;
 
-	if (la9310_dev == NULL) {
-		pr_err("No LA9310 device name found during %s\n", __func__);
+	if (rfnm_usb_dev == NULL) {
+		pr_err("No streaming pipeline found during %s\n", __func__);
 		return;
 	}
 
 	err = rfnm_callback_deinit();
 	if (err < 0)
-		dev_err(la9310_dev->dev, "Failed to unregister V2H Callback\n");
+		dev_err(rfnm_usb_dev->la9310_dev->dev, "Failed to unregister V2H Callback\n");
 
 	
 
-	stop_sm();
+	rfnm_devs_destroy();
 
-	kfree(rfnm_dev);
 	kfree(tmp_usb_buffer_copy_to_be_deprecated);
-	//kfree(rfnm_rx_usb_buf);
+	//kfree(rfnm_dev->rx_usb_buf);
 	
 
 	//tasklet_kill(&rfnm_tasklet_in);
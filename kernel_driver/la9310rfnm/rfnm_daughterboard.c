@@ -39,10 +39,13 @@
 #include <linux/of.h>
 #include <linux/platform_device.h>
 #include <linux/spi/spi.h>
+#include <linux/debugfs.h>
 
 //#include "rfnm_types.h"
 #include <linux/rfnm-shared.h>
 
+#include "rfnm_stream.h"
+
 struct rfnm_dgb *rfnm_dgb[2];
 struct rfnm_bootconfig *bootcfg;
 volatile struct rfnm_m7_dgb *m7_dgb;
@@ -281,12 +284,33 @@ int rfnm_dgb_rx_set(struct rfnm_dgb *rfnm_dgb_dt, struct rfnm_api_rx_ch * rx_ch)
 
 
 
+// the channel list being applied, only touched by the worker
 struct rfnm_dev_tx_ch_list r_tx_chlist_work;
 struct rfnm_dev_rx_ch_list r_rx_chlist_work;
 
+static rfnm_chlist_done_fn rfnm_chlist_done_cb;
+
 #include <linux/workqueue.h>
 
-void rfnm_apply_dev_tx_chlist_work(struct work_struct * tasklet_data) {
+// DECLARE_WORK further down
+extern struct work_struct rfnm_chlist_work;
+
+void rfnm_set_chlist_done_cb(rfnm_chlist_done_fn fn) {
+	WRITE_ONCE(rfnm_chlist_done_cb, fn);
+	// let a running work item finish with the old callback
+	flush_work(&rfnm_chlist_work);
+}
+EXPORT_SYMBOL(rfnm_set_chlist_done_cb);
+
+static void rfnm_chlist_done(int txrx, uint32_t cc) {
+	rfnm_chlist_done_fn fn = READ_ONCE(rfnm_chlist_done_cb);
+
+	if(fn) {
+		fn(txrx, cc);
+	}
+}
+
+static void rfnm_run_tx_chlist(void) {
 	int i, q, d = 0;
 
 	for(i = 0; i < 2; i++) {
@@ -307,14 +331,10 @@ void rfnm_apply_dev_tx_chlist_work(struct work_struct * tasklet_data) {
 	}
 	rfnm_la9310_stream(rfnm_tx_dac_s, rfnm_rx_adc_s);
 	rfnm_dev_work_res.cc_rx = r_rx_chlist_work.cc;
+	rfnm_chlist_done(RFNM_EVT_CH_TX, r_tx_chlist_work.cc);
 }
-DECLARE_WORK(rfnm_tx_chlist_work, &rfnm_apply_dev_tx_chlist_work);
 
-
-
-
-
-void rfnm_apply_dev_rx_chlist_work(struct work_struct * tasklet_data) {
+static void rfnm_run_rx_chlist(void) {
 	int i, q, d = 0;
 
 	for(i = 0; i < 2; i++) {
@@ -336,25 +356,142 @@ void rfnm_apply_dev_rx_chlist_work(struct work_struct * tasklet_data) {
 
 	rfnm_la9310_stream(rfnm_tx_dac_s, rfnm_rx_adc_s);
 	rfnm_dev_work_res.cc_rx = r_rx_chlist_work.cc;
+	rfnm_chlist_done(RFNM_EVT_CH_RX, rfnm_dev_work_res.cc_rx);
 }
 
-DECLARE_WORK(rfnm_rx_chlist_work , &rfnm_apply_dev_rx_chlist_work);
+/*
+ * Channel list commands from the host, applied in order by one work item.
+ * A command that arrives while the previous one of the same direction is
+ * still waiting is merged into it: the host always sends the full list, so
+ * the merged command carries the newest list and the union of the apply
+ * masks.
+ */
+#define RFNM_CHLIST_QLEN 16
 
-void rfnm_apply_dev_tx_chlist(struct rfnm_dev_tx_ch_list * r_chlist) {
-	memcpy(&r_tx_chlist_work, r_chlist, sizeof(struct rfnm_dev_tx_ch_list));
-	schedule_work(&rfnm_tx_chlist_work);
+struct rfnm_chlist_cmd {
+	int txrx;
+	union {
+		struct rfnm_dev_tx_ch_list tx;
+		struct rfnm_dev_rx_ch_list rx;
+	};
+};
+
+static struct rfnm_chlist_cmd rfnm_chlist_q[RFNM_CHLIST_QLEN];
+static unsigned rfnm_chlist_head, rfnm_chlist_tail;
+static DEFINE_SPINLOCK(rfnm_chlist_lock);
+
+// in debugfs as rfnm_daughterboard/chlist_coalesced and chlist_dropped
+static u32 rfnm_chlist_coalesced;
+static u32 rfnm_chlist_dropped;
+static struct dentry *rfnm_dgb_dfs;
+
+void rfnm_chlist_work_fn(struct work_struct * tasklet_data) {
+	unsigned long flags;
+	int txrx;
+
+	while(1) {
+		spin_lock_irqsave(&rfnm_chlist_lock, flags);
+
+		if(rfnm_chlist_tail == rfnm_chlist_head) {
+			spin_unlock_irqrestore(&rfnm_chlist_lock, flags);
+			break;
+		}
+
+		txrx = rfnm_chlist_q[rfnm_chlist_tail].txrx;
+		if(txrx == RFNM_EVT_CH_TX) {
+			memcpy(&r_tx_chlist_work, &rfnm_chlist_q[rfnm_chlist_tail].tx, sizeof(struct rfnm_dev_tx_ch_list));
+		} else {
+			memcpy(&r_rx_chlist_work, &rfnm_chlist_q[rfnm_chlist_tail].rx, sizeof(struct rfnm_dev_rx_ch_list));
+		}
+		rfnm_chlist_tail = (rfnm_chlist_tail + 1) % RFNM_CHLIST_QLEN;
+
+		spin_unlock_irqrestore(&rfnm_chlist_lock, flags);
+
+		if(txrx == RFNM_EVT_CH_TX) {
+			rfnm_run_tx_chlist();
+		} else {
+			rfnm_run_rx_chlist();
+		}
+	}
 }
-EXPORT_SYMBOL(rfnm_apply_dev_tx_chlist);
+DECLARE_WORK(rfnm_chlist_work, &rfnm_chlist_work_fn);
 
-void rfnm_apply_dev_rx_chlist(struct rfnm_dev_rx_ch_list * r_chlist) {
+// called with rfnm_chlist_lock held, returns the pending command a new one can merge into
+static struct rfnm_chlist_cmd *rfnm_chlist_merge_target(int txrx) {
+	unsigned last;
+
+	if(rfnm_chlist_tail == rfnm_chlist_head) {
+		return NULL;
+	}
+
+	last = (rfnm_chlist_head + RFNM_CHLIST_QLEN - 1) % RFNM_CHLIST_QLEN;
+	if(rfnm_chlist_q[last].txrx == txrx) {
+		return &rfnm_chlist_q[last];
+	}
+
+	if((rfnm_chlist_head + 1) % RFNM_CHLIST_QLEN != rfnm_chlist_tail) {
+		// room left, keep tx and rx commands in the order they came in
+		return NULL;
+	}
+
+	// full, merge into the newest pending command of the same direction
+	for(unsigned i = last; i != rfnm_chlist_tail; ) {
+		i = (i + RFNM_CHLIST_QLEN - 1) % RFNM_CHLIST_QLEN;
+		if(rfnm_chlist_q[i].txrx == txrx) {
+			return &rfnm_chlist_q[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void rfnm_chlist_queue(int txrx, const void *r_chlist) {
+	struct rfnm_chlist_cmd *cmd;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rfnm_chlist_lock, flags);
+
+	cmd = rfnm_chlist_merge_target(txrx);
 
-	if(work_pending(&rfnm_rx_chlist_work)) {
-		printk("Not scheduling work! bug... \n");
+	if(cmd) {
+		if(txrx == RFNM_EVT_CH_TX) {
+			typeof(cmd->tx.apply) apply = cmd->tx.apply;
+
+			memcpy(&cmd->tx, r_chlist, sizeof(struct rfnm_dev_tx_ch_list));
+			cmd->tx.apply |= apply;
+		} else {
+			typeof(cmd->rx.apply) apply = cmd->rx.apply;
+
+			memcpy(&cmd->rx, r_chlist, sizeof(struct rfnm_dev_rx_ch_list));
+			cmd->rx.apply |= apply;
+		}
+		rfnm_chlist_coalesced++;
+	} else if((rfnm_chlist_head + 1) % RFNM_CHLIST_QLEN == rfnm_chlist_tail) {
+		rfnm_chlist_dropped++;
+		printk("RFNM: channel list queue full, dropping %s command\n", txrx == RFNM_EVT_CH_TX ? "tx" : "rx");
 	} else {
-		memcpy(&r_rx_chlist_work, r_chlist, sizeof(struct rfnm_dev_rx_ch_list));
-		schedule_work(&rfnm_rx_chlist_work);
+		cmd = &rfnm_chlist_q[rfnm_chlist_head];
+		cmd->txrx = txrx;
+		if(txrx == RFNM_EVT_CH_TX) {
+			memcpy(&cmd->tx, r_chlist, sizeof(struct rfnm_dev_tx_ch_list));
+		} else {
+			memcpy(&cmd->rx, r_chlist, sizeof(struct rfnm_dev_rx_ch_list));
+		}
+		rfnm_chlist_head = (rfnm_chlist_head + 1) % RFNM_CHLIST_QLEN;
 	}
-	
+
+	spin_unlock_irqrestore(&rfnm_chlist_lock, flags);
+
+	schedule_work(&rfnm_chlist_work);
+}
+
+void rfnm_apply_dev_tx_chlist(struct rfnm_dev_tx_ch_list * r_chlist) {
+	rfnm_chlist_queue(RFNM_EVT_CH_TX, r_chlist);
+}
+EXPORT_SYMBOL(rfnm_apply_dev_tx_chlist);
+
+void rfnm_apply_dev_rx_chlist(struct rfnm_dev_rx_ch_list * r_chlist) {
+	rfnm_chlist_queue(RFNM_EVT_CH_RX, r_chlist);
 }
 EXPORT_SYMBOL(rfnm_apply_dev_rx_chlist);
 
@@ -1096,6 +1233,10 @@ static __init int rfnm_daughterboard_init(void)
 
 	memset(&rfnm_rx_adc_s[0], 0, 4);
 	rfnm_tx_dac_s = 0;
+
+	rfnm_dgb_dfs = debugfs_create_dir("rfnm_daughterboard", NULL);
+	debugfs_create_u32("chlist_coalesced", 0444, rfnm_dgb_dfs, &rfnm_chlist_coalesced);
+	debugfs_create_u32("chlist_dropped", 0444, rfnm_dgb_dfs, &rfnm_chlist_dropped);
 		
 /*
 	struct device *dev;
@@ -1121,6 +1262,7 @@ static __exit void rfnm_daughterboard_exit(void)
 	//kobject_put(&foo->kobj);
 	//kset_unregister(rfnm_dgb_primary_kset);
 
+	debugfs_remove_recursive(rfnm_dgb_dfs);
 	memunmap(bootcfg);
 }
 
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_dma.c - streaming DMA API handoffs of the shared buffers
+ *
+ * The regions are memremap'd WB, for System RAM that is the linear map,
+ * which is what dma_sync_single_* operate on. rfnm/nlm<N>/dma_stats prints
+ * per region how many syncs ran, over how many bytes and how long they took.
+ */
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <asm/cacheflush.h>
+
+#include "rfnm_dma.h"
+
+int rfnm_dma_region_map(struct rfnm_dma_region *r, struct device *dev, const char *name,
+			void *virt, size_t size, enum dma_data_direction dir)
+{
+	r->name = name;
+	r->dev = dev;
+	r->virt = virt;
+	r->size = size;
+	r->dir = dir;
+	r->mapped = 0;
+	r->wc = 0;
+	atomic64_set(&r->syncs, 0);
+	atomic64_set(&r->bytes, 0);
+	atomic64_set(&r->ns, 0);
+	r->max_ns = 0;
+
+	if (!virt)
+		return -ENOMEM;
+
+	// dma_sync_single_* get back to the cpu address with phys_to_virt
+	if (!virt_addr_valid(virt) || !virt_addr_valid(virt + size - 1)) {
+		dev_warn(dev, "%s is not in the linear map, cache maintenance through cache.S\n", name);
+		return 0;
+	}
+
+	r->dma = dma_map_single(dev, virt, size, dir);
+	if (dma_mapping_error(dev, r->dma)) {
+		dev_warn(dev, "%s: dma_map_single failed, cache maintenance through cache.S\n", name);
+		return 0;
+	}
+
+	r->mapped = 1;
+	return 0;
+}
+
+int rfnm_dma_region_map_wc(struct rfnm_dma_region *r, struct device *dev, const char *name,
+			   void *virt, size_t size, enum dma_data_direction dir)
+{
+	// only for the accounting, there is nothing to map
+	rfnm_dma_region_map(r, dev, name, NULL, size, dir);
+	r->virt = virt;
+	r->wc = 1;
+
+	return virt ? 0 : -ENOMEM;
+}
+
+void *rfnm_dma_vmap_wc(phys_addr_t phys, size_t size)
+{
+	unsigned long i, off = offset_in_page(phys), n = PAGE_ALIGN(size + off) >> PAGE_SHIFT;
+	unsigned long pfn = PHYS_PFN(phys);
+	unsigned long lin;
+	struct page **pages;
+	void *virt;
+
+	// pfn_valid also holds for no-map memory, only the linear map has the alias cleaned below
+	if (!virt_addr_valid(phys_to_virt(phys)) || !virt_addr_valid(phys_to_virt(phys + size - 1)))
+		return NULL;
+
+	pages = kvmalloc_array(n, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return NULL;
+
+	for (i = 0; i < n; i++)
+		pages[i] = pfn_to_page(pfn + i);
+
+	// dirty lines of the cacheable alias would be written back over the stream later
+	lin = (unsigned long) phys_to_virt(phys);
+	dcache_clean_poc(lin, lin + size);
+	dcache_inval_poc(lin, lin + size);
+
+	virt = vmap(pages, n, VM_MAP, pgprot_writecombine(PAGE_KERNEL));
+	kvfree(pages);
+
+	return virt ? virt + off : NULL;
+}
+
+void rfnm_dma_vunmap_wc(void *virt)
+{
+	if (virt)
+		vunmap((void *) ((unsigned long) virt & PAGE_MASK));
+}
+
+void rfnm_dma_region_unmap(struct rfnm_dma_region *r)
+{
+	if (r->mapped) {
+		// the buffers are not looked at again, no need for a last sync
+		dma_unmap_single_attrs(r->dev, r->dma, r->size, r->dir, DMA_ATTR_SKIP_CPU_SYNC);
+		r->mapped = 0;
+	}
+}
+
+static void rfnm_dma_account(struct rfnm_dma_region *r, size_t len, u64 t0)
+{
+	u64 ns = ktime_get_ns() - t0;
+
+	atomic64_inc(&r->syncs);
+	atomic64_add(len, &r->bytes);
+	atomic64_add(ns, &r->ns);
+	// racy, good enough for a maximum
+	if (ns > READ_ONCE(r->max_ns))
+		WRITE_ONCE(r->max_ns, ns);
+}
+
+void rfnm_dma_for_cpu(struct rfnm_dma_region *r, const void *p, size_t len)
+{
+	size_t off = (const u8 *) p - (const u8 *) r->virt;
+	u64 t0;
+
+	if (!len)
+		return;
+
+	t0 = ktime_get_ns();
+	if (r->wc)
+		rmb();
+	else if (r->mapped)
+		dma_sync_single_for_cpu(r->dev, r->dma + off, len, r->dir);
+	else if (r->dir != DMA_TO_DEVICE)
+		dcache_inval_poc((unsigned long) p, (unsigned long) p + len);
+	rfnm_dma_account(r, len, t0);
+}
+
+void rfnm_dma_for_device(struct rfnm_dma_region *r, const void *p, size_t len)
+{
+	size_t off = (const u8 *) p - (const u8 *) r->virt;
+	u64 t0;
+
+	if (!len)
+		return;
+
+	t0 = ktime_get_ns();
+	if (r->wc)
+		// drain the write-combining buffers, dsb st
+		wmb();
+	else if (r->mapped)
+		dma_sync_single_for_device(r->dev, r->dma + off, len, r->dir);
+	else
+		dcache_clean_poc((unsigned long) p, (unsigned long) p + len);
+	rfnm_dma_account(r, len, t0);
+}
+
+static void rfnm_dma_ring(struct rfnm_dma_region *r, size_t elem, u32 ring, u32 first, u32 cnt,
+			  void (*sync)(struct rfnm_dma_region *, const void *, size_t))
+{
+	const u8 *base = r->virt;
+	u32 n = min(cnt, ring - first);
+
+	sync(r, base + first * elem, n * elem);
+	sync(r, base, (cnt - n) * elem);
+}
+
+void rfnm_dma_ring_for_cpu(struct rfnm_dma_region *r, size_t elem, u32 ring, u32 first, u32 cnt)
+{
+	rfnm_dma_ring(r, elem, ring, first, cnt, rfnm_dma_for_cpu);
+}
+
+void rfnm_dma_ring_for_device(struct rfnm_dma_region *r, size_t elem, u32 ring, u32 first, u32 cnt)
+{
+	rfnm_dma_ring(r, elem, ring, first, cnt, rfnm_dma_for_device);
+}
+
+static int dfs_rfnm_dma_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const dirs[] = {
+		[DMA_BIDIRECTIONAL] = "bidir",
+		[DMA_TO_DEVICE] = "to_dev",
+		[DMA_FROM_DEVICE] = "from_dev",
+		[DMA_NONE] = "none",
+	};
+	struct rfnm_dma_region *regions = s->private;
+	int i;
+
+	seq_printf(s, "%-12s %-8s %-7s %10s %12s %8s %8s %8s\n",
+		"region", "dir", "mode", "syncs", "KB", "avg ns", "max ns", "ns/KB");
+
+	for (i = 0; i < RFNM_DMA_REGIONS; i++) {
+		struct rfnm_dma_region *r = &regions[i];
+		u64 syncs = atomic64_read(&r->syncs);
+		u64 bytes = atomic64_read(&r->bytes);
+		u64 ns = atomic64_read(&r->ns);
+
+		if (!r->name)
+			continue;
+
+		seq_printf(s, "%-12s %-8s %-7s %10llu %12llu %8llu %8llu %8llu\n",
+			r->name, dirs[r->dir], r->wc ? "wc" : r->mapped ? "dma" : "cache.S",
+			syncs, bytes >> 10,
+			syncs ? div64_u64(ns, syncs) : 0, READ_ONCE(r->max_ns),
+			bytes >> 10 ? div64_u64(ns, bytes >> 10) : 0);
+	}
+
+	return 0;
+}
+
+static int dfs_rfnm_dma_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dfs_rfnm_dma_stats_show, inode->i_private);
+}
+
+static const struct file_operations dfs_rfnm_dma_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_dma_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void rfnm_dma_debugfs_init(struct dentry *dir, struct rfnm_dma_region *regions)
+{
+	debugfs_create_file("dma_stats", 0444, dir, regions, &dfs_rfnm_dma_stats_fops);
+}
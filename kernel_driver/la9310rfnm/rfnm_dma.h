@@ -0,0 +1,83 @@
+#ifndef __RFNM_DMA_H__
+#define __RFNM_DMA_H__
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/dma-direction.h>
+
+/*
+ * Cache maintenance of the buffers shared with the LA9310, through the
+ * streaming DMA API. The rx usb buffers are left to the udc, which maps
+ * every request it is given against the USB controller.
+ *
+ * Each region is mapped once with dma_map_single and every handoff is a
+ * dma_sync_single_for_cpu/for_device over the buffers involved, nothing
+ * more. If the memory isn't in the linear map the DMA API can't reach it,
+ * the region then falls back to the dcache_*_poc copies in cache.S on the
+ * same ranges. Every sync is counted and timed, rfnm/nlm<N>/dma_stats in
+ * debugfs.
+ *
+ * A region the cpu only writes can instead be mapped write-combining
+ * (Normal-NC) with rfnm_dma_vmap_wc, the stores go around the cache and a
+ * handoff is just a barrier draining them.
+ */
+
+struct device;
+struct dentry;
+
+struct rfnm_dma_region {
+	const char *name;
+	struct device *dev;
+	void *virt;
+	size_t size;
+	dma_addr_t dma;
+	enum dma_data_direction dir;
+	// 0 when cache.S does the maintenance
+	int mapped;
+	// written through a write-combining alias, nothing to maintain
+	int wc;
+
+	atomic64_t syncs;
+	atomic64_t bytes;
+	atomic64_t ns;
+	u64 max_ns;
+};
+
+// the regions of one streaming pipeline, rfnm_dev->dma[]
+enum {
+	// streaming ring of LA9310 buffer descriptors, rfnm_handler_in reads
+	RFNM_DMA_BUFDESC_RX,
+	// rfnm_handler_out writes, the LA9310 reads
+	RFNM_DMA_BUFDESC_TX,
+	RFNM_DMA_REGIONS,
+};
+
+int rfnm_dma_region_map(struct rfnm_dma_region *r, struct device *dev, const char *name,
+			void *virt, size_t size, enum dma_data_direction dir);
+int rfnm_dma_region_map_wc(struct rfnm_dma_region *r, struct device *dev, const char *name,
+			   void *virt, size_t size, enum dma_data_direction dir);
+void rfnm_dma_region_unmap(struct rfnm_dma_region *r);
+
+/*
+ * Write-combining kernel mapping of linear mapped memory at phys, the
+ * cacheable alias is cleaned and invalidated first and must not be
+ * touched while this one is in use
+ */
+void *rfnm_dma_vmap_wc(phys_addr_t phys, size_t size);
+void rfnm_dma_vunmap_wc(void *virt);
+
+// len bytes at p, inside the region, become visible to the cpu / the device
+void rfnm_dma_for_cpu(struct rfnm_dma_region *r, const void *p, size_t len);
+void rfnm_dma_for_device(struct rfnm_dma_region *r, const void *p, size_t len);
+
+/*
+ * cnt ring elements of elem bytes from first, the ring starts at the region
+ * and has ring elements, split at the wrap
+ */
+void rfnm_dma_ring_for_cpu(struct rfnm_dma_region *r, size_t elem, u32 ring, u32 first, u32 cnt);
+void rfnm_dma_ring_for_device(struct rfnm_dma_region *r, size_t elem, u32 ring, u32 first, u32 cnt);
+
+// dma_stats in dir, over the RFNM_DMA_REGIONS regions
+void rfnm_dma_debugfs_init(struct dentry *dir, struct rfnm_dma_region *regions);
+
+#endif
@@ -0,0 +1,500 @@
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/prefetch.h>
+#include <asm/neon.h>
+#include <asm/neon-intrinsics.h>
+
+#include "rfnm_dsp.h"
+
+// sin(x) for x in [0, pi/2], Q15, 256 steps
+static const int16_t rfnm_sin_quarter[257] = {
+	0, 201, 402, 603, 804, 1005, 1206, 1407, 1608, 1809, 2009, 2210,
+	2411, 2611, 2811, 3012, 3212, 3412, 3612, 3812, 4011, 4211, 4410, 4609,
+	4808, 5007, 5205, 5404, 5602, 5800, 5998, 6195, 6393, 6590, 6787, 6983,
+	7180, 7376, 7571, 7767, 7962, 8157, 8351, 8546, 8740, 8933, 9127, 9319,
+	9512, 9704, 9896, 10088, 10279, 10469, 10660, 10850, 11039, 11228, 11417, 11605,
+	11793, 11980, 12167, 12354, 12540, 12725, 12910, 13095, 13279, 13463, 13646, 13828,
+	14010, 14192, 14373, 14553, 14733, 14912, 15091, 15269, 15447, 15624, 15800, 15976,
+	16151, 16326, 16500, 16673, 16846, 17018, 17190, 17361, 17531, 17700, 17869, 18037,
+	18205, 18372, 18538, 18703, 18868, 19032, 19195, 19358, 19520, 19681, 19841, 20001,
+	20160, 20318, 20475, 20632, 20788, 20943, 21097, 21251, 21403, 21555, 21706, 21856,
+	22006, 22154, 22302, 22449, 22595, 22740, 22884, 23028, 23170, 23312, 23453, 23593,
+	23732, 23870, 24008, 24144, 24279, 24414, 24548, 24680, 24812, 24943, 25073, 25202,
+	25330, 25457, 25583, 25708, 25833, 25956, 26078, 26199, 26320, 26439, 26557, 26674,
+	26791, 26906, 27020, 27133, 27246, 27357, 27467, 27576, 27684, 27791, 27897, 28002,
+	28106, 28209, 28311, 28411, 28511, 28610, 28707, 28803, 28899, 28993, 29086, 29178,
+	29269, 29359, 29448, 29535, 29622, 29707, 29792, 29875, 29957, 30038, 30118, 30196,
+	30274, 30350, 30425, 30499, 30572, 30644, 30715, 30784, 30853, 30920, 30986, 31050,
+	31114, 31177, 31238, 31298, 31357, 31415, 31471, 31527, 31581, 31634, 31686, 31737,
+	31786, 31834, 31881, 31927, 31972, 32015, 32058, 32099, 32138, 32177, 32214, 32251,
+	32286, 32319, 32352, 32383, 32413, 32442, 32470, 32496, 32522, 32546, 32568, 32590,
+	32610, 32629, 32647, 32664, 32679, 32693, 32706, 32718, 32729, 32738, 32746, 32753,
+	32758, 32762, 32766, 32767, 32767,
+};
+
+// phase is a full turn over 2^32
+int16_t rfnm_sin_q15(uint32_t phase)
+{
+	uint32_t pos = (phase >> 14) & 0xffff;
+	uint32_t idx, frac;
+	int32_t v;
+
+	if (phase & (1 << 30)) {
+		pos = 0x10000 - pos;
+	}
+
+	idx = pos >> 8;
+	frac = pos & 0xff;
+
+	if (idx == 256) {
+		v = rfnm_sin_quarter[256];
+	} else {
+		v = rfnm_sin_quarter[idx];
+		v += ((rfnm_sin_quarter[idx + 1] - v) * (int32_t) frac) >> 8;
+	}
+
+	return (phase & (1u << 31)) ? -v : v;
+}
+EXPORT_SYMBOL(rfnm_sin_q15);
+
+static inline int16_t rfnm_sat16(int32_t v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return v;
+}
+
+/*
+ * Windowed sinc, cutoff at the input Nyquist rate, Hann window over
+ * factor * RFNM_TX_INTERP_TAPS points. Integer only, so it can run from
+ * any context without touching the FP state.
+ */
+static void rfnm_tx_interp_design(struct rfnm_tx_interp *ip)
+{
+	uint32_t len = ip->factor * RFNM_TX_INTERP_TAPS;
+	int32_t *h;
+	int64_t sum;
+	int i, j, k;
+
+	h = kcalloc(len, sizeof(int32_t), GFP_KERNEL);
+	if (!h) {
+		// fall back to a zero order hold
+		for (k = 0; k < ip->factor; k++) {
+			memset(ip->coef[k], 0, sizeof(ip->coef[k]));
+			ip->coef[k][0] = 32767;
+		}
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		// distance from the centre in half samples: t / (2 * factor) input samples
+		int32_t t = 2 * i - (int32_t) (len - 1);
+		uint32_t ph;
+		int32_t s, w;
+
+		// sin(pi * t / (2 * factor)), a full turn is 4 * factor half samples
+		ph = (uint32_t) ((int64_t) t * ((1ll << 30) / ip->factor));
+		s = rfnm_sin_q15(ph);
+
+		// sinc = s / (pi * t / (2 * factor)), t is odd so never zero
+		h[i] = div_s64((int64_t) s * 2 * ip->factor * 10000, 31416 * t);
+
+		// Hann: sin^2(pi * (i + 1) / (len + 1))
+		ph = div_u64((uint64_t) (i + 1) << 31, len + 1);
+		w = rfnm_sin_q15(ph);
+		w = (w * w) >> 15;
+
+		h[i] = (h[i] * w) >> 15;
+	}
+
+	for (k = 0; k < ip->factor; k++) {
+		sum = 0;
+		for (j = 0; j < RFNM_TX_INTERP_TAPS; j++) {
+			sum += h[j * ip->factor + k];
+		}
+		if (sum <= 0) {
+			sum = 1;
+		}
+		for (j = 0; j < RFNM_TX_INTERP_TAPS; j++) {
+			ip->coef[k][j] = rfnm_sat16(div_s64((int64_t) h[j * ip->factor + k] * 32768, sum));
+		}
+	}
+
+	kfree(h);
+}
+
+struct rfnm_tx_interp *rfnm_tx_interp_alloc(uint32_t factor, int32_t nco_step, uint32_t n_out)
+{
+	struct rfnm_tx_interp *ip;
+
+	if (factor < 1 || factor > RFNM_TX_INTERP_MAX_FACTOR || !is_power_of_2(factor)) {
+		return ERR_PTR(-EINVAL);
+	}
+
+	// each DAC buffer has to start on a whole input sample
+	if (n_out % factor) {
+		return ERR_PTR(-EINVAL);
+	}
+
+	ip = kzalloc(sizeof(struct rfnm_tx_interp), GFP_KERNEL);
+	if (!ip)
+		return ERR_PTR(-ENOMEM);
+
+	ip->x = vzalloc((RFNM_TX_INTERP_TAPS - 1 + n_out) * 2 * sizeof(int16_t));
+	ip->y = vzalloc(n_out * 2 * sizeof(int16_t));
+	if (!ip->x || !ip->y) {
+		vfree(ip->x);
+		vfree(ip->y);
+		kfree(ip);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	ip->factor = factor;
+	ip->n_out = n_out;
+	ip->nco_step = nco_step;
+
+	rfnm_tx_interp_design(ip);
+
+	return ip;
+}
+EXPORT_SYMBOL(rfnm_tx_interp_alloc);
+
+void rfnm_tx_interp_free(struct rfnm_tx_interp *ip)
+{
+	if (IS_ERR_OR_NULL(ip))
+		return;
+
+	vfree(ip->x);
+	vfree(ip->y);
+	kfree(ip);
+}
+EXPORT_SYMBOL(rfnm_tx_interp_free);
+
+static void rfnm_tx_interp_filter(struct rfnm_tx_interp *ip, uint32_t *dst, const int16_t *x, uint32_t cnt)
+{
+	const uint32_t l = ip->factor;
+	uint32_t n = 0, k, j;
+
+	for (; n + 8 <= cnt; n += 8) {
+		for (k = 0; k < l; k++) {
+			const int16_t *c = ip->coef[k];
+			int32x4_t ai0 = vdupq_n_s32(0), ai1 = vdupq_n_s32(0);
+			int32x4_t aq0 = vdupq_n_s32(0), aq1 = vdupq_n_s32(0);
+			int16x8x2_t o, z;
+			uint32x4_t w0, w1;
+			uint32_t *d;
+
+			for (j = 0; j < RFNM_TX_INTERP_TAPS; j++) {
+				int16x8x2_t v = vld2q_s16(x + ((int32_t) n - (int32_t) j) * 2);
+
+				ai0 = vmlal_n_s16(ai0, vget_low_s16(v.val[0]), c[j]);
+				ai1 = vmlal_high_n_s16(ai1, v.val[0], c[j]);
+				aq0 = vmlal_n_s16(aq0, vget_low_s16(v.val[1]), c[j]);
+				aq1 = vmlal_high_n_s16(aq1, v.val[1], c[j]);
+			}
+
+			o.val[0] = vcombine_s16(vqrshrn_n_s32(ai0, 15), vqrshrn_n_s32(ai1, 15));
+			o.val[1] = vcombine_s16(vqrshrn_n_s32(aq0, 15), vqrshrn_n_s32(aq1, 15));
+			z = vzipq_s16(o.val[0], o.val[1]);
+			w0 = vreinterpretq_u32_s16(z.val[0]);
+			w1 = vreinterpretq_u32_s16(z.val[1]);
+
+			// output n + m lands on (n + m) * l + k
+			d = dst + n * l + k;
+			vst1q_lane_u32(d + 0 * l, w0, 0);
+			vst1q_lane_u32(d + 1 * l, w0, 1);
+			vst1q_lane_u32(d + 2 * l, w0, 2);
+			vst1q_lane_u32(d + 3 * l, w0, 3);
+			vst1q_lane_u32(d + 4 * l, w1, 0);
+			vst1q_lane_u32(d + 5 * l, w1, 1);
+			vst1q_lane_u32(d + 6 * l, w1, 2);
+			vst1q_lane_u32(d + 7 * l, w1, 3);
+		}
+	}
+
+	for (; n < cnt; n++) {
+		for (k = 0; k < l; k++) {
+			int32_t ai = 0, aq = 0;
+			int16_t *d = (int16_t *) (dst + n * l + k);
+
+			for (j = 0; j < RFNM_TX_INTERP_TAPS; j++) {
+				const int16_t *s = x + ((int32_t) n - (int32_t) j) * 2;
+
+				ai += s[0] * ip->coef[k][j];
+				aq += s[1] * ip->coef[k][j];
+			}
+			d[0] = rfnm_sat16((ai + (1 << 14)) >> 15);
+			d[1] = rfnm_sat16((aq + (1 << 14)) >> 15);
+		}
+	}
+}
+
+static void rfnm_tx_nco(struct rfnm_tx_interp *ip, int16_t *buf, uint32_t cnt)
+{
+	uint32_t phase = ip->nco_phase;
+	uint32_t n = 0, m;
+
+	for (; n + 4 <= cnt; n += 4) {
+		int16_t c[4], s[4];
+		int16x4x2_t v;
+		int16x4_t co, si;
+		int32x4_t ri, rq;
+
+		for (m = 0; m < 4; m++) {
+			s[m] = rfnm_sin_q15(phase);
+			c[m] = rfnm_sin_q15(phase + (1u << 30));
+			phase += ip->nco_step;
+		}
+
+		co = vld1_s16(c);
+		si = vld1_s16(s);
+		v = vld2_s16(buf + n * 2);
+
+		// (i + jq) * (c + js)
+		ri = vmlsl_s16(vmull_s16(v.val[0], co), v.val[1], si);
+		rq = vmlal_s16(vmull_s16(v.val[0], si), v.val[1], co);
+
+		v.val[0] = vqrshrn_n_s32(ri, 15);
+		v.val[1] = vqrshrn_n_s32(rq, 15);
+		vst2_s16(buf + n * 2, v);
+	}
+
+	for (; n < cnt; n++) {
+		int32_t s = rfnm_sin_q15(phase);
+		int32_t c = rfnm_sin_q15(phase + (1u << 30));
+		int32_t i = buf[n * 2], q = buf[n * 2 + 1];
+
+		buf[n * 2] = rfnm_sat16((i * c - q * s + (1 << 14)) >> 15);
+		buf[n * 2 + 1] = rfnm_sat16((i * s + q * c + (1 << 14)) >> 15);
+		phase += ip->nco_step;
+	}
+
+	ip->nco_phase = phase;
+}
+
+static inline void rfnm_iq_corr_apply(int16_t *buf, uint32_t cnt, const struct rfnm_iq_corr *corr)
+{
+	int32x4_t dci = vdupq_n_s32(corr->dc[0] << 14);
+	int32x4_t dcq = vdupq_n_s32(corr->dc[1] << 14);
+	uint32_t n = 0;
+
+	for (; n + 8 <= cnt; n += 8) {
+		int16x8x2_t v = vld2q_s16(buf + n * 2);
+		int32x4_t ai0, ai1, aq0, aq1;
+
+		ai0 = vmlal_n_s16(vmlal_n_s16(dci, vget_low_s16(v.val[0]), corr->m[0]), vget_low_s16(v.val[1]), corr->m[1]);
+		ai1 = vmlal_high_n_s16(vmlal_high_n_s16(dci, v.val[0], corr->m[0]), v.val[1], corr->m[1]);
+		aq0 = vmlal_n_s16(vmlal_n_s16(dcq, vget_low_s16(v.val[0]), corr->m[2]), vget_low_s16(v.val[1]), corr->m[3]);
+		aq1 = vmlal_high_n_s16(vmlal_high_n_s16(dcq, v.val[0], corr->m[2]), v.val[1], corr->m[3]);
+
+		v.val[0] = vcombine_s16(vqrshrn_n_s32(ai0, 14), vqrshrn_n_s32(ai1, 14));
+		v.val[1] = vcombine_s16(vqrshrn_n_s32(aq0, 14), vqrshrn_n_s32(aq1, 14));
+		vst2q_s16(buf + n * 2, v);
+	}
+
+	for (; n < cnt; n++) {
+		int32_t i = buf[n * 2], q = buf[n * 2 + 1];
+
+		buf[n * 2] = rfnm_sat16((corr->m[0] * i + corr->m[1] * q + (corr->dc[0] << 14) + (1 << 13)) >> 14);
+		buf[n * 2 + 1] = rfnm_sat16((corr->m[2] * i + corr->m[3] * q + (corr->dc[1] << 14) + (1 << 13)) >> 14);
+	}
+}
+
+/*
+ * Fill one DAC buffer (n_out samples) from part `part` of the unpacked
+ * chunk sitting at rfnm_tx_interp_input(). A chunk feeds `factor` DAC
+ * buffers, call rfnm_tx_interp_advance() once all of them are written.
+ * The correction runs last so the DC term cancels LO leakage after the NCO.
+ * The filter stores are strided and NCO and correction work in place, so all
+ * of it runs in ip->y and dst is only written, front to back.
+ */
+void rfnm_tx_interp_run(struct rfnm_tx_interp *ip, int16_t *dst, uint32_t part, const struct rfnm_iq_corr *corr)
+{
+	uint32_t cnt = ip->n_out / ip->factor;
+	const int16_t *x = rfnm_tx_interp_input(ip) + part * cnt * 2;
+
+	kernel_neon_begin();
+	rfnm_tx_interp_filter(ip, (uint32_t *) ip->y, x, cnt);
+	if (ip->nco_step) {
+		rfnm_tx_nco(ip, ip->y, ip->n_out);
+	}
+	if (corr && corr->enabled) {
+		rfnm_iq_corr_apply(ip->y, ip->n_out, corr);
+	}
+	kernel_neon_end();
+
+	memcpy(dst, ip->y, ip->n_out * 2 * sizeof(int16_t));
+}
+EXPORT_SYMBOL(rfnm_tx_interp_run);
+
+void rfnm_tx_interp_advance(struct rfnm_tx_interp *ip)
+{
+	memmove(ip->x, ip->x + ip->n_out * 2, (RFNM_TX_INTERP_TAPS - 1) * 2 * sizeof(int16_t));
+}
+EXPORT_SYMBOL(rfnm_tx_interp_advance);
+
+/*
+ * rfnm_unpack12to16_aarch64 with the correction fused in: 12 bit packed
+ * I/Q in, corrected and saturated int16 I/Q out, one pass over the data.
+ * bytes is the output size, as for the unfused kernel.
+ */
+void rfnm_tx_unpack_corr(int16_t *dest, const uint8_t *src, uint32_t bytes, const struct rfnm_iq_corr *corr)
+{
+	uint32_t cnt = bytes / 4;
+	uint32_t n = 0;
+	int32x4_t dci = vdupq_n_s32(corr->dc[0] << 14);
+	int32x4_t dcq = vdupq_n_s32(corr->dc[1] << 14);
+	const uint8x16_t lo_nib = vdupq_n_u8(0x0f);
+	const uint8x16_t hi_nib = vdupq_n_u8(0xf0);
+
+	kernel_neon_begin();
+
+	for (; n + 16 <= cnt; n += 16) {
+		uint8x16x3_t p = vld3q_u8(src + n * 3);
+		uint8x16_t iq = vandq_u8(p.val[1], lo_nib);
+		uint8x16_t qq = vandq_u8(p.val[1], hi_nib);
+		int16x8_t i[2], q[2];
+		int h;
+
+		prefetch(src + n * 3 + 192);
+
+		// i = (b0 | (b1 & 0xf) << 8) << 4, q = (b1 & 0xf0) | b2 << 8
+		i[0] = vreinterpretq_s16_u16(vorrq_u16(vshll_n_u8(vget_low_u8(p.val[0]), 4), vshlq_n_u16(vmovl_u8(vget_low_u8(iq)), 12)));
+		i[1] = vreinterpretq_s16_u16(vorrq_u16(vshll_high_n_u8(p.val[0], 4), vshlq_n_u16(vmovl_high_u8(iq), 12)));
+		q[0] = vreinterpretq_s16_u16(vorrq_u16(vshll_n_u8(vget_low_u8(p.val[2]), 8), vmovl_u8(vget_low_u8(qq))));
+		q[1] = vreinterpretq_s16_u16(vorrq_u16(vshll_high_n_u8(p.val[2], 8), vmovl_high_u8(qq)));
+
+		for (h = 0; h < 2; h++) {
+			int32x4_t ai0, ai1, aq0, aq1;
+			int16x8x2_t o;
+
+			ai0 = vmlal_n_s16(vmlal_n_s16(dci, vget_low_s16(i[h]), corr->m[0]), vget_low_s16(q[h]), corr->m[1]);
+			ai1 = vmlal_high_n_s16(vmlal_high_n_s16(dci, i[h], corr->m[0]), q[h], corr->m[1]);
+			aq0 = vmlal_n_s16(vmlal_n_s16(dcq, vget_low_s16(i[h]), corr->m[2]), vget_low_s16(q[h]), corr->m[3]);
+			aq1 = vmlal_high_n_s16(vmlal_high_n_s16(dcq, i[h], corr->m[2]), q[h], corr->m[3]);
+
+			o.val[0] = vcombine_s16(vqrshrn_n_s32(ai0, 14), vqrshrn_n_s32(ai1, 14));
+			o.val[1] = vcombine_s16(vqrshrn_n_s32(aq0, 14), vqrshrn_n_s32(aq1, 14));
+			vst2q_s16(dest + (n + h * 8) * 2, o);
+		}
+	}
+
+	for (; n < cnt; n++) {
+		const uint8_t *s = src + n * 3;
+		int32_t i = (int16_t) ((s[0] | (s[1] & 0x0f) << 8) << 4);
+		int32_t q = (int16_t) ((s[1] & 0xf0) | s[2] << 8);
+
+		dest[n * 2] = rfnm_sat16((corr->m[0] * i + corr->m[1] * q + (corr->dc[0] << 14) + (1 << 13)) >> 14);
+		dest[n * 2 + 1] = rfnm_sat16((corr->m[2] * i + corr->m[3] * q + (corr->dc[1] << 14) + (1 << 13)) >> 14);
+	}
+
+	kernel_neon_end();
+}
+EXPORT_SYMBOL(rfnm_tx_unpack_corr);
+
+/*
+ * rfnm_pack16to12_aarch64 with DC removal and the IQ matrix fused in.
+ * src is the raw sign/magnitude ADC output, bytes is the input size.
+ * The sum of the (uncorrected) samples is returned for DC tracking.
+ */
+void rfnm_rx_pack_corr(uint8_t *dest, const int16_t *src, uint32_t bytes,
+			const struct rfnm_iq_corr *corr, const int16_t dc[2], int64_t sum[2])
+{
+	uint32_t cnt = bytes / 4;
+	uint32_t n = 0;
+	// fold -M * dc into the accumulator start value
+	int32_t oi = -(corr->m[0] * dc[0] + corr->m[1] * dc[1]);
+	int32_t oq = -(corr->m[2] * dc[0] + corr->m[3] * dc[1]);
+	int32x4_t vo_i = vdupq_n_s32(oi), vo_q = vdupq_n_s32(oq);
+	int32x4_t si = vdupq_n_s32(0), sq = vdupq_n_s32(0);
+	const int16x8_t mag = vdupq_n_s16(0x7fff);
+	int64_t tail_i = 0, tail_q = 0;
+
+	kernel_neon_begin();
+
+	for (; n + 16 <= cnt; n += 16) {
+		uint16x8_t oi16[2], oq16[2];
+		uint8x16x3_t p;
+		int h;
+
+		prefetch(src + n * 2 + 128);
+
+		for (h = 0; h < 2; h++) {
+			int16x8x2_t v = vld2q_s16(src + (n + h * 8) * 2);
+			int16x8_t mi = vshrq_n_s16(v.val[0], 15);
+			int16x8_t mq = vshrq_n_s16(v.val[1], 15);
+			int16x8_t i, q;
+			int32x4_t ai0, ai1, aq0, aq1;
+
+			// sign/magnitude to two's complement
+			i = vsubq_s16(veorq_s16(vandq_s16(v.val[0], mag), mi), mi);
+			q = vsubq_s16(veorq_s16(vandq_s16(v.val[1], mag), mq), mq);
+
+			si = vpadalq_s16(si, i);
+			sq = vpadalq_s16(sq, q);
+
+			ai0 = vmlal_n_s16(vmlal_n_s16(vo_i, vget_low_s16(i), corr->m[0]), vget_low_s16(q), corr->m[1]);
+			ai1 = vmlal_high_n_s16(vmlal_high_n_s16(vo_i, i, corr->m[0]), q, corr->m[1]);
+			aq0 = vmlal_n_s16(vmlal_n_s16(vo_q, vget_low_s16(i), corr->m[2]), vget_low_s16(q), corr->m[3]);
+			aq1 = vmlal_high_n_s16(vmlal_high_n_s16(vo_q, i, corr->m[2]), q, corr->m[3]);
+
+			oi16[h] = vreinterpretq_u16_s16(vcombine_s16(vqrshrn_n_s32(ai0, 14), vqrshrn_n_s32(ai1, 14)));
+			oq16[h] = vreinterpretq_u16_s16(vcombine_s16(vqrshrn_n_s32(aq0, 14), vqrshrn_n_s32(aq1, 14)));
+		}
+
+		// b0 = i[11:4], b1 = i[15:12] | q[7:4] << 4, b2 = q[15:8]
+		p.val[0] = vcombine_u8(vshrn_n_u16(oi16[0], 4), vshrn_n_u16(oi16[1], 4));
+		p.val[1] = vorrq_u8(vcombine_u8(vshrn_n_u16(oi16[0], 12), vshrn_n_u16(oi16[1], 12)),
+				vshlq_n_u8(vcombine_u8(vshrn_n_u16(oq16[0], 4), vshrn_n_u16(oq16[1], 4)), 4));
+		p.val[2] = vcombine_u8(vshrn_n_u16(oq16[0], 8), vshrn_n_u16(oq16[1], 8));
+
+		vst3q_u8(dest + n * 3, p);
+	}
+
+	for (; n < cnt; n++) {
+		int16_t ri = src[n * 2], rq = src[n * 2 + 1];
+		int32_t i = ri < 0 ? -(ri & 0x7fff) : ri;
+		int32_t q = rq < 0 ? -(rq & 0x7fff) : rq;
+		uint16_t ci, cq;
+		uint8_t *d = dest + n * 3;
+
+		tail_i += i;
+		tail_q += q;
+
+		ci = rfnm_sat16((corr->m[0] * i + corr->m[1] * q + oi + (1 << 13)) >> 14);
+		cq = rfnm_sat16((corr->m[2] * i + corr->m[3] * q + oq + (1 << 13)) >> 14);
+
+		d[0] = ci >> 4;
+		d[1] = ((ci >> 12) & 0xf) | (((cq >> 4) & 0xf) << 4);
+		d[2] = cq >> 8;
+	}
+
+	sum[0] = vaddlvq_s32(si) + tail_i;
+	sum[1] = vaddlvq_s32(sq) + tail_q;
+
+	kernel_neon_end();
+}
+EXPORT_SYMBOL(rfnm_rx_pack_corr);
+
+// single pole tracker, time constant of 2^shift buffers
+void rfnm_rx_dc_update(struct rfnm_rx_dc *dc, const int64_t sum[2], uint32_t cnt, uint32_t shift)
+{
+	int i;
+
+	if (!cnt)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		int32_t mean = div_s64(sum[i] << 8, cnt);
+
+		dc->est[i] += (mean - dc->est[i]) >> shift;
+	}
+}
+EXPORT_SYMBOL(rfnm_rx_dc_update);
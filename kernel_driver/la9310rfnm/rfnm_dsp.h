@@ -0,0 +1,85 @@
+#ifndef __RFNM_DSP_H__
+#define __RFNM_DSP_H__
+
+#include <linux/types.h>
+
+/*
+ * On-device sample processing for the streaming path.
+ *
+ * All sample buffers are interleaved I/Q int16 (two's complement, 12 bit
+ * data left aligned as produced by rfnm_unpack12to16_aarch64).
+ */
+
+/*
+ * Per channel 2x2 gain/IQ imbalance matrix (Q14) and DC offset:
+ * i' = m[0] * i + m[1] * q + dc[0]
+ * q' = m[2] * i + m[3] * q + dc[1]
+ */
+struct rfnm_iq_corr {
+	int16_t m[4];
+	int16_t dc[2];
+	int enabled;
+};
+
+#define RFNM_IQ_CORR_ONE		(1 << 14)
+
+#define RFNM_TX_INTERP_MAX_FACTOR	64
+#define RFNM_TX_INTERP_TAPS		16	// taps per polyphase branch
+
+struct rfnm_tx_interp {
+	uint32_t factor;
+	// samples per DAC buffer, i.e. number of outputs per call to rfnm_tx_interp_run()
+	uint32_t n_out;
+	// coef[k][j] = h[j * factor + k], Q15, each branch normalised to unity DC gain
+	int16_t coef[RFNM_TX_INTERP_MAX_FACTOR][RFNM_TX_INTERP_TAPS];
+	// RFNM_TX_INTERP_TAPS - 1 samples of history followed by one unpacked USB chunk
+	int16_t *x;
+	// one DAC buffer, rendered here and copied out in one sequential pass, the
+	// ring may be write-combining and must not be read back
+	int16_t *y;
+	int32_t nco_step;
+	uint32_t nco_phase;
+};
+
+int16_t rfnm_sin_q15(uint32_t phase);
+
+struct rfnm_tx_interp *rfnm_tx_interp_alloc(uint32_t factor, int32_t nco_step, uint32_t n_out);
+void rfnm_tx_interp_free(struct rfnm_tx_interp *ip);
+
+static inline int16_t *rfnm_tx_interp_input(struct rfnm_tx_interp *ip)
+{
+	return ip->x + (RFNM_TX_INTERP_TAPS - 1) * 2;
+}
+
+void rfnm_tx_interp_run(struct rfnm_tx_interp *ip, int16_t *dst, uint32_t part, const struct rfnm_iq_corr *corr);
+void rfnm_tx_interp_advance(struct rfnm_tx_interp *ip);
+
+void rfnm_tx_unpack_corr(int16_t *dest, const uint8_t *src, uint32_t bytes, const struct rfnm_iq_corr *corr);
+
+/*
+ * RX direction: the correction is o = M * (x - dc), with dc either the
+ * static corr->dc or the running estimate below.
+ */
+struct rfnm_rx_dc {
+	// running DC estimate, Q8 sample units
+	int32_t est[2];
+};
+
+// longer than this the estimate barely moves, and a shift >= 32 is undefined
+#define RFNM_RX_DC_SHIFT_MAX	16
+
+void rfnm_rx_pack_corr(uint8_t *dest, const int16_t *src, uint32_t bytes,
+			const struct rfnm_iq_corr *corr, const int16_t dc[2], int64_t sum[2]);
+void rfnm_rx_dc_update(struct rfnm_rx_dc *dc, const int64_t sum[2], uint32_t cnt, uint32_t shift);
+
+static inline int16_t rfnm_rx_dc_get(const struct rfnm_rx_dc *dc, int i)
+{
+	return (dc->est[i] + (1 << 7)) >> 8;
+}
+
+struct dentry;
+
+// debugfs benchmark of the pack/unpack kernels and cache maintenance
+void rfnm_microbench_init(struct dentry *dir);
+
+#endif
@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_flight.c - per cpu event rings of the streaming pipeline
+ *
+ * Writers only ever touch the ring of their own cpu: the slot comes from a
+ * local_t, safe against the usb completions interrupting the RX/TX threads
+ * on that cpu, and seq is written last. Readers copy a record only if its
+ * seq is the same before and after the copy; a record overwritten while it
+ * is being read is skipped.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/sort.h>
+
+#include "rfnm_flight.h"
+
+// the copy is taken this long after the error, to catch what followed
+#define RFNM_FLIGHT_SNAP_DELAY_MS	20
+
+static const char * const rfnm_flight_stages[RFNM_FLIGHT_STAGES] = {
+	[RFNM_FLIGHT_RX] = "rx",
+	[RFNM_FLIGHT_TX] = "tx",
+	[RFNM_FLIGHT_USB] = "usb",
+	[RFNM_FLIGHT_CTRL] = "ctrl",
+};
+
+// event name, then what a, b, c and d hold, NULL when unused
+static const char * const rfnm_flight_fmt[RFNM_FL_EVENTS][5] = {
+	[RFNM_FL_RX_READ] = { "read", "head", "tail", "cnt", "usb_head" },
+	[RFNM_FL_RX_OVERRUN] = { "overrun", "head", "tail", "behind" },
+	[RFNM_FL_RX_CC] = { "cc", "adc", "expect", "cc", "tail" },
+	[RFNM_FL_TX_WRITE] = { "write", "txid", "head", "usb_cc", "list" },
+	[RFNM_FL_TX_UNDERRUN] = { "underrun", "txid", "head", "margin", "new_head" },
+	[RFNM_FL_TX_LATENCY] = { "latency", "txid", "head", "margin", "new_head" },
+	[RFNM_FL_TX_CC] = { "cc", "usb_cc", "gap", "head", "list" },
+	[RFNM_FL_USB_IN] = { "in", "ep", "status", "actual", "done" },
+	[RFNM_FL_USB_OUT] = { "out", "ep", "status", "actual", "done" },
+	[RFNM_FL_EP_RECOVERY] = { "recovery", "dir", "ep", "ret" },
+	[RFNM_FL_EPOCH] = { "epoch", "epoch", "rx_tail", "tx_head" },
+	[RFNM_FL_HEALTH] = { "health", "stage", "step", "ms", "progress" },
+};
+
+void rfnm_flight_rec(struct rfnm_flight *f, int stage, int evt, u32 a, u32 b, u32 c, u32 d)
+{
+	struct rfnm_flight_ring *r;
+	struct rfnm_flight_rec *rec;
+	u32 seq;
+
+	if (!f->cpu)
+		return;
+
+	r = &get_cpu_ptr(f->cpu)->ring[stage];
+	seq = local_inc_return(&r->head);
+	rec = &r->rec[(seq - 1) % RFNM_FLIGHT_LEN];
+
+	WRITE_ONCE(rec->seq, 0);
+	smp_wmb();
+	rec->ts_ns = ktime_get_ns();
+	rec->stage = stage;
+	rec->evt = evt;
+	rec->cpu = smp_processor_id();
+	rec->a = a;
+	rec->b = b;
+	rec->c = c;
+	rec->d = d;
+	smp_store_release(&rec->seq, seq);
+
+	put_cpu_ptr(f->cpu);
+}
+
+static int rfnm_flight_cmp(const void *a, const void *b)
+{
+	const struct rfnm_flight_rec *ra = a, *rb = b;
+
+	if (ra->ts_ns != rb->ts_ns)
+		return ra->ts_ns < rb->ts_ns ? -1 : 1;
+	return 0;
+}
+
+static size_t rfnm_flight_max(void)
+{
+	return (size_t) nr_cpu_ids * RFNM_FLIGHT_STAGES * RFNM_FLIGHT_LEN;
+}
+
+// every consistent record of every ring into out, time ordered
+static u32 rfnm_flight_copy(struct rfnm_flight *f, struct rfnm_flight_rec *out)
+{
+	u32 n = 0;
+	int cpu, stage, i;
+
+	for_each_possible_cpu(cpu) {
+		struct rfnm_flight_cpu *fc = per_cpu_ptr(f->cpu, cpu);
+
+		for (stage = 0; stage < RFNM_FLIGHT_STAGES; stage++) {
+			for (i = 0; i < RFNM_FLIGHT_LEN; i++) {
+				struct rfnm_flight_rec *rec = &fc->ring[stage].rec[i];
+				u32 seq = smp_load_acquire(&rec->seq);
+
+				if (!seq)
+					continue;
+				out[n] = *rec;
+				smp_rmb();
+				if (READ_ONCE(rec->seq) != seq)
+					continue;
+				n++;
+			}
+		}
+	}
+
+	sort(out, n, sizeof(*out), rfnm_flight_cmp, NULL);
+	return n;
+}
+
+static void rfnm_flight_snap_work(struct work_struct *work)
+{
+	struct rfnm_flight *f = container_of(to_delayed_work(work), struct rfnm_flight, snap_work);
+	const char *reason = READ_ONCE(f->snap_pending);
+
+	mutex_lock(&f->snap_lock);
+	f->snap_cnt = rfnm_flight_copy(f, f->snap);
+	f->snap_reason = reason;
+	f->snap_ts_ns = ktime_get_ns();
+	f->snaps++;
+	mutex_unlock(&f->snap_lock);
+
+	// armed again only now, errors in between belong to this copy
+	WRITE_ONCE(f->snap_next, jiffies + HZ);
+	smp_store_release(&f->snap_pending, NULL);
+
+	printk("%s: %s, %u events in flight_error\n", f->name, reason, f->snap_cnt);
+}
+
+void rfnm_flight_error(struct rfnm_flight *f, const char *reason)
+{
+	f->errors++;
+
+	if (!f->cpu || time_before(jiffies, READ_ONCE(f->snap_next)))
+		return;
+
+	if (cmpxchg(&f->snap_pending, NULL, reason))
+		return;
+
+	schedule_delayed_work(&f->snap_work, msecs_to_jiffies(RFNM_FLIGHT_SNAP_DELAY_MS));
+}
+
+int rfnm_flight_init(struct rfnm_flight *f, const char *name, int on)
+{
+	int cpu, stage;
+
+	memset(f, 0, sizeof(*f));
+	f->name = name;
+	f->snap_next = jiffies;
+	mutex_init(&f->snap_lock);
+	INIT_DELAYED_WORK(&f->snap_work, rfnm_flight_snap_work);
+
+	if (!on)
+		return 0;
+
+	f->snap = kvcalloc(rfnm_flight_max(), sizeof(*f->snap), GFP_KERNEL);
+	f->cpu = alloc_percpu(struct rfnm_flight_cpu);
+	if (!f->snap || !f->cpu) {
+		rfnm_flight_free(f);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct rfnm_flight_cpu *fc = per_cpu_ptr(f->cpu, cpu);
+
+		memset(fc, 0, sizeof(*fc));
+		for (stage = 0; stage < RFNM_FLIGHT_STAGES; stage++)
+			local_set(&fc->ring[stage].head, 0);
+	}
+
+	return 0;
+}
+
+void rfnm_flight_free(struct rfnm_flight *f)
+{
+	cancel_delayed_work_sync(&f->snap_work);
+	free_percpu(f->cpu);
+	f->cpu = NULL;
+	kvfree(f->snap);
+	f->snap = NULL;
+}
+
+static void rfnm_flight_show_recs(struct seq_file *s, struct rfnm_flight_rec *recs, u32 n)
+{
+	u64 t0 = n ? recs[n - 1].ts_ns : 0;
+	u32 i;
+	int k;
+
+	// times relative to the newest event, the error is usually close to it
+	for (i = 0; i < n; i++) {
+		struct rfnm_flight_rec *rec = &recs[i];
+		const char * const *fmt = rfnm_flight_fmt[rec->evt < RFNM_FL_EVENTS ? rec->evt : 0];
+		u32 args[4] = { rec->a, rec->b, rec->c, rec->d };
+
+		seq_printf(s, "%16llu %12lld %3u %-4s %-9s", rec->ts_ns, (s64) (rec->ts_ns - t0),
+			rec->cpu, rfnm_flight_stages[rec->stage], fmt[0] ? fmt[0] : "?");
+		for (k = 0; k < 4; k++) {
+			if (fmt[k + 1])
+				seq_printf(s, " %s %d", fmt[k + 1], (s32) args[k]);
+		}
+		seq_putc(s, '\n');
+	}
+}
+
+static int dfs_rfnm_flight_show(struct seq_file *s, void *unused)
+{
+	struct rfnm_flight *f = s->private;
+	struct rfnm_flight_rec *recs;
+	u32 n;
+
+	if (!f->cpu) {
+		seq_puts(s, "off\n");
+		return 0;
+	}
+
+	recs = kvmalloc_array(rfnm_flight_max(), sizeof(*recs), GFP_KERNEL);
+	if (!recs)
+		return -ENOMEM;
+
+	n = rfnm_flight_copy(f, recs);
+	seq_printf(s, "%u events, %llu errors\n", n, f->errors);
+	seq_printf(s, "%16s %12s %3s %-4s %-9s\n", "time ns", "ns to last", "cpu", "ring", "event");
+	rfnm_flight_show_recs(s, recs, n);
+
+	kvfree(recs);
+	return 0;
+}
+
+static int dfs_rfnm_flight_error_show(struct seq_file *s, void *unused)
+{
+	struct rfnm_flight *f = s->private;
+
+	mutex_lock(&f->snap_lock);
+	if (f->snap_reason) {
+		seq_printf(s, "%s at %llu ns, %u events, copy %llu of %llu errors\n", f->snap_reason,
+			f->snap_ts_ns, f->snap_cnt, f->snaps, f->errors);
+		seq_printf(s, "%16s %12s %3s %-4s %-9s\n", "time ns", "ns to last", "cpu", "ring", "event");
+		rfnm_flight_show_recs(s, f->snap, f->snap_cnt);
+	} else {
+		seq_puts(s, "no error yet\n");
+	}
+	mutex_unlock(&f->snap_lock);
+
+	return 0;
+}
+
+static int dfs_rfnm_flight_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dfs_rfnm_flight_show, inode->i_private);
+}
+
+static int dfs_rfnm_flight_error_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dfs_rfnm_flight_error_show, inode->i_private);
+}
+
+static const struct file_operations dfs_rfnm_flight_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_flight_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations dfs_rfnm_flight_error_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_flight_error_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void rfnm_flight_debugfs_init(struct dentry *dir, struct rfnm_flight *f)
+{
+	debugfs_create_file("flight", 0444, dir, f, &dfs_rfnm_flight_fops);
+	debugfs_create_file("flight_error", 0444, dir, f, &dfs_rfnm_flight_error_fops);
+}
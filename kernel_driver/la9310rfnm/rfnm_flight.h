@@ -0,0 +1,105 @@
+#ifndef __RFNM_FLIGHT_H__
+#define __RFNM_FLIGHT_H__
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <asm/local.h>
+
+/*
+ * Flight recorder of one streaming pipeline: the last RFNM_FLIGHT_LEN events
+ * of each stage, on each cpu, in rings nothing but that cpu writes. A record
+ * is a slot taken with local_inc_return and four stage specific words, cheap
+ * enough for every pass and every usb completion.
+ *
+ * rfnm/nlm<N>/flight dumps the rings merged in time order. rfnm_flight_error
+ * freezes them into rfnm/nlm<N>/flight_error a little after the error, so the
+ * events that followed are in the dump too.
+ */
+
+struct dentry;
+
+#define RFNM_FLIGHT_LEN		256
+
+// rings per cpu, the stage an event belongs to
+enum {
+	RFNM_FLIGHT_RX,
+	RFNM_FLIGHT_TX,
+	RFNM_FLIGHT_USB,
+	RFNM_FLIGHT_CTRL,
+	RFNM_FLIGHT_STAGES,
+};
+
+// what a, b, c and d of each event hold, rfnm_flight_fmt in rfnm_flight.c
+enum {
+	RFNM_FL_RX_READ = 1,	// head, tail, buffers read, rx usb head
+	RFNM_FL_RX_OVERRUN,	// head, tail, buffers behind
+	RFNM_FL_RX_CC,		// adc, cc expected, cc read, tail
+	RFNM_FL_TX_WRITE,	// tx_buf_id, head, usb_cc, list size
+	RFNM_FL_TX_UNDERRUN,	// tx_buf_id, head, margin, new head
+	RFNM_FL_TX_LATENCY,	// tx_buf_id, head, margin, new head
+	RFNM_FL_TX_CC,		// usb_cc, gap, head, list size
+	RFNM_FL_USB_IN,		// ep, status, actual, completions
+	RFNM_FL_USB_OUT,	// ep, status, actual, completions
+	RFNM_FL_EP_RECOVERY,	// dir, ep, result
+	RFNM_FL_EPOCH,		// epoch, rx tail, tx head
+	RFNM_FL_HEALTH,		// stage, step, ms, progress
+	RFNM_FL_EVENTS,
+};
+
+struct rfnm_flight_rec {
+	u64 ts_ns;
+	// slot number + 1, 0 while the slot is being written
+	u32 seq;
+	u8 stage;
+	u8 evt;
+	u16 cpu;
+	u32 a, b, c, d;
+};
+
+struct rfnm_flight_ring {
+	local_t head;
+	struct rfnm_flight_rec rec[RFNM_FLIGHT_LEN];
+};
+
+struct rfnm_flight_cpu {
+	struct rfnm_flight_ring ring[RFNM_FLIGHT_STAGES];
+};
+
+struct rfnm_flight {
+	// NULL when off, every call is then a no-op
+	struct rfnm_flight_cpu __percpu *cpu;
+
+	// last frozen copy, time ordered
+	struct mutex snap_lock;
+	struct rfnm_flight_rec *snap;
+	u32 snap_cnt;
+	const char *snap_reason;
+	u64 snap_ts_ns;
+	u64 snaps;
+	// racy between the stages, only a count
+	u64 errors;
+
+	struct delayed_work snap_work;
+	const char *snap_pending;
+	unsigned long snap_next;
+	const char *name;
+};
+
+// with on == 0 nothing is allocated and nothing recorded
+int rfnm_flight_init(struct rfnm_flight *f, const char *name, int on);
+void rfnm_flight_free(struct rfnm_flight *f);
+
+void rfnm_flight_rec(struct rfnm_flight *f, int stage, int evt, u32 a, u32 b, u32 c, u32 d);
+
+/*
+ * Something went wrong, freeze the rings for a post mortem. Callable from any
+ * context, at most one copy a second, reason must be a string literal.
+ */
+void rfnm_flight_error(struct rfnm_flight *f, const char *reason);
+
+// flight and flight_error in dir
+void rfnm_flight_debugfs_init(struct dentry *dir, struct rfnm_flight *f);
+
+#endif
@@ -0,0 +1,480 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_microbench.c - cost of the streaming primitives per buffer size
+ *
+ * Reading rfnm/microbench runs rfnm_pack16to12_aarch64,
+ * rfnm_unpack12to16_aarch64, dcache_clean_poc and dcache_inval_poc over a
+ * sweep of sizes and buffer offsets on the reading cpu and prints ns/byte
+ * and cycles/sample. The arch timer doesn't count cycles, they are derived
+ * from the current cpufreq. Pack/unpack output is checked against the C
+ * reference below. A sweep takes a few seconds, don't run it while
+ * streaming. app/rfnm_microbench is the user space counterpart.
+ *
+ * Reading rfnm/ring_check runs the rfnm_ring.c self check for a few ring
+ * sizes and times rfnm_ring_rx_poll and rfnm_ring_tx_poll, app/rfnm_ring_sim
+ * -C does the same in user space. rfnm_ring_kunit.ko runs it under KUnit.
+ *
+ * Reading rfnm/tx_wc_bench replays the rfnm_handler_out write pattern, usb
+ * chunks of RFNM_TX_USB_BUF_MULTI dac buffers unpacked into a descriptor
+ * ring, once into cacheable memory cleaned after every chunk and once into
+ * a write-combining mapping of the same pages with only a barrier, the two
+ * settings of the tx_wc module parameter. Both run again through
+ * rfnm_tx_interp_run at RFNM_MB_TX_INTERP with the NCO and the correction
+ * on, the tx_interp path. Time per dac buffer is put against how long the
+ * DAC takes to play one at rfnm/tx_wc_bench_ksps.
+ *
+ * Sizes are bytes on the int16 side (pack input, unpack output), one
+ * sample is 4 of them.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/cpufreq.h>
+#include <linux/sizes.h>
+#include <linux/gfp.h>
+#include <asm/cacheflush.h>
+
+#include <linux/rfnm-shared.h>
+
+#include "rfnm_dsp.h"
+#include "rfnm_ring.h"
+#include "rfnm_dma.h"
+
+void rfnm_pack16to12_aarch64_wrapper(uint8_t * dest, uint8_t * src, uint32_t bytes);
+void rfnm_unpack12to16_aarch64_wrapper(uint8_t * dest, uint8_t * src, uint32_t bytes);
+
+static u32 rfnm_mb_iters = 64;
+
+// multiples of 256, the unrolling of the unpack kernel
+static const u32 rfnm_mb_sizes[] = { SZ_1K, SZ_4K, SZ_16K, SZ_64K, SZ_256K, SZ_1M };
+// aligned, 16 byte aligned, crossing cache lines
+static const u32 rfnm_mb_offs[] = { 0, 16, 40 };
+
+// small ones are checked exhaustively, 0x4000 is RFNM_ADC_BUFCNT and RFNM_DAC_BUFCNT
+static const u32 rfnm_ring_check_sizes[] = { 128, 200, 256, 4096, 0x4000 };
+
+#define RFNM_MB_BUF_SIZE	(SZ_1M + SZ_4K)
+
+// descriptor ring of the tx_wc bench, larger than the L2 so that it streams
+#define RFNM_MB_TX_RING_SIZE	SZ_2M
+
+// the DAC at full rate, 122.88 MS/s
+static u32 rfnm_mb_dac_ksps = 122880;
+
+enum {
+	RFNM_MB_PACK,
+	RFNM_MB_UNPACK,
+	RFNM_MB_CLEAN,
+	RFNM_MB_CLEAN_DIRTY,
+	RFNM_MB_INVAL,
+	RFNM_MB_CNT,
+};
+
+static const char *rfnm_mb_names[RFNM_MB_CNT] = {
+	"pack16to12", "unpack12to16", "clean_poc", "clean_poc dirty", "inval_poc",
+};
+
+// the raw ADC samples are sign/magnitude, as in rfnm_rx_pack_corr
+static void rfnm_mb_pack_ref(uint8_t *dst, const int16_t *src, u32 bytes)
+{
+	u32 n;
+
+	for (n = 0; n < bytes / 4; n++, dst += 3) {
+		int16_t ri = src[n * 2], rq = src[n * 2 + 1];
+		uint16_t i = ri < 0 ? -(ri & 0x7fff) : ri;
+		uint16_t q = rq < 0 ? -(rq & 0x7fff) : rq;
+
+		dst[0] = i >> 4;
+		dst[1] = (i >> 12) | (q & 0xf0);
+		dst[2] = q >> 8;
+	}
+}
+
+static void rfnm_mb_unpack_ref(int16_t *dst, const uint8_t *src, u32 bytes)
+{
+	u32 n;
+
+	for (n = 0; n < bytes / 4; n++, src += 3) {
+		dst[n * 2] = (uint16_t) ((src[0] | src[1] << 8) << 4);
+		dst[n * 2 + 1] = (src[1] | src[2] << 8) & 0xfff0;
+	}
+}
+
+static u64 rfnm_mb_run(int op, uint8_t *dst, uint8_t *src, u32 size)
+{
+	u64 t0, ns = 0;
+	u32 i;
+
+	for (i = 0; i < rfnm_mb_iters; i++) {
+		if (op == RFNM_MB_CLEAN_DIRTY)
+			memset(src, i, size);
+
+		t0 = ktime_get_ns();
+		switch (op) {
+		case RFNM_MB_PACK:
+			rfnm_pack16to12_aarch64_wrapper(dst, src, size);
+			break;
+		case RFNM_MB_UNPACK:
+			rfnm_unpack12to16_aarch64_wrapper(dst, src, size);
+			break;
+		case RFNM_MB_CLEAN:
+		case RFNM_MB_CLEAN_DIRTY:
+			dcache_clean_poc((unsigned long) src, (unsigned long) src + size);
+			break;
+		case RFNM_MB_INVAL:
+			dcache_inval_poc((unsigned long) src, (unsigned long) src + size);
+			break;
+		}
+		ns += ktime_get_ns() - t0;
+	}
+
+	return ns;
+}
+
+static const char *rfnm_mb_check(int op, uint8_t *dst, uint8_t *src, uint8_t *ref, u32 size)
+{
+	get_random_bytes(src, size);
+
+	if (op == RFNM_MB_PACK) {
+		rfnm_pack16to12_aarch64_wrapper(dst, src, size);
+		rfnm_mb_pack_ref(ref, (int16_t *) src, size);
+		return memcmp(dst, ref, size / 4 * 3) ? "MISMATCH" : "ok";
+	}
+	if (op == RFNM_MB_UNPACK) {
+		rfnm_unpack12to16_aarch64_wrapper(dst, src, size);
+		rfnm_mb_unpack_ref((int16_t *) ref, src, size);
+		return memcmp(dst, ref, size) ? "MISMATCH" : "ok";
+	}
+	return "-";
+}
+
+static int dfs_rfnm_microbench_show(struct seq_file *s, void *unused)
+{
+	uint8_t *src, *dst, *ref;
+	unsigned int khz;
+	int cpu, op, z, o;
+
+	if (!rfnm_mb_iters)
+		return -EINVAL;
+
+	src = vmalloc(RFNM_MB_BUF_SIZE);
+	dst = vmalloc(RFNM_MB_BUF_SIZE);
+	ref = vmalloc(RFNM_MB_BUF_SIZE);
+	if (!src || !dst || !ref) {
+		vfree(src);
+		vfree(dst);
+		vfree(ref);
+		return -ENOMEM;
+	}
+
+	migrate_disable();
+	cpu = smp_processor_id();
+	khz = cpufreq_quick_get(cpu);
+
+	seq_printf(s, "cpu %d, %u kHz, %u iterations\n", cpu, khz, rfnm_mb_iters);
+	seq_printf(s, "%-16s %8s %4s %10s %12s %s\n", "op", "size", "off", "ns/byte", "cyc/sample", "check");
+
+	for (op = 0; op < RFNM_MB_CNT; op++) {
+		for (z = 0; z < ARRAY_SIZE(rfnm_mb_sizes); z++) {
+			for (o = 0; o < ARRAY_SIZE(rfnm_mb_offs); o++) {
+				u32 size = rfnm_mb_sizes[z], off = rfnm_mb_offs[o];
+				u64 bytes = (u64) size * rfnm_mb_iters;
+				const char *check;
+				u64 ns, nspb, cps;
+
+				check = rfnm_mb_check(op, dst + off, src + off, ref, size);
+				ns = rfnm_mb_run(op, dst + off, src + off, size);
+
+				// both in thousandths, cycles = ns * khz / 10^6, 4 bytes a sample
+				nspb = div64_u64(ns * 1000, bytes);
+				cps = div64_u64(ns * khz, bytes * 250);
+
+				seq_printf(s, "%-16s %8u %4u %6llu.%03llu %8llu.%03llu %s\n",
+					rfnm_mb_names[op], size, off,
+					nspb / 1000, nspb % 1000, cps / 1000, cps % 1000, check);
+
+				cond_resched();
+			}
+		}
+	}
+
+	migrate_enable();
+
+	vfree(src);
+	vfree(dst);
+	vfree(ref);
+	return 0;
+}
+
+static int dfs_rfnm_microbench_open(struct inode *inode, struct file *file)
+{
+	// big enough for the whole table, seq_file would rerun the sweep to grow it
+	return single_open_size(file, dfs_rfnm_microbench_show, NULL, SZ_16K);
+}
+
+static const struct file_operations dfs_rfnm_microbench_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_microbench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// interpolation factor of the tx_interp modes
+#define RFNM_MB_TX_INTERP	2
+
+struct rfnm_mb_tx_res {
+	u64 ns;
+	u64 max_ns;
+	const char *check;
+};
+
+// what rfnm_handler_out does per usb chunk, ring slots of sizeof(struct rfnm_bufdesc_tx)
+static void rfnm_mb_tx_ring(struct rfnm_mb_tx_res *res, struct rfnm_bufdesc_tx *ring, u32 slots,
+			    uint8_t *src, uint8_t *ref, u32 chunks, int wc, struct rfnm_tx_interp *ip,
+			    const struct rfnm_iq_corr *corr)
+{
+	u32 head = 0, c, w, p;
+	u64 t0, ns;
+
+	res->ns = 0;
+	res->max_ns = 0;
+
+	for (c = 0; c < chunks; c++) {
+		u32 first = head;
+
+		t0 = ktime_get_ns();
+		for (w = 0; w < RFNM_TX_USB_BUF_MULTI; w++) {
+			if (ip) {
+				rfnm_unpack12to16_aarch64_wrapper((uint8_t *) rfnm_tx_interp_input(ip),
+							&src[w * LA_TX_BASE_BUFSIZE_12], LA_TX_BASE_BUFSIZE);
+				for (p = 0; p < ip->factor; p++) {
+					rfnm_tx_interp_run(ip, (int16_t *) ring[head].buf, p, corr);
+					ring[head].cc = (c * RFNM_TX_USB_BUF_MULTI + w) * ip->factor + p;
+					head = rfnm_ring_next(slots, head);
+				}
+				rfnm_tx_interp_advance(ip);
+				continue;
+			}
+
+			rfnm_unpack12to16_aarch64_wrapper((uint8_t *) ring[head].buf,
+						&src[w * LA_TX_BASE_BUFSIZE_12], LA_TX_BASE_BUFSIZE);
+			ring[head].cc = c * RFNM_TX_USB_BUF_MULTI + w;
+			head = rfnm_ring_next(slots, head);
+		}
+
+		if (wc) {
+			wmb();
+		} else if (head > first) {
+			dcache_clean_poc((unsigned long) &ring[first], (unsigned long) &ring[head]);
+		} else {
+			dcache_clean_poc((unsigned long) &ring[first], (unsigned long) &ring[slots]);
+			dcache_clean_poc((unsigned long) &ring[0], (unsigned long) &ring[head]);
+		}
+		ns = ktime_get_ns() - t0;
+
+		res->ns += ns;
+		res->max_ns = max(res->max_ns, ns);
+	}
+
+	if (ip) {
+		// filtered output, nothing to compare against
+		res->check = "-";
+		return;
+	}
+
+	// the last buffer written, read back through the same mapping
+	head = head ? head - 1 : slots - 1;
+	res->check = memcmp(ring[head].buf, ref, LA_TX_BASE_BUFSIZE) ? "MISMATCH" : "ok";
+}
+
+static int dfs_rfnm_tx_wc_bench_show(struct seq_file *s, void *unused)
+{
+	static const char * const modes[] = { "wb+clean", "wc", "wb+interp", "wc+interp" };
+	// a made up correction, only the cost matters
+	static const struct rfnm_iq_corr corr = {
+		.m = { RFNM_IQ_CORR_ONE, 100, -100, RFNM_IQ_CORR_ONE - 50 }, .dc = { 8, -8 }, .enabled = 1,
+	};
+	struct rfnm_tx_interp *ip = NULL;
+	u32 slots = RFNM_MB_TX_RING_SIZE / sizeof(struct rfnm_bufdesc_tx);
+	u32 chunks, mode;
+	struct rfnm_mb_tx_res res;
+	uint8_t *src, *ref;
+	void *wb, *wc;
+	u64 period_ps;
+	int cpu;
+
+	if (!rfnm_mb_iters || !rfnm_mb_dac_ksps || slots < RFNM_TX_USB_BUF_MULTI * RFNM_MB_TX_INTERP)
+		return -EINVAL;
+
+	src = vmalloc(LA_TX_BASE_BUFSIZE_12 * RFNM_TX_USB_BUF_MULTI);
+	ref = vmalloc(LA_TX_BASE_BUFSIZE);
+	wb = alloc_pages_exact(RFNM_MB_TX_RING_SIZE, GFP_KERNEL);
+	if (!src || !ref || !wb) {
+		vfree(src);
+		vfree(ref);
+		if (wb)
+			free_pages_exact(wb, RFNM_MB_TX_RING_SIZE);
+		return -ENOMEM;
+	}
+
+	get_random_bytes(src, LA_TX_BASE_BUFSIZE_12 * RFNM_TX_USB_BUF_MULTI);
+	rfnm_mb_unpack_ref((int16_t *) ref, &src[(RFNM_TX_USB_BUF_MULTI - 1) * LA_TX_BASE_BUFSIZE_12],
+			LA_TX_BASE_BUFSIZE);
+
+	// the ring goes round a few times
+	chunks = max_t(u32, rfnm_mb_iters, 4 * slots / RFNM_TX_USB_BUF_MULTI);
+	// LA_TX_BASE_BUFSIZE / 4 samples
+	period_ps = div64_u64((u64) LA_TX_BASE_BUFSIZE * 250000000ULL, rfnm_mb_dac_ksps);
+
+	// nco at dac rate / 16
+	ip = rfnm_tx_interp_alloc(RFNM_MB_TX_INTERP, 1 << 28, LA_TX_BASE_BUFSIZE / 4);
+	if (IS_ERR(ip))
+		ip = NULL;
+
+	migrate_disable();
+	cpu = smp_processor_id();
+
+	seq_printf(s, "cpu %d, dac %u ksps, %u bytes a buffer played in %llu ns, %u buffers a chunk, %u chunks\n",
+		cpu, rfnm_mb_dac_ksps, LA_TX_BASE_BUFSIZE, div64_u64(period_ps, 1000),
+		RFNM_TX_USB_BUF_MULTI, chunks);
+	seq_printf(s, "%-10s %12s %12s %10s %s\n", "mode", "ns/buffer", "max ns/buf", "% of dac", "check");
+
+	for (mode = 0; mode < ARRAY_SIZE(modes); mode++) {
+		int use_wc = mode & 1;
+		u32 bufs = RFNM_TX_USB_BUF_MULTI;
+		u64 per_buf, max_buf;
+
+		if (mode >= 2) {
+			if (!ip) {
+				seq_printf(s, "%-10s can't set up the interpolator\n", modes[mode]);
+				continue;
+			}
+			bufs *= RFNM_MB_TX_INTERP;
+		}
+
+		// wb first, mapping wc cleans and invalidates what it left in the cache
+		wc = NULL;
+		if (use_wc) {
+			wc = rfnm_dma_vmap_wc(virt_to_phys(wb), RFNM_MB_TX_RING_SIZE);
+			if (!wc) {
+				seq_printf(s, "%-10s can't map write-combining\n", modes[mode]);
+				continue;
+			}
+		}
+
+		rfnm_mb_tx_ring(&res, use_wc ? wc : wb, slots, src, ref, chunks, use_wc,
+				mode >= 2 ? ip : NULL, &corr);
+		rfnm_dma_vunmap_wc(wc);
+
+		per_buf = div64_u64(res.ns, (u64) chunks * bufs);
+		max_buf = div64_u64(res.max_ns, bufs);
+
+		seq_printf(s, "%-10s %12llu %12llu %9llu%% %s\n", modes[mode], per_buf, max_buf,
+			div64_u64(per_buf * 100000, period_ps), res.check);
+
+		cond_resched();
+	}
+
+	migrate_enable();
+
+	rfnm_tx_interp_free(ip);
+	free_pages_exact(wb, RFNM_MB_TX_RING_SIZE);
+	vfree(src);
+	vfree(ref);
+	return 0;
+}
+
+static int dfs_rfnm_tx_wc_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dfs_rfnm_tx_wc_bench_show, NULL);
+}
+
+static const struct file_operations dfs_rfnm_tx_wc_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_tx_wc_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static u32 rfnm_ring_check_sink;
+
+static u64 rfnm_ring_check_time(u32 size, int tx, u32 n)
+{
+	u64 t0 = ktime_get_ns();
+
+	WRITE_ONCE(rfnm_ring_check_sink, rfnm_ring_check_bench(size, tx, n));
+	// ps per call
+	return div64_u64((ktime_get_ns() - t0) * 1000, n);
+}
+
+static int dfs_rfnm_ring_check_show(struct seq_file *s, void *unused)
+{
+	struct rfnm_ring_check c;
+	int z, failed = 0;
+
+	if (!rfnm_mb_iters)
+		return -EINVAL;
+
+	seq_printf(s, "%8s %10s %6s %12s %12s\n", "size", "cases", "failed", "rx_poll ns", "tx_poll ns");
+
+	for (z = 0; z < ARRAY_SIZE(rfnm_ring_check_sizes); z++) {
+		u32 size = rfnm_ring_check_sizes[z];
+		u32 n = size * rfnm_mb_iters;
+		u64 rx, tx;
+
+		rfnm_ring_check_run(&c, size);
+		rx = rfnm_ring_check_time(size, 0, n);
+		tx = rfnm_ring_check_time(size, 1, n);
+
+		seq_printf(s, "%8u %10u %6u %8llu.%03llu %8llu.%03llu\n", size, c.cases, c.failed,
+			rx / 1000, rx % 1000, tx / 1000, tx % 1000);
+		if (c.failed) {
+			seq_printf(s, "\tfirst: %s, head %u tail %u\n", c.what, c.head, c.tail);
+			failed++;
+		}
+
+		cond_resched();
+	}
+
+	seq_printf(s, "%s\n", failed ? "FAIL" : "ok");
+	return 0;
+}
+
+static int dfs_rfnm_ring_check_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dfs_rfnm_ring_check_show, NULL);
+}
+
+static const struct file_operations dfs_rfnm_ring_check_fops = {
+	.owner = THIS_MODULE,
+	.open = dfs_rfnm_ring_check_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+#if IS_ENABLED(CONFIG_KUNIT)
+// for rfnm_ring_kunit.ko, rfnm_ring*.c also build in user space
+EXPORT_SYMBOL_GPL(rfnm_ring_rx_poll);
+EXPORT_SYMBOL_GPL(rfnm_ring_rx_cc);
+EXPORT_SYMBOL_GPL(rfnm_ring_tx_poll);
+EXPORT_SYMBOL_GPL(rfnm_ring_tx_cc);
+EXPORT_SYMBOL_GPL(rfnm_ring_check_run);
+#endif
+
+void rfnm_microbench_init(struct dentry *dir)
+{
+	debugfs_create_file("microbench", 0444, dir, NULL, &dfs_rfnm_microbench_fops);
+	debugfs_create_u32("microbench_iters", 0644, dir, &rfnm_mb_iters);
+	debugfs_create_file("ring_check", 0444, dir, NULL, &dfs_rfnm_ring_check_fops);
+	debugfs_create_file("tx_wc_bench", 0444, dir, NULL, &dfs_rfnm_tx_wc_bench_fops);
+	debugfs_create_u32("tx_wc_bench_ksps", 0644, dir, &rfnm_mb_dac_ksps);
+}
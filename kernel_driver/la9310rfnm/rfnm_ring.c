@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_ring.c - LA9310 ring flow control, shared with app/rfnm_ring_sim
+ *
+ * Keep this free of anything but integer arithmetic, the simulator compiles
+ * it as is in user space.
+ */
+
+#include "rfnm_ring.h"
+
+enum rfnm_ring_rx_act rfnm_ring_rx_poll(uint32_t size, uint32_t head, uint32_t tail, uint32_t *cnt)
+{
+	uint32_t readable = rfnm_ring_readable(size, head, tail);
+
+	if(readable < RFNM_RING_RX_MIN) {
+		*cnt = 0;
+		return RFNM_RING_RX_WAIT;
+	}
+
+	readable -= RFNM_RING_RX_LAG;
+	*cnt = readable;
+
+	if(readable > size / 4) {
+		// too many buffers behind, jump forward
+		return RFNM_RING_RX_OVERRUN;
+	}
+
+	return RFNM_RING_RX_READ;
+}
+
+int rfnm_ring_rx_cc(uint32_t *expect, uint32_t cc)
+{
+	int err = *expect != cc;
+
+	*expect = cc + 1;
+	return err;
+}
+
+enum rfnm_ring_tx_act rfnm_ring_tx_poll(uint32_t size, uint32_t tail, uint32_t *head,
+					uint32_t want, uint32_t *cnt)
+{
+	uint32_t writable = rfnm_ring_writable(size, *head, tail);
+	uint32_t margin = size - writable;
+
+	if(margin < RFNM_RING_TX_MIN_MARGIN || margin > RFNM_RING_TX_MAX_LATENCY) {
+		// too close to the M7, or too far ahead, restart a fixed latency ahead of it
+		*head = (rfnm_ring_wrap(size, tail) + RFNM_RING_TX_RESTART) % size;
+		*cnt = margin;
+		return margin < RFNM_RING_TX_MIN_MARGIN ? RFNM_RING_TX_UNDERRUN : RFNM_RING_TX_LATENCY;
+	}
+
+	if(writable < want) {
+		*cnt = writable;
+		return RFNM_RING_TX_WAIT;
+	}
+
+	*cnt = want;
+	return RFNM_RING_TX_WRITE;
+}
+
+int64_t rfnm_ring_tx_cc(uint64_t *expect, uint64_t usb_cc)
+{
+	int64_t gap = usb_cc - *expect;
+
+	*expect = usb_cc + 1;
+	return gap;
+}
@@ -0,0 +1,133 @@
+#ifndef __RFNM_RING_H__
+#define __RFNM_RING_H__
+
+/*
+ * Flow control between the LA9310 (M7) and the streaming threads, without
+ * the memory it runs on.
+ *
+ * RX: the M7 fills rfnm_bufdesc_rx and publishes rx_head, rfnm_handler_in
+ * reads behind it from tail. TX: rfnm_handler_out fills rfnm_bufdesc_tx from
+ * head, the M7 plays them out and publishes tx_buf_id.
+ *
+ * la9310_rfnm.c runs this on the shared memory, app/rfnm_ring_sim on a
+ * simulated M7 in user space, so both must build without kernel headers
+ * beyond linux/types.h.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+// wait until this many buffers are readable
+#define RFNM_RING_RX_MIN		32
+// need to stay behind writer, as the ping pong dma has a 2 buffers write latency
+#define RFNM_RING_RX_LAG		16
+
+// closer than this to the M7 read position is an underrun
+#define RFNM_RING_TX_MIN_MARGIN		20
+// buffers queued ahead of the M7 before the latency is cut back
+#define RFNM_RING_TX_MAX_LATENCY	4500
+// where head restarts after an underrun or a latency cut, ahead of the M7
+#define RFNM_RING_TX_RESTART		(RFNM_RING_TX_MAX_LATENCY / 3)
+
+/*
+ * Occupancy, for any head and tail. The indices published by the M7 are
+ * taken modulo size, an out of range one (a torn read, a restarted M7)
+ * must not send head or tail out of the ring.
+ */
+static inline uint32_t rfnm_ring_wrap(uint32_t size, uint32_t idx)
+{
+	return idx < size ? idx : idx % size;
+}
+
+// buffers from tail up to head, the reader side
+static inline uint32_t rfnm_ring_readable(uint32_t size, uint32_t head, uint32_t tail)
+{
+	head = rfnm_ring_wrap(size, head);
+	tail = rfnm_ring_wrap(size, tail);
+	return head >= tail ? head - tail : size - tail + head;
+}
+
+// buffers from head up to tail, the writer side
+static inline uint32_t rfnm_ring_writable(uint32_t size, uint32_t head, uint32_t tail)
+{
+	return rfnm_ring_readable(size, tail, head);
+}
+
+// buffers the writer is ahead of the reader, size when head == tail
+static inline uint32_t rfnm_ring_margin(uint32_t size, uint32_t head, uint32_t tail)
+{
+	return size - rfnm_ring_writable(size, head, tail);
+}
+
+enum rfnm_ring_rx_act {
+	RFNM_RING_RX_WAIT,
+	RFNM_RING_RX_READ,
+	// over a quarter of the ring behind, tail must jump to the writer
+	RFNM_RING_RX_OVERRUN,
+};
+
+enum rfnm_ring_tx_act {
+	// less than a usb chunk of room
+	RFNM_RING_TX_WAIT,
+	RFNM_RING_TX_WRITE,
+	// head was moved to RFNM_RING_TX_RESTART ahead of the M7
+	RFNM_RING_TX_UNDERRUN,
+	RFNM_RING_TX_LATENCY,
+};
+
+/*
+ * head: rx_head of the M7, tail: next buffer to read
+ * cnt: READ buffers to read from tail, OVERRUN how far behind
+ */
+enum rfnm_ring_rx_act rfnm_ring_rx_poll(uint32_t size, uint32_t head, uint32_t tail, uint32_t *cnt);
+
+/*
+ * Check cc against the one expected for its adc and expect the next.
+ * Returns nonzero if buffers were lost or repeated.
+ */
+int rfnm_ring_rx_cc(uint32_t *expect, uint32_t cc);
+
+/*
+ * tail: tx_buf_id of the M7, head: next buffer to fill, moved on
+ * UNDERRUN and LATENCY. want: buffers one usb chunk expands to.
+ * cnt: WRITE buffers to fill from head, UNDERRUN/LATENCY the margin
+ */
+enum rfnm_ring_tx_act rfnm_ring_tx_poll(uint32_t size, uint32_t tail, uint32_t *head,
+					uint32_t want, uint32_t *cnt);
+
+/*
+ * Check the usb_cc of a chunk against the expected one and expect the next.
+ * Returns the gap, 0 if continuous.
+ */
+int64_t rfnm_ring_tx_cc(uint64_t *expect, uint64_t usb_cc);
+
+static inline uint32_t rfnm_ring_next(uint32_t size, uint32_t idx)
+{
+	if(++idx == size) {
+		idx = 0;
+	}
+	return idx;
+}
+
+/*
+ * Self check and benchmark, rfnm_ring_check.c. rfnm/ring_check in debugfs
+ * and rfnm_ring_sim -C run them.
+ */
+struct rfnm_ring_check {
+	uint32_t cases;
+	uint32_t failed;
+	// first failure
+	const char *what;
+	uint32_t head, tail;
+};
+
+// sweep head and tail over every position of small rings, the boundaries of big ones
+void rfnm_ring_check_run(struct rfnm_ring_check *c, uint32_t size);
+
+// n rfnm_ring_rx_poll or rfnm_ring_tx_poll calls over all positions, returns a checksum
+uint32_t rfnm_ring_check_bench(uint32_t size, int tx, uint32_t n);
+
+#endif
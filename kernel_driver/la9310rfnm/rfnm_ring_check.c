@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_ring_check.c - self check and benchmark of the ring flow control
+ *
+ * Checks rfnm_ring.c against plain modular arithmetic for every head/tail
+ * pair of small rings and for the positions around 0, the lag, the minimum
+ * read, a quarter and the end of big ones, out of range M7 indices
+ * included, and the cc checks across gaps, repeats and 32 bit wrap.
+ * Built into la9310rfnm.ko (rfnm/ring_check) and librfnm_ring
+ * (rfnm_ring_sim -C), so it sticks to integer code like rfnm_ring.c.
+ */
+
+#include "rfnm_ring.h"
+
+// rings up to this size get every head/tail pair
+#define RFNM_RING_CHECK_FULL	256
+
+static const uint32_t rfnm_ring_check_wants[] = { 1, 4, 64 };
+
+static void rfnm_ring_check_fail(struct rfnm_ring_check *c, const char *what,
+				 uint32_t head, uint32_t tail)
+{
+	if(!c->failed++) {
+		c->what = what;
+		c->head = head;
+		c->tail = tail;
+	}
+}
+
+#define RFNM_RING_CHECK(c, cond, what, head, tail)	do {	\
+	(c)->cases++;						\
+	if(!(cond))						\
+		rfnm_ring_check_fail(c, what, head, tail);	\
+} while(0)
+
+static void rfnm_ring_check_pair(struct rfnm_ring_check *c, uint32_t size, uint32_t head, uint32_t tail)
+{
+	uint32_t h = (uint32_t) ((uint64_t) head % size), t = (uint32_t) ((uint64_t) tail % size);
+	uint32_t readable = (uint32_t) (((uint64_t) h + size - t) % size);
+	uint32_t writable = (uint32_t) (((uint64_t) t + size - h) % size);
+	uint32_t cnt, new_head, w;
+	enum rfnm_ring_rx_act rx;
+	enum rfnm_ring_tx_act tx;
+
+	RFNM_RING_CHECK(c, rfnm_ring_readable(size, head, tail) == readable, "readable", head, tail);
+	RFNM_RING_CHECK(c, rfnm_ring_writable(size, head, tail) == writable, "writable", head, tail);
+	RFNM_RING_CHECK(c, rfnm_ring_margin(size, head, tail) == size - writable, "margin", head, tail);
+	RFNM_RING_CHECK(c, readable + writable == (h == t ? 0 : size), "readable + writable", head, tail);
+
+	// RX, head is rx_head of the M7
+	rx = rfnm_ring_rx_poll(size, head, tail, &cnt);
+	if(readable < RFNM_RING_RX_MIN) {
+		RFNM_RING_CHECK(c, rx == RFNM_RING_RX_WAIT && !cnt, "rx wait", head, tail);
+	} else {
+		RFNM_RING_CHECK(c, cnt == readable - RFNM_RING_RX_LAG, "rx lag", head, tail);
+		RFNM_RING_CHECK(c, rx == (cnt > size / 4 ? RFNM_RING_RX_OVERRUN : RFNM_RING_RX_READ),
+				"rx overrun", head, tail);
+	}
+
+	// TX, head is the kernel head, tail tx_buf_id of the M7
+	for(w = 0; w < sizeof(rfnm_ring_check_wants) / sizeof(rfnm_ring_check_wants[0]); w++) {
+		uint32_t want = rfnm_ring_check_wants[w];
+		uint32_t margin = size - writable;
+
+		new_head = head;
+		tx = rfnm_ring_tx_poll(size, tail, &new_head, want, &cnt);
+
+		if(margin < RFNM_RING_TX_MIN_MARGIN || margin > RFNM_RING_TX_MAX_LATENCY) {
+			RFNM_RING_CHECK(c, tx == (margin < RFNM_RING_TX_MIN_MARGIN ?
+					RFNM_RING_TX_UNDERRUN : RFNM_RING_TX_LATENCY) && cnt == margin,
+					"tx restart", head, tail);
+			RFNM_RING_CHECK(c, new_head == (uint32_t) (((uint64_t) t + RFNM_RING_TX_RESTART) % size),
+					"tx restart head", head, tail);
+		} else if(writable < want) {
+			RFNM_RING_CHECK(c, tx == RFNM_RING_TX_WAIT && new_head == head, "tx wait", head, tail);
+		} else {
+			RFNM_RING_CHECK(c, tx == RFNM_RING_TX_WRITE && cnt == want && new_head == head,
+					"tx write", head, tail);
+		}
+		RFNM_RING_CHECK(c, new_head < size || new_head == head, "tx head range", head, tail);
+	}
+}
+
+static void rfnm_ring_check_cc(struct rfnm_ring_check *c)
+{
+	static const uint32_t starts[] = { 0, 1, 0x7fffffff, 0xfffffffe, 0xffffffff };
+	static const int32_t gaps[] = { 1, 2, 17, -1, -2, 0x4000 };
+	uint64_t usb_expect;
+	uint32_t expect;
+	int i, g;
+
+	for(i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		// continuous, across the 32 bit wrap of the adc cc
+		expect = starts[i];
+		RFNM_RING_CHECK(c, !rfnm_ring_rx_cc(&expect, starts[i]), "rx cc", starts[i], 0);
+		RFNM_RING_CHECK(c, !rfnm_ring_rx_cc(&expect, starts[i] + 1), "rx cc wrap", starts[i], 1);
+
+		for(g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+			uint32_t cc = starts[i] + gaps[g];
+
+			// a gap or a repeat is one error, then in sequence again
+			expect = starts[i] + 1;
+			RFNM_RING_CHECK(c, rfnm_ring_rx_cc(&expect, cc) == (gaps[g] != 1), "rx cc gap", starts[i], cc);
+			RFNM_RING_CHECK(c, !rfnm_ring_rx_cc(&expect, cc + 1), "rx cc resync", starts[i], cc);
+
+			usb_expect = (uint64_t) starts[i] + 1;
+			RFNM_RING_CHECK(c, rfnm_ring_tx_cc(&usb_expect, (uint64_t) starts[i] + gaps[g]) == gaps[g] - 1,
+					"tx cc gap", starts[i], gaps[g]);
+			RFNM_RING_CHECK(c, !rfnm_ring_tx_cc(&usb_expect, (uint64_t) starts[i] + gaps[g] + 1),
+					"tx cc resync", starts[i], gaps[g]);
+		}
+	}
+
+	// usb_cc is 64 bit, no wrap at 2^32
+	usb_expect = 0xffffffffULL;
+	RFNM_RING_CHECK(c, !rfnm_ring_tx_cc(&usb_expect, 0xffffffffULL), "tx cc 32", 0xffffffff, 0);
+	RFNM_RING_CHECK(c, usb_expect == 0x100000000ULL, "tx cc 64", 0xffffffff, 1);
+}
+
+void rfnm_ring_check_run(struct rfnm_ring_check *c, uint32_t size)
+{
+	uint32_t pos[32];
+	uint32_t npos = 0, h, t;
+
+	c->cases = 0;
+	c->failed = 0;
+	c->what = 0;
+
+	rfnm_ring_check_cc(c);
+
+	if(size <= RFNM_RING_CHECK_FULL) {
+		for(h = 0; h < size; h++) {
+			for(t = 0; t < size; t++) {
+				rfnm_ring_check_pair(c, size, h, t);
+			}
+		}
+		return;
+	}
+
+	pos[npos++] = 0;
+	pos[npos++] = 1;
+	pos[npos++] = RFNM_RING_RX_LAG - 1;
+	pos[npos++] = RFNM_RING_RX_LAG;
+	pos[npos++] = RFNM_RING_RX_MIN - 1;
+	pos[npos++] = RFNM_RING_RX_MIN;
+	pos[npos++] = RFNM_RING_TX_MIN_MARGIN;
+	pos[npos++] = size / 4 - 1;
+	pos[npos++] = size / 4;
+	pos[npos++] = size / 4 + RFNM_RING_RX_LAG;
+	pos[npos++] = size / 4 + RFNM_RING_RX_LAG + 1;
+	pos[npos++] = size / 2;
+	pos[npos++] = size - RFNM_RING_TX_MAX_LATENCY % size;
+	pos[npos++] = size - RFNM_RING_TX_RESTART % size;
+	pos[npos++] = size - RFNM_RING_RX_MIN;
+	pos[npos++] = size - 2;
+	pos[npos++] = size - 1;
+	// out of range, what the M7 might publish
+	pos[npos++] = size;
+	pos[npos++] = size + 1;
+	pos[npos++] = 2 * size - 1;
+	pos[npos++] = 0xffffbfff;
+	pos[npos++] = 0xffffffff;
+
+	// every pair of positions, and each of them against a full sweep of the other side
+	for(h = 0; h < npos; h++) {
+		for(t = 0; t < npos; t++) {
+			rfnm_ring_check_pair(c, size, pos[h], pos[t]);
+		}
+		for(t = 0; t < size; t++) {
+			rfnm_ring_check_pair(c, size, pos[h], t);
+			rfnm_ring_check_pair(c, size, t, pos[h]);
+		}
+	}
+}
+
+uint32_t rfnm_ring_check_bench(uint32_t size, int tx, uint32_t n)
+{
+	uint32_t sum = 0, head = 0, tail = 0, cnt, i;
+
+	for(i = 0; i < n; i++) {
+		// head walks the ring, tail lags it by a varying amount
+		if(++head == size) {
+			head = 0;
+			tail = (tail + 97) % size;
+		}
+
+		if(tx) {
+			uint32_t h = head;
+
+			sum += rfnm_ring_tx_poll(size, tail, &h, 4, &cnt) + cnt + h;
+		} else {
+			sum += rfnm_ring_rx_poll(size, head, tail, &cnt) + cnt;
+		}
+	}
+
+	return sum;
+}
@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_ring_kunit.c - KUnit suite of the ring flow control
+ *
+ * rfnm_ring_check_run over the ring sizes of rfnm/ring_check, then the
+ * policy edges of rfnm_ring.c one by one. Built as rfnm_ring_kunit.ko when
+ * the kernel has CONFIG_KUNIT, on the rfnm_ring symbols of la9310rfnm.ko:
+ *	insmod la9310rfnm.ko && insmod rfnm_ring_kunit.ko
+ * The results are in dmesg and /sys/kernel/debug/kunit/rfnm_ring/results.
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+
+#include "rfnm_ring.h"
+
+#define RFNM_KUNIT_SIZE	4096
+
+static const u32 rfnm_ring_kunit_sizes[] = { 128, 200, 256, 4096, 0x4000 };
+
+static void rfnm_ring_kunit_size_desc(const u32 *size, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "size %u", *size);
+}
+
+KUNIT_ARRAY_PARAM(rfnm_ring_kunit_size, rfnm_ring_kunit_sizes, rfnm_ring_kunit_size_desc);
+
+// every head/tail pair of the small rings, the boundaries of the big ones, the cc checks
+static void rfnm_ring_kunit_check(struct kunit *test)
+{
+	const u32 *size = test->param_value;
+	struct rfnm_ring_check c;
+
+	rfnm_ring_check_run(&c, *size);
+
+	KUNIT_EXPECT_GT(test, c.cases, 0u);
+	KUNIT_EXPECT_EQ_MSG(test, c.failed, 0u, "%s, head %u tail %u",
+		c.what ? c.what : "", c.head, c.tail);
+}
+
+static void rfnm_ring_kunit_rx(struct kunit *test)
+{
+	u32 cnt;
+
+	// below RFNM_RING_RX_MIN nothing is read
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_poll(RFNM_KUNIT_SIZE, RFNM_RING_RX_MIN - 1, 0, &cnt), RFNM_RING_RX_WAIT);
+	KUNIT_EXPECT_EQ(test, cnt, 0u);
+
+	// then all but the lag behind the M7
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_poll(RFNM_KUNIT_SIZE, RFNM_RING_RX_MIN, 0, &cnt), RFNM_RING_RX_READ);
+	KUNIT_EXPECT_EQ(test, cnt, (u32) (RFNM_RING_RX_MIN - RFNM_RING_RX_LAG));
+
+	// across the end of the ring
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_poll(RFNM_KUNIT_SIZE, 8, RFNM_KUNIT_SIZE - 40, &cnt), RFNM_RING_RX_READ);
+	KUNIT_EXPECT_EQ(test, cnt, (u32) (48 - RFNM_RING_RX_LAG));
+
+	// a quarter of the ring is still read, one more is an overrun
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_poll(RFNM_KUNIT_SIZE, RFNM_KUNIT_SIZE / 4 + RFNM_RING_RX_LAG, 0, &cnt),
+		RFNM_RING_RX_READ);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_poll(RFNM_KUNIT_SIZE, RFNM_KUNIT_SIZE / 4 + RFNM_RING_RX_LAG + 1, 0, &cnt),
+		RFNM_RING_RX_OVERRUN);
+	KUNIT_EXPECT_EQ(test, cnt, (u32) (RFNM_KUNIT_SIZE / 4 + 1));
+}
+
+static void rfnm_ring_kunit_tx(struct kunit *test)
+{
+	u32 head, cnt;
+
+	// enough room and margin, head stays for the caller to move
+	head = RFNM_RING_TX_MIN_MARGIN;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_poll(RFNM_KUNIT_SIZE, 0, &head, 4, &cnt), RFNM_RING_TX_WRITE);
+	KUNIT_EXPECT_EQ(test, cnt, 4u);
+	KUNIT_EXPECT_EQ(test, head, (u32) RFNM_RING_TX_MIN_MARGIN);
+
+	// too close to the M7, head restarts ahead of it
+	head = RFNM_RING_TX_MIN_MARGIN - 1;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_poll(RFNM_KUNIT_SIZE, 0, &head, 4, &cnt), RFNM_RING_TX_UNDERRUN);
+	KUNIT_EXPECT_EQ(test, cnt, (u32) (RFNM_RING_TX_MIN_MARGIN - 1));
+	KUNIT_EXPECT_EQ(test, head, (u32) RFNM_RING_TX_RESTART);
+
+	// head == tail is a full ring, a margin of size
+	head = 100;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_poll(RFNM_KUNIT_SIZE, 100, &head, 4, &cnt), RFNM_RING_TX_WAIT);
+	KUNIT_EXPECT_EQ(test, cnt, 0u);
+	KUNIT_EXPECT_EQ(test, head, 100u);
+
+	// too far ahead, the latency is cut back across the end of the ring
+	head = RFNM_RING_TX_MAX_LATENCY + 1;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_poll(0x4000, 0, &head, 4, &cnt), RFNM_RING_TX_LATENCY);
+	head = 0x4000 - 10;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_poll(0x4000, 0x4000 - 20, &head, 4, &cnt), RFNM_RING_TX_UNDERRUN);
+	KUNIT_EXPECT_EQ(test, head, (u32) ((0x4000 - 20 + RFNM_RING_TX_RESTART) % 0x4000));
+
+	// less room than a usb chunk
+	head = 2 * RFNM_RING_TX_MIN_MARGIN;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_poll(2 * RFNM_RING_TX_MIN_MARGIN + 4, 0, &head, 8, &cnt), RFNM_RING_TX_WAIT);
+	KUNIT_EXPECT_EQ(test, cnt, 4u);
+	KUNIT_EXPECT_EQ(test, head, (u32) (2 * RFNM_RING_TX_MIN_MARGIN));
+}
+
+// indices the M7 publishes are taken modulo the size, head and tail never leave the ring
+static void rfnm_ring_kunit_range(struct kunit *test)
+{
+	u32 head, cnt;
+
+	KUNIT_EXPECT_EQ(test, rfnm_ring_wrap(RFNM_KUNIT_SIZE, RFNM_KUNIT_SIZE), 0u);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_wrap(RFNM_KUNIT_SIZE, 0xffffffff), 0xffffffffu % RFNM_KUNIT_SIZE);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_readable(RFNM_KUNIT_SIZE, RFNM_KUNIT_SIZE + 40, 0), 40u);
+
+	head = 0;
+	rfnm_ring_tx_poll(RFNM_KUNIT_SIZE, 0xffffffff, &head, 4, &cnt);
+	KUNIT_EXPECT_LT(test, head, (u32) RFNM_KUNIT_SIZE);
+}
+
+static void rfnm_ring_kunit_cc(struct kunit *test)
+{
+	u64 usb_expect;
+	u32 expect;
+
+	// the adc cc wraps at 32 bit
+	expect = 0xffffffff;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_cc(&expect, 0xffffffff), 0);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_cc(&expect, 0), 0);
+
+	// a gap or a repeat is one error, then in sequence again
+	expect = 10;
+	KUNIT_EXPECT_NE(test, rfnm_ring_rx_cc(&expect, 12), 0);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_rx_cc(&expect, 13), 0);
+	KUNIT_EXPECT_NE(test, rfnm_ring_rx_cc(&expect, 13), 0);
+
+	// usb_cc is 64 bit, the gap is signed
+	usb_expect = 0xffffffffULL;
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_cc(&usb_expect, 0xffffffffULL), 0LL);
+	KUNIT_EXPECT_EQ(test, usb_expect, 0x100000000ULL);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_cc(&usb_expect, 0x100000011ULL), 0x11LL);
+	KUNIT_EXPECT_EQ(test, rfnm_ring_tx_cc(&usb_expect, 0x100000011ULL), -1LL);
+}
+
+static struct kunit_case rfnm_ring_kunit_cases[] = {
+	KUNIT_CASE_PARAM(rfnm_ring_kunit_check, rfnm_ring_kunit_size_gen_params),
+	KUNIT_CASE(rfnm_ring_kunit_rx),
+	KUNIT_CASE(rfnm_ring_kunit_tx),
+	KUNIT_CASE(rfnm_ring_kunit_range),
+	KUNIT_CASE(rfnm_ring_kunit_cc),
+	{}
+};
+
+static struct kunit_suite rfnm_ring_kunit_suite = {
+	.name = "rfnm_ring",
+	.test_cases = rfnm_ring_kunit_cases,
+};
+
+kunit_test_suite(rfnm_ring_kunit_suite);
+
+MODULE_DESCRIPTION("KUnit tests of the RFNM ring flow control");
+MODULE_LICENSE("GPL");
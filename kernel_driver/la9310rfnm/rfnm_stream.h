@@ -0,0 +1,113 @@
+#ifndef __RFNM_STREAM_H__
+#define __RFNM_STREAM_H__
+
+/*
+ * Glue between the RFNM usb function (rfnm_usb_function.ko), the
+ * streaming core (la9310rfnm.ko) and rfnm_daughterboard.ko.
+ */
+
+// bulk endpoints per direction, adc channel N streams on IN endpoint N, the
+// OUT endpoints all feed the dac ring, ordered by usb_cc
+#define RFNM_EP_CNT 4
+
+// usb_request->context carries the endpoint index
+#define RFNM_EP_ID_TO_CTX(id)	((void *) (uintptr_t) (id))
+#define RFNM_EP_CTX_TO_ID(ctx)	((int) (uintptr_t) (ctx))
+
+// requests queued per endpoint when f_ss_opts bulk_qlen is left at 0
+#define RFNM_USB_IN_QLEN_DEFAULT	16
+#define RFNM_USB_OUT_QLEN_DEFAULT	8
+#define RFNM_USB_QLEN_MAX		64
+
+// an IN request spans up to this many consecutive struct rfnm_rx_usb_buf, on udcs
+// with sg support the run may wrap around the end of the ring
+#define RFNM_RX_REQ_SLOTS_MAX		8
+
+void rfnm_stream_set_rx_req_size(uint32_t bytes, int sg_supported);
+
+// alt setting 1 turns the IN endpoints isochronous, chunk is the payload per
+// service interval (maxpacket * mult * burst), 0 goes back to bulk
+void rfnm_stream_set_iso(int id, uint32_t chunk);
+
+enum {
+	RFNM_EP_DIR_IN,
+	RFNM_EP_DIR_OUT,
+	RFNM_EP_DIR_CNT,
+};
+
+struct usb_ep;
+struct usb_request;
+
+// the streaming core dequeues these when it recovers a failed endpoint
+void rfnm_stream_ep_add_req(int dir, int id, struct usb_ep *ep, struct usb_request *req);
+void rfnm_stream_ep_reset(int dir, int id);
+
+/*
+ * Stream events, pushed to the host on the interrupt IN endpoint. A transfer
+ * carries as many records as fit in RFNM_NOTIFY_MAXPACKET.
+ */
+enum {
+	RFNM_EVT_RX_OVERRUN = 1,	// ch = adc (0xff: all), arg = buffers lost
+	RFNM_EVT_TX_UNDERRUN,		// ch = dac, arg = dac buffers left when the reader caught up
+	RFNM_EVT_TX_CC_GAP,		// ch = dac, arg = usb buffers missing from the host
+	RFNM_EVT_RETUNE_DONE,		// ch = RFNM_EVT_CH_RX/TX, arg = cc of the applied channel list
+	RFNM_EVT_EP_RECOVERY,		// ch = endpoint | RFNM_EVT_CH_IN for IN, arg = 0 or -errno
+	RFNM_EVT_LATENCY,		// ch = dac, arg = dac buffers queued before the latency was cut
+	RFNM_EVT_STALL,			// ch = RFNM_HEALTH_* stage, arg = ms without progress
+};
+
+#define RFNM_EVT_CH_RX		0
+#define RFNM_EVT_CH_TX		1
+#define RFNM_EVT_CH_IN		0x80
+
+// stages the health check watches, the ch of RFNM_EVT_STALL
+enum {
+	RFNM_HEALTH_RX_M7,	// rx_head published by the M7
+	RFNM_HEALTH_RX,		// rfnm_handler_in
+	RFNM_HEALTH_USB_IN,	// IN completions
+	RFNM_HEALTH_TX,		// rfnm_handler_out
+	RFNM_HEALTH_TX_M7,	// tx_buf_id published by the M7
+	RFNM_HEALTH_CNT,
+};
+
+struct __attribute__((__packed__)) rfnm_stream_event {
+	uint8_t type;
+	uint8_t ch;
+	uint16_t seq;
+	uint32_t arg;
+	uint64_t ts_ns;
+};
+
+#define RFNM_NOTIFY_MAXPACKET	64
+
+typedef void (*rfnm_stream_notify_fn)(const struct rfnm_stream_event *ev);
+
+// the usb function registers its sender, NULL unregisters and waits for running calls
+void rfnm_stream_set_notifier(rfnm_stream_notify_fn fn);
+void rfnm_stream_event(uint8_t type, uint8_t ch, uint32_t arg);
+
+/*
+ * Second consumer of the rx ring next to usb (e.g. rfnm_udp.ko). The RX thread
+ * of LA9310 nlm<dev> calls the tap for every struct rfnm_rx_usb_buf it
+ * finishes, the buffer stays valid until the ring wraps, check usb_cc before
+ * and after reading it. The tap must not block, NULL unregisters and waits
+ * for running calls. -ENODEV if there is no such pipeline.
+ */
+struct rfnm_rx_usb_buf;
+typedef void (*rfnm_rx_tap_fn)(const struct rfnm_rx_usb_buf *buf);
+int rfnm_stream_set_rx_tap(int dev, rfnm_rx_tap_fn fn);
+
+/*
+ * Soft restart for RFNM_GET_SM_RESET. ep0 setup can't wait for the stages, so
+ * this returns at once and done runs later from the USB thread with 0 once
+ * the new epoch runs, or from a work item with -ETIMEDOUT. -EBUSY while an
+ * earlier restart still waits for done.
+ */
+typedef void (*rfnm_restart_done_fn)(void *ctx, int status);
+int rfnm_stream_soft_restart(rfnm_restart_done_fn done, void *ctx);
+
+// rfnm_daughterboard calls this once a channel list has been applied
+typedef void (*rfnm_chlist_done_fn)(int txrx, uint32_t cc);
+void rfnm_set_chlist_done_cb(rfnm_chlist_done_fn fn);
+
+#endif
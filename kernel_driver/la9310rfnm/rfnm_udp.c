@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_udp.c - IQ streaming over UDP on the usb ethernet (NCM) link
+ *
+ * Every rx usb buffer of the enabled adcs is sent as VITA-49.0 IF data
+ * packets, one multicast group per adc, so several hosts can subscribe to
+ * a channel at the same time as the vendor bulk interface is streaming.
+ *
+ * Packet layout (big endian, 5 words of header):
+ *	word 0	packet type 1 (IF data with stream id), TSI other, TSF sample
+ *		count, 4 bit packet count, packet size in words
+ *	word 1	stream id = adc
+ *	word 2	integer timestamp = usb_cc of the rx usb buffer, the buffer
+ *		sequence number shared with the bulk stream
+ *	word 3-4 fractional timestamp = sample count of the first sample
+ *	payload	packed 12 bit IQ as in struct rfnm_rx_usb_buf, zero padded to a
+ *		whole word in the last packet of a buffer
+ *
+ * The payload is not copied: the header goes into a corked datagram and
+ * the ring pages are attached behind it as frags, the rx usb buffers are in
+ * the linear map like the sg lists of the IN requests need. The skb holds
+ * the pages until the netdev is done with them, a buffer the RX thread
+ * reuses before that goes out torn; usb_cc is checked again after the send
+ * to count the ones caught in time. A netdev without NETIF_F_SG gets the
+ * payload copied by the stack instead.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include <linux/debugfs.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/uio.h>
+#include <linux/bvec.h>
+#include <net/sock.h>
+#include <net/net_namespace.h>
+
+#include <linux/rfnm-shared.h>
+
+#include "rfnm_stream.h"
+
+static char *ifname = "usb0";
+module_param(ifname, charp, 0444);
+MODULE_PARM_DESC(ifname, "network interface of the NCM function");
+
+static char *group = "239.255.49.0";
+module_param(group, charp, 0444);
+MODULE_PARM_DESC(group, "multicast group of adc 0, adc N is sent to group + N");
+
+static ushort port = 4991;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "destination udp port");
+
+static uint channels = 0xf;
+module_param(channels, uint, 0644);
+MODULE_PARM_DESC(channels, "bitmask of the adcs to send");
+
+static uint payload = 1440;
+module_param(payload, uint, 0444);
+MODULE_PARM_DESC(payload, "IQ bytes per packet, a multiple of 12");
+
+static int nlm;
+module_param(nlm, int, 0444);
+MODULE_PARM_DESC(nlm, "LA9310 (nlm<N>) whose rx ring is sent");
+
+#define RFNM_UDP_ADC_CNT		4
+// jumbo frame less the ip, udp and vrt headers
+#define RFNM_UDP_PAYLOAD_MAX		8952
+// pages a payload can straddle
+#define RFNM_UDP_PAGES_MAX		(DIV_ROUND_UP(RFNM_UDP_PAYLOAD_MAX, PAGE_SIZE) + 1)
+
+#define RFNM_VRT_TYPE_IF_DATA_SID	(0x1 << 28)
+#define RFNM_VRT_TSI_OTHER		(0x3 << 22)
+#define RFNM_VRT_TSF_SAMPLE_COUNT	(0x1 << 20)
+
+struct rfnm_vrt_hdr {
+	__be32 hdr;
+	__be32 stream_id;
+	__be32 ts_int;
+	__be32 ts_frac[2];
+};
+
+// buffers handed over by the RX thread, single producer, single consumer
+#define RFNM_UDP_QLEN 256
+
+struct rfnm_udp_ele {
+	const struct rfnm_rx_usb_buf *buf;
+	uint64_t usb_cc;
+	uint32_t adc;
+};
+
+static struct rfnm_udp_ele rfnm_udp_q[RFNM_UDP_QLEN];
+static unsigned rfnm_udp_head, rfnm_udp_tail;
+
+struct rfnm_udp_stream {
+	struct socket *sock;
+	int connected;
+	uint8_t pkt_cnt;
+};
+
+static struct rfnm_udp_stream rfnm_udp_streams[RFNM_UDP_ADC_CNT];
+static __be32 rfnm_udp_group;
+
+static DECLARE_WAIT_QUEUE_HEAD(rfnm_udp_wq);
+static struct task_struct *rfnm_udp_task;
+
+static struct dentry *rfnm_udp_dfs;
+// each counter has a single writer, the RX thread or the UDP thread
+static u64 rfnm_udp_sent;
+// RX thread, the queue to the UDP thread was full
+static u64 rfnm_udp_queue_full;
+// UDP thread, not connected or socket buffer full
+static u64 rfnm_udp_dropped;
+// the RX thread came around the ring before or while the buffer was sent
+static u64 rfnm_udp_overwritten;
+static u64 rfnm_udp_errors;
+
+static const uint8_t rfnm_udp_pad[4];
+
+// RX thread, must not block
+static void rfnm_udp_tap(const struct rfnm_rx_usb_buf *buf)
+{
+	unsigned head = rfnm_udp_head;
+	uint32_t adc = buf->adc_id;
+
+	if (adc >= RFNM_UDP_ADC_CNT || !(READ_ONCE(channels) & (1 << adc)))
+		return;
+
+	if (head - READ_ONCE(rfnm_udp_tail) >= RFNM_UDP_QLEN) {
+		rfnm_udp_queue_full++;
+		return;
+	}
+
+	rfnm_udp_q[head % RFNM_UDP_QLEN].buf = buf;
+	rfnm_udp_q[head % RFNM_UDP_QLEN].usb_cc = buf->usb_cc;
+	rfnm_udp_q[head % RFNM_UDP_QLEN].adc = adc;
+	smp_store_release(&rfnm_udp_head, head + 1);
+
+	wake_up(&rfnm_udp_wq);
+}
+
+// the NCM link may come up long after the module is loaded, so this is retried
+static int rfnm_udp_connect(struct rfnm_udp_stream *st, uint32_t adc)
+{
+	struct sockaddr_in addr = { 0 };
+	struct net_device *dev;
+	int ret;
+
+	dev = dev_get_by_name(&init_net, ifname);
+	if (!dev)
+		return -ENODEV;
+
+	ret = sock_bindtoindex(st->sock->sk, dev->ifindex, true);
+	dev_put(dev);
+	if (ret)
+		return ret;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(ntohl(rfnm_udp_group) + adc);
+
+	ret = kernel_connect(st->sock, (struct sockaddr *) &addr, sizeof(addr), 0);
+	if (ret)
+		return ret;
+
+	printk("rfnm_udp: adc %d -> %pI4:%d on %s\n", adc, &addr.sin_addr.s_addr, port, ifname);
+	st->connected = 1;
+	return 0;
+}
+
+// len bytes of the ring at p appended to the corked datagram as page frags
+static int rfnm_udp_send_pages(struct socket *sock, const uint8_t *p, size_t len, int flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	struct bio_vec bv[RFNM_UDP_PAGES_MAX];
+	struct msghdr msg = { .msg_flags = flags | MSG_SPLICE_PAGES };
+	size_t left = len, n;
+	int i;
+
+	for (i = 0; left; i++, p += n, left -= n) {
+		n = min_t(size_t, left, PAGE_SIZE - offset_in_page(p));
+		bvec_set_page(&bv[i], virt_to_page(p), n, offset_in_page(p));
+	}
+
+	iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, bv, i, len);
+	return sock_sendmsg(sock, &msg);
+#else
+	size_t n;
+	int ret;
+
+	for (; len; p += n, len -= n) {
+		n = min_t(size_t, len, PAGE_SIZE - offset_in_page(p));
+		ret = kernel_sendpage(sock, virt_to_page(p), offset_in_page(p), n,
+			flags | (len > n ? MSG_MORE : 0));
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+#endif
+}
+
+static void rfnm_udp_send_buf(const struct rfnm_udp_ele *ele)
+{
+	struct rfnm_udp_stream *st = &rfnm_udp_streams[ele->adc];
+	const uint8_t *data = ele->buf->buf;
+	size_t len = sizeof_field(struct rfnm_rx_usb_buf, buf);
+	uint64_t spb = len / 3;
+	struct rfnm_vrt_hdr hdr;
+	struct msghdr msg;
+	struct kvec iov[2];
+	size_t off, n, pad;
+	uint64_t sc;
+	int ret;
+
+	if (!st->connected && rfnm_udp_connect(st, ele->adc)) {
+		rfnm_udp_dropped++;
+		return;
+	}
+
+	if (READ_ONCE(ele->buf->usb_cc) != ele->usb_cc) {
+		rfnm_udp_overwritten++;
+		return;
+	}
+
+	for (off = 0; off < len; off += n) {
+		n = min_t(size_t, len - off, payload);
+		pad = -n & 3;
+		sc = (ele->usb_cc - 1) * spb + off / 3;
+
+		hdr.hdr = cpu_to_be32(RFNM_VRT_TYPE_IF_DATA_SID | RFNM_VRT_TSI_OTHER |
+			RFNM_VRT_TSF_SAMPLE_COUNT | (st->pkt_cnt++ & 0xf) << 16 |
+			(sizeof(hdr) + n + pad) / 4);
+		hdr.stream_id = cpu_to_be32(ele->adc);
+		hdr.ts_int = cpu_to_be32((uint32_t) ele->usb_cc);
+		hdr.ts_frac[0] = cpu_to_be32(sc >> 32);
+		hdr.ts_frac[1] = cpu_to_be32(sc);
+
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = sizeof(hdr);
+		iov[1].iov_base = (void *) rfnm_udp_pad;
+		iov[1].iov_len = pad;
+
+		// header, payload, pad, corked into one datagram, a failed step drops it
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_flags = MSG_DONTWAIT | MSG_MORE;
+		ret = kernel_sendmsg(st->sock, &msg, &iov[0], 1, sizeof(hdr));
+		if (ret >= 0)
+			ret = rfnm_udp_send_pages(st->sock, data + off, n, MSG_DONTWAIT | (pad ? MSG_MORE : 0));
+		if (ret >= 0 && pad) {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_flags = MSG_DONTWAIT;
+			ret = kernel_sendmsg(st->sock, &msg, &iov[1], 1, pad);
+		}
+		if (ret == -EAGAIN || ret == -ENOBUFS) {
+			rfnm_udp_dropped++;
+			return;
+		}
+		if (ret < 0) {
+			rfnm_udp_errors++;
+			// the NCM link went down or came back as another netdev, bind and connect again
+			if (ret == -ENETUNREACH || ret == -ENODEV)
+				st->connected = 0;
+			return;
+		}
+		rfnm_udp_sent++;
+	}
+
+	if (READ_ONCE(ele->buf->usb_cc) != ele->usb_cc)
+		rfnm_udp_overwritten++;
+}
+
+static int rfnm_udp_thread(void *data)
+{
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(rfnm_udp_wq, kthread_should_stop() ||
+			rfnm_udp_tail != smp_load_acquire(&rfnm_udp_head));
+
+		while (rfnm_udp_tail != smp_load_acquire(&rfnm_udp_head)) {
+			rfnm_udp_send_buf(&rfnm_udp_q[rfnm_udp_tail % RFNM_UDP_QLEN]);
+			smp_store_release(&rfnm_udp_tail, rfnm_udp_tail + 1);
+		}
+	}
+
+	return 0;
+}
+
+static void rfnm_udp_release(void)
+{
+	int i;
+
+	for (i = 0; i < RFNM_UDP_ADC_CNT; i++) {
+		if (rfnm_udp_streams[i].sock)
+			sock_release(rfnm_udp_streams[i].sock);
+		rfnm_udp_streams[i].sock = NULL;
+	}
+}
+
+static int __init rfnm_udp_init(void)
+{
+	int i, ret;
+
+	if (!payload || payload % 12 || payload > RFNM_UDP_PAYLOAD_MAX) {
+		printk("rfnm_udp: payload must be a multiple of 12 up to %d\n", RFNM_UDP_PAYLOAD_MAX);
+		return -EINVAL;
+	}
+
+	if (!in4_pton(group, -1, (u8 *) &rfnm_udp_group, -1, NULL)) {
+		printk("rfnm_udp: bad group %s\n", group);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < RFNM_UDP_ADC_CNT; i++) {
+		ret = sock_create_kern(&init_net, AF_INET, SOCK_DGRAM, IPPROTO_UDP, &rfnm_udp_streams[i].sock);
+		if (ret) {
+			rfnm_udp_release();
+			return ret;
+		}
+	}
+
+	rfnm_udp_task = kthread_run(rfnm_udp_thread, NULL, "UDP");
+	if (IS_ERR(rfnm_udp_task)) {
+		rfnm_udp_release();
+		return PTR_ERR(rfnm_udp_task);
+	}
+
+	ret = rfnm_stream_set_rx_tap(nlm, rfnm_udp_tap);
+	if (ret) {
+		printk("rfnm_udp: no streaming pipeline on nlm%d\n", nlm);
+		kthread_stop(rfnm_udp_task);
+		rfnm_udp_release();
+		return ret;
+	}
+
+	rfnm_udp_dfs = debugfs_create_dir("rfnm_udp", NULL);
+	debugfs_create_u64("sent", 0444, rfnm_udp_dfs, &rfnm_udp_sent);
+	debugfs_create_u64("queue_full", 0444, rfnm_udp_dfs, &rfnm_udp_queue_full);
+	debugfs_create_u64("dropped", 0444, rfnm_udp_dfs, &rfnm_udp_dropped);
+	debugfs_create_u64("overwritten", 0444, rfnm_udp_dfs, &rfnm_udp_overwritten);
+	debugfs_create_u64("errors", 0444, rfnm_udp_dfs, &rfnm_udp_errors);
+
+	return 0;
+}
+
+static void __exit rfnm_udp_exit(void)
+{
+	rfnm_stream_set_rx_tap(nlm, NULL);
+	kthread_stop(rfnm_udp_task);
+	debugfs_remove_recursive(rfnm_udp_dfs);
+	rfnm_udp_release();
+}
+
+module_init(rfnm_udp_init);
+module_exit(rfnm_udp_exit);
+MODULE_DESCRIPTION("RFNM IQ over UDP");
+MODULE_LICENSE("GPL");
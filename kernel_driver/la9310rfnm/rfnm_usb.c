@@ -43,6 +43,10 @@ USB_GADGET_COMPOSITE_OPTIONS();
 static int functionMask = FN_MSG | FN_NCM; // Default, all functions
 module_param(functionMask, int, S_IRUSR | S_IRGRP | S_IROTH);
 
+// compose rfnm_usb_bench.ko instead of the streaming function
+static int bench = 0;
+module_param(bench, int, S_IRUSR | S_IRGRP | S_IROTH);
+
 static struct usb_device_descriptor rfnm_device_desc = {
 	.bLength =		sizeof rfnm_device_desc,
 	.bDescriptorType =	USB_DT_DEVICE,
@@ -251,7 +255,7 @@ static int rfnm_bind(struct usb_composite_dev *cdev)
 	rfnm_wsled_set(0, 0, 0, 0, 0xff);
 	rfnm_wsled_send_chain(0);
 
-	fi_rfnm = usb_get_function_instance("RFNM");
+	fi_rfnm = usb_get_function_instance(bench ? "rfnm_bench" : "RFNM");
 	if (IS_ERR(fi_rfnm))
 		return PTR_ERR(fi_rfnm);
 
@@ -0,0 +1,638 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * rfnm_usb_bench.c - USB throughput benchmark function
+ *
+ * Derived from f_sourcesink like rfnm_usb_function.c and with the same bulk
+ * endpoint layout, but nothing behind it: IN endpoints send a running counter,
+ * OUT endpoints check one (see uapi/rfnm_usb_bench.h). With la9310rfnm.ko and
+ * rfnm_bufdesc_rx out of the picture, app/rfnm_usb_bench shows what the USB
+ * link alone can do.
+ *
+ * On the RFNM, rfnm_usb.ko bench=1 composes this in place of the streaming
+ * function. It needs nothing but libcomposite, so it also runs on dummy_hcd:
+ *
+ *	make -C /lib/modules/$(uname -r)/build M=$PWD obj-m=rfnm_usb_bench.o
+ *	modprobe dummy_hcd && insmod rfnm_usb_bench.ko
+ *
+ * and a configfs gadget with a functions/rfnm_bench.0 directory.
+ */
+
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/usb/composite.h>
+#include <linux/err.h>
+
+#include "../../uapi/rfnm_usb_bench.h"
+
+#define RFNM_BENCH_QLEN_DEFAULT		8
+#define RFNM_BENCH_QLEN_MAX		64
+#define RFNM_BENCH_BUFLEN_DEFAULT	(64 * 1024)
+#define RFNM_BENCH_BUFLEN_MAX		(256 * 1024)
+
+// usb_request->context carries the endpoint index
+#define RFNM_BENCH_ID_TO_CTX(id)	((void *) (uintptr_t) (id))
+#define RFNM_BENCH_CTX_TO_ID(ctx)	((int) (uintptr_t) (ctx))
+
+struct f_rfnm_bench_opts {
+	struct usb_function_instance	func_inst;
+	unsigned			buflen;
+	unsigned			qlen;
+
+	struct mutex			lock;
+	int				refcnt;
+};
+
+struct f_rfnm_bench {
+	struct usb_function	function;
+
+	struct usb_ep		*in_ep[RFNM_BENCH_EP_CNT];
+	struct usb_ep		*out_ep[RFNM_BENCH_EP_CNT];
+
+	unsigned		buflen;
+	unsigned		qlen;
+
+	/* next word per IN endpoint, expected word per OUT endpoint */
+	u32			in_next[RFNM_BENCH_EP_CNT];
+	u32			out_next[RFNM_BENCH_EP_CNT];
+	int			out_sync[RFNM_BENCH_EP_CNT];
+
+	spinlock_t		lock;
+	u64			t0;
+	struct rfnm_usb_bench_stats stats;
+};
+
+static inline struct f_rfnm_bench *func_to_bench(struct usb_function *f)
+{
+	return container_of(f, struct f_rfnm_bench, function);
+}
+
+/*-------------------------------------------------------------------------*/
+
+static struct usb_interface_descriptor rfnm_bench_intf = {
+	.bLength =		USB_DT_INTERFACE_SIZE,
+	.bDescriptorType =	USB_DT_INTERFACE,
+
+	.bAlternateSetting =	0,
+	.bNumEndpoints =	2 * RFNM_BENCH_EP_CNT,
+	.bInterfaceClass =	USB_CLASS_VENDOR_SPEC,
+};
+
+static struct usb_endpoint_descriptor fs_in_desc[RFNM_BENCH_EP_CNT];
+static struct usb_endpoint_descriptor fs_out_desc[RFNM_BENCH_EP_CNT];
+static struct usb_endpoint_descriptor hs_in_desc[RFNM_BENCH_EP_CNT];
+static struct usb_endpoint_descriptor hs_out_desc[RFNM_BENCH_EP_CNT];
+static struct usb_endpoint_descriptor ss_in_desc[RFNM_BENCH_EP_CNT];
+static struct usb_endpoint_descriptor ss_out_desc[RFNM_BENCH_EP_CNT];
+
+static struct usb_ss_ep_comp_descriptor ss_bulk_comp_desc = {
+	.bLength =		USB_DT_SS_EP_COMP_SIZE,
+	.bDescriptorType =	USB_DT_SS_ENDPOINT_COMP,
+
+	.bMaxBurst =		15,
+	.bmAttributes =		0,
+	.wBytesPerInterval =	0,
+};
+
+/* filled in at bind */
+static struct usb_descriptor_header *fs_bench_descs[2 * RFNM_BENCH_EP_CNT + 2];
+static struct usb_descriptor_header *hs_bench_descs[2 * RFNM_BENCH_EP_CNT + 2];
+static struct usb_descriptor_header *ss_bench_descs[4 * RFNM_BENCH_EP_CNT + 2];
+
+static struct usb_string strings_bench[] = {
+	[0].s = "rfnm usb benchmark",
+	{  }			/* end of list */
+};
+
+static struct usb_gadget_strings stringtab_bench = {
+	.language	= 0x0409,	/* en-us */
+	.strings	= strings_bench,
+};
+
+static struct usb_gadget_strings *bench_strings[] = {
+	&stringtab_bench,
+	NULL,
+};
+
+/*-------------------------------------------------------------------------*/
+
+static int rfnm_bench_bind(struct usb_configuration *c, struct usb_function *f)
+{
+	struct usb_composite_dev *cdev = c->cdev;
+	struct f_rfnm_bench	*b = func_to_bench(f);
+	int			id, i, fs = 0, hs = 0, ss = 0;
+
+	id = usb_interface_id(c, f);
+	if (id < 0)
+		return id;
+	rfnm_bench_intf.bInterfaceNumber = id;
+
+	fs_bench_descs[fs++] = (struct usb_descriptor_header *) &rfnm_bench_intf;
+	hs_bench_descs[hs++] = (struct usb_descriptor_header *) &rfnm_bench_intf;
+	ss_bench_descs[ss++] = (struct usb_descriptor_header *) &rfnm_bench_intf;
+
+	for (i = 0; i < RFNM_BENCH_EP_CNT; i++) {
+		memset(&fs_in_desc[i], 0, sizeof(fs_in_desc[i]));
+		fs_in_desc[i].bLength = USB_DT_ENDPOINT_SIZE;
+		fs_in_desc[i].bDescriptorType = USB_DT_ENDPOINT;
+		fs_in_desc[i].bEndpointAddress = USB_DIR_IN;
+		fs_in_desc[i].bmAttributes = USB_ENDPOINT_XFER_BULK;
+
+		fs_out_desc[i] = fs_in_desc[i];
+		fs_out_desc[i].bEndpointAddress = USB_DIR_OUT;
+
+		b->in_ep[i] = usb_ep_autoconfig(cdev->gadget, &fs_in_desc[i]);
+		if (!b->in_ep[i])
+			goto autoconf_fail;
+
+		b->out_ep[i] = usb_ep_autoconfig(cdev->gadget, &fs_out_desc[i]);
+		if (!b->out_ep[i])
+			goto autoconf_fail;
+
+		hs_in_desc[i] = fs_in_desc[i];
+		hs_in_desc[i].wMaxPacketSize = cpu_to_le16(512);
+		hs_out_desc[i] = fs_out_desc[i];
+		hs_out_desc[i].wMaxPacketSize = cpu_to_le16(512);
+
+		ss_in_desc[i] = fs_in_desc[i];
+		ss_in_desc[i].wMaxPacketSize = cpu_to_le16(1024);
+		ss_out_desc[i] = fs_out_desc[i];
+		ss_out_desc[i].wMaxPacketSize = cpu_to_le16(1024);
+
+		fs_bench_descs[fs++] = (struct usb_descriptor_header *) &fs_in_desc[i];
+		fs_bench_descs[fs++] = (struct usb_descriptor_header *) &fs_out_desc[i];
+
+		hs_bench_descs[hs++] = (struct usb_descriptor_header *) &hs_in_desc[i];
+		hs_bench_descs[hs++] = (struct usb_descriptor_header *) &hs_out_desc[i];
+
+		ss_bench_descs[ss++] = (struct usb_descriptor_header *) &ss_in_desc[i];
+		ss_bench_descs[ss++] = (struct usb_descriptor_header *) &ss_bulk_comp_desc;
+		ss_bench_descs[ss++] = (struct usb_descriptor_header *) &ss_out_desc[i];
+		ss_bench_descs[ss++] = (struct usb_descriptor_header *) &ss_bulk_comp_desc;
+	}
+
+	fs_bench_descs[fs] = NULL;
+	hs_bench_descs[hs] = NULL;
+	ss_bench_descs[ss] = NULL;
+
+	return usb_assign_descriptors(f, fs_bench_descs, hs_bench_descs,
+			ss_bench_descs, ss_bench_descs);
+
+autoconf_fail:
+	ERROR(cdev, "%s: can't autoconfigure on %s\n",
+		f->name, cdev->gadget->name);
+	return -ENODEV;
+}
+
+static void rfnm_bench_free_func(struct usb_function *f)
+{
+	struct f_rfnm_bench_opts *opts;
+
+	opts = container_of(f->fi, struct f_rfnm_bench_opts, func_inst);
+
+	mutex_lock(&opts->lock);
+	opts->refcnt--;
+	mutex_unlock(&opts->lock);
+
+	usb_free_all_descriptors(f);
+	kfree(func_to_bench(f));
+}
+
+static struct usb_request *rfnm_bench_alloc_req(struct usb_ep *ep, unsigned len)
+{
+	struct usb_request *req;
+
+	req = usb_ep_alloc_request(ep, GFP_ATOMIC);
+	if (!req)
+		return NULL;
+
+	req->length = len;
+	req->buf = kmalloc(len, GFP_ATOMIC);
+	if (!req->buf) {
+		usb_ep_free_request(ep, req);
+		return NULL;
+	}
+
+	return req;
+}
+
+static void rfnm_bench_free_req(struct usb_ep *ep, struct usb_request *req)
+{
+	kfree(req->buf);
+	usb_ep_free_request(ep, req);
+}
+
+static void rfnm_bench_fill(struct f_rfnm_bench *b, int id, struct usb_request *req)
+{
+	__le32		*w = req->buf;
+	u32		c = b->in_next[id];
+	unsigned	i;
+
+	for (i = 0; i < req->length / 4; i++)
+		w[i] = cpu_to_le32(c++);
+
+	b->in_next[id] = c;
+}
+
+static void rfnm_bench_check(struct f_rfnm_bench *b, int id, struct usb_request *req)
+{
+	const __le32	*w = req->buf;
+	u32		next = b->out_next[id];
+	u64		errors = 0;
+	unsigned long	flags;
+	unsigned	i;
+
+	for (i = 0; i < req->actual / 4; i++) {
+		u32 v = le32_to_cpu(w[i]);
+
+		if (!b->out_sync[id]) {
+			b->out_sync[id] = 1;
+			next = v;
+		}
+		if (v != next)
+			errors++;
+		next = v + 1;
+	}
+
+	b->out_next[id] = next;
+
+	spin_lock_irqsave(&b->lock, flags);
+	b->stats.out_bytes[id] += req->actual;
+	b->stats.out_errors[id] += errors;
+	spin_unlock_irqrestore(&b->lock, flags);
+}
+
+static void rfnm_bench_complete(struct usb_ep *ep, struct usb_request *req)
+{
+	struct f_rfnm_bench	*b = ep->driver_data;
+	int			id = RFNM_BENCH_CTX_TO_ID(req->context);
+	int			in = usb_endpoint_dir_in(ep->desc);
+	unsigned long		flags;
+	int			status;
+
+	/* driver_data will be null if ep has been disabled */
+	if (!b)
+		return;
+
+	switch (req->status) {
+
+	case 0:				/* normal completion */
+		if (in) {
+			spin_lock_irqsave(&b->lock, flags);
+			b->stats.in_bytes[id] += req->actual;
+			spin_unlock_irqrestore(&b->lock, flags);
+
+			rfnm_bench_fill(b, id, req);
+		} else {
+			rfnm_bench_check(b, id, req);
+		}
+		break;
+
+	/* this endpoint is normally active while we're configured */
+	case -ECONNABORTED:		/* hardware forced ep reset */
+	case -ECONNRESET:		/* request dequeued */
+	case -ESHUTDOWN:		/* disconnect from host */
+		rfnm_bench_free_req(ep, req);
+		return;
+
+	default:
+		spin_lock_irqsave(&b->lock, flags);
+		if (in)
+			b->stats.in_failed[id]++;
+		else
+			b->stats.out_failed[id]++;
+		spin_unlock_irqrestore(&b->lock, flags);
+		break;
+	}
+
+	status = usb_ep_queue(ep, req, GFP_ATOMIC);
+	if (status) {
+		printk("rfnm_bench: kill %s: resubmit %d bytes --> %d\n",
+				ep->name, req->length, status);
+		rfnm_bench_free_req(ep, req);
+	}
+}
+
+static int rfnm_bench_start_ep(struct f_rfnm_bench *b, struct usb_ep *ep, int id, int in)
+{
+	struct usb_request	*req;
+	int			i, status;
+
+	for (i = 0; i < b->qlen; i++) {
+		req = rfnm_bench_alloc_req(ep, b->buflen);
+		if (!req)
+			return -ENOMEM;
+
+		req->complete = rfnm_bench_complete;
+		req->context = RFNM_BENCH_ID_TO_CTX(id);
+
+		if (in)
+			rfnm_bench_fill(b, id, req);
+
+		status = usb_ep_queue(ep, req, GFP_ATOMIC);
+		if (status) {
+			rfnm_bench_free_req(ep, req);
+			return status;
+		}
+	}
+
+	return 0;
+}
+
+static void rfnm_bench_reset_stats(struct f_rfnm_bench *b)
+{
+	unsigned long	flags;
+	int		i;
+
+	spin_lock_irqsave(&b->lock, flags);
+	memset(&b->stats, 0, sizeof(b->stats));
+	b->t0 = ktime_get_ns();
+	for (i = 0; i < RFNM_BENCH_EP_CNT; i++)
+		b->out_sync[i] = 0;
+	spin_unlock_irqrestore(&b->lock, flags);
+}
+
+static void rfnm_bench_disable_eps(struct f_rfnm_bench *b)
+{
+	int i;
+
+	for (i = 0; i < RFNM_BENCH_EP_CNT; i++) {
+		usb_ep_disable(b->in_ep[i]);
+		usb_ep_disable(b->out_ep[i]);
+	}
+}
+
+static int rfnm_bench_enable_eps(struct usb_composite_dev *cdev, struct f_rfnm_bench *b)
+{
+	struct f_rfnm_bench_opts	*opts;
+	struct usb_ep			*ep;
+	int				i, dir, result;
+
+	// configfs changes are picked up here, i.e. on the next set_alt
+	opts = container_of(b->function.fi, struct f_rfnm_bench_opts, func_inst);
+
+	mutex_lock(&opts->lock);
+	b->buflen = opts->buflen;
+	b->qlen = opts->qlen;
+	mutex_unlock(&opts->lock);
+
+	rfnm_bench_reset_stats(b);
+
+	for (i = 0; i < RFNM_BENCH_EP_CNT; i++) {
+		b->in_next[i] = 0;
+
+		for (dir = 0; dir < 2; dir++) {
+			ep = dir ? b->out_ep[i] : b->in_ep[i];
+
+			result = config_ep_by_speed(cdev->gadget, &b->function, ep);
+			if (result)
+				goto fail;
+			result = usb_ep_enable(ep);
+			if (result < 0)
+				goto fail;
+			ep->driver_data = b;
+
+			result = rfnm_bench_start_ep(b, ep, i, !dir);
+			if (result < 0)
+				goto fail;
+		}
+	}
+
+	printk("rfnm_bench: %d x %d bytes per endpoint\n", b->qlen, b->buflen);
+	return 0;
+
+fail:
+	ERROR(cdev, "failure enabling endpoints %d\n", result);
+	rfnm_bench_disable_eps(b);
+	return result;
+}
+
+static int rfnm_bench_set_alt(struct usb_function *f, unsigned intf, unsigned alt)
+{
+	struct f_rfnm_bench		*b = func_to_bench(f);
+	struct usb_composite_dev	*cdev = f->config->cdev;
+
+	if (alt)
+		return -EINVAL;
+
+	rfnm_bench_disable_eps(b);
+	return rfnm_bench_enable_eps(cdev, b);
+}
+
+static void rfnm_bench_disable(struct usb_function *f)
+{
+	rfnm_bench_disable_eps(func_to_bench(f));
+}
+
+static int rfnm_bench_setup(struct usb_function *f, const struct usb_ctrlrequest *ctrl)
+{
+	struct f_rfnm_bench		*b = func_to_bench(f);
+	struct usb_composite_dev	*cdev = f->config->cdev;
+	struct usb_request		*req = cdev->req;
+	u16				w_value = le16_to_cpu(ctrl->wValue);
+	u16				w_length = le16_to_cpu(ctrl->wLength);
+	unsigned long			flags;
+	int				value = -EOPNOTSUPP;
+
+	if (ctrl->bRequest != RFNM_BENCH_B_REQUEST)
+		return value;
+
+	switch (w_value) {
+	case RFNM_BENCH_GET_STATS:
+		if (ctrl->bRequestType != (USB_DIR_IN | USB_TYPE_VENDOR))
+			break;
+		spin_lock_irqsave(&b->lock, flags);
+		b->stats.time_ns = ktime_get_ns() - b->t0;
+		memcpy(req->buf, &b->stats, sizeof(b->stats));
+		spin_unlock_irqrestore(&b->lock, flags);
+		value = min_t(unsigned, w_length, sizeof(b->stats));
+		break;
+	case RFNM_BENCH_RESET:
+		if (ctrl->bRequestType != (USB_DIR_OUT | USB_TYPE_VENDOR))
+			break;
+		rfnm_bench_reset_stats(b);
+		value = 0;
+		break;
+	}
+
+	/* respond with data transfer or status phase? */
+	if (value >= 0) {
+		req->zero = 0;
+		req->length = value;
+		value = usb_ep_queue(cdev->gadget->ep0, req, GFP_ATOMIC);
+		if (value < 0)
+			ERROR(cdev, "rfnm_bench response, err %d\n", value);
+	}
+
+	return value;
+}
+
+static bool rfnm_bench_req_match(struct usb_function *f,
+			       const struct usb_ctrlrequest *creq,
+			       bool config0)
+{
+	return creq->bRequest == RFNM_BENCH_B_REQUEST &&
+		(creq->bRequestType == (USB_DIR_IN | USB_TYPE_VENDOR) ||
+		 creq->bRequestType == (USB_DIR_OUT | USB_TYPE_VENDOR));
+}
+
+static struct usb_function *rfnm_bench_alloc_func(struct usb_function_instance *fi)
+{
+	struct f_rfnm_bench		*b;
+	struct f_rfnm_bench_opts	*opts;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return ERR_PTR(-ENOMEM);
+
+	opts = container_of(fi, struct f_rfnm_bench_opts, func_inst);
+
+	mutex_lock(&opts->lock);
+	opts->refcnt++;
+	mutex_unlock(&opts->lock);
+
+	spin_lock_init(&b->lock);
+
+	b->function.name = RFNM_BENCH_FUNC_NAME;
+	b->function.bind = rfnm_bench_bind;
+	b->function.set_alt = rfnm_bench_set_alt;
+	b->function.disable = rfnm_bench_disable;
+	b->function.setup = rfnm_bench_setup;
+	b->function.req_match = rfnm_bench_req_match;
+	b->function.strings = bench_strings;
+
+	b->function.free_func = rfnm_bench_free_func;
+
+	return &b->function;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static inline struct f_rfnm_bench_opts *to_f_rfnm_bench_opts(struct config_item *item)
+{
+	return container_of(to_config_group(item), struct f_rfnm_bench_opts,
+			    func_inst.group);
+}
+
+static void rfnm_bench_attr_release(struct config_item *item)
+{
+	struct f_rfnm_bench_opts *opts = to_f_rfnm_bench_opts(item);
+
+	usb_put_function_instance(&opts->func_inst);
+}
+
+static struct configfs_item_operations rfnm_bench_item_ops = {
+	.release		= rfnm_bench_attr_release,
+};
+
+static ssize_t f_rfnm_bench_opts_buflen_show(struct config_item *item, char *page)
+{
+	struct f_rfnm_bench_opts *opts = to_f_rfnm_bench_opts(item);
+	int result;
+
+	mutex_lock(&opts->lock);
+	result = sprintf(page, "%u\n", opts->buflen);
+	mutex_unlock(&opts->lock);
+
+	return result;
+}
+
+// bytes per request, a multiple of 1024 so OUT requests end on a packet
+static ssize_t f_rfnm_bench_opts_buflen_store(struct config_item *item,
+					   const char *page, size_t len)
+{
+	struct f_rfnm_bench_opts *opts = to_f_rfnm_bench_opts(item);
+	int ret;
+	u32 num;
+
+	ret = kstrtou32(page, 0, &num);
+	if (ret)
+		return ret;
+
+	if (!num || num % 1024 || num > RFNM_BENCH_BUFLEN_MAX)
+		return -EINVAL;
+
+	mutex_lock(&opts->lock);
+	opts->buflen = num;
+	mutex_unlock(&opts->lock);
+
+	return len;
+}
+
+CONFIGFS_ATTR(f_rfnm_bench_opts_, buflen);
+
+static ssize_t f_rfnm_bench_opts_qlen_show(struct config_item *item, char *page)
+{
+	struct f_rfnm_bench_opts *opts = to_f_rfnm_bench_opts(item);
+	int result;
+
+	mutex_lock(&opts->lock);
+	result = sprintf(page, "%u\n", opts->qlen);
+	mutex_unlock(&opts->lock);
+
+	return result;
+}
+
+// requests queued per endpoint
+static ssize_t f_rfnm_bench_opts_qlen_store(struct config_item *item,
+					   const char *page, size_t len)
+{
+	struct f_rfnm_bench_opts *opts = to_f_rfnm_bench_opts(item);
+	int ret;
+	u32 num;
+
+	ret = kstrtou32(page, 0, &num);
+	if (ret)
+		return ret;
+
+	if (!num || num > RFNM_BENCH_QLEN_MAX)
+		return -EINVAL;
+
+	mutex_lock(&opts->lock);
+	opts->qlen = num;
+	mutex_unlock(&opts->lock);
+
+	return len;
+}
+
+CONFIGFS_ATTR(f_rfnm_bench_opts_, qlen);
+
+static struct configfs_attribute *rfnm_bench_attrs[] = {
+	&f_rfnm_bench_opts_attr_buflen,
+	&f_rfnm_bench_opts_attr_qlen,
+	NULL,
+};
+
+static const struct config_item_type rfnm_bench_func_type = {
+	.ct_item_ops    = &rfnm_bench_item_ops,
+	.ct_attrs	= rfnm_bench_attrs,
+	.ct_owner       = THIS_MODULE,
+};
+
+static void rfnm_bench_free_instance(struct usb_function_instance *fi)
+{
+	kfree(container_of(fi, struct f_rfnm_bench_opts, func_inst));
+}
+
+static struct usb_function_instance *rfnm_bench_alloc_inst(void)
+{
+	struct f_rfnm_bench_opts *opts;
+
+	opts = kzalloc(sizeof(*opts), GFP_KERNEL);
+	if (!opts)
+		return ERR_PTR(-ENOMEM);
+	mutex_init(&opts->lock);
+	opts->func_inst.free_func_inst = rfnm_bench_free_instance;
+	opts->buflen = RFNM_BENCH_BUFLEN_DEFAULT;
+	opts->qlen = RFNM_BENCH_QLEN_DEFAULT;
+
+	config_group_init_type_name(&opts->func_inst.group, "",
+				    &rfnm_bench_func_type);
+
+	return &opts->func_inst;
+}
+DECLARE_USB_FUNCTION_INIT(rfnm_bench, rfnm_bench_alloc_inst, rfnm_bench_alloc_func);
+
+MODULE_LICENSE("GPL");
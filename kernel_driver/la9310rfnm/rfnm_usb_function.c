@@ -19,7 +19,8 @@
 #include "drivers/usb/gadget/function/g_zero.h"
 #include "drivers/usb/gadget/u_f.h"
 
-#define RFNM_EP_CNT 4
+#include "rfnm_stream.h"
+#include "../../uapi/rfnm_stream_layout.h"
 
 
 
@@ -36,7 +37,11 @@ struct f_sourcesink {
 
 	struct usb_ep		*in_ep[RFNM_EP_CNT];
 	struct usb_ep		*out_ep[RFNM_EP_CNT];
+	struct usb_ep		*notify_ep;
+	struct usb_request	*notify_req;
 	int			cur_alt;
+	/* alt 1 (isochronous IN) was advertised at bind */
+	int			isoc;
 
 	unsigned pattern;
 	unsigned buflen;
@@ -47,6 +52,13 @@ static inline struct f_sourcesink *func_to_ss(struct usb_function *f)
 	return container_of(f, struct f_sourcesink, function);
 }
 
+/* f_ss_opts plus the settings g_zero.h has no field for */
+struct rfnm_ss_opts {
+	struct f_ss_opts	ss;
+	/* sample rate alt 1 is sized for, 0 leaves alt 1 out of the descriptors */
+	unsigned		isoc_ksps;
+};
+
 /*-------------------------------------------------------------------------*/
 
 static struct usb_interface_assoc_descriptor iad_desc = {
@@ -75,11 +87,31 @@ static struct usb_interface_descriptor source_sink_intf_alt0 = {
 	.bDescriptorType =	USB_DT_INTERFACE,
 
 	.bAlternateSetting =	0,
-	.bNumEndpoints =	(2 * RFNM_EP_CNT),
+	.bNumEndpoints =	(2 * RFNM_EP_CNT + 1),
 	.bInterfaceClass =	USB_CLASS_VENDOR_SPEC,
 	/* .iInterface		= DYNAMIC */
 };
 
+/*
+ * Alt 1 is the same interface with the IN endpoints isochronous, for hosts
+ * that want bounded latency rather than bulk throughput. OUT stays bulk, the
+ * TX thread consumes one whole struct rfnm_tx_usb_buf per request.
+ */
+static struct usb_interface_descriptor source_sink_intf_alt1 = {
+	.bLength =		USB_DT_INTERFACE_SIZE,
+	.bDescriptorType =	USB_DT_INTERFACE,
+
+	.bAlternateSetting =	1,
+	.bNumEndpoints =	(2 * RFNM_EP_CNT + 1),
+	.bInterfaceClass =	USB_CLASS_VENDOR_SPEC,
+	/* .iInterface		= DYNAMIC */
+};
+
+/* index of source_sink_intf_alt1 in the descriptor lists */
+#define RFNM_FS_ALT1_IDX	(2 * RFNM_EP_CNT + 2)
+#define RFNM_HS_ALT1_IDX	(2 * RFNM_EP_CNT + 2)
+#define RFNM_SS_ALT1_IDX	(4 * RFNM_EP_CNT + 3)
+
 /* full speed support: */
 
 static struct usb_endpoint_descriptor fs_source_desc_proto = {
@@ -109,6 +141,29 @@ static struct usb_endpoint_descriptor fs_loop_sink_desc = {
 	.bmAttributes =		USB_ENDPOINT_XFER_BULK,
 };
 
+/* stream events, see struct rfnm_stream_event */
+static struct usb_endpoint_descriptor fs_notify_desc = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+
+	.bEndpointAddress =	USB_DIR_IN,
+	.bmAttributes =		USB_ENDPOINT_XFER_INT,
+	.wMaxPacketSize =	cpu_to_le16(RFNM_NOTIFY_MAXPACKET),
+	.bInterval =		1,
+};
+
+static struct usb_endpoint_descriptor fs_iso_source_desc_proto = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+
+	.bEndpointAddress =	USB_DIR_IN,
+	.bmAttributes =		USB_ENDPOINT_XFER_ISOC,
+	.wMaxPacketSize =	cpu_to_le16(1023),
+	.bInterval =		1,
+};
+
+static struct usb_endpoint_descriptor fs_iso_source_desc[RFNM_EP_CNT];
+
 static struct usb_descriptor_header *fs_source_sink_descs[] = {
 	(struct usb_descriptor_header *) &source_sink_intf_alt0,
 	
@@ -123,6 +178,24 @@ static struct usb_descriptor_header *fs_source_sink_descs[] = {
 
 	(struct usb_descriptor_header *) &fs_source_desc[3],
 	(struct usb_descriptor_header *) &fs_sink_desc[3],
+
+	(struct usb_descriptor_header *) &fs_notify_desc,
+
+	(struct usb_descriptor_header *) &source_sink_intf_alt1,
+
+	(struct usb_descriptor_header *) &fs_iso_source_desc[0],
+	(struct usb_descriptor_header *) &fs_sink_desc[0],
+
+	(struct usb_descriptor_header *) &fs_iso_source_desc[1],
+	(struct usb_descriptor_header *) &fs_sink_desc[1],
+
+	(struct usb_descriptor_header *) &fs_iso_source_desc[2],
+	(struct usb_descriptor_header *) &fs_sink_desc[2],
+
+	(struct usb_descriptor_header *) &fs_iso_source_desc[3],
+	(struct usb_descriptor_header *) &fs_sink_desc[3],
+
+	(struct usb_descriptor_header *) &fs_notify_desc,
 	NULL,
 };
 
@@ -148,6 +221,26 @@ static struct usb_endpoint_descriptor hs_sink_desc_proto = {
 };
 
 
+/* one microframe */
+static struct usb_endpoint_descriptor hs_notify_desc = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+
+	.bmAttributes =		USB_ENDPOINT_XFER_INT,
+	.wMaxPacketSize =	cpu_to_le16(RFNM_NOTIFY_MAXPACKET),
+	.bInterval =		1,
+};
+
+static struct usb_endpoint_descriptor hs_iso_source_desc_proto = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+
+	.bmAttributes =		USB_ENDPOINT_XFER_ISOC,
+	.wMaxPacketSize =	cpu_to_le16(1024),
+	.bInterval =		1,
+};
+
+static struct usb_endpoint_descriptor hs_iso_source_desc[RFNM_EP_CNT];
 
 static struct usb_descriptor_header *hs_source_sink_descs[] = {
 	//(struct usb_descriptor_header *) &source_sink_intf_alt0,
@@ -166,6 +259,24 @@ static struct usb_descriptor_header *hs_source_sink_descs[] = {
 	(struct usb_descriptor_header *) &hs_source_desc[3],
 	(struct usb_descriptor_header *) &hs_sink_desc[3],
 
+	(struct usb_descriptor_header *) &hs_notify_desc,
+
+	(struct usb_descriptor_header *) &source_sink_intf_alt1,
+
+	(struct usb_descriptor_header *) &hs_iso_source_desc[0],
+	(struct usb_descriptor_header *) &hs_sink_desc[0],
+
+	(struct usb_descriptor_header *) &hs_iso_source_desc[1],
+	(struct usb_descriptor_header *) &hs_sink_desc[1],
+
+	(struct usb_descriptor_header *) &hs_iso_source_desc[2],
+	(struct usb_descriptor_header *) &hs_sink_desc[2],
+
+	(struct usb_descriptor_header *) &hs_iso_source_desc[3],
+	(struct usb_descriptor_header *) &hs_sink_desc[3],
+
+	(struct usb_descriptor_header *) &hs_notify_desc,
+
 	NULL,
 };
 
@@ -209,6 +320,43 @@ static struct usb_ss_ep_comp_descriptor ss_sink_comp_desc = {
 static struct usb_endpoint_descriptor ss_sink_desc[RFNM_EP_CNT];
 static struct usb_endpoint_descriptor ss_source_desc[RFNM_EP_CNT];
 
+static struct usb_endpoint_descriptor ss_notify_desc = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+
+	.bmAttributes =		USB_ENDPOINT_XFER_INT,
+	.wMaxPacketSize =	cpu_to_le16(RFNM_NOTIFY_MAXPACKET),
+	.bInterval =		1,
+};
+
+static struct usb_ss_ep_comp_descriptor ss_notify_comp_desc = {
+	.bLength =		USB_DT_SS_EP_COMP_SIZE,
+	.bDescriptorType =	USB_DT_SS_ENDPOINT_COMP,
+
+	.bMaxBurst =		0,
+	.bmAttributes =		0,
+	.wBytesPerInterval =	cpu_to_le16(RFNM_NOTIFY_MAXPACKET),
+};
+
+static struct usb_endpoint_descriptor ss_iso_source_desc_proto = {
+	.bLength =		USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType =	USB_DT_ENDPOINT,
+
+	.bmAttributes =		USB_ENDPOINT_XFER_ISOC,
+	.wMaxPacketSize =	cpu_to_le16(1024),
+	.bInterval =		1,
+};
+
+static struct usb_ss_ep_comp_descriptor ss_iso_source_comp_desc = {
+	.bLength =		USB_DT_SS_EP_COMP_SIZE,
+	.bDescriptorType =	USB_DT_SS_ENDPOINT_COMP,
+
+	.bMaxBurst =		0,
+	.bmAttributes =		0,
+	.wBytesPerInterval =	cpu_to_le16(1024),
+};
+
+static struct usb_endpoint_descriptor ss_iso_source_desc[RFNM_EP_CNT];
 
 static struct usb_descriptor_header *ss_source_sink_descs[] = {
 //	(struct usb_descriptor_header *) &iad_desc,
@@ -233,6 +381,34 @@ static struct usb_descriptor_header *ss_source_sink_descs[] = {
 	(struct usb_descriptor_header *) &ss_source_comp_desc,
 	(struct usb_descriptor_header *) &ss_sink_desc[3],
 	(struct usb_descriptor_header *) &ss_sink_comp_desc,
+
+	(struct usb_descriptor_header *) &ss_notify_desc,
+	(struct usb_descriptor_header *) &ss_notify_comp_desc,
+
+	(struct usb_descriptor_header *) &source_sink_intf_alt1,
+
+	(struct usb_descriptor_header *) &ss_iso_source_desc[0],
+	(struct usb_descriptor_header *) &ss_iso_source_comp_desc,
+	(struct usb_descriptor_header *) &ss_sink_desc[0],
+	(struct usb_descriptor_header *) &ss_sink_comp_desc,
+
+	(struct usb_descriptor_header *) &ss_iso_source_desc[1],
+	(struct usb_descriptor_header *) &ss_iso_source_comp_desc,
+	(struct usb_descriptor_header *) &ss_sink_desc[1],
+	(struct usb_descriptor_header *) &ss_sink_comp_desc,
+
+	(struct usb_descriptor_header *) &ss_iso_source_desc[2],
+	(struct usb_descriptor_header *) &ss_iso_source_comp_desc,
+	(struct usb_descriptor_header *) &ss_sink_desc[2],
+	(struct usb_descriptor_header *) &ss_sink_comp_desc,
+
+	(struct usb_descriptor_header *) &ss_iso_source_desc[3],
+	(struct usb_descriptor_header *) &ss_iso_source_comp_desc,
+	(struct usb_descriptor_header *) &ss_sink_desc[3],
+	(struct usb_descriptor_header *) &ss_sink_comp_desc,
+
+	(struct usb_descriptor_header *) &ss_notify_desc,
+	(struct usb_descriptor_header *) &ss_notify_comp_desc,
 	NULL,
 };
 
@@ -270,6 +446,77 @@ static void disable_ep(struct usb_composite_dev *cdev, struct usb_ep *ep)
 }
 
 
+/*
+ * Size the alt 1 endpoints for ksps complex samples per second, 3 bytes each
+ * once packed to 12 bit, plus 1/16 for the buffer headers and clock tolerance.
+ * interval is bInterval, i.e. 2^(interval - 1) (micro)frames.
+ */
+static void rfnm_isoc_size(unsigned ksps, unsigned interval)
+{
+	u64 bps = (u64) ksps * 1000 * 3;
+	unsigned bytes, mult, burst, i;
+
+	bps += bps / 16;
+
+	/* full speed, one packet per service interval */
+	bytes = DIV_ROUND_UP_ULL(bps << (interval - 1), 1000);
+	if (bytes > 1023) {
+		printk("isoc: %u ksps doesn't fit full speed\n", ksps);
+		bytes = 1023;
+	}
+	fs_iso_source_desc_proto.wMaxPacketSize = cpu_to_le16(bytes);
+	fs_iso_source_desc_proto.bInterval = interval;
+
+	bytes = DIV_ROUND_UP_ULL(bps << (interval - 1), 8000);
+
+	/* high speed, up to 3 transactions of 1024 per microframe */
+	mult = clamp_t(unsigned, DIV_ROUND_UP(bytes, 1024), 1, 3);
+	if (bytes > mult * 1024)
+		printk("isoc: %u ksps doesn't fit high speed\n", ksps);
+	hs_iso_source_desc_proto.wMaxPacketSize =
+		cpu_to_le16(min(DIV_ROUND_UP(bytes, mult), 1024u) | (mult - 1) << 11);
+	hs_iso_source_desc_proto.bInterval = interval;
+
+	/* super speed, bursts of up to 16 packets, up to 3 bursts */
+	burst = DIV_ROUND_UP(bytes, 1024);
+	mult = clamp_t(unsigned, DIV_ROUND_UP(burst, 16), 1, 3);
+	burst = clamp_t(unsigned, DIV_ROUND_UP(burst, mult), 1, 16);
+	if (bytes > mult * burst * 1024) {
+		printk("isoc: %u ksps doesn't fit super speed\n", ksps);
+		bytes = mult * burst * 1024;
+	}
+	ss_iso_source_desc_proto.bInterval = interval;
+	ss_iso_source_comp_desc.bMaxBurst = burst - 1;
+	ss_iso_source_comp_desc.bmAttributes = mult - 1;
+	ss_iso_source_comp_desc.wBytesPerInterval = cpu_to_le16(bytes);
+
+	for (i = 0; i < RFNM_EP_CNT; i++) {
+		memcpy(&fs_iso_source_desc[i], &fs_iso_source_desc_proto, sizeof(struct usb_endpoint_descriptor));
+		memcpy(&hs_iso_source_desc[i], &hs_iso_source_desc_proto, sizeof(struct usb_endpoint_descriptor));
+		memcpy(&ss_iso_source_desc[i], &ss_iso_source_desc_proto, sizeof(struct usb_endpoint_descriptor));
+
+		fs_iso_source_desc[i].bEndpointAddress = fs_source_desc[i].bEndpointAddress;
+		hs_iso_source_desc[i].bEndpointAddress = fs_source_desc[i].bEndpointAddress;
+		ss_iso_source_desc[i].bEndpointAddress = fs_source_desc[i].bEndpointAddress;
+	}
+
+	printk("isoc: %u ksps, fs %u hs %u ss %u bytes per interval\n", ksps,
+		usb_endpoint_maxp(&fs_iso_source_desc_proto),
+		usb_endpoint_maxp(&hs_iso_source_desc_proto) * usb_endpoint_maxp_mult(&hs_iso_source_desc_proto),
+		le16_to_cpu(ss_iso_source_comp_desc.wBytesPerInterval));
+}
+
+/* bytes the core gets to put in each isochronous IN request */
+static unsigned rfnm_isoc_chunk(struct usb_gadget *gadget)
+{
+	if (gadget->speed >= USB_SPEED_SUPER)
+		return le16_to_cpu(ss_iso_source_comp_desc.wBytesPerInterval);
+	if (gadget->speed == USB_SPEED_HIGH)
+		return usb_endpoint_maxp(&hs_iso_source_desc_proto) *
+			usb_endpoint_maxp_mult(&hs_iso_source_desc_proto);
+	return usb_endpoint_maxp(&fs_iso_source_desc_proto);
+}
+
 static char rfnm_ext_prop_name[] = "DeviceInterfaceGUID";
 static char rfnm_ext_prop_data[] = "{766609f3-ef4a-4e79-bd07-988fe1a5696f}";
 
@@ -286,6 +533,8 @@ sourcesink_bind(struct usb_configuration *c, struct usb_function *f)
 {
 	struct usb_composite_dev *cdev = c->cdev;
 	struct f_sourcesink	*ss = func_to_ss(f);
+	struct rfnm_ss_opts	*opts;
+	unsigned		isoc_ksps, isoc_interval;
 	int	id, i;
 	int ret;
 
@@ -322,6 +571,7 @@ sourcesink_bind(struct usb_configuration *c, struct usb_function *f)
 	//if (id < 0)
 	//	return id;
 	source_sink_intf_alt0.bInterfaceNumber = id;
+	source_sink_intf_alt1.bInterfaceNumber = id;
 	// ?? 
 	
 
@@ -355,8 +605,33 @@ sourcesink_bind(struct usb_configuration *c, struct usb_function *f)
 		ss_source_desc[i].bEndpointAddress = fs_source_desc[i].bEndpointAddress;
 		ss_sink_desc[i].bEndpointAddress = fs_sink_desc[i].bEndpointAddress;
 	}
-	
-	
+
+	ss->notify_ep = usb_ep_autoconfig(cdev->gadget, &fs_notify_desc);
+	if (!ss->notify_ep)
+		goto autoconf_fail;
+
+	hs_notify_desc.bEndpointAddress = fs_notify_desc.bEndpointAddress;
+	ss_notify_desc.bEndpointAddress = fs_notify_desc.bEndpointAddress;
+
+	opts = container_of(f->fi, struct rfnm_ss_opts, ss.func_inst);
+
+	mutex_lock(&opts->ss.lock);
+	isoc_ksps = opts->isoc_ksps;
+	isoc_interval = opts->ss.isoc_interval;
+	mutex_unlock(&opts->ss.lock);
+
+	/* alt 1 reuses the IN endpoints claimed above */
+	ss->isoc = isoc_ksps != 0;
+	if (ss->isoc) {
+		rfnm_isoc_size(isoc_ksps, isoc_interval);
+		fs_source_sink_descs[RFNM_FS_ALT1_IDX] = (struct usb_descriptor_header *) &source_sink_intf_alt1;
+		hs_source_sink_descs[RFNM_HS_ALT1_IDX] = (struct usb_descriptor_header *) &source_sink_intf_alt1;
+		ss_source_sink_descs[RFNM_SS_ALT1_IDX] = (struct usb_descriptor_header *) &source_sink_intf_alt1;
+	} else {
+		fs_source_sink_descs[RFNM_FS_ALT1_IDX] = NULL;
+		hs_source_sink_descs[RFNM_HS_ALT1_IDX] = NULL;
+		ss_source_sink_descs[RFNM_SS_ALT1_IDX] = NULL;
+	}
 
 	ret = usb_assign_descriptors(f, fs_source_sink_descs,
 			hs_source_sink_descs, ss_source_sink_descs,
@@ -514,17 +789,20 @@ static void source_sink_complete(struct usb_ep *ep, struct usb_request *req)
 static void rfnm_submit_usb_req_in(struct usb_ep *ep, struct usb_request *req);
 static void rfnm_submit_usb_req_out(struct usb_ep *ep, struct usb_request *req);
 
-static int source_sink_start_ep_in(struct f_sourcesink *ss, struct usb_ep *ep)
+static int source_sink_start_ep_in(struct f_sourcesink *ss, struct usb_ep *ep, int id, int qlen,
+		unsigned isoc_chunk)
 {
 	struct usb_request	*req;
-	int	i, size, qlen, status = 0;
+	int	i, size, status = 0;
 	
 	// qlen = 8 breaks after reloading the driver (host app is reporting not in sync)
 	// probably because original driver had fixed qlen=1
-	// I have a feeling that qlen=8 might have better performances
+	// qlen comes from the bulk_qlen configfs attribute, sweep it per host controller
 	
-	qlen = 16;
-	size = RFNM_USB_RX_PACKET_SIZE;
+	// the streaming core points req->buf at its own buffers before queueing,
+	// the size of the request is set with bulk_buflen, or one service interval
+	// on alt 1
+	size = isoc_chunk ? isoc_chunk : RFNM_USB_RX_PACKET_SIZE;
 
 	printk("in ep qlen %d size %d\n", qlen, size);
 
@@ -534,6 +812,8 @@ static int source_sink_start_ep_in(struct f_sourcesink *ss, struct usb_ep *ep)
 			return -ENOMEM;
 
 		req->complete = rfnm_submit_usb_req_in;
+		req->context = RFNM_EP_ID_TO_CTX(id);
+		rfnm_stream_ep_add_req(RFNM_EP_DIR_IN, id, ep, req);
 		//if (is_in)
 		//	reinit_write_data(ep, req);
 		//else if (ss->pattern != 2)
@@ -553,16 +833,15 @@ static int source_sink_start_ep_in(struct f_sourcesink *ss, struct usb_ep *ep)
 	return status;
 }
 
-static int source_sink_start_ep_out(struct f_sourcesink *ss, struct usb_ep *ep)
+static int source_sink_start_ep_out(struct f_sourcesink *ss, struct usb_ep *ep, int id, int qlen)
 {
 	struct usb_request	*req;
-	int	i, size, qlen, status = 0;
+	int	i, size, status = 0;
 	
 	// qlen = 8 breaks after reloading the driver (host app is reporting not in sync)
 	// probably because original driver had fixed qlen=1
-	// I have a feeling that qlen=8 might have better performances
 	
-	qlen = 8;
+	// one struct rfnm_tx_usb_buf per request, the TX thread depends on it
 	size = RFNM_USB_TX_PACKET_SIZE;
 
 	printk("out ep qlen %d size %d\n", qlen, size);
@@ -573,6 +852,8 @@ static int source_sink_start_ep_out(struct f_sourcesink *ss, struct usb_ep *ep)
 			return -ENOMEM;
 
 		req->complete = rfnm_submit_usb_req_out;
+		req->context = RFNM_EP_ID_TO_CTX(id);
+		rfnm_stream_ep_add_req(RFNM_EP_DIR_OUT, id, ep, req);
 		//if (is_in)
 		//	reinit_write_data(ep, req);
 		//else if (ss->pattern != 2)
@@ -592,18 +873,115 @@ static int source_sink_start_ep_out(struct f_sourcesink *ss, struct usb_ep *ep)
 	return status;
 }
 
+/*
+ * Stream events from la9310rfnm are queued here and sent on notify_ep,
+ * as many records per transfer as fit in RFNM_NOTIFY_MAXPACKET.
+ */
+#define RFNM_NOTIFY_QLEN 32
+
+static DEFINE_SPINLOCK(rfnm_notify_q_lock);
+static struct f_sourcesink *rfnm_notify_ss;
+static struct rfnm_stream_event rfnm_notify_q[RFNM_NOTIFY_QLEN];
+static unsigned rfnm_notify_head, rfnm_notify_tail;
+static unsigned rfnm_notify_dropped;
+static int rfnm_notify_busy;
+
+/* called with rfnm_notify_q_lock held */
+static void rfnm_notify_send(void)
+{
+	struct f_sourcesink *ss = rfnm_notify_ss;
+	struct usb_request *req;
+	int n = 0;
+
+	if (!ss || rfnm_notify_busy || rfnm_notify_head == rfnm_notify_tail)
+		return;
+
+	req = ss->notify_req;
+
+	while (rfnm_notify_tail != rfnm_notify_head &&
+		(n + 1) * sizeof(struct rfnm_stream_event) <= RFNM_NOTIFY_MAXPACKET) {
+		memcpy(req->buf + n * sizeof(struct rfnm_stream_event),
+			&rfnm_notify_q[rfnm_notify_tail], sizeof(struct rfnm_stream_event));
+		rfnm_notify_tail = (rfnm_notify_tail + 1) % RFNM_NOTIFY_QLEN;
+		n++;
+	}
+
+	req->length = n * sizeof(struct rfnm_stream_event);
+
+	if (usb_ep_queue(ss->notify_ep, req, GFP_ATOMIC))
+		rfnm_notify_dropped += n;
+	else
+		rfnm_notify_busy = 1;
+}
+
+static void rfnm_notify_event(const struct rfnm_stream_event *ev)
+{
+	unsigned long flags;
+	unsigned next;
+
+	spin_lock_irqsave(&rfnm_notify_q_lock, flags);
+
+	if (rfnm_notify_ss) {
+		next = (rfnm_notify_head + 1) % RFNM_NOTIFY_QLEN;
+		if (next == rfnm_notify_tail) {
+			/* host isn't reading, keep the oldest records */
+			rfnm_notify_dropped++;
+		} else {
+			rfnm_notify_q[rfnm_notify_head] = *ev;
+			rfnm_notify_head = next;
+		}
+
+		rfnm_notify_send();
+	}
+
+	spin_unlock_irqrestore(&rfnm_notify_q_lock, flags);
+}
+
+static void rfnm_notify_complete(struct usb_ep *ep, struct usb_request *req)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rfnm_notify_q_lock, flags);
+	rfnm_notify_busy = 0;
+	if (req->status == 0)
+		rfnm_notify_send();
+	spin_unlock_irqrestore(&rfnm_notify_q_lock, flags);
+}
+
+static void rfnm_notify_chlist_done(int txrx, uint32_t cc)
+{
+	rfnm_stream_event(RFNM_EVT_RETUNE_DONE, txrx, cc);
+}
+
 static void disable_source_sink(struct f_sourcesink *ss)
 {
 	struct usb_composite_dev	*cdev;
+	unsigned long			flags;
 	int i;
 
 	cdev = ss->function.config->cdev;
 
 	for(i = 0; i < RFNM_EP_CNT; i++) {
+		rfnm_stream_set_iso(i, 0);
+		rfnm_stream_ep_reset(RFNM_EP_DIR_IN, i);
+		rfnm_stream_ep_reset(RFNM_EP_DIR_OUT, i);
 		disable_ep(cdev, ss->in_ep[i]);
 		disable_ep(cdev, ss->out_ep[i]);
 	}
 
+	spin_lock_irqsave(&rfnm_notify_q_lock, flags);
+	rfnm_notify_ss = NULL;
+	spin_unlock_irqrestore(&rfnm_notify_q_lock, flags);
+
+	disable_ep(cdev, ss->notify_ep);
+	if (ss->notify_req) {
+		free_ep_req(ss->notify_ep, ss->notify_req);
+		ss->notify_req = NULL;
+	}
+
+	if (rfnm_notify_dropped)
+		printk("notify: %u events dropped\n", rfnm_notify_dropped);
+
 	VDBG(cdev, "%s disabled\n", ss->function.name);
 }
 
@@ -614,12 +992,32 @@ enable_source_sink(struct usb_composite_dev *cdev, struct f_sourcesink *ss,
 	int					result = 0;
 	int					speed = cdev->gadget->speed;
 	struct usb_ep				*ep;
-	int i;
+	struct f_ss_opts			*ss_opts;
+	unsigned long				flags;
+	unsigned				isoc_chunk;
+	int i, in_qlen, out_qlen;
+
+	// configfs changes are picked up here, i.e. on the next set_alt
+	ss_opts = container_of(ss->function.fi, struct f_ss_opts, func_inst);
+
+	mutex_lock(&ss_opts->lock);
+	if(ss_opts->bulk_qlen) {
+		in_qlen = out_qlen = ss_opts->bulk_qlen;
+	} else {
+		in_qlen = RFNM_USB_IN_QLEN_DEFAULT;
+		out_qlen = RFNM_USB_OUT_QLEN_DEFAULT;
+	}
+	ss->buflen = ss_opts->bulk_buflen;
+	mutex_unlock(&ss_opts->lock);
+
+	rfnm_stream_set_rx_req_size(ss->buflen, cdev->gadget->sg_supported);
+
+	isoc_chunk = alt ? rfnm_isoc_chunk(cdev->gadget) : 0;
 
 	for(i = 0; i < RFNM_EP_CNT; i++) {
 
 		ep = ss->in_ep[i];
-		result = config_ep_by_speed(cdev->gadget, &(ss->function), ep);
+		result = config_ep_by_speed_and_alt(cdev->gadget, &(ss->function), ep, alt);
 		if (result)
 			return result;
 		result = usb_ep_enable(ep);
@@ -627,14 +1025,16 @@ enable_source_sink(struct usb_composite_dev *cdev, struct f_sourcesink *ss,
 			return result;
 		ep->driver_data = ss;
 
-		result = source_sink_start_ep_in(ss, ep);
+		rfnm_stream_set_iso(i, isoc_chunk);
+
+		result = source_sink_start_ep_in(ss, ep, i, in_qlen, isoc_chunk);
 		if (result < 0) {
 			usb_ep_disable(ep);
 			return result;
 		}
 
 		ep = ss->out_ep[i];
-		result = config_ep_by_speed(cdev->gadget, &(ss->function), ep);
+		result = config_ep_by_speed_and_alt(cdev->gadget, &(ss->function), ep, alt);
 		if (result)
 			goto fail;
 		result = usb_ep_enable(ep);
@@ -642,12 +1042,35 @@ enable_source_sink(struct usb_composite_dev *cdev, struct f_sourcesink *ss,
 			goto fail;
 		ep->driver_data = ss;
 
-		result = source_sink_start_ep_out(ss, ep);
+		result = source_sink_start_ep_out(ss, ep, i, out_qlen);
 		if (result < 0) {
 			usb_ep_disable(ep);
 			return result;
 		}
 	}
+
+	ep = ss->notify_ep;
+	result = config_ep_by_speed_and_alt(cdev->gadget, &(ss->function), ep, alt);
+	if (result)
+		goto fail;
+	result = usb_ep_enable(ep);
+	if (result < 0)
+		goto fail;
+	ep->driver_data = ss;
+
+	ss->notify_req = ss_alloc_ep_req(ep, RFNM_NOTIFY_MAXPACKET);
+	if (!ss->notify_req) {
+		usb_ep_disable(ep);
+		return -ENOMEM;
+	}
+	ss->notify_req->complete = rfnm_notify_complete;
+
+	spin_lock_irqsave(&rfnm_notify_q_lock, flags);
+	rfnm_notify_head = rfnm_notify_tail = 0;
+	rfnm_notify_busy = 0;
+	rfnm_notify_dropped = 0;
+	rfnm_notify_ss = ss;
+	spin_unlock_irqrestore(&rfnm_notify_q_lock, flags);
 	
 
 	ss->cur_alt = alt;
@@ -665,7 +1088,10 @@ static int sourcesink_set_alt(struct usb_function *f,
 	struct f_sourcesink		*ss = func_to_ss(f);
 	struct usb_composite_dev	*cdev = f->config->cdev;
 
-	printk("sourcesink_set_alt\n");
+	printk("sourcesink_set_alt %d\n", alt);
+
+	if (alt > 1 || (alt == 1 && !ss->isoc))
+		return -EINVAL;
 
 	disable_source_sink(ss);
 	return enable_source_sink(cdev, ss, alt);
@@ -701,6 +1127,20 @@ static void rfnm_setup_complete_rx(struct usb_ep *ep, struct usb_request *req) {
 	rfnm_apply_dev_rx_chlist(&r_chlist);	
 }
 
+// USB thread or the restart timeout, the data or status stage of RFNM_GET_SM_RESET
+static void rfnm_sm_reset_done(void *ctx, int status)
+{
+	struct usb_composite_dev *cdev = ctx;
+	unsigned long flags;
+	int value;
+
+	spin_lock_irqsave(&cdev->lock, flags);
+	value = usb_ep_queue(cdev->gadget->ep0, cdev->req, GFP_ATOMIC);
+	spin_unlock_irqrestore(&cdev->lock, flags);
+	if (value < 0)
+		ERROR(cdev, "source/sink response, err %d\n", value);
+}
+
 static int sourcesink_setup(struct usb_function *f,
 		const struct usb_ctrlrequest *ctrl)
 {
@@ -769,7 +1209,43 @@ unknown:
 			ERROR(c->cdev, "source/sink response, err %d\n", value);
 	}
 
-	
+	// host libraries parse the rx usb buffers with this instead of rfnm-shared.h
+	if(ctrl->bRequest == RFNM_LAYOUT_B_REQUEST) {
+		struct f_sourcesink *ss = func_to_ss(f);
+		struct rfnm_stream_layout l = {
+			.version = cpu_to_le16(RFNM_LAYOUT_VERSION),
+			.ep_cnt = cpu_to_le16(RFNM_EP_CNT),
+			.buf_size = cpu_to_le32(sizeof(struct rfnm_rx_usb_buf)),
+			.req_size = cpu_to_le32(ss->buflen),
+			.magic = cpu_to_le32(0x7ab8bd6f),
+			.adc_cc_step = cpu_to_le32(RFNM_RX_USB_BUF_MULTI),
+			.payload_off = cpu_to_le32(offsetof(struct rfnm_rx_usb_buf, buf)),
+			.payload_size = cpu_to_le32(sizeof_field(struct rfnm_rx_usb_buf, buf)),
+		};
+
+#define RFNM_LAYOUT_FIELD(_f, _m) do { \
+		(_f).off = cpu_to_le16(offsetof(struct rfnm_rx_usb_buf, _m)); \
+		(_f).size = cpu_to_le16(sizeof_field(struct rfnm_rx_usb_buf, _m)); \
+	} while (0)
+
+		RFNM_LAYOUT_FIELD(l.magic_field, magic);
+		RFNM_LAYOUT_FIELD(l.usb_cc, usb_cc);
+		RFNM_LAYOUT_FIELD(l.adc_cc, adc_cc);
+		RFNM_LAYOUT_FIELD(l.adc_id, adc_id);
+		RFNM_LAYOUT_FIELD(l.phytimer, phytimer);
+
+		if(ctrl->bRequestType != 0xc0 || w_value) {
+			return -EOPNOTSUPP;
+		}
+		req->length = min_t(u16, w_length, sizeof(l));
+		req->zero = 0;
+		memcpy(req->buf, &l, req->length);
+		value = usb_ep_queue(c->cdev->gadget->ep0, req, GFP_ATOMIC);
+		if (value < 0) {
+			ERROR(c->cdev, "source/sink response, err %d\n", value);
+		}
+		return value;
+	}
 
 	if((ctrl->bRequestType == 0xc0 && ctrl->wValue == RFNM_GET_DEV_HWINFO)) {
 		req->length = w_length;
@@ -839,14 +1315,12 @@ unknown:
 	if((ctrl->bRequestType == 0xc0 && ctrl->wValue == RFNM_GET_SM_RESET)) {
 		req->length = w_length;
 		req->zero = 0;
-		//struct rfnm_dev_status r_stat;
-		//rfnm_populate_dev_status(&r_stat);
-		rfnm_restart_sm(1);
-		//memcpy(req->buf, &r_stat, w_length);
-		//printk("length: %d\n", w_length);
-		value = usb_ep_queue(c->cdev->gadget->ep0, req, GFP_ATOMIC);
+		// the reply is queued by rfnm_sm_reset_done once the stages run again
+		value = rfnm_stream_soft_restart(rfnm_sm_reset_done, c->cdev);
 		if (value < 0) {
-			ERROR(c->cdev, "source/sink response, err %d\n", value);
+			ERROR(c->cdev, "soft restart, err %d\n", value);
+		} else if (!w_length) {
+			value = USB_GADGET_DELAYED_STATUS;
 		}
 	}
 
@@ -878,6 +1352,10 @@ static bool func_req_match(struct usb_function *f,
 	
 	//printk("creq->bRequest %x creq->bRequestType %x creq->wValue %x\n", creq->bRequest, creq->bRequestType, creq->wValue);
 
+	if(creq->bRequest == RFNM_LAYOUT_B_REQUEST) {
+		return creq->bRequestType == 0xc0;
+	}
+
 	if(creq->bRequest != RFNM_B_REQUEST) {
 		return false;
 	}
@@ -946,9 +1424,173 @@ static struct configfs_item_operations ss_item_ops = {
 	.release		= ss_attr_release,
 };
 
+static ssize_t f_ss_opts_bulk_qlen_show(struct config_item *item, char *page)
+{
+	struct f_ss_opts *opts = to_f_ss_opts(item);
+	int result;
+
+	mutex_lock(&opts->lock);
+	result = sprintf(page, "%u\n", opts->bulk_qlen);
+	mutex_unlock(&opts->lock);
 
+	return result;
+}
+
+// 0 selects the default depths, takes effect on the next set_alt
+static ssize_t f_ss_opts_bulk_qlen_store(struct config_item *item,
+					   const char *page, size_t len)
+{
+	struct f_ss_opts *opts = to_f_ss_opts(item);
+	int ret;
+	u32 num;
+
+	ret = kstrtou32(page, 0, &num);
+	if (ret)
+		return ret;
+
+	if (num > RFNM_USB_QLEN_MAX)
+		return -EINVAL;
+
+	mutex_lock(&opts->lock);
+	opts->bulk_qlen = num;
+	mutex_unlock(&opts->lock);
+
+	return len;
+}
+
+CONFIGFS_ATTR(f_ss_opts_, bulk_qlen);
+
+static ssize_t f_ss_opts_bulk_buflen_show(struct config_item *item, char *page)
+{
+	struct f_ss_opts *opts = to_f_ss_opts(item);
+	int result;
+
+	mutex_lock(&opts->lock);
+	result = sprintf(page, "%u\n", opts->bulk_buflen);
+	mutex_unlock(&opts->lock);
+
+	return result;
+}
+
+// IN request size, a multiple of the rx usb buffer, takes effect on the next set_alt
+static ssize_t f_ss_opts_bulk_buflen_store(struct config_item *item,
+					   const char *page, size_t len)
+{
+	struct f_ss_opts *opts = to_f_ss_opts(item);
+	int ret;
+	u32 num;
+
+	ret = kstrtou32(page, 0, &num);
+	if (ret)
+		return ret;
+
+	// the streaming core splits the request in struct rfnm_rx_usb_buf
+	if (!num || num % sizeof(struct rfnm_rx_usb_buf) ||
+		num / sizeof(struct rfnm_rx_usb_buf) > RFNM_RX_REQ_SLOTS_MAX)
+		return -EINVAL;
+
+	mutex_lock(&opts->lock);
+	opts->bulk_buflen = num;
+	mutex_unlock(&opts->lock);
+
+	return len;
+}
+
+CONFIGFS_ATTR(f_ss_opts_, bulk_buflen);
+
+static inline struct rfnm_ss_opts *to_rfnm_ss_opts(struct config_item *item)
+{
+	return container_of(to_f_ss_opts(item), struct rfnm_ss_opts, ss);
+}
+
+static ssize_t f_ss_opts_isoc_ksps_show(struct config_item *item, char *page)
+{
+	struct rfnm_ss_opts *opts = to_rfnm_ss_opts(item);
+	int result;
+
+	mutex_lock(&opts->ss.lock);
+	result = sprintf(page, "%u\n", opts->isoc_ksps);
+	mutex_unlock(&opts->ss.lock);
+
+	return result;
+}
+
+// sample rate the isochronous alt setting is sized for, 0 disables alt 1
+static ssize_t f_ss_opts_isoc_ksps_store(struct config_item *item,
+					   const char *page, size_t len)
+{
+	struct rfnm_ss_opts *opts = to_rfnm_ss_opts(item);
+	int ret;
+	u32 num;
+
+	mutex_lock(&opts->ss.lock);
+	if (opts->ss.refcnt) {
+		ret = -EBUSY;
+		goto end;
+	}
+
+	ret = kstrtou32(page, 0, &num);
+	if (ret)
+		goto end;
+
+	opts->isoc_ksps = num;
+	ret = len;
+end:
+	mutex_unlock(&opts->ss.lock);
+	return ret;
+}
+
+CONFIGFS_ATTR(f_ss_opts_, isoc_ksps);
+
+static ssize_t f_ss_opts_isoc_interval_show(struct config_item *item, char *page)
+{
+	struct f_ss_opts *opts = to_f_ss_opts(item);
+	int result;
+
+	mutex_lock(&opts->lock);
+	result = sprintf(page, "%u\n", opts->isoc_interval);
+	mutex_unlock(&opts->lock);
+
+	return result;
+}
+
+// bInterval of the alt 1 endpoints, latency vs. bytes per request
+static ssize_t f_ss_opts_isoc_interval_store(struct config_item *item,
+					   const char *page, size_t len)
+{
+	struct f_ss_opts *opts = to_f_ss_opts(item);
+	int ret;
+	u8 num;
+
+	mutex_lock(&opts->lock);
+	if (opts->refcnt) {
+		ret = -EBUSY;
+		goto end;
+	}
+
+	ret = kstrtou8(page, 0, &num);
+	if (ret)
+		goto end;
+
+	if (num < 1 || num > 16) {
+		ret = -EINVAL;
+		goto end;
+	}
+
+	opts->isoc_interval = num;
+	ret = len;
+end:
+	mutex_unlock(&opts->lock);
+	return ret;
+}
+
+CONFIGFS_ATTR(f_ss_opts_, isoc_interval);
 
 static struct configfs_attribute *ss_attrs[] = {
+	&f_ss_opts_attr_bulk_qlen,
+	&f_ss_opts_attr_bulk_buflen,
+	&f_ss_opts_attr_isoc_ksps,
+	&f_ss_opts_attr_isoc_interval,
 	NULL,
 };
 
@@ -960,24 +1602,28 @@ static const struct config_item_type ss_func_type = {
 
 static void source_sink_free_instance(struct usb_function_instance *fi)
 {
-	struct f_ss_opts *ss_opts;
+	struct rfnm_ss_opts *opts;
 
-	ss_opts = container_of(fi, struct f_ss_opts, func_inst);
-	kfree(ss_opts);
+	opts = container_of(fi, struct rfnm_ss_opts, ss.func_inst);
+	kfree(opts);
 }
 
 static struct usb_function_instance *source_sink_alloc_inst(void)
 {
+	struct rfnm_ss_opts *opts;
 	struct f_ss_opts *ss_opts;
 
-	ss_opts = kzalloc(sizeof(*ss_opts), GFP_KERNEL);
-	if (!ss_opts)
+	opts = kzalloc(sizeof(*opts), GFP_KERNEL);
+	if (!opts)
 		return ERR_PTR(-ENOMEM);
+	ss_opts = &opts->ss;
 	mutex_init(&ss_opts->lock);
 	ss_opts->func_inst.free_func_inst = source_sink_free_instance;
-	ss_opts->isoc_interval = GZERO_ISOC_INTERVAL;
+	// one (micro)frame, alt 1 is there for latency
+	ss_opts->isoc_interval = 1;
 	ss_opts->isoc_maxpacket = GZERO_ISOC_MAXPACKET;
-	ss_opts->bulk_buflen = GZERO_BULK_BUFLEN;
+	ss_opts->bulk_buflen = sizeof(struct rfnm_rx_usb_buf);
+	ss_opts->bulk_qlen = 0;
 
 	config_group_init_type_name(&ss_opts->func_inst.group, "",
 				    &ss_func_type);
@@ -1001,12 +1647,18 @@ static int __init sslb_modinit(void)
 	ret = usb_function_register(&RFNMusb_func);
 	if (ret)
 		return ret;
+
+	rfnm_stream_set_notifier(rfnm_notify_event);
+	rfnm_set_chlist_done_cb(rfnm_notify_chlist_done);
+
 	if (ret)
 		usb_function_unregister(&RFNMusb_func);
 	return ret;
 }
 static void __exit sslb_modexit(void)
 {
+	rfnm_set_chlist_done_cb(NULL);
+	rfnm_stream_set_notifier(NULL);
 	usb_function_unregister(&RFNMusb_func);
 }
 module_init(sslb_modinit);
@@ -0,0 +1,516 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+/*
+ * Sample format conversion for the host library, see rfnm_lib.h.
+ *
+ * Wire format, one complex sample in 3 bytes, as rfnm_pack16to12_aarch64
+ * and rfnm_unpack12to16_aarch64 on the device:
+ *	b0 = i[11:4], b1 = i[15:12] | q[7:4] << 4, b2 = q[15:8]
+ * with i and q two's complement int16, 12 bit data left aligned.
+ *
+ * Every kernel exists as scalar C, SSE4.1, AVX2, AVX-512BW and NEON, the
+ * best one the CPU runs is picked on first use. RFNM_CONV_ISA in the
+ * environment forces one (scalar, sse4, avx2, avx512, neon). The float
+ * conversions go through int16 in blocks that stay in L1.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RFNM_CONV_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define RFNM_CONV_NEON
+#endif
+
+#include <rfnm_lib.h>
+
+/* complex samples per pass of the float conversions */
+#define RFNM_CONV_BLOCK		256
+
+struct rfnm_conv_ops {
+	const char *name;
+	void (*unpack)(int16_t *dst, const uint8_t *src, uint32_t cnt);
+	void (*pack)(uint8_t *dst, const int16_t *src, uint32_t cnt);
+	/* n values, not complex samples */
+	void (*s16_to_f32)(float *dst, const int16_t *src, uint32_t n);
+	void (*f32_to_s16)(int16_t *dst, const float *src, uint32_t n);
+};
+
+static void rfnm_unpack_c(int16_t *dst, const uint8_t *src, uint32_t cnt)
+{
+	uint32_t n;
+
+	for (n = 0; n < cnt; n++, src += 3) {
+		dst[n * 2] = (int16_t) (uint16_t) ((src[0] | src[1] << 8) << 4);
+		dst[n * 2 + 1] = (int16_t) (uint16_t) ((src[1] | src[2] << 8) & 0xfff0);
+	}
+}
+
+static void rfnm_pack_c(uint8_t *dst, const int16_t *src, uint32_t cnt)
+{
+	uint32_t n;
+
+	for (n = 0; n < cnt; n++, dst += 3) {
+		uint16_t i = src[n * 2], q = src[n * 2 + 1];
+
+		dst[0] = i >> 4;
+		dst[1] = (i >> 12) | (q & 0xf0);
+		dst[2] = q >> 8;
+	}
+}
+
+static void rfnm_s16_to_f32_c(float *dst, const int16_t *src, uint32_t n)
+{
+	uint32_t k;
+
+	for (k = 0; k < n; k++)
+		dst[k] = src[k] * (1.0f / 32768);
+}
+
+/* rounded to 12 bits and saturated, so packing only drops zeros */
+static void rfnm_f32_to_s16_c(int16_t *dst, const float *src, uint32_t n)
+{
+	uint32_t k;
+
+	for (k = 0; k < n; k++) {
+		float v = src[k] * 2048;
+
+		if (v > 2047)
+			v = 2047;
+		if (v < -2048)
+			v = -2048;
+		dst[k] = lrintf(v) * 16;
+	}
+}
+
+static const struct rfnm_conv_ops rfnm_conv_c = {
+	"scalar", rfnm_unpack_c, rfnm_pack_c, rfnm_s16_to_f32_c, rfnm_f32_to_s16_c,
+};
+
+#ifdef RFNM_CONV_X86
+
+/*
+ * unpack: a shuffle puts (b0, b1) under every i and (b1, b2) under every q,
+ * then i is shifted up by 4 and q masked, 4 samples per 128 bit lane.
+ * pack: both 12 bit halves of a sample are merged into 24 bits of a dword
+ * with a multiply-add, then the 3 low bytes of every dword are gathered.
+ */
+#define RFNM_X86_UNPACK_SHUF	0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11
+#define RFNM_X86_PACK_SHUF	0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+__attribute__((target("sse4.1")))
+static void rfnm_unpack_sse4(int16_t *dst, const uint8_t *src, uint32_t cnt)
+{
+	const __m128i shuf = _mm_setr_epi8(RFNM_X86_UNPACK_SHUF);
+	const __m128i qmask = _mm_set1_epi16((short) 0xfff0);
+	uint32_t n = 0;
+
+	/* 16 byte loads, 12 bytes used */
+	for (; n + 6 <= cnt; n += 4) {
+		__m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + n * 3)), shuf);
+
+		x = _mm_blend_epi16(_mm_slli_epi16(x, 4), _mm_and_si128(x, qmask), 0xaa);
+		_mm_storeu_si128((__m128i *) (dst + n * 2), x);
+	}
+
+	rfnm_unpack_c(dst + n * 2, src + n * 3, cnt - n);
+}
+
+__attribute__((target("sse4.1")))
+static void rfnm_pack_sse4(uint8_t *dst, const int16_t *src, uint32_t cnt)
+{
+	const __m128i shuf = _mm_setr_epi8(RFNM_X86_PACK_SHUF);
+	const __m128i mul = _mm_set1_epi32(0x10000001);
+	uint32_t n = 0;
+
+	for (; n + 4 <= cnt; n += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (src + n * 2));
+		uint32_t hi;
+
+		x = _mm_shuffle_epi8(_mm_madd_epi16(_mm_srli_epi16(x, 4), mul), shuf);
+		_mm_storel_epi64((__m128i *) (dst + n * 3), x);
+		hi = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+		memcpy(dst + n * 3 + 8, &hi, 4);
+	}
+
+	rfnm_pack_c(dst + n * 3, src + n * 2, cnt - n);
+}
+
+__attribute__((target("sse4.1")))
+static void rfnm_s16_to_f32_sse4(float *dst, const int16_t *src, uint32_t n)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768);
+	uint32_t k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (src + k));
+
+		_mm_storeu_ps(dst + k, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(x)), scale));
+		_mm_storeu_ps(dst + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(x, 8))), scale));
+	}
+
+	rfnm_s16_to_f32_c(dst + k, src + k, n - k);
+}
+
+__attribute__((target("sse4.1")))
+static void rfnm_f32_to_s16_sse4(int16_t *dst, const float *src, uint32_t n)
+{
+	const __m128 scale = _mm_set1_ps(2048);
+	const __m128 lo = _mm_set1_ps(-2048), hi = _mm_set1_ps(2047);
+	uint32_t k = 0;
+
+	/* saturate before cvtps, out of int32 range it gives INT_MIN */
+	for (; k + 8 <= n; k += 8) {
+		__m128 fa = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + k), scale), lo), hi);
+		__m128 fb = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + k + 4), scale), lo), hi);
+		__m128i x = _mm_packs_epi32(_mm_cvtps_epi32(fa), _mm_cvtps_epi32(fb));
+
+		_mm_storeu_si128((__m128i *) (dst + k), _mm_slli_epi16(x, 4));
+	}
+
+	rfnm_f32_to_s16_c(dst + k, src + k, n - k);
+}
+
+static const struct rfnm_conv_ops rfnm_conv_sse4 = {
+	"sse4", rfnm_unpack_sse4, rfnm_pack_sse4, rfnm_s16_to_f32_sse4, rfnm_f32_to_s16_sse4,
+};
+
+__attribute__((target("avx2")))
+static void rfnm_unpack_avx2(int16_t *dst, const uint8_t *src, uint32_t cnt)
+{
+	const __m256i shuf = _mm256_setr_epi8(RFNM_X86_UNPACK_SHUF, RFNM_X86_UNPACK_SHUF);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	const __m256i qmask = _mm256_set1_epi16((short) 0xfff0);
+	uint32_t n = 0;
+
+	/* 32 byte loads, 24 bytes used, bytes 12-27 moved to the upper lane */
+	for (; n + 11 <= cnt; n += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) (src + n * 3));
+
+		x = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(x, lanes), shuf);
+		x = _mm256_blend_epi16(_mm256_slli_epi16(x, 4), _mm256_and_si256(x, qmask), 0xaa);
+		_mm256_storeu_si256((__m256i *) (dst + n * 2), x);
+	}
+
+	rfnm_unpack_c(dst + n * 2, src + n * 3, cnt - n);
+}
+
+__attribute__((target("avx2")))
+static void rfnm_pack_avx2(uint8_t *dst, const int16_t *src, uint32_t cnt)
+{
+	const __m256i shuf = _mm256_setr_epi8(RFNM_X86_PACK_SHUF, RFNM_X86_PACK_SHUF);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	const __m256i store = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+	const __m256i mul = _mm256_set1_epi32(0x10000001);
+	uint32_t n = 0;
+
+	for (; n + 8 <= cnt; n += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) (src + n * 2));
+
+		x = _mm256_shuffle_epi8(_mm256_madd_epi16(_mm256_srli_epi16(x, 4), mul), shuf);
+		x = _mm256_permutevar8x32_epi32(x, lanes);
+		_mm256_maskstore_epi32((int *) (dst + n * 3), store, x);
+	}
+
+	rfnm_pack_c(dst + n * 3, src + n * 2, cnt - n);
+}
+
+__attribute__((target("avx2")))
+static void rfnm_s16_to_f32_avx2(float *dst, const int16_t *src, uint32_t n)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768);
+	uint32_t k = 0;
+
+	for (; k + 16 <= n; k += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (src + k));
+		__m128i b = _mm_loadu_si128((const __m128i *) (src + k + 8));
+
+		_mm256_storeu_ps(dst + k, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a)), scale));
+		_mm256_storeu_ps(dst + k + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b)), scale));
+	}
+
+	rfnm_s16_to_f32_c(dst + k, src + k, n - k);
+}
+
+__attribute__((target("avx2")))
+static void rfnm_f32_to_s16_avx2(int16_t *dst, const float *src, uint32_t n)
+{
+	const __m256 scale = _mm256_set1_ps(2048);
+	const __m256 lo = _mm256_set1_ps(-2048), hi = _mm256_set1_ps(2047);
+	uint32_t k = 0;
+
+	for (; k + 16 <= n; k += 16) {
+		__m256 fa = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + k), scale), lo), hi);
+		__m256 fb = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + k + 8), scale), lo), hi);
+		/* packs works per lane, put the qwords back in order */
+		__m256i x = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(fa), _mm256_cvtps_epi32(fb)), 0xd8);
+
+		_mm256_storeu_si256((__m256i *) (dst + k), _mm256_slli_epi16(x, 4));
+	}
+
+	rfnm_f32_to_s16_c(dst + k, src + k, n - k);
+}
+
+static const struct rfnm_conv_ops rfnm_conv_avx2 = {
+	"avx2", rfnm_unpack_avx2, rfnm_pack_avx2, rfnm_s16_to_f32_avx2, rfnm_f32_to_s16_avx2,
+};
+
+__attribute__((target("avx512f,avx512bw")))
+static void rfnm_unpack_avx512(int16_t *dst, const uint8_t *src, uint32_t cnt)
+{
+	const __m512i shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(RFNM_X86_UNPACK_SHUF));
+	const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6, 6, 7, 8, 9, 9, 10, 11, 12);
+	const __m512i qmask = _mm512_set1_epi16((short) 0xfff0);
+	uint32_t n = 0;
+
+	/* 64 byte loads, 48 bytes used */
+	for (; n + 22 <= cnt; n += 16) {
+		__m512i x = _mm512_loadu_si512(src + n * 3);
+
+		x = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(lanes, x), shuf);
+		x = _mm512_mask_blend_epi16(0xaaaaaaaa, _mm512_slli_epi16(x, 4), _mm512_and_si512(x, qmask));
+		_mm512_storeu_si512(dst + n * 2, x);
+	}
+
+	rfnm_unpack_c(dst + n * 2, src + n * 3, cnt - n);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void rfnm_pack_avx512(uint8_t *dst, const int16_t *src, uint32_t cnt)
+{
+	const __m512i shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(RFNM_X86_PACK_SHUF));
+	const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15);
+	const __m512i mul = _mm512_set1_epi32(0x10000001);
+	uint32_t n = 0;
+
+	for (; n + 16 <= cnt; n += 16) {
+		__m512i x = _mm512_loadu_si512(src + n * 2);
+
+		x = _mm512_shuffle_epi8(_mm512_madd_epi16(_mm512_srli_epi16(x, 4), mul), shuf);
+		x = _mm512_permutexvar_epi32(lanes, x);
+		_mm512_mask_storeu_epi8(dst + n * 3, (1ULL << 48) - 1, x);
+	}
+
+	rfnm_pack_c(dst + n * 3, src + n * 2, cnt - n);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void rfnm_s16_to_f32_avx512(float *dst, const int16_t *src, uint32_t n)
+{
+	const __m512 scale = _mm512_set1_ps(1.0f / 32768);
+	uint32_t k = 0;
+
+	for (; k + 32 <= n; k += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (src + k));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (src + k + 16));
+
+		_mm512_storeu_ps(dst + k, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(a)), scale));
+		_mm512_storeu_ps(dst + k + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(b)), scale));
+	}
+
+	rfnm_s16_to_f32_c(dst + k, src + k, n - k);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void rfnm_f32_to_s16_avx512(int16_t *dst, const float *src, uint32_t n)
+{
+	const __m512 scale = _mm512_set1_ps(2048);
+	const __m512 lo = _mm512_set1_ps(-2048), hi = _mm512_set1_ps(2047);
+	uint32_t k = 0;
+
+	for (; k + 16 <= n; k += 16) {
+		__m512 fa = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(src + k), scale), lo), hi);
+		__m256i x = _mm512_cvtepi32_epi16(_mm512_cvtps_epi32(fa));
+
+		_mm256_storeu_si256((__m256i *) (dst + k), _mm256_slli_epi16(x, 4));
+	}
+
+	rfnm_f32_to_s16_c(dst + k, src + k, n - k);
+}
+
+static const struct rfnm_conv_ops rfnm_conv_avx512 = {
+	"avx512", rfnm_unpack_avx512, rfnm_pack_avx512, rfnm_s16_to_f32_avx512, rfnm_f32_to_s16_avx512,
+};
+
+#endif
+
+#ifdef RFNM_CONV_NEON
+
+/* the same de-interleaving loads and stores as the device kernels */
+static void rfnm_unpack_neon(int16_t *dst, const uint8_t *src, uint32_t cnt)
+{
+	const uint8x16_t lo_nib = vdupq_n_u8(0x0f);
+	const uint8x16_t hi_nib = vdupq_n_u8(0xf0);
+	uint32_t n = 0;
+
+	for (; n + 16 <= cnt; n += 16) {
+		uint8x16x3_t p = vld3q_u8(src + n * 3);
+		uint8x16_t iq = vandq_u8(p.val[1], lo_nib);
+		uint8x16_t qq = vandq_u8(p.val[1], hi_nib);
+		int16x8x2_t o[2];
+
+		o[0].val[0] = vreinterpretq_s16_u16(vorrq_u16(vshll_n_u8(vget_low_u8(p.val[0]), 4), vshlq_n_u16(vmovl_u8(vget_low_u8(iq)), 12)));
+		o[1].val[0] = vreinterpretq_s16_u16(vorrq_u16(vshll_high_n_u8(p.val[0], 4), vshlq_n_u16(vmovl_high_u8(iq), 12)));
+		o[0].val[1] = vreinterpretq_s16_u16(vorrq_u16(vshll_n_u8(vget_low_u8(p.val[2]), 8), vmovl_u8(vget_low_u8(qq))));
+		o[1].val[1] = vreinterpretq_s16_u16(vorrq_u16(vshll_high_n_u8(p.val[2], 8), vmovl_high_u8(qq)));
+
+		vst2q_s16(dst + n * 2, o[0]);
+		vst2q_s16(dst + n * 2 + 16, o[1]);
+	}
+
+	rfnm_unpack_c(dst + n * 2, src + n * 3, cnt - n);
+}
+
+static void rfnm_pack_neon(uint8_t *dst, const int16_t *src, uint32_t cnt)
+{
+	uint32_t n = 0;
+
+	for (; n + 16 <= cnt; n += 16) {
+		int16x8x2_t a = vld2q_s16(src + n * 2);
+		int16x8x2_t b = vld2q_s16(src + n * 2 + 16);
+		uint16x8_t i0 = vreinterpretq_u16_s16(a.val[0]), i1 = vreinterpretq_u16_s16(b.val[0]);
+		uint16x8_t q0 = vreinterpretq_u16_s16(a.val[1]), q1 = vreinterpretq_u16_s16(b.val[1]);
+		uint8x16x3_t p;
+
+		p.val[0] = vcombine_u8(vshrn_n_u16(i0, 4), vshrn_n_u16(i1, 4));
+		p.val[1] = vorrq_u8(vcombine_u8(vmovn_u16(vshrq_n_u16(i0, 12)), vmovn_u16(vshrq_n_u16(i1, 12))),
+				vshlq_n_u8(vcombine_u8(vshrn_n_u16(q0, 4), vshrn_n_u16(q1, 4)), 4));
+		p.val[2] = vcombine_u8(vshrn_n_u16(q0, 8), vshrn_n_u16(q1, 8));
+
+		vst3q_u8(dst + n * 3, p);
+	}
+
+	rfnm_pack_c(dst + n * 3, src + n * 2, cnt - n);
+}
+
+static void rfnm_s16_to_f32_neon(float *dst, const int16_t *src, uint32_t n)
+{
+	uint32_t k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		int16x8_t x = vld1q_s16(src + k);
+
+		/* fixed point with 15 fraction bits, i.e. / 32768 */
+		vst1q_f32(dst + k, vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(x)), 15));
+		vst1q_f32(dst + k + 4, vcvtq_n_f32_s32(vmovl_high_s16(x), 15));
+	}
+
+	rfnm_s16_to_f32_c(dst + k, src + k, n - k);
+}
+
+static void rfnm_f32_to_s16_neon(int16_t *dst, const float *src, uint32_t n)
+{
+	const int16x8_t lo = vdupq_n_s16(-2048), hi = vdupq_n_s16(2047);
+	uint32_t k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + k), 2048));
+		int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + k + 4), 2048));
+		int16x8_t x = vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+
+		vst1q_s16(dst + k, vshlq_n_s16(vminq_s16(vmaxq_s16(x, lo), hi), 4));
+	}
+
+	rfnm_f32_to_s16_c(dst + k, src + k, n - k);
+}
+
+static const struct rfnm_conv_ops rfnm_conv_neon = {
+	"neon", rfnm_unpack_neon, rfnm_pack_neon, rfnm_s16_to_f32_neon, rfnm_f32_to_s16_neon,
+};
+
+#endif
+
+static const struct rfnm_conv_ops *rfnm_conv_all[] = {
+#ifdef RFNM_CONV_X86
+	&rfnm_conv_avx512, &rfnm_conv_avx2, &rfnm_conv_sse4,
+#endif
+#ifdef RFNM_CONV_NEON
+	&rfnm_conv_neon,
+#endif
+	&rfnm_conv_c,
+};
+
+static const struct rfnm_conv_ops *rfnm_conv = &rfnm_conv_c;
+static pthread_once_t rfnm_conv_once = PTHREAD_ONCE_INIT;
+
+static int rfnm_conv_supported(const struct rfnm_conv_ops *ops)
+{
+#ifdef RFNM_CONV_X86
+	__builtin_cpu_init();
+	if (ops == &rfnm_conv_avx512)
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+	if (ops == &rfnm_conv_avx2)
+		return __builtin_cpu_supports("avx2");
+	if (ops == &rfnm_conv_sse4)
+		return __builtin_cpu_supports("sse4.1");
+#endif
+	return 1;
+}
+
+static void rfnm_conv_init(void)
+{
+	const char *force = getenv("RFNM_CONV_ISA");
+	unsigned i;
+
+	for (i = 0; i < sizeof(rfnm_conv_all) / sizeof(rfnm_conv_all[0]); i++) {
+		if (force && strcmp(force, rfnm_conv_all[i]->name))
+			continue;
+		if (rfnm_conv_supported(rfnm_conv_all[i])) {
+			rfnm_conv = rfnm_conv_all[i];
+			return;
+		}
+	}
+}
+
+static const struct rfnm_conv_ops *rfnm_conv_get(void)
+{
+	pthread_once(&rfnm_conv_once, rfnm_conv_init);
+	return rfnm_conv;
+}
+
+const char *rfnm_conv_isa(void)
+{
+	return rfnm_conv_get()->name;
+}
+
+void rfnm_unpack12to16(int16_t *dst, const uint8_t *src, uint32_t cnt)
+{
+	rfnm_conv_get()->unpack(dst, src, cnt);
+}
+
+void rfnm_pack16to12(uint8_t *dst, const int16_t *src, uint32_t cnt)
+{
+	rfnm_conv_get()->pack(dst, src, cnt);
+}
+
+void rfnm_unpack12tocf32(float *dst, const uint8_t *src, uint32_t cnt)
+{
+	const struct rfnm_conv_ops *ops = rfnm_conv_get();
+	int16_t tmp[RFNM_CONV_BLOCK * 2];
+	uint32_t n, k;
+
+	for (n = 0; n < cnt; n += k) {
+		k = cnt - n < RFNM_CONV_BLOCK ? cnt - n : RFNM_CONV_BLOCK;
+		ops->unpack(tmp, src + n * 3, k);
+		ops->s16_to_f32(dst + n * 2, tmp, k * 2);
+	}
+}
+
+void rfnm_packcf32to12(uint8_t *dst, const float *src, uint32_t cnt)
+{
+	const struct rfnm_conv_ops *ops = rfnm_conv_get();
+	int16_t tmp[RFNM_CONV_BLOCK * 2];
+	uint32_t n, k;
+
+	for (n = 0; n < cnt; n += k) {
+		k = cnt - n < RFNM_CONV_BLOCK ? cnt - n : RFNM_CONV_BLOCK;
+		ops->f32_to_s16(tmp, src + n * 2, k * 2);
+		ops->pack(dst + n * 3, tmp, k);
+	}
+}
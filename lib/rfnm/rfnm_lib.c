@@ -0,0 +1,768 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+/*
+ * Host streaming library for the RFNM usb function, see rfnm_lib.h.
+ *
+ * Threads: one libusb event thread per device completes transfers, splits
+ * them into buffers and reorders them by usb_cc. Every channel has its own
+ * single producer, single consumer ring of buffers, consumed either by a
+ * worker thread per channel that runs the callback or by the application
+ * through rfnm_rx_acquire/rfnm_rx_release. Channels are consumed in
+ * parallel, the event thread only reads the buffer headers.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <libusb-1.0/libusb.h>
+
+#include <rfnm_lib.h>
+
+#define RFNM_DEF_TRANSFERS	16
+#define RFNM_MAX_TRANSFERS	256
+
+struct rfnm_rx_ch;
+
+struct rfnm_xfer {
+	struct libusb_transfer *t;
+	struct rfnm_rx_ch *ch;
+	/* buffers not yet released, the transfer is resubmitted at 0 */
+	atomic_uint refs;
+};
+
+struct rfnm_ent {
+	struct rfnm_rx_buf buf;
+	struct rfnm_xfer *x;
+	int valid;
+};
+
+struct rfnm_rx_ch {
+	struct rfnm_dev *dev;
+	uint32_t id;
+	unsigned char addr;
+	int active;
+
+	struct rfnm_xfer *xfers;
+	uint32_t xfer_cnt;
+
+	/* reorder window, event thread only, indexed by usb_cc % win_size */
+	struct rfnm_ent *win;
+	uint32_t win_size;
+	uint64_t next_cc;
+	uint64_t max_cc;
+	uint64_t pend_gap;
+	uint64_t last_adc_cc;
+	int synced;
+
+	/* event thread -> consumer */
+	struct rfnm_ent *ring;
+	uint32_t ring_size;
+	atomic_uint ring_head;
+	atomic_uint ring_tail;
+	atomic_int waiting;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	pthread_t worker;
+	int has_worker;
+
+	struct rfnm_rx_stats stats;
+};
+
+struct rfnm_dev {
+	libusb_context *ctx;
+	libusb_device_handle *h;
+	int intf;
+	struct rfnm_stream_layout layout;
+
+	struct rfnm_rx_ch ch[RFNM_LIB_MAX_CH];
+	uint32_t ch_cnt;
+
+	struct rfnm_rx_params params;
+	int running;
+	atomic_int stopping;
+	/* workers joined, the event thread may empty the rings */
+	atomic_int drain;
+	/* submitted or held by the consumer */
+	atomic_int in_flight;
+	pthread_t event_thread;
+};
+
+static uint64_t rfnm_field(const uint8_t *p, const struct rfnm_stream_field *f)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = f->size - 1; i >= 0; i--)
+		v = v << 8 | p[f->off + i];
+	return v;
+}
+
+static uint64_t rfnm_field_mask(const struct rfnm_stream_field *f)
+{
+	return f->size >= 8 ? ~0ULL : (1ULL << (8 * f->size)) - 1;
+}
+
+static void rfnm_xfer_put(struct rfnm_xfer *x)
+{
+	struct rfnm_dev *dev = x->ch->dev;
+
+	if (atomic_fetch_sub(&x->refs, 1) != 1)
+		return;
+
+	if (!atomic_load(&dev->stopping) && !libusb_submit_transfer(x->t))
+		return;
+
+	atomic_fetch_sub(&dev->in_flight, 1);
+}
+
+static void rfnm_ring_push(struct rfnm_rx_ch *ch, const struct rfnm_ent *e)
+{
+	unsigned head = atomic_load_explicit(&ch->ring_head, memory_order_relaxed);
+
+	/* sized for every buffer of every transfer, never full */
+	ch->ring[head % ch->ring_size] = *e;
+	atomic_store(&ch->ring_head, head + 1);
+
+	if (atomic_load(&ch->waiting)) {
+		pthread_mutex_lock(&ch->lock);
+		pthread_cond_signal(&ch->cond);
+		pthread_mutex_unlock(&ch->lock);
+	}
+}
+
+static void rfnm_deliver(struct rfnm_rx_ch *ch, struct rfnm_ent *e)
+{
+	const struct rfnm_stream_layout *l = &ch->dev->layout;
+	uint64_t mask = rfnm_field_mask(&l->adc_cc);
+
+	e->buf.usb_cc_gap = ch->pend_gap;
+	ch->pend_gap = 0;
+
+	e->buf.adc_cc_gap = 0;
+	if (ch->stats.bufs) {
+		uint64_t d = (e->buf.adc_cc - ch->last_adc_cc - l->adc_cc_step) & mask;
+
+		/* a step backwards is the LA9310 restarting, not a gap */
+		if (d && d < mask / 2)
+			e->buf.adc_cc_gap = d;
+	}
+	ch->last_adc_cc = e->buf.adc_cc;
+
+	ch->stats.bufs++;
+	ch->stats.bytes += e->buf.bytes;
+	ch->stats.usb_cc_lost += e->buf.usb_cc_gap;
+	ch->stats.adc_cc_lost += e->buf.adc_cc_gap;
+
+	rfnm_ring_push(ch, e);
+}
+
+/* hand over everything up to the first hole */
+static void rfnm_win_flush(struct rfnm_rx_ch *ch)
+{
+	struct rfnm_ent *e;
+
+	while ((e = &ch->win[ch->next_cc % ch->win_size])->valid) {
+		e->valid = 0;
+		rfnm_deliver(ch, e);
+		ch->next_cc++;
+	}
+}
+
+/* give up on the holes before usb_cc, or on all of them */
+static void rfnm_win_skip(struct rfnm_rx_ch *ch, uint64_t usb_cc)
+{
+	while (ch->next_cc < usb_cc) {
+		struct rfnm_ent *e = &ch->win[ch->next_cc % ch->win_size];
+
+		if (e->valid) {
+			e->valid = 0;
+			rfnm_deliver(ch, e);
+		} else {
+			ch->pend_gap++;
+		}
+		ch->next_cc++;
+	}
+}
+
+static void rfnm_win_insert(struct rfnm_rx_ch *ch, struct rfnm_ent *e)
+{
+	uint64_t cc = e->buf.usb_cc;
+	struct rfnm_ent *slot;
+
+	if (ch->synced && ch->next_cc > cc + ch->win_size) {
+		/* too far back to be late, usb_cc restarted with the stream */
+		rfnm_win_skip(ch, ch->next_cc + ch->win_size);
+		ch->pend_gap = 0;
+		ch->synced = 0;
+		ch->stats.resync++;
+	}
+
+	if (!ch->synced) {
+		ch->next_cc = ch->max_cc = cc;
+		ch->synced = 1;
+	}
+
+	if (cc < ch->next_cc) {
+		ch->stats.late++;
+		rfnm_xfer_put(e->x);
+		return;
+	}
+
+	if (cc >= ch->next_cc + ch->win_size) {
+		if (cc - ch->next_cc > 2 * (uint64_t) ch->win_size) {
+			/* don't walk a big jump one usb_cc at a time */
+			rfnm_win_skip(ch, ch->next_cc + ch->win_size);
+			ch->pend_gap += cc - ch->next_cc;
+			ch->next_cc = cc;
+		} else {
+			rfnm_win_skip(ch, cc - ch->win_size + 1);
+		}
+	}
+
+	slot = &ch->win[cc % ch->win_size];
+	if (slot->valid) {
+		ch->stats.late++;
+		rfnm_xfer_put(e->x);
+		return;
+	}
+
+	if (cc < ch->max_cc)
+		ch->stats.reordered++;
+	else
+		ch->max_cc = cc;
+
+	*slot = *e;
+	slot->valid = 1;
+
+	rfnm_win_flush(ch);
+}
+
+static void rfnm_rx_complete(struct rfnm_xfer *x)
+{
+	struct rfnm_rx_ch *ch = x->ch;
+	const struct rfnm_stream_layout *l = &ch->dev->layout;
+	struct libusb_transfer *t = x->t;
+	uint32_t n = t->actual_length / l->buf_size;
+	uint32_t i;
+
+	if (t->actual_length % l->buf_size)
+		ch->stats.short_xfers++;
+
+	/* one reference per buffer, plus one until all of them are queued */
+	atomic_store(&x->refs, n + 1);
+
+	for (i = 0; i < n; i++) {
+		const uint8_t *p = t->buffer + i * l->buf_size;
+		struct rfnm_ent e;
+
+		if (rfnm_field(p, &l->magic_field) != l->magic) {
+			ch->stats.bad_magic++;
+			rfnm_xfer_put(x);
+			continue;
+		}
+
+		e.buf.iq = p + l->payload_off;
+		e.buf.bytes = l->payload_size;
+		e.buf.adc = rfnm_field(p, &l->adc_id);
+		e.buf.usb_cc = rfnm_field(p, &l->usb_cc);
+		e.buf.adc_cc = rfnm_field(p, &l->adc_cc);
+		e.buf.phytimer = rfnm_field(p, &l->phytimer);
+		e.x = x;
+		e.valid = 0;
+
+		rfnm_win_insert(ch, &e);
+	}
+
+	rfnm_xfer_put(x);
+}
+
+static void LIBUSB_CALL rfnm_rx_cb(struct libusb_transfer *t)
+{
+	struct rfnm_xfer *x = t->user_data;
+	struct rfnm_dev *dev = x->ch->dev;
+
+	if (t->status == LIBUSB_TRANSFER_COMPLETED && !atomic_load(&dev->stopping)) {
+		rfnm_rx_complete(x);
+		return;
+	}
+
+	if (t->status != LIBUSB_TRANSFER_COMPLETED && t->status != LIBUSB_TRANSFER_CANCELLED)
+		x->ch->stats.failed_xfers++;
+	if (t->status == LIBUSB_TRANSFER_NO_DEVICE)
+		atomic_store(&dev->stopping, 1);
+
+	atomic_store(&x->refs, 1);
+	rfnm_xfer_put(x);
+}
+
+/* event thread, once the consumers are gone */
+static void rfnm_rx_drain(struct rfnm_dev *dev)
+{
+	uint32_t c, i;
+
+	for (c = 0; c < dev->ch_cnt; c++) {
+		struct rfnm_rx_ch *ch = &dev->ch[c];
+		unsigned tail;
+
+		if (!ch->active)
+			continue;
+
+		for (i = 0; i < ch->win_size; i++) {
+			if (ch->win[i].valid) {
+				ch->win[i].valid = 0;
+				rfnm_xfer_put(ch->win[i].x);
+			}
+		}
+
+		tail = atomic_load(&ch->ring_tail);
+		while (tail != atomic_load(&ch->ring_head)) {
+			rfnm_xfer_put(ch->ring[tail % ch->ring_size].x);
+			atomic_store(&ch->ring_tail, ++tail);
+		}
+
+		/* transfers resubmitted by a consumer that raced with stopping */
+		for (i = 0; i < ch->xfer_cnt; i++)
+			libusb_cancel_transfer(ch->xfers[i].t);
+	}
+}
+
+static void *rfnm_event_thread(void *arg)
+{
+	struct rfnm_dev *dev = arg;
+
+	while (1) {
+		struct timeval tv = { 0, 100000 };
+
+		libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+
+		if (atomic_load(&dev->drain)) {
+			rfnm_rx_drain(dev);
+			if (!atomic_load(&dev->in_flight))
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+static void *rfnm_worker_thread(void *arg)
+{
+	struct rfnm_rx_ch *ch = arg;
+	struct rfnm_dev *dev = ch->dev;
+	const struct rfnm_rx_buf *buf;
+
+	while (!atomic_load(&dev->stopping)) {
+		if (rfnm_rx_acquire(dev, ch->id, &buf, 100))
+			continue;
+		dev->params.cb(dev->params.cb_ctx, buf);
+		rfnm_rx_release(dev, ch->id);
+	}
+
+	return NULL;
+}
+
+int rfnm_rx_acquire(struct rfnm_dev *dev, uint32_t ch_id,
+		    const struct rfnm_rx_buf **buf, int timeout_ms)
+{
+	struct rfnm_rx_ch *ch;
+	struct timespec ts;
+	unsigned tail;
+	int ret = 0;
+
+	if (ch_id >= dev->ch_cnt || !dev->ch[ch_id].active)
+		return -EINVAL;
+
+	ch = &dev->ch[ch_id];
+	tail = atomic_load_explicit(&ch->ring_tail, memory_order_relaxed);
+
+	if (tail == atomic_load(&ch->ring_head)) {
+		if (!timeout_ms)
+			return -ETIMEDOUT;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_ms / 1000;
+		ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+
+		pthread_mutex_lock(&ch->lock);
+		atomic_store(&ch->waiting, 1);
+		while (!ret && tail == atomic_load(&ch->ring_head) && !atomic_load(&dev->stopping)) {
+			if (timeout_ms < 0)
+				pthread_cond_wait(&ch->cond, &ch->lock);
+			else
+				ret = pthread_cond_timedwait(&ch->cond, &ch->lock, &ts);
+		}
+		atomic_store(&ch->waiting, 0);
+		pthread_mutex_unlock(&ch->lock);
+
+		if (tail == atomic_load(&ch->ring_head))
+			return -ETIMEDOUT;
+	}
+
+	*buf = &ch->ring[tail % ch->ring_size].buf;
+	return 0;
+}
+
+void rfnm_rx_release(struct rfnm_dev *dev, uint32_t ch_id)
+{
+	struct rfnm_rx_ch *ch = &dev->ch[ch_id];
+	unsigned tail = atomic_load_explicit(&ch->ring_tail, memory_order_relaxed);
+
+	if (tail == atomic_load(&ch->ring_head))
+		return;
+
+	rfnm_xfer_put(ch->ring[tail % ch->ring_size].x);
+	atomic_store(&ch->ring_tail, tail + 1);
+}
+
+static void rfnm_ch_free(struct rfnm_rx_ch *ch)
+{
+	uint32_t i;
+
+	for (i = 0; i < ch->xfer_cnt; i++)
+		libusb_free_transfer(ch->xfers[i].t);
+	free(ch->xfers);
+	free(ch->win);
+	free(ch->ring);
+	ch->xfers = NULL;
+	ch->win = NULL;
+	ch->ring = NULL;
+	ch->xfer_cnt = 0;
+	ch->active = 0;
+}
+
+static int rfnm_ch_alloc(struct rfnm_dev *dev, struct rfnm_rx_ch *ch)
+{
+	const struct rfnm_rx_params *p = &dev->params;
+	uint32_t size = p->xfer_bufs * dev->layout.buf_size;
+	uint32_t i;
+
+	ch->xfers = calloc(p->transfers, sizeof(*ch->xfers));
+	ch->win_size = p->reorder_bufs;
+	ch->win = calloc(ch->win_size, sizeof(*ch->win));
+	for (ch->ring_size = 1; ch->ring_size < p->transfers * p->xfer_bufs; )
+		ch->ring_size <<= 1;
+	ch->ring = calloc(ch->ring_size, sizeof(*ch->ring));
+	if (!ch->xfers || !ch->win || !ch->ring)
+		return -ENOMEM;
+
+	for (i = 0; i < p->transfers; i++) {
+		struct rfnm_xfer *x = &ch->xfers[i];
+		unsigned char *buf;
+
+		x->t = libusb_alloc_transfer(0);
+		if (!x->t)
+			return -ENOMEM;
+		ch->xfer_cnt++;
+
+		buf = malloc(size);
+		if (!buf)
+			return -ENOMEM;
+
+		x->ch = ch;
+		libusb_fill_bulk_transfer(x->t, dev->h, ch->addr, buf, size, rfnm_rx_cb, x, 0);
+		x->t->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+	}
+
+	memset(&ch->stats, 0, sizeof(ch->stats));
+	atomic_store(&ch->ring_head, 0);
+	atomic_store(&ch->ring_tail, 0);
+	ch->synced = 0;
+	ch->pend_gap = 0;
+	ch->active = 1;
+	return 0;
+}
+
+int rfnm_rx_start(struct rfnm_dev *dev, const struct rfnm_rx_params *params)
+{
+	uint32_t c, i, max_win;
+	int r;
+
+	if (dev->running)
+		return -EBUSY;
+	if (!params->ch_mask || params->ch_mask >> dev->ch_cnt)
+		return -EINVAL;
+
+	dev->params = *params;
+	if (!dev->params.transfers)
+		dev->params.transfers = RFNM_DEF_TRANSFERS;
+	if (!dev->params.xfer_bufs)
+		dev->params.xfer_bufs = dev->layout.req_size / dev->layout.buf_size;
+	if (!dev->params.xfer_bufs)
+		dev->params.xfer_bufs = 1;
+	if (!dev->params.reorder_bufs)
+		dev->params.reorder_bufs = 2 * dev->params.xfer_bufs;
+	if (dev->params.transfers > RFNM_MAX_TRANSFERS)
+		return -EINVAL;
+	/* buffers waiting in the window hold their transfer, keep one transfer out of it */
+	max_win = (dev->params.transfers - 1) * dev->params.xfer_bufs;
+	if (dev->params.reorder_bufs > max_win)
+		dev->params.reorder_bufs = max_win ? max_win : 1;
+
+	atomic_store(&dev->stopping, 0);
+	atomic_store(&dev->drain, 0);
+	atomic_store(&dev->in_flight, 0);
+
+	for (c = 0; c < dev->ch_cnt; c++) {
+		if (!(dev->params.ch_mask & (1 << c)))
+			continue;
+		r = rfnm_ch_alloc(dev, &dev->ch[c]);
+		if (r)
+			goto err;
+	}
+
+	for (c = 0; c < dev->ch_cnt; c++) {
+		struct rfnm_rx_ch *ch = &dev->ch[c];
+
+		for (i = 0; ch->active && i < ch->xfer_cnt; i++) {
+			atomic_store(&ch->xfers[i].refs, 0);
+			r = libusb_submit_transfer(ch->xfers[i].t);
+			if (r) {
+				fprintf(stderr, "rfnm: submit ep %02x: %s\n", ch->addr, libusb_error_name(r));
+				r = -EIO;
+				goto err_stop;
+			}
+			atomic_fetch_add(&dev->in_flight, 1);
+		}
+	}
+
+	r = -pthread_create(&dev->event_thread, NULL, rfnm_event_thread, dev);
+	if (r)
+		goto err_stop;
+	dev->running = 1;
+
+	for (c = 0; c < dev->ch_cnt; c++) {
+		struct rfnm_rx_ch *ch = &dev->ch[c];
+
+		if (!ch->active || !dev->params.cb)
+			continue;
+		r = -pthread_create(&ch->worker, NULL, rfnm_worker_thread, ch);
+		if (r) {
+			/* the channel would never be consumed, stop the ones already running */
+			rfnm_rx_stop(dev);
+			return r;
+		}
+		ch->has_worker = 1;
+	}
+
+	return 0;
+
+err_stop:
+	/* nothing has completed yet without the event thread, cancel and reap */
+	atomic_store(&dev->stopping, 1);
+	for (c = 0; c < dev->ch_cnt; c++)
+		for (i = 0; i < dev->ch[c].xfer_cnt; i++)
+			libusb_cancel_transfer(dev->ch[c].xfers[i].t);
+	while (atomic_load(&dev->in_flight))
+		libusb_handle_events(dev->ctx);
+err:
+	for (c = 0; c < dev->ch_cnt; c++)
+		rfnm_ch_free(&dev->ch[c]);
+	return r;
+}
+
+int rfnm_rx_stop(struct rfnm_dev *dev)
+{
+	uint32_t c;
+
+	if (!dev->running)
+		return -EINVAL;
+
+	atomic_store(&dev->stopping, 1);
+
+	for (c = 0; c < dev->ch_cnt; c++) {
+		struct rfnm_rx_ch *ch = &dev->ch[c];
+
+		if (ch->has_worker) {
+			pthread_mutex_lock(&ch->lock);
+			pthread_cond_signal(&ch->cond);
+			pthread_mutex_unlock(&ch->lock);
+			pthread_join(ch->worker, NULL);
+			ch->has_worker = 0;
+		}
+	}
+
+	atomic_store(&dev->drain, 1);
+	pthread_join(dev->event_thread, NULL);
+
+	for (c = 0; c < dev->ch_cnt; c++)
+		rfnm_ch_free(&dev->ch[c]);
+
+	dev->running = 0;
+	return 0;
+}
+
+int rfnm_rx_get_stats(struct rfnm_dev *dev, uint32_t ch, struct rfnm_rx_stats *st)
+{
+	if (ch >= dev->ch_cnt)
+		return -EINVAL;
+
+	memcpy(st, &dev->ch[ch].stats, sizeof(*st));
+	return 0;
+}
+
+const struct rfnm_stream_layout *rfnm_get_layout(struct rfnm_dev *dev)
+{
+	return &dev->layout;
+}
+
+/* the first vendor class interface with bulk IN endpoints, channel N is the Nth */
+static int rfnm_find_interface(struct rfnm_dev *dev)
+{
+	struct libusb_config_descriptor *cfg;
+	int i, j;
+
+	if (libusb_get_active_config_descriptor(libusb_get_device(dev->h), &cfg))
+		return -EIO;
+
+	dev->intf = -1;
+
+	for (i = 0; i < cfg->bNumInterfaces && dev->intf < 0; i++) {
+		const struct libusb_interface_descriptor *id = &cfg->interface[i].altsetting[0];
+
+		if (id->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC)
+			continue;
+
+		for (j = 0; j < id->bNumEndpoints && dev->ch_cnt < RFNM_LIB_MAX_CH; j++) {
+			const struct libusb_endpoint_descriptor *ed = &id->endpoint[j];
+
+			if ((ed->bmAttributes & 3) != LIBUSB_TRANSFER_TYPE_BULK ||
+				!(ed->bEndpointAddress & LIBUSB_ENDPOINT_IN))
+				continue;
+
+			dev->ch[dev->ch_cnt].id = dev->ch_cnt;
+			dev->ch[dev->ch_cnt].addr = ed->bEndpointAddress;
+			dev->ch_cnt++;
+		}
+
+		if (dev->ch_cnt)
+			dev->intf = id->bInterfaceNumber;
+	}
+
+	libusb_free_config_descriptor(cfg);
+	return dev->intf < 0 ? -ENODEV : 0;
+}
+
+static int rfnm_read_layout(struct rfnm_dev *dev)
+{
+	struct rfnm_stream_layout l;
+	struct rfnm_stream_field *f[] = {
+		&dev->layout.magic_field, &dev->layout.usb_cc, &dev->layout.adc_cc,
+		&dev->layout.adc_id, &dev->layout.phytimer,
+	};
+	const struct rfnm_stream_field *lf[] = {
+		&l.magic_field, &l.usb_cc, &l.adc_cc, &l.adc_id, &l.phytimer,
+	};
+	int i, r;
+
+	r = libusb_control_transfer(dev->h, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR,
+		RFNM_LAYOUT_B_REQUEST, 0, 0, (unsigned char *) &l, sizeof(l), 1000);
+	if (r != sizeof(l)) {
+		fprintf(stderr, "rfnm: stream layout: %s\n", r < 0 ? libusb_error_name(r) : "short read");
+		return -EIO;
+	}
+
+	dev->layout.version = le16toh(l.version);
+	dev->layout.ep_cnt = le16toh(l.ep_cnt);
+	dev->layout.buf_size = le32toh(l.buf_size);
+	dev->layout.req_size = le32toh(l.req_size);
+	dev->layout.magic = le32toh(l.magic);
+	dev->layout.adc_cc_step = le32toh(l.adc_cc_step);
+	dev->layout.payload_off = le32toh(l.payload_off);
+	dev->layout.payload_size = le32toh(l.payload_size);
+
+	for (i = 0; i < 5; i++) {
+		f[i]->off = le16toh(lf[i]->off);
+		f[i]->size = le16toh(lf[i]->size);
+		if (f[i]->size > 8 || f[i]->off + f[i]->size > dev->layout.buf_size)
+			return -EPROTO;
+	}
+
+	if (dev->layout.version != RFNM_LAYOUT_VERSION || !dev->layout.buf_size ||
+		dev->layout.payload_off + dev->layout.payload_size > dev->layout.buf_size)
+		return -EPROTO;
+
+	return 0;
+}
+
+struct rfnm_dev *rfnm_open(uint16_t vid, uint16_t pid)
+{
+	struct rfnm_dev *dev;
+	int c, r;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+
+	for (c = 0; c < RFNM_LIB_MAX_CH; c++) {
+		dev->ch[c].dev = dev;
+		pthread_mutex_init(&dev->ch[c].lock, NULL);
+		pthread_cond_init(&dev->ch[c].cond, NULL);
+	}
+
+	r = libusb_init(&dev->ctx);
+	if (r) {
+		fprintf(stderr, "rfnm: libusb_init: %s\n", libusb_error_name(r));
+		free(dev);
+		return NULL;
+	}
+
+	dev->h = libusb_open_device_with_vid_pid(dev->ctx, vid, pid);
+	if (!dev->h)
+		goto err;
+
+	if (rfnm_find_interface(dev))
+		goto err;
+
+	libusb_set_auto_detach_kernel_driver(dev->h, 1);
+	r = libusb_claim_interface(dev->h, dev->intf);
+	if (r) {
+		fprintf(stderr, "rfnm: claim interface %d: %s\n", dev->intf, libusb_error_name(r));
+		goto err;
+	}
+
+	/* bulk endpoints, alt 1 is isochronous */
+	libusb_set_interface_alt_setting(dev->h, dev->intf, 0);
+
+	if (rfnm_read_layout(dev))
+		goto err_release;
+
+	return dev;
+
+err_release:
+	libusb_release_interface(dev->h, dev->intf);
+err:
+	if (dev->h)
+		libusb_close(dev->h);
+	libusb_exit(dev->ctx);
+	free(dev);
+	return NULL;
+}
+
+void rfnm_close(struct rfnm_dev *dev)
+{
+	int c;
+
+	if (dev->running)
+		rfnm_rx_stop(dev);
+
+	libusb_release_interface(dev->h, dev->intf);
+	libusb_close(dev->h);
+	libusb_exit(dev->ctx);
+
+	for (c = 0; c < RFNM_LIB_MAX_CH; c++) {
+		pthread_mutex_destroy(&dev->ch[c].lock);
+		pthread_cond_destroy(&dev->ch[c].cond);
+	}
+	free(dev);
+}
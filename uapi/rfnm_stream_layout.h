@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef __RFNM_STREAM_LAYOUT_H__
+#define __RFNM_STREAM_LAYOUT_H__
+
+/*
+ * Wire layout of the IQ stream of the RFNM usb function, so host code can
+ * parse struct rfnm_rx_usb_buf without the kernel headers that define it.
+ *
+ * An IN transfer on endpoint N carries whole buffers of adc N, buf_size
+ * bytes each. Every buffer starts with a header, the fields below give the
+ * offset and width (1, 2, 4 or 8 bytes, little endian) of the ones a host
+ * needs, followed by payload_size bytes of packed 12 bit IQ at payload_off.
+ */
+
+/* bRequestType 0xc0, wValue 0, returns struct rfnm_stream_layout */
+#define RFNM_LAYOUT_B_REQUEST	102
+
+#define RFNM_LAYOUT_VERSION	1
+
+struct __attribute__((__packed__)) rfnm_stream_field {
+	uint16_t off;
+	uint16_t size;
+};
+
+struct __attribute__((__packed__)) rfnm_stream_layout {
+	uint16_t version;
+	uint16_t ep_cnt;
+	/* one struct rfnm_rx_usb_buf */
+	uint32_t buf_size;
+	/* bytes per IN request, a multiple of buf_size */
+	uint32_t req_size;
+	uint32_t magic;
+	struct rfnm_stream_field magic_field;
+	/* +1 per buffer and adc, gaps are buffers the device dropped */
+	struct rfnm_stream_field usb_cc;
+	/* +adc_cc_step per buffer, gaps are lost on the LA9310 side */
+	struct rfnm_stream_field adc_cc;
+	struct rfnm_stream_field adc_id;
+	struct rfnm_stream_field phytimer;
+	uint32_t adc_cc_step;
+	uint32_t payload_off;
+	uint32_t payload_size;
+};
+
+#endif
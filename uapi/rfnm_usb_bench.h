@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef __RFNM_USB_BENCH_H__
+#define __RFNM_USB_BENCH_H__
+
+/*
+ * rfnm_usb_bench gadget function (kernel_driver/la9310rfnm/rfnm_usb_bench.c)
+ * and its host tool (app/rfnm_usb_bench).
+ *
+ * The function has the interface layout of the RFNM streaming function,
+ * RFNM_BENCH_EP_CNT bulk IN/OUT pairs on a vendor class interface. Every IN
+ * endpoint sends a running 32 bit little endian counter, every OUT endpoint
+ * expects one. Both sides take the first word they see as the start value.
+ */
+
+#define RFNM_BENCH_FUNC_NAME	"rfnm_bench"
+
+#define RFNM_BENCH_EP_CNT	4
+
+/* vendor requests, bRequest RFNM_BENCH_B_REQUEST, wValue selects */
+#define RFNM_BENCH_B_REQUEST	101
+#define RFNM_BENCH_GET_STATS	0	/* 0xc0, returns struct rfnm_usb_bench_stats */
+#define RFNM_BENCH_RESET	1	/* 0x40, zeroes the stats, OUT checkers resync */
+
+struct __attribute__((__packed__)) rfnm_usb_bench_stats {
+	/* since the last reset or set_alt */
+	uint64_t time_ns;
+	uint64_t in_bytes[RFNM_BENCH_EP_CNT];
+	uint64_t out_bytes[RFNM_BENCH_EP_CNT];
+	/* words that weren't the previous word + 1 */
+	uint64_t out_errors[RFNM_BENCH_EP_CNT];
+	/* completions with an error status, requeued */
+	uint64_t in_failed[RFNM_BENCH_EP_CNT];
+	uint64_t out_failed[RFNM_BENCH_EP_CNT];
+};
+
+#endif